@@ -0,0 +1,201 @@
+#ifndef AVAILABILITY_H
+#define AVAILABILITY_H
+
+#include <sched.h>		// sched_yield, while a snapshot is being written
+
+#define AVAIL_SPINS 100		// reads before we let the writer run
+#define AVAIL_INLINE 4		// frames of an answer the room sends itself
+
+// an item of the snapshot
+typedef struct {
+	char name[LINE_LEN];	// the item
+	int left;				// units the room still has
+	int total;				// units of the inventory
+}AvailItem;
+
+// struct holding what the room that is filling up can still give, for
+// players who want to know before they join. The rooms write it while
+// holding the semaphore, so there is one writer at a time, and readers
+// never take the semaphore: the sequence number is odd while a writer
+// is at work and changes with every write, so a reader that saw it odd
+// or changed copies the snapshot again (seqlock). It has room for every
+// item of the inventory it was made for, a reload with more items makes
+// a new one for the rooms that open after it
+typedef struct {
+	unsigned seq;			// bumped before and after every write
+	pid_t room;				// the room that is filling up (0 = none yet)
+	int catalog;			// version of the inventory it opened with
+	int count;				// items listed
+	int size;				// items it has room for
+	AvailItem items[];		// the items
+}Availability;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the bytes of a snapshot
+ *
+ * @param Takes in the items it has room for
+ *
+ * @return The snapshot's size
+ */
+size_t availabilitySize(int items) {
+	return sizeof(Availability) + (size_t)items*sizeof(AvailItem);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Creates the shared snapshot. The segment is marked for
+ * deletion right away, every process attaches it through fork
+ *
+ * @param Takes in the items of the inventory
+ *
+ * @return A pointer to the snapshot
+ */
+Availability *openAvailability(int items) {
+	int id;				// segment's id
+	Availability *a;	// the snapshot
+
+	if ( (id = shmget(IPC_PRIVATE, availabilitySize(items), IPC_CREAT | 0600)) < 0 ) {
+		perror("shmget error -> availability");
+		exit(1);
+	}
+
+	if ( (a = shmat(id, NULL, 0)) == (void *)-1 ) {
+		perror("shmat error -> availability");
+		exit(1);
+	}
+
+	shmctl(id, IPC_RMID, NULL);
+
+	bzero(a, availabilitySize(items));
+	a->size = items;
+
+	return a;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Writer side. Publishes what a room has left. A room that
+ * opens takes the snapshot over, the others only update it while it is
+ * theirs. Must be called while holding the semaphore
+ *
+ * @param Takes in the snapshot, the room's pid, whether it just opened,
+ * the version and the room's inventory and the room's quantities
+ *
+ */
+void publishAvailability(Availability *a, pid_t room, int opened, int catalog,
+	Inventory *inv, int *qData) {
+	unsigned seq = a->seq;	// sequence number before the write
+	int i;					// for counter
+
+	if ( !opened && (a->room != room) ) {
+		return;	// a newer room is filling up
+	}
+
+	__atomic_store_n(&(a->seq), seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	a->room = room;
+	a->catalog = catalog;
+	a->count = (inv->count < a->size) ? inv->count : a->size;
+
+	for (i=0; i<a->count; ++i) {
+		if (opened) {
+			strcpy(a->items[i].name, inv->items[i]);
+			a->items[i].total = inv->quantity[i];
+		}
+
+		a->items[i].left = qData[i];
+	}
+
+	__atomic_store_n(&(a->seq), seq + 2, __ATOMIC_RELEASE);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Reader side. Copies a consistent snapshot, without locking
+ *
+ * @param Takes in the snapshot and the copy to fill in, of
+ * availabilitySize(a->size) bytes
+ *
+ */
+void readAvailability(Availability *a, Availability *out) {
+	unsigned before, after;	// sequence numbers around the copy
+	int spins = 0;			// attempts so far
+
+	for (;;) {
+		before = __atomic_load_n(&(a->seq), __ATOMIC_ACQUIRE);
+
+		if ( !(before & 1) ) {
+			memcpy(out, a, availabilitySize(a->size));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			after = __atomic_load_n(&(a->seq), __ATOMIC_RELAXED);
+
+			if (before == after) {
+				return;
+			}
+		}
+
+		// the writer might be waiting for our core
+		if (++spins % AVAIL_SPINS == 0) {
+			sched_yield();
+		}
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Writes a snapshot as the answer to an availability query: a
+ * line with the room, the version of its inventory and the number of
+ * item lines that follow, then one line per item the player asked
+ * about with its name, the units a player joining now can get and the
+ * units of the inventory, tab separated. An item the inventory doesn't
+ * have has none of either. The lines go in as many frames of pSize
+ * chars as they need, none of them is split between two frames
+ *
+ * @param Takes in the snapshot, the units the rooms can still borrow
+ * for each of its items (NULL if they don't borrow), the items asked
+ * about and a pointer the frames are returned in (freed by the caller)
+ *
+ * @return The number of frames
+ */
+int formatAvailability(Availability *a, int *pool, Inventory *asked, char **text) {
+	char line[pSize];	// an item's line
+	int frames = 1;		// frames written
+	int at;				// chars of the last one
+	int len;			// chars of a line
+	int i, j;			// for counters
+
+	if ( (*text = calloc(asked->count + 1, pSize)) == NULL ) {
+		perror("Allocation error");
+		exit(1);
+	}
+
+	at = snprintf(*text, pSize, "AVAIL %d %d %d\n", a->room, a->catalog, asked->count);
+
+	for (i=0; i<asked->count; ++i) {
+		for (j=0; (j < a->count) && strcmp(a->items[j].name, asked->items[i]); ++j);
+
+		if (j < a->count) {
+			len = snprintf(line, sizeof(line), "%s\t%d\t%d\n", a->items[j].name,
+				a->items[j].left + (pool ? pool[j] : 0), a->items[j].total);
+		} else {
+			len = snprintf(line, sizeof(line), "%s\t0\t0\n", asked->items[i]);
+		}
+
+		// the frame's last char stays a terminator
+		if (at + len >= pSize) {
+			++frames;
+			at = 0;
+		}
+
+		memcpy(*text + (size_t)(frames-1)*pSize + at, line, len);
+		at += len;
+	}
+
+	return frames;
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
@@ -13,14 +13,36 @@
 
 #include "Inventory.h"
 #include "ClientBackend.h"
+#include "Trace.h"		// latency stamps of traced messages
 
 #include <pthread.h>
 
 	/*- ---- Global Variables & Defining ---- -*/ 
 #define WAIT 60 // wait time
+#define RESUME_TRIES 10	// seconds we try to get our seat back
+#define MAX_MOVES 4		// busy nodes we let send us on
 
 // declaring a var to let us know when the client waited too long
 volatile int timeOut = WAIT;
+
+// our resumption token (empty if the server doesn't keep seats)
+char token[LINE_LEN];
+
+// the server's address, to reconnect
+char *serverHost = NULL;
+
+// the node a busy node sent us to, it becomes the server's address
+char movedTo[pSize];
+
+// number of the last chat message we got, the server sends us what
+// came after it when we reconnect
+unsigned long long lastSeq = 0;
+
+// our messages carry trace stamps (/trace on)
+volatile int tracing = 0;
+
+// latency of the traced messages we got, per stage
+TraceHist traceHist;
 	/*- ---- Global Variables & Defining ---- -*/ 
 
 
@@ -30,14 +52,18 @@ void *playerRead(void *param);
 void *playerWrite(void *param);
 
 void initChat(int sockfd);
+void traceCommand(char *msg);
 
 void catch_alarm(int signo);
 void catch_alarm_con(int signo);
 
-void init(int *sockfd, struct hostent *server, 
-	struct sockaddr_in *servaddr, char *h);
+void init(int *sockfd, char *h);
+int connectServer(char *host);
+int resume(int *sockfd);
 
-void clientUp(int sockfd, struct sockaddr_in *servaddr, cSettings set, Inventory inv);
+void clientUp(int sockfd, cSettings set, Inventory inv);
+void watchRoom(int sockfd, cSettings set);
+int checkAvailability(int sockfd, Inventory inv);
 int sendInv(Inventory inv, int sockfd);
 	/*- ------- Function declarations ------- -*/ 
 
@@ -49,15 +75,25 @@ int main(int argc, char **argv) {
 	Inventory inv;					// player inventory
 
 	int sockfd;						// socket
-	struct sockaddr_in servaddr;	// struct for server address
-	struct hostent *server = NULL;	// stores information about the given host
 
 	// setting the alarm to another handler
 	signal(SIGALRM, catch_alarm_con);
 
+	// a lost connection shows up as a failed write, not a signal
+	signal(SIGPIPE, SIG_IGN);
+
 	// getting parameters to set up the server according to the user
 	initcSettings(argc, argv, &set);
 
+	// spectators have no inventory, they only read the chat
+	if (set.roomID >= 0) {
+		serverHost = set.host_name;
+		init(&sockfd, set.host_name);
+		watchRoom(sockfd, set);
+
+		return 0;
+	}
+
 	// taking data from inventory to a struct for easy management
 	if ( readInventory(set.inventory, &inv) ) {
 		perror("Inventory problem");
@@ -67,53 +103,164 @@ int main(int argc, char **argv) {
 	// printing the inventory to the user
 	printInventory(inv);
 
-	// initializing socket and server values
-	init(&sockfd, server, &servaddr, set.host_name);
+	// connecting to the server
+	serverHost = set.host_name;
+	init(&sockfd, set.host_name);
 
-	// starting up the client
-	clientUp(sockfd, &servaddr, set, inv);
+	// only asking, the exit status tells whether we could join now
+	if (set.check) {
+		return checkAvailability(sockfd, inv);
+	}
 
-	// free-ing allocated space
-	free(server);
+	// starting up the client
+	clientUp(sockfd, set, inv);
 
 	return 0;
 }
 
 /*- ---------------------------------------------------------------- -*/
 /**
- * @brief Initializing socket and server values according to the 
- * hostname given and the port selected
+ * @brief Connecting to the server, exiting if we can't
  *
- * @param Takes in the socket, the hostent struct, the sockaddress
- * struct and the hostname
+ * @param Takes in the socket and the address of the server
  *
  */
-void init(int *sockfd, struct hostent *server, 
-	struct sockaddr_in *servaddr, char *host) {
-		
-	// initializing connection variables
-	server = gethostbyname(host);
-	if ( server == NULL ) {
-		fprintf(stderr, "Invalid hostname \n");
+void init(int *sockfd, char *host) {
+	if ( (*sockfd = connectServer(host)) < 0 ) {
 		exit(1);
 	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Connects to the server, picking the transport from the
+ * address given. A path (anything with a '/') is the server's Unix
+ * domain socket, the fastest way in for a player on the same host.
+ * Anything else is a hostname or an IPv4/IPv6 address, with the port
+ * after a colon (host:port or [address]:port) when it isn't the usual
+ * one, we try every address it resolves to until one takes the
+ * connection
+ *
+ * @param Takes in the address of the server
+ *
+ * @return The connected socket or -1 on error
+ */
+int connectServer(char *host) {
+	struct sockaddr_un unaddr;		// Unix domain address
+	struct addrinfo hints;			// what we look up
+	struct addrinfo *res, *ai;		// addresses of the host
+	char port[LINE_LEN];			// port number as a service name
+	char name[LINE_LEN*4];			// the host without the port
+	int sockfd = -1;				// client endpoint
+	int err;						// lookup result
+
+	if (strchr(host, '/')) {
+		if (strlen(host) >= sizeof(unaddr.sun_path)) {
+			fprintf(stderr, "Invalid socket path \n");
+			return -1;
+		}
+
+		bzero(&unaddr, sizeof(unaddr));
+		unaddr.sun_family = AF_UNIX;
+		strcpy(unaddr.sun_path, host);
+
+		if ( (sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ) {
+			perror("Couldn't open socket");
+			return -1;
+		}
+
+		// connect the client's and server's endpoints
+		if ( connect(sockfd, (struct sockaddr *)&unaddr, sizeof(unaddr)) < 0 ) {
+			perror("Couldn't connect");
+			close(sockfd);
+			return -1;
+		}
+
+		return sockfd;
+	}
+
+	// looking the host up, IPv6 and IPv4 alike
+	bzero(&hints, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	splitAddress(host, name, sizeof(name), port);
+
+	if ( (err = getaddrinfo(name, port, &hints, &res)) != 0 ) {
+		fprintf(stderr, "Invalid hostname: %s \n", gai_strerror(err));
+		return -1;
+	}
+
+	for (ai = res; ai && (sockfd < 0); ai = ai->ai_next) {
+		if ( (sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0 ) {
+			continue;
+		}
+
+		if ( connect(sockfd, ai->ai_addr, ai->ai_addrlen) < 0 ) {
+			close(sockfd);
+			sockfd = -1;
+		}
+	}
+
+	freeaddrinfo(res);
 
-	*sockfd = socket(AF_INET, SOCK_STREAM, 0);  // client endpoint
-	if ( *sockfd < 0 ) {
-		perror("Couldn't open socket");
+	if (sockfd < 0) {
+		perror("Couldn't connect");
 	}
 
-	// zero servaddr fields
-	bzero(servaddr, sizeof(*servaddr)); 
+	return sockfd;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Gets our seat back after the connection dropped. We send our
+ * token and the last message we got instead of the inventory and the
+ * server answers in one round trip, followed by the messages we missed. The new connection takes
+ * the old socket's number, so the writing thread keeps using it
+ *
+ * @param Takes in a pointer to the connection socket
+ *
+ * @return 0 if we are back or -1 if the seat is gone
+ */
+int resume(int *sockfd) {
+	char request[pSize];		// our token
+	char response[LINE_LEN];	// server's response
+	int fd;						// new connection
+	int tries;					// attempts so far
+
+	printf("Connection lost, getting our seat back ...\n");
+
+	bzero(request, sizeof(request));
+	snprintf(request, sizeof(request), "RESUME %s %llu", token, lastSeq);
+
+	for (tries=0; tries<RESUME_TRIES; ++tries) {
+		if (tries > 0) {
+			sleep(1);
+		}
+
+		if ( (fd = connectServer(serverHost)) < 0 ) {
+			continue;	// the server might be back in a moment
+		}
+
+		if ( (write(fd, request, sizeof(request)) != sizeof(request)) ||
+			(recv(fd, response, sizeof(response), MSG_WAITALL) != sizeof(response)) ) {
+			close(fd);
+			continue;
+		}
+
+		if (strncmp(response, "OK", 2)) {
+			close(fd);
+			return -1;	// the seat is gone
+		}
+
+		dup2(fd, *sockfd);
+		close(fd);
 
-	// copying server values to the hostent struct
-	bcopy((char *)server->h_addr, 
-         (char *)&servaddr->sin_addr.s_addr,
-         server->h_length);
+		printf("Reconnected\n");
 
-	// setting the family and port for the server
-	servaddr->sin_family = AF_INET;	
-	servaddr->sin_port = htons(PORT_NO);
+		return 0;
+	}
+
+	return -1;
 }
 
 /*- ---------------------------------------------------------------- -*/
@@ -121,19 +268,16 @@ void init(int *sockfd, struct hostent *server,
  * @brief Setting up the client to make contact with the server and 
  * managing all the client actions
  *
- * @param Takes in the socket and the sockaddress
+ * @param Takes in the connected socket, the settings and the inventory
  *
  */
-void clientUp(int sockfd, struct sockaddr_in *servaddr, cSettings set, Inventory inv) {
+void clientUp(int sockfd, cSettings set, Inventory inv) {
 	char strInv[pSize];		// player's inventory in chars
 	char response[LINE_LEN];// server's response depending on the inventory's validity
+	char moved[pSize];		// our inventory, for the node we are sent to
+	int moves = 0;			// nodes that sent us on
+	int pos, eta;			// waitlist position and estimated wait
 
-	// connect the client's and server's endpoints
-	if ( connect(sockfd, (struct sockaddr *)servaddr, sizeof(*servaddr)) < 0 ) {
-		perror("Couldn't connect");
-		exit(1);
-	}
-	
 	// parsing the inventory struct to char * (ascii chars)
 	parseInvIntoStr(set.name, inv, strInv);
 
@@ -154,15 +298,69 @@ void clientUp(int sockfd, struct sockaddr_in *servaddr, cSettings set, Inventory
 		exit(1);
 	}
 
+	// the node is full and sends us to another one, its address comes
+	// in a frame of its own. That one keeps us since we say where we
+	// come from, but a node that doesn't might send us on again
+	while ( !strncmp(response, "MOVE", 4) && (strlen(strInv) + 6 < sizeof(moved)) ) {
+		if ( (++moves > MAX_MOVES) ||
+			(recv(sockfd, movedTo, sizeof(movedTo), MSG_WAITALL) != sizeof(movedTo)) ) {
+			printf("The server is full and couldn't send us to another one\n");
+			exit(1);
+		}
+
+		movedTo[pSize-1] = '\0';
+		movedTo[strcspn(movedTo, "\n")] = '\0';
+		close(sockfd);
+
+		serverHost = movedTo;
+		printf("The server is full, moving to %s\n", serverHost);
+
+		if ( (sockfd = connectServer(serverHost)) < 0 ) {
+			exit(1);
+		}
+
+		bzero(moved, sizeof(moved));
+		memcpy(moved, "MOVED ", 6);
+		memcpy(moved + 6, strInv, strlen(strInv));
+
+		if ( (write(sockfd, moved, sizeof(moved)) < 0) ||
+			(read(sockfd, response, sizeof(response)) < 0) ) {
+			perror("Error getting the server's response");
+			exit(1);
+		}
+	}
+
+	// the items are taken at the moment, so the server keeps us
+	// waiting until a room that can serve us opens
+	while (!strncmp(response, "WAIT", 4)) {
+		// waiting on the server is expected from now on
+		alarm(0);
+
+		if (sscanf(response, "WAIT %d %d", &pos, &eta) == 2) {
+			printf("Requested items are taken. Waitlist position: %d (about %d seconds)\n",
+				pos, eta);
+		}
+
+		if (read(sockfd, response, sizeof(response)) <= 0) {
+			perror("Error getting the server's response");
+			exit(1);
+		}
+	}
+
 	// checking the response
-	if (strcmp(response, "OK\n")) {
+	if (strncmp(response, "OK", 2)) {
 		// something went wrong therefore we inform the player
 		printf("Your inventory is invalid or the requested items are not available\n");
 		printf("Exiting ... Try again with a different inventory\n");
 
 		exit(1);
 	} else {
-		printf("%s\n", response);
+		// keeping the token we get our seat back with
+		if (sscanf(response, "OK %31s", token) == 1) {
+			printf("OK\n");
+		} else {
+			printf("%s\n", response);
+		}
 	}
 
 	// stopping the alarm
@@ -178,6 +376,130 @@ void clientUp(int sockfd, struct sockaddr_in *servaddr, cSettings set, Inventory
 	close(sockfd);
 }
 
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Watches a room's chat as a spectator. We ask for the room
+ * instead of sending an inventory and print what it says until it ends
+ *
+ * @param Takes in the connected socket and the settings
+ *
+ */
+void watchRoom(int sockfd, cSettings set) {
+	char request[pSize];		// the room we watch
+	char response[LINE_LEN];	// server's response
+
+	bzero(request, sizeof(request));
+	snprintf(request, sizeof(request), "WATCH %d", set.roomID);
+
+	alarm(30);	// shouldn't take more than 30 seconds
+
+	if ( (write(sockfd, request, sizeof(request)) != sizeof(request)) ||
+		(recv(sockfd, response, sizeof(response), MSG_WAITALL) != sizeof(response)) ) {
+		perror("Error getting the server's response");
+		exit(1);
+	}
+
+	alarm(0);
+
+	if (strncmp(response, "OK", 2)) {
+		printf("%s\n", response);
+		exit(1);
+	}
+
+	printf("%s\n", response);
+
+	// no token, so the reading thread's loop ends with the room
+	playerRead(&sockfd);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Asks the server which of our items the room that is filling up
+ * has left, instead of joining. The answer is a line with the room and
+ * the number of item lines, followed by a line per item we asked about
+ * (name, units left, units of the inventory), in as many frames as they
+ * need
+ *
+ * @param Takes in the connected socket and our inventory
+ *
+ * @return 0 if the room can give us our items now or 1 if not
+ */
+int checkAvailability(int sockfd, Inventory inv) {
+	char request[pSize];	// the query
+	char answer[pSize];		// a frame of the server's answer
+	char item[LINE_LEN];	// an item of the answer
+	char *line;				// a line of it
+	char *next;				// and where it ends
+	int left, total;		// its units
+	int room, catalog;		// the room it describes
+	int lines;				// item lines of the answer
+	int pos;				// the item in our inventory
+	int found = 0;			// our items the room has enough of
+
+	bzero(request, sizeof(request));
+	parseInvIntoStr("AVAIL", inv, request);
+
+	alarm(30);	// shouldn't take more than 30 seconds
+
+	if ( (write(sockfd, request, sizeof(request)) != sizeof(request)) ||
+		(recv(sockfd, answer, sizeof(answer), MSG_WAITALL) != sizeof(answer)) ||
+		(sscanf(answer, "AVAIL %d %d %d", &room, &catalog, &lines) != 3) ) {
+		perror("Error getting the server's response");
+		exit(1);
+	}
+
+	printf("Room %d has left: \n", room);
+
+	answer[pSize-1] = '\0';
+
+	if ( (line = strchr(answer, '\n')) == NULL ) {
+		printf("The server's answer is malformed\n");
+		exit(1);
+	}
+
+	++line;
+
+	while (lines > 0) {
+		// the lines go on in the next frame
+		if (*line == '\0') {
+			if (recv(sockfd, answer, sizeof(answer), MSG_WAITALL) != sizeof(answer)) {
+				perror("Error getting the server's response");
+				exit(1);
+			}
+
+			answer[pSize-1] = '\0';
+			line = answer;
+		}
+
+		// a cut or garbled answer tells us nothing about our items
+		if ( (sscanf(line, "%31s %d %d", item, &left, &total) != 3) ||
+			((next = strchr(line, '\n')) == NULL) ) {
+			printf("The server's answer is malformed\n");
+			exit(1);
+		}
+
+		printf("\t %s \t %d of %d \n", item, left, total);
+
+		if ( findItem(inv, item, &pos) && (left >= inv.quantity[pos]) ) {
+			++found;
+		}
+
+		line = next + 1;
+		--lines;
+	}
+
+	alarm(0);
+	close(sockfd);
+
+	if (found == inv.count) {
+		printf("Your items are available\n");
+		return 0;
+	}
+
+	printf("Your items are not available at the moment\n");
+	return 1;
+}
+
 /*- ---------------------------------------------------------------- -*/
 /**
  * @brief Opens the chat. This function creates 2 threads, one for
@@ -232,15 +554,54 @@ void *playerRead(void *args) {
 	// declaring a buffer for reading
 	char msg[pSize];
 
+	// number of a chat message
+	unsigned long long seq;
+
 	// while connection is good
 	while (1) {
-		// get the message
-		if (read(*sockfd, msg, sizeof(msg)) <= 0) {
+		// get the message, whole (missed ones arrive back to back)
+		if (recv(*sockfd, msg, sizeof(msg), MSG_WAITALL) != sizeof(msg)) {
+			// the server keeps our seat for a while
+			if ( token[0] && (resume(sockfd) == 0) ) {
+				continue;
+			}
+
 			perror("Error getting the server's response");
 			close(*sockfd);
 			exit(1);
 		}	
 
+		// our token changed (we moved to another room, whose
+		// messages are numbered from its newest one)
+		if (!strncmp(msg, "TOKEN ", 6)) {
+			sscanf(msg, "TOKEN %31s", token);
+			memcpy(&lastSeq, msg + FRAME_TEXT, sizeof(lastSeq));
+			continue;
+		}
+
+		// chat messages carry their number at the end of the frame, they
+		// come in order. One we have already came with the ones we missed
+		memcpy(&seq, msg + FRAME_TEXT, sizeof(seq));
+
+		if (seq > 0) {
+			if (seq <= lastSeq) {
+				continue;
+			}
+
+			lastSeq = seq;
+		}
+
+		// a traced message gets our stamps too, then its stages are
+		// added to the histograms
+		if (isTraced(msg, sizeof(msg))) {
+			traceStamp(msg, TRACE_RECV);
+			printf("%s\n", msg);
+			traceStamp(msg, TRACE_SHOWN);
+			traceRecord(&traceHist, msg);
+
+			continue;
+		}
+
 		// print the message
 		printf("%s\n", msg);
 	}
@@ -264,7 +625,9 @@ void *playerWrite(void *args) {
 
 	char c;			// character from stdin
 	int count = 0;	// characters read
-	char msg[pSize];// character array
+	char msg[pSize] = {0};	// character array
+	long long typed = 0;	// when he pressed enter, if we trace
+	int wasTraced = 0;		// the last message carried stamps
 
 	// while connection is good
 	while(1) {
@@ -274,11 +637,47 @@ void *playerWrite(void *args) {
 			msg[count++] = c;
 		}
 
+		if (tracing) {
+			typed = traceNow();
+		}
+
 		// terminating the string
 		msg[count] = '\0';
 
+		// tracing is ours, the server doesn't hear about it
+		if (!strncmp(msg, "/trace", 6)) {
+			traceCommand(msg);
+			count = 0;
+			continue;
+		}
+
+		// commands for the server, or help for the player
+		if ( (msg[0] == '/') && !slashCommand(msg) ) {
+			count = 0;
+			continue;
+		}
+
+		// a traced message leaves room for its stamps, the next
+		// untraced one must not look like it carries them
+		if (tracing) {
+			msg[TRACE_AT-1] = '\0';
+			startTrace(msg, typed);
+			traceStamp(msg, TRACE_SENT);
+		} else if ( wasTraced && (strlen(msg) < TRACE_AT) ) {
+			clearTrace(msg);
+		}
+
+		wasTraced = tracing;
+
 		// writing the string to the server
 		if (write(*sockfd, msg, sizeof(msg)) <= 0) {
+			// the reading thread gets our seat back
+			if (token[0]) {
+				printf("Message not sent, reconnecting ...\n");
+				count = 0;
+				continue;
+			}
+
 			perror("Error sending the message");
 			close(*sockfd);
 			exit(1);
@@ -291,6 +690,30 @@ void *playerWrite(void *args) {
 	return NULL;
 }
 
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Handles the trace command: "/trace on" stamps our messages at
+ * every stage on their way to the other players (their clients keep the
+ * histograms), "/trace off" stops, "/trace reset" empties our histograms
+ * and "/trace" prints them
+ *
+ * @param Takes in the line the player typed
+ *
+ */
+void traceCommand(char *msg) {
+	if (!strcmp(msg, "/trace on")) {
+		tracing = 1;
+		printf("Tracing your messages, the other players see their latency with /trace\n");
+	} else if (!strcmp(msg, "/trace off")) {
+		tracing = 0;
+		printf("Not tracing your messages\n");
+	} else if (!strcmp(msg, "/trace reset")) {
+		bzero(&traceHist, sizeof(traceHist));
+	} else {
+		printTraceHist(&traceHist);
+	}
+}
+
 /*- ---------------------------------------------------------------- -*/
 /**
  * @brief Handles the sigalarm signal
@@ -5,8 +5,9 @@
 typedef struct {
 	char name[LINE_LEN];
 	char inventory[LINE_LEN];
-	char host_name[LINE_LEN];
-	int roomID;
+	char host_name[LINE_LEN*4];	// hostname, address or socket path
+	int roomID;	// room we watch as a spectator (-1 = we play)
+	int check;	// only ask whether the inventory is available
 }cSettings;
 
 /*- ---------------------------------------------------------------- -*/
@@ -28,6 +29,7 @@ typedef struct {
 	// setting roomID to invalid -1 so that we know we haven't
 	// assigned this player yet
 	s->roomID = -1;
+	s->check = 0;
 
 	// managing invalid parameter input
 	if (argc != 6) {
@@ -43,7 +45,16 @@ typedef struct {
 		} else if ( !strcmp(argv[i], "-i") && gotI == 0 ) {
 			strcpy(s->inventory, argv[i+1]);
 			gotI = 1;
-		} else if ( gotH == 0 ) {
+		} else if ( !strcmp(argv[i], "-a") && gotI == 0 ) {
+			// asking before joining, with the same inventory file
+			strcpy(s->inventory, argv[i+1]);
+			s->check = 1;
+			gotI = 1;
+		} else if ( !strcmp(argv[i], "-w") && gotI == 0 && atoi(argv[i+1]) >= 0 ) {
+			// spectators watch a room (0 = the one filling up) instead
+			s->roomID = atoi(argv[i+1]);
+			gotI = 1;
+		} else if ( gotH == 0 && strlen(argv[i]) < sizeof(s->host_name) ) {
 			strcpy(s->host_name, argv[i--]);
 			gotH = 1;			
 		} else {
@@ -55,11 +66,86 @@ typedef struct {
 	if (gotN && gotI && gotH) {
 		printf("\n\t Settings for this player: \n\n");
 		printf("\t Name: %s \n", s->name);
-		printf("\t Inventory selection: %s \n", s->inventory);
+		if (s->roomID >= 0) {
+			printf("\t Watching room: %d \n", s->roomID);
+		} else if (s->check) {
+			printf("\t Checking inventory: %s \n", s->inventory);
+		} else {
+			printf("\t Inventory selection: %s \n", s->inventory);
+		}
 		printf("\t Host name: %s \n\n", s->host_name);
 	} else {
 		printf("Invalid or missing parameters. Exiting ... \n");
 		exit(1);
 	}
 }
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Turns a slash command the player typed into the message the
+ * server expects: "/w <player> <text>" whispers, "/c <channel> <text>"
+ * talks on a channel, "/join <channel>" and "/leave <channel>" change
+ * channels, "/history [number]" asks for missed messages and "/trade
+ * <player> <item> <n> <item> <m>", "/accept <player>" and "/items" trade
+ * items with the other players. Anything else starting with a slash
+ * prints the commands (/trace never gets here, the client handles it)
+ *
+ * @param Takes in the line the player typed (pSize chars), which is
+ * rewritten in place
+ *
+ * @return 1 if the line has to be sent, 0 otherwise
+ */
+int slashCommand(char *msg) {
+	char *word = NULL;	// the server's name for the command
+	int skip = 0;		// chars of the slash command
+	int len;			// chars of the server's name
+	int rest;			// chars after the slash command
+
+	if (!strncmp(msg, "/w ", 3)) {
+		word = "WHISPER ";
+		skip = 3;
+	} else if (!strncmp(msg, "/c ", 3)) {
+		word = "CHANNEL ";
+		skip = 3;
+	} else if (!strncmp(msg, "/join ", 6)) {
+		word = "JOIN ";
+		skip = 6;
+	} else if (!strncmp(msg, "/leave ", 7)) {
+		word = "LEAVE ";
+		skip = 7;
+	} else if (!strncmp(msg, "/history", 8)) {
+		word = "HISTORY";
+		skip = 8;
+	} else if (!strncmp(msg, "/trade ", 7)) {
+		word = "TRADE ";
+		skip = 7;
+	} else if (!strncmp(msg, "/accept ", 8)) {
+		word = "ACCEPT ";
+		skip = 8;
+	} else if (!strncmp(msg, "/items", 6)) {
+		word = "ITEMS";
+		skip = 6;
+	}
+
+	if (word == NULL) {
+		printf("Commands: /w <player> <text>, /c <channel> <text>, /join <channel>, "
+			"/leave <channel>, /history [number], /trade <player> <item> <n> <item> <m>, "
+			"/accept <player>, /items, /trace [on|off|reset] \n");
+		return 0;
+	}
+
+	len = strlen(word);
+	rest = strlen(msg + skip);
+
+	if (len + rest > pSize - 1) {
+		rest = pSize - 1 - len;
+	}
+
+	memmove(msg + len, msg + skip, rest);
+	memcpy(msg, word, len);
+	msg[len + rest] = '\0';
+
+	return 1;
+}
+
+/*- ---------------------------------------------------------------- -*/
 #endif
\ No newline at end of file
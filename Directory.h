@@ -0,0 +1,300 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <limits.h>		// INT_MAX, for nodes without a player limit
+#include <arpa/inet.h>		// inet_ntop, for our own address
+
+#define DIR_NODES 64		// nodes the directory lists
+#define DIR_EXPIRE 3		// seconds a node stays listed without reporting
+#define DIR_REPORT_MS 500	// how often a node reports its load
+#define DIR_FREE_ANY INT_MAX	// what a node without a player limit can take
+
+// message between a node and the directory, the same both ways. A node
+// reports the address its players connect to and the players it can
+// still take, and the directory answers with the other node that can
+// take the most (addr empty if none can). Any service that answers the
+// same way can stand in for ours
+typedef struct {
+	char addr[LINE_LEN*4];	// node's address, host:port
+	int free;				// players it can still take
+}DirMsg;
+
+// struct describing a node in the directory
+typedef struct {
+	DirMsg last;	// its last report
+	double seen;	// when it came
+}DirNode;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Opens a UDP socket on the given port, IPv6 with IPv4-mapped
+ * addresses or IPv4 only when the host has no IPv6
+ *
+ * @param Takes in the port
+ *
+ * @return The socket or -1 if the port is taken
+ */
+int bindDirectory(int port) {
+	struct sockaddr_in6 addr6;	// IPv6 address (dual-stack)
+	struct sockaddr_in addr;	// IPv4 address
+	int off = 0;				// IPV6_V6ONLY off
+	int sock;					// the socket
+
+	bzero(&addr6, sizeof(addr6));
+	addr6.sin6_family = AF_INET6;
+	addr6.sin6_port = htons(port);
+	addr6.sin6_addr = in6addr_any;
+
+	if ( ((sock = socket(AF_INET6, SOCK_DGRAM, 0)) >= 0) &&
+		!setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) &&
+		!bind(sock, (struct sockaddr *)&addr6, sizeof(addr6)) ) {
+		return sock;
+	}
+
+	if ( (sock >= 0) && (errno == EADDRINUSE) ) {
+		close(sock);
+		return -1;
+	}
+
+	if (sock >= 0) {
+		close(sock);
+	}
+
+	bzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = INADDR_ANY;
+
+	if ( ((sock = socket(AF_INET, SOCK_DGRAM, 0)) >= 0) &&
+		!bind(sock, (struct sockaddr *)&addr, sizeof(addr)) ) {
+		return sock;
+	}
+
+	if (sock >= 0) {
+		close(sock);
+	}
+
+	return -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Starts the stand-in directory, a process of its own that the
+ * nodes report to. It only keeps each node's last report, so it can be
+ * restarted (or replaced) at any time and is up to date within a report.
+ * It leaves with the server that started it, and waits for the port if
+ * the directory of a server we replaced still has it
+ *
+ * @param Takes in the port it listens on
+ *
+ * @return The directory's pid
+ */
+pid_t startDirectory(int port) {
+	pid_t parent = getpid();		// the server that hosts us
+	pid_t pid;						// the directory
+	DirNode nodes[DIR_NODES];		// nodes that report
+	int count = 0;					// entries used
+	struct sockaddr_storage from;	// node that reported
+	socklen_t len;					// its address length
+	struct timeval tick = {1, 0};	// we look for our server every second
+	DirMsg msg;						// a report, then our answer
+	double now;						// time of the report
+	int sock;						// our socket
+	int node, best;					// node that reported and the one we suggest
+	int i;							// for counter
+
+	if ( (pid = fork()) != 0 ) {
+		if (pid < 0) {
+			perror("Couldn't start the directory");
+			exit(1);
+		}
+
+		return pid;
+	}
+
+	while ( (sock = bindDirectory(port)) < 0 ) {
+		if (getppid() != parent) {
+			exit(0);
+		}
+
+		sleep(1);
+	}
+
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tick, sizeof(tick));
+
+	logMsg(LOG_INFO, "| Directory listening on port %d |", port);
+
+	for (;;) {
+		if (getppid() != parent) {
+			exit(0);
+		}
+
+		len = sizeof(from);
+
+		if (recvfrom(sock, &msg, sizeof(msg), 0, (struct sockaddr *)&from, &len) != sizeof(msg)) {
+			continue;
+		}
+
+		msg.addr[sizeof(msg.addr)-1] = '\0';
+		now = monoTime();
+
+		// the node's entry, or the one of a node that stopped reporting
+		for (node=0; (node < count) && strcmp(nodes[node].last.addr, msg.addr); ++node);
+
+		if (node == count) {
+			for (node=0; (node < count) && (now - nodes[node].seen <= DIR_EXPIRE); ++node);
+
+			if ( (node == count) && (count < DIR_NODES) ) {
+				++count;
+			}
+		}
+
+		if (node < count) {
+			nodes[node].last = msg;
+			nodes[node].seen = now;
+		}
+
+		// the other node that can take the most players
+		best = -1;
+
+		for (i=0; i<count; ++i) {
+			if ( (i != node) && (now - nodes[i].seen <= DIR_EXPIRE) && (nodes[i].last.free > 0) &&
+				((best < 0) || (nodes[i].last.free > nodes[best].last.free)) ) {
+				best = i;
+			}
+		}
+
+		if (best >= 0) {
+			msg = nodes[best].last;
+		} else {
+			bzero(&msg, sizeof(msg));
+		}
+
+		sendto(sock, &msg, sizeof(msg), 0, (struct sockaddr *)&from, len);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Node side. Opens a UDP socket towards the directory
+ *
+ * @param Takes in the directory's address, host:port
+ *
+ * @return The socket or -1 if the address can't be resolved
+ */
+int openDirectory(char *addr) {
+	struct addrinfo hints;		// what we look up
+	struct addrinfo *res, *ai;	// addresses of the directory
+	char host[LINE_LEN*4];		// its host
+	char port[LINE_LEN];		// and port
+	int sock = -1;				// the socket
+
+	splitAddress(addr, host, sizeof(host), port);
+
+	bzero(&hints, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if (getaddrinfo(host, port, &hints, &res) != 0) {
+		return -1;
+	}
+
+	for (ai = res; ai && (sock < 0); ai = ai->ai_next) {
+		if ( (sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0 ) {
+			continue;
+		}
+
+		if (connect(sock, ai->ai_addr, ai->ai_addrlen) < 0) {
+			close(sock);
+			sock = -1;
+		}
+	}
+
+	freeaddrinfo(res);
+
+	return sock;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Node side. Finds the address the other nodes can send our
+ * players to when none was given: the one of ours that the directory's
+ * socket goes out from, so a node that reaches the directory reaches us
+ * too. A directory on this host only shows us the loopback address, then
+ * the host's name is the best we have
+ *
+ * @param Takes in the socket, our port and a buffer of the given size
+ *
+ */
+void nodeAddress(int sock, int port, char *addr, size_t len) {
+	struct sockaddr_in6 ours;		// our end of the socket (IPv4 fits too)
+	struct sockaddr_in *ours4 = (struct sockaddr_in *)&ours;
+	socklen_t size = sizeof(ours);	// its length
+	char host[LINE_LEN*4];			// our address or name
+
+	if ( (getsockname(sock, (struct sockaddr *)&ours, &size) < 0) ||
+		((ours.sin6_family == AF_INET) && (ntohl(ours4->sin_addr.s_addr) >> 24 == 127)) ||
+		((ours.sin6_family == AF_INET6) && (IN6_IS_ADDR_LOOPBACK(&(ours.sin6_addr)) ||
+		(IN6_IS_ADDR_V4MAPPED(&(ours.sin6_addr)) && (ours.sin6_addr.s6_addr[12] == 127)))) ) {
+		if (gethostname(host, sizeof(host)) < 0) {
+			strcpy(host, "127.0.0.1");
+		}
+
+		host[sizeof(host)-1] = '\0';
+		snprintf(addr, len, "%s:%d", host, port);
+	} else if (ours.sin6_family == AF_INET) {
+		inet_ntop(AF_INET, &(ours4->sin_addr), host, sizeof(host));
+		snprintf(addr, len, "%s:%d", host, port);
+	} else if (IN6_IS_ADDR_V4MAPPED(&(ours.sin6_addr))) {
+		inet_ntop(AF_INET, &(ours.sin6_addr.s6_addr[12]), host, sizeof(host));
+		snprintf(addr, len, "%s:%d", host, port);
+	} else {
+		inet_ntop(AF_INET6, &(ours.sin6_addr), host, sizeof(host));
+		snprintf(addr, len, "[%s]:%d", host, port);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Node side. Tells the directory how many players we can still
+ * take. The answer comes later through the same socket
+ *
+ * @param Takes in the socket, our address and the players we can take
+ *
+ */
+void reportLoad(int sock, char *addr, int free) {
+	DirMsg msg;	// our report
+
+	bzero(&msg, sizeof(msg));
+	snprintf(msg.addr, sizeof(msg.addr), "%s", addr);
+	msg.free = free;
+
+	// a directory that is down just misses a report
+	send(sock, &msg, sizeof(msg), MSG_DONTWAIT);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Node side. Reads the directory's answer to our last report
+ *
+ * @param Takes in the socket and a buffer of LINE_LEN*4 chars for the
+ * node it suggests
+ *
+ * @return 1 if we got an answer ("" if no node can take players) or 0
+ */
+int readSuggestion(int sock, char *next) {
+	DirMsg msg;	// the answer
+
+	if (recv(sock, &msg, sizeof(msg), MSG_DONTWAIT) != sizeof(msg)) {
+		return 0;
+	}
+
+	msg.addr[sizeof(msg.addr)-1] = '\0';
+	strcpy(next, msg.addr);
+
+	return 1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
@@ -0,0 +1,346 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <ctype.h>		// case folding of the banned words
+
+#define FILTER_MASK 0		// banned words are replaced with stars
+#define FILTER_REJECT 1		// messages with banned words are not relayed
+
+// struct every process of the server shares to find the current word
+// list. The main server compiles a new list into a segment of its own,
+// publishes its id and bumps the generation; the player processes
+// attach it the next time they see the generation change
+typedef struct {
+	int gen;		// bumped with every new word list
+	int shmid;		// segment of the current automaton (-1 = none)
+	int policy;		// what happens to messages with banned words
+}FilterCtl;
+
+// Aho-Corasick automaton of the banned words, compiled to a table of
+// next states so that a message is scanned in a single pass, one table
+// lookup per byte. Bytes that appear in no word share a column, which
+// keeps the table small
+typedef struct {
+	int states;				// states of the automaton (0 is the root)
+	int classes;			// columns of the table
+	int words;				// banned words it matches
+	unsigned char cls[256];	// column of each byte (case folded)
+
+	// states*classes next states, followed by the length of the
+	// longest word that ends in each state (0 if none does)
+	int table[];
+}Filter;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Creates the shared filter control. The segment is marked for
+ * deletion right away, every process attaches it through fork
+ *
+ * @param Takes in the policy
+ *
+ * @return A pointer to the control
+ */
+FilterCtl *openFilterCtl(int policy) {
+	int id;			// segment's id
+	FilterCtl *c;	// the control
+
+	if ( (id = shmget(IPC_PRIVATE, sizeof(FilterCtl), IPC_CREAT | 0600)) < 0 ) {
+		perror("shmget error -> filter");
+		exit(1);
+	}
+
+	if ( (c = shmat(id, NULL, 0)) == (void *)-1 ) {
+		perror("shmat error -> filter");
+		exit(1);
+	}
+
+	shmctl(id, IPC_RMID, NULL);
+
+	c->gen = 0;
+	c->shmid = -1;
+	c->policy = policy;
+
+	return c;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Compiles a word list (one word per line, '#' starts a comment)
+ * into an automaton in a new shared memory segment. The segment is
+ * marked for deletion at once, so it goes away with the last process
+ * that has it attached (Linux lets others attach it until then)
+ *
+ * @param Takes in the path of the list and a pointer for the segment's id
+ *
+ * @return The automaton, attached, or NULL on error
+ */
+Filter *compileFilter(char *path, int *shmid) {
+	FILE *fp;				// the word list
+	char line[pSize];		// a word
+	char **words = NULL;	// all of them
+	int count = 0;			// number of them
+	int bound = 1;			// most states the automaton can have
+	unsigned char cls[256];	// column of each byte
+	int classes = 1;		// columns, column 0 is for the other bytes
+	int states = 1;			// states so far
+	int *next;				// next states while we build
+	int *out;				// longest word ending in each state
+	int *fail;				// state each one falls back to
+	int *queue;				// breadth first order of the states
+	int head = 0, tail = 0;	// ends of the queue
+	int s, t, c, i, len;	// for counters
+	Filter *f;				// the automaton
+	size_t size;			// its bytes
+
+	if ( (fp = fopen(path, "r")) == NULL ) {
+		return NULL;
+	}
+
+	bzero(cls, sizeof(cls));
+
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if ( (line[0] == '\0') || (line[0] == '#') ) {
+			continue;
+		}
+
+		if ( (words = realloc(words, sizeof(char *)*(count+1))) == NULL ) {
+			fclose(fp);
+			return NULL;
+		}
+
+		// one column per byte the words use
+		for (i=0; line[i]; ++i) {
+			line[i] = tolower((unsigned char)line[i]);
+
+			if (cls[(unsigned char)line[i]] == 0) {
+				cls[(unsigned char)line[i]] = classes++;
+			}
+		}
+
+		words[count++] = strdup(line);
+		bound += i;
+	}
+
+	fclose(fp);
+
+	// upper case letters scan like lower case ones
+	for (c='A'; c<='Z'; ++c) {
+		cls[c] = cls[tolower(c)];
+	}
+
+	next = calloc((size_t)bound*classes, sizeof(int));
+	out = calloc(bound, sizeof(int));
+	fail = calloc(bound, sizeof(int));
+	queue = malloc(sizeof(int)*bound);
+
+	if ( !next || !out || !fail || !queue ) {
+		perror("Allocation error -> filter");
+		exit(1);
+	}
+
+	// the trie of the words (0 stands for no child, the root is
+	// nobody's child)
+	for (i=0; i<count; ++i) {
+		s = 0;
+
+		for (len=0; words[i][len]; ++len) {
+			c = cls[(unsigned char)words[i][len]];
+
+			if (next[s*classes + c] == 0) {
+				next[s*classes + c] = states++;
+			}
+
+			s = next[s*classes + c];
+		}
+
+		if (len > out[s]) {
+			out[s] = len;
+		}
+
+		free(words[i]);
+	}
+
+	free(words);
+
+	// the fall back links, level by level, turn the trie into a table
+	// with a next state for every state and column
+	for (c=1; c<classes; ++c) {
+		if (next[c]) {
+			queue[tail++] = next[c];
+		}
+	}
+
+	while (head < tail) {
+		s = queue[head++];
+
+		if (out[fail[s]] > out[s]) {
+			out[s] = out[fail[s]];
+		}
+
+		for (c=0; c<classes; ++c) {
+			t = next[s*classes + c];
+
+			if (t) {
+				fail[t] = next[fail[s]*classes + c];
+				queue[tail++] = t;
+			} else {
+				next[s*classes + c] = next[fail[s]*classes + c];
+			}
+		}
+	}
+
+	// copying it to a segment the player processes can attach
+	size = sizeof(Filter) + sizeof(int)*((size_t)states*classes + states);
+
+	if ( ((*shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600)) < 0) ||
+		((f = shmat(*shmid, NULL, 0)) == (void *)-1) ) {
+		f = NULL;
+	}
+
+	if (*shmid >= 0) {
+		shmctl(*shmid, IPC_RMID, NULL);
+	}
+
+	if (f == NULL) {
+		free(next);
+		free(out);
+		free(fail);
+		free(queue);
+
+		return NULL;
+	}
+
+	f->states = states;
+	f->classes = classes;
+	f->words = count;
+	memcpy(f->cls, cls, sizeof(cls));
+	memcpy(f->table, next, sizeof(int)*(size_t)states*classes);
+	memcpy(f->table + (size_t)states*classes, out, sizeof(int)*states);
+
+	free(next);
+	free(out);
+	free(fail);
+	free(queue);
+
+	return f;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Main server side. Makes a compiled word list the current one
+ * and lets go of the old one (processes still using it keep it)
+ *
+ * @param Takes in the control, the new automaton, its segment's id and
+ * a pointer to the automaton this process had
+ *
+ */
+void publishFilter(FilterCtl *c, Filter *f, int shmid, Filter **mine) {
+	if (*mine) {
+		shmdt(*mine);
+	}
+
+	*mine = f;
+	c->shmid = shmid;
+	__atomic_add_fetch(&(c->gen), 1, __ATOMIC_RELEASE);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the current automaton, attaching it first if the main
+ * server published a new one since we last looked. Costs an atomic load
+ * when nothing changed
+ *
+ * @param Takes in the control, the automaton this process has and the
+ * generation it belongs to
+ *
+ * @return The automaton or NULL if there is none
+ */
+Filter *currentFilter(FilterCtl *c, Filter **mine, int *gen) {
+	int now;	// current generation
+	Filter *f;	// the new automaton
+
+	if ( (c == NULL) || ((now = __atomic_load_n(&(c->gen), __ATOMIC_ACQUIRE)) == *gen) ) {
+		return *mine;
+	}
+
+	// a list replaced again meanwhile is gone, we try the next one
+	if ( (f = shmat(c->shmid, NULL, SHM_RDONLY)) == (void *)-1 ) {
+		return *mine;
+	}
+
+	if (*mine) {
+		shmdt(*mine);
+	}
+
+	*mine = f;
+	*gen = now;
+
+	return *mine;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Scans a message for banned words in one pass, masking them
+ * with stars if asked to
+ *
+ * @param Takes in the automaton, the message and whether to mask
+ *
+ * @return The number of banned words found
+ */
+int scanFilter(Filter *f, char *text, int mask) {
+	int *next = f->table;								// the table
+	int *out = f->table + (size_t)f->states*f->classes;	// word lengths
+	int s = 0;											// current state
+	int found = 0;										// words found
+	int i;												// for counter
+
+	for (i=0; text[i]; ++i) {
+		s = next[s*f->classes + f->cls[(unsigned char)text[i]]];
+
+		if (out[s]) {
+			++found;
+
+			if (mask) {
+				memset(text + i - out[s] + 1, '*', out[s]);
+			}
+		}
+	}
+
+	return found;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the name of a filter policy
+ *
+ * @param Takes in the policy
+ *
+ * @return The policy's name
+ */
+char *filterPolicyName(int policy) {
+	return (policy == FILTER_REJECT) ? "reject" : "mask";
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Parses the filter policy name given to the server
+ *
+ * @param Takes in the policy's name
+ *
+ * @return The policy or -1 if the name is unknown
+ */
+int parseFilterPolicy(char *name) {
+	if (!strcmp(name, "mask")) {
+		return FILTER_MASK;
+	} else if (!strcmp(name, "reject")) {
+		return FILTER_REJECT;
+	}
+
+	return -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
@@ -0,0 +1,480 @@
+/**
+ * @file GameCore.c
+ *
+ * @brief The game's room logic without sockets or processes, built
+ * into libgamecore.a
+ *
+ * A room here is what a room of the server keeps in its shared memory
+ * (the items it has left, its players and their channels), in the
+ * caller's memory instead, and it answers and relays through a
+ * Transport. Joins go through the server's parseStrIntoInv,
+ * subInventories and joinResponse, and messages through its
+ * routeCommand and recipients, in pSize frames like the room sends.
+ * The history and its numbering, the banned words filter, the rate
+ * limit, trades and seats kept for reconnecting players are the
+ * server's alone, and so are the pipes and the player processes.
+ * The loopback transport keeps each peer's frames in a queue in memory,
+ * so benchmarks and tests see the room's own costs without the network
+ * stack's
+ *
+ */
+
+// the server's helpers become the library's own, only the functions of
+// GameCore.h stay global (the Makefile makes the others local), so a
+// program that includes the server's headers too still links
+#include "Inventory.h"
+#include "Rooms.h"			// routes, channels and recipients
+#include "GameCore.h"
+
+#if CORE_FRAME_LEN != pSize
+#error "CORE_FRAME_LEN has to match the server's pSize"
+#endif
+
+// struct holding a room
+struct CoreRoom {
+	Inventory inv;			// the room's inventory, as it opened
+	int *qData;				// the items it has left
+	int quota;				// max items a player can ask for
+	int slots;				// number of player slots
+	int players;			// players in the room
+	int *sockArray;			// each slot's peer (-1 if the slot is free)
+	char (*names)[LINE_LEN];	// their names
+	Channel chans[MAX_CHANNELS];	// the room's channels
+	unsigned long long *bits;	// their subscribers, a bitmap each
+	int words;				// words of a subscriber bitmap
+	int *targets;			// recipients of the message being relayed
+	char frame[pSize];		// the frame being sent
+	Transport *t;			// how the frames get to the players
+};
+
+// struct holding a peer's queue in the loopback
+typedef struct {
+	int head;		// oldest frame
+	int count;		// frames queued
+}LoopQueue;
+
+// struct holding the loopback transport
+struct Loopback {
+	Transport t;		// what the rooms send through
+	int peers;			// peers it has a queue for
+	int depth;			// frames per queue
+	LoopQueue *queues;	// the queues
+	size_t *lens;		// length of every frame
+	char *frames;		// and the frames, depth of them per peer
+	long dropped;		// frames dropped because a queue was full
+};
+
+	/*- ------- Function declarations ------- -*/
+
+// looks a player of a room up by his name
+static int corePlayer(char *name, void *ctx);
+
+// the loopback's side of the transport
+static int loopbackSend(Transport *t, int peer, char *frame, size_t len);
+static void loopbackClose(Transport *t, int peer);
+
+	/*- ------- Function declarations ------- -*/
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Opens a room with the inventory of a file, like a room of the
+ * server opens with the inventory given with -i
+ *
+ * @param Takes in the inventory file, the number of slots, the max
+ * quota of a player and the transport the room sends through
+ *
+ * @return The room or NULL if the inventory can't be used
+ */
+CoreRoom *openCoreRoom(char *inventory, int slots, int quota, Transport *t) {
+	CoreRoom *room;	// the room
+	int i;			// for counter
+
+	if ( (slots <= 0) || ((room = calloc(1, sizeof(CoreRoom))) == NULL) ) {
+		return NULL;
+	}
+
+	if ( readInventory(inventory, &(room->inv)) || checkForDuplicates(room->inv) ) {
+		freeInventory(&(room->inv));
+		free(room);
+		return NULL;
+	}
+
+	room->quota = quota;
+	room->slots = slots;
+	room->words = channelWords(slots);
+	room->t = t;
+
+	room->qData = malloc(sizeof(int)*(room->inv.count + 1));
+	room->sockArray = malloc(sizeof(int)*slots);
+	room->names = calloc(slots, LINE_LEN);
+	room->bits = calloc(MAX_CHANNELS*room->words, sizeof(unsigned long long));
+	room->targets = malloc(sizeof(int)*slots);
+
+	if ( !room->qData || !room->sockArray || !room->names || !room->bits || !room->targets ) {
+		perror("Couldn't open the room");
+		exit(1);
+	}
+
+	for (i=0; i<slots; ++i) {
+		room->sockArray[i] = -1;
+	}
+
+	coreRestock(room);
+
+	return room;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Closes a room and the connections of its players
+ *
+ * @param Takes in the room
+ *
+ */
+void closeCoreRoom(CoreRoom *room) {
+	int i;	// for counter
+
+	for (i=0; i<room->slots; ++i) {
+		if (room->sockArray[i] >= 0) {
+			room->t->close(room->t, room->sockArray[i]);
+		}
+	}
+
+	freeInventory(&(room->inv));
+	free(room->qData);
+	free(room->sockArray);
+	free(room->names);
+	free(room->bits);
+	free(room->targets);
+	free(room);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Serves a player's request the way servePlayer does: the items
+ * he asks for are taken out of the room's if it has all of them and he
+ * stays within the quota, and he is answered either way, with a
+ * LINE_LEN response like the server's
+ *
+ * @param Takes in the room, the player's peer and his request
+ *
+ * @return His slot or -1 if he was turned away
+ */
+int coreJoin(CoreRoom *room, int peer, char *request) {
+	char response[LINE_LEN];	// the answer to his request
+	char *name;			// player's name
+	Inventory plInv;	// his inventory
+	int slot = -1;		// his slot
+	int i;				// for counter
+
+	for (i=0; (i < room->slots) && (slot < 0); ++i) {
+		if (room->sockArray[i] < 0) {
+			slot = i;
+		}
+	}
+
+	parseStrIntoInv(&name, request, &plInv);
+
+	if ( (slot >= 0) && name && subInventories(&(room->inv), plInv, room->qData, room->quota) ) {
+		room->sockArray[slot] = peer;
+		strncpy(room->names[slot], name, LINE_LEN-1);
+		room->names[slot][LINE_LEN-1] = '\0';
+		++room->players;
+
+		// no seat is kept for him, so there is no token to send
+		joinResponse(response, 0, slot, 0);
+	} else {
+		slot = -1;
+
+		strcpy(response, "Encountered a problem");
+	}
+
+	room->t->send(room->t, peer, response, sizeof(response));
+
+	free(name);
+	freeInventory(&plInv);
+
+	return slot;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Looks for a player of a room by his name, for routeCommand
+ *
+ * @param Takes in the name and the room
+ *
+ * @return His slot or -1 if he isn't in the room
+ */
+static int corePlayer(char *name, void *ctx) {
+	CoreRoom *room = ctx;	// the room
+	int i;					// for counter
+
+	for (i=0; i<room->slots; ++i) {
+		if ( (room->sockArray[i] >= 0) && !strcmp(room->names[i], name) ) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Relays a player's message to the players its route names, the
+ * way chat does: the commands go through routeCommand and the rest to
+ * the whole room. The frame is made once and handed to the transport
+ * for each of them
+ *
+ * @param Takes in the room, the player's slot and his message
+ *
+ * @return The frames sent or -1 if the slot is free
+ */
+int coreMessage(CoreRoom *room, int slot, char *raw) {
+	char *name;	// the sender
+	char *body;	// what the others read
+	int to;		// the message's route
+	int n;		// its recipients
+	int i;		// for counter
+
+	if ( (slot < 0) || (slot >= room->slots) || (room->sockArray[slot] < 0) ) {
+		return -1;
+	}
+
+	name = room->names[slot];
+
+	if (!routeCommand(room->chans, room->bits, room->words, corePlayer, room, slot, name, raw,
+		room->frame, &to, &body)) {
+		to = ROUTE_ALL;
+		bzero(room->frame, pSize);
+		snprintf(room->frame, FRAME_TEXT, "[%s]: %s", name, raw);
+	}
+
+	n = recipients(room->sockArray, room->slots, room->bits, room->words,
+		room->sockArray[slot], to, room->targets);
+
+	for (i=0; i<n; ++i) {
+		room->t->send(room->t, room->sockArray[room->targets[i]], room->frame, pSize);
+	}
+
+	return n;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Gives a player's seat up, with his channels, like freeSlot
+ *
+ * @param Takes in the room and his slot
+ *
+ */
+void coreLeave(CoreRoom *room, int slot) {
+	int i;	// for counter
+
+	if ( (slot < 0) || (slot >= room->slots) || (room->sockArray[slot] < 0) ) {
+		return;
+	}
+
+	room->t->close(room->t, room->sockArray[slot]);
+	room->sockArray[slot] = -1;
+	--room->players;
+
+	for (i=0; i<MAX_CHANNELS; ++i) {
+		leaveChannel(room->chans, room->bits, room->words, i, slot);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the number of players in a room
+ *
+ * @param Takes in the room
+ *
+ * @return The players
+ */
+int corePlayers(CoreRoom *room) {
+	return room->players;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Gives the room its whole inventory back
+ *
+ * @param Takes in the room
+ *
+ */
+void coreRestock(CoreRoom *room) {
+	memcpy(room->qData, room->inv.quantity, sizeof(int)*room->inv.count);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Loopback side of the transport, queues a frame for its peer
+ *
+ * @param Takes in the transport, the peer, the frame and its length
+ *
+ * @return 0 or -1 if the loopback has no queue for the peer
+ */
+static int loopbackSend(Transport *t, int peer, char *frame, size_t len) {
+	Loopback *lb = t->ctx;	// the loopback
+	LoopQueue *q;			// the peer's queue
+	int at;					// where the frame goes
+
+	if ( (peer < 0) || (peer >= lb->peers) ) {
+		return -1;
+	}
+
+	q = &(lb->queues[peer]);
+
+	if (len > pSize) {
+		len = pSize;
+	}
+
+	// a full queue drops its oldest frame
+	if (q->count == lb->depth) {
+		q->head = (q->head + 1) % lb->depth;
+		--q->count;
+		++lb->dropped;
+	}
+
+	at = peer*lb->depth + (q->head + q->count) % lb->depth;
+	memcpy(lb->frames + (size_t)at*pSize, frame, len);
+	lb->lens[at] = len;
+	++q->count;
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Loopback side of the transport, a peer the room is done with
+ * loses what was queued for him
+ *
+ * @param Takes in the transport and the peer
+ *
+ */
+static void loopbackClose(Transport *t, int peer) {
+	loopbackDrain(t->ctx, peer);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Opens a loopback transport
+ *
+ * @param Takes in the number of peers and the frames queued per peer
+ *
+ * @return The loopback
+ */
+Loopback *openLoopback(int peers, int depth) {
+	Loopback *lb;	// the loopback
+
+	if ( (lb = calloc(1, sizeof(Loopback))) == NULL ) {
+		perror("Couldn't open the loopback");
+		exit(1);
+	}
+
+	lb->peers = peers;
+	lb->depth = (depth > 0) ? depth : 1;
+	lb->queues = calloc(peers, sizeof(LoopQueue));
+	lb->lens = calloc((size_t)peers*lb->depth, sizeof(size_t));
+	lb->frames = malloc((size_t)peers*lb->depth*pSize);
+
+	if ( !lb->queues || !lb->lens || !lb->frames ) {
+		perror("Couldn't open the loopback");
+		exit(1);
+	}
+
+	lb->t.send = loopbackSend;
+	lb->t.close = loopbackClose;
+	lb->t.ctx = lb;
+
+	return lb;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Frees a loopback transport
+ *
+ * @param Takes in the loopback
+ *
+ */
+void closeLoopback(Loopback *lb) {
+	free(lb->queues);
+	free(lb->lens);
+	free(lb->frames);
+	free(lb);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the transport of a loopback, for the rooms
+ *
+ * @param Takes in the loopback
+ *
+ * @return Its transport
+ */
+Transport *loopbackTransport(Loopback *lb) {
+	return &(lb->t);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Takes the oldest frame queued for a peer
+ *
+ * @param Takes in the loopback, the peer, a buffer and its length (a
+ * longer frame is cut)
+ *
+ * @return The frame's length or 0 if nothing was queued
+ */
+size_t loopbackRead(Loopback *lb, int peer, char *frame, size_t len) {
+	LoopQueue *q;	// the peer's queue
+	int at;			// the frame
+
+	if ( (peer < 0) || (peer >= lb->peers) || (lb->queues[peer].count == 0) ) {
+		return 0;
+	}
+
+	q = &(lb->queues[peer]);
+	at = peer*lb->depth + q->head;
+
+	if (len > lb->lens[at]) {
+		len = lb->lens[at];
+	}
+
+	memcpy(frame, lb->frames + (size_t)at*pSize, len);
+	q->head = (q->head + 1) % lb->depth;
+	--q->count;
+
+	return len;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Throws away the frames queued for a peer
+ *
+ * @param Takes in the loopback and the peer
+ *
+ * @return The frames there were
+ */
+int loopbackDrain(Loopback *lb, int peer) {
+	int n;	// frames queued
+
+	if ( (peer < 0) || (peer >= lb->peers) ) {
+		return 0;
+	}
+
+	n = lb->queues[peer].count;
+	lb->queues[peer].head = lb->queues[peer].count = 0;
+
+	return n;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the frames the loopback dropped
+ *
+ * @param Takes in the loopback
+ *
+ * @return The frames dropped because a queue was full
+ */
+long loopbackDropped(Loopback *lb) {
+	return lb->dropped;
+}
@@ -0,0 +1,96 @@
+#ifndef GAMECORE_H
+#define GAMECORE_H
+
+/*
+ * A model of a game room as a library (libgamecore.a): a room takes
+ * players whose items its inventory can serve and relays their chat,
+ * whispers and channel messages like a room of the server, but in the
+ * caller's process and through a transport of the caller's choosing.
+ * It is a room of its own, not the server's: only the parsing of the
+ * requests, the join answers and the routing of the commands are the
+ * functions the server's rooms call too (in Inventory.h and Rooms.h).
+ * The relay path (chat, the pipes, pushMessage), the history, the banned
+ * words filter, the rate limit, trades and reconnecting players are the
+ * server's alone. Only the functions of this header are exported.
+ *
+ * Nothing is forked and nothing waits, the caller hands every request
+ * and message to the room as it arrives, from a single thread.
+ */
+
+#include <stddef.h>		// size_t
+
+#define CORE_FRAME_LEN 1024	// longest frame a room sends (the server's pSize)
+
+// struct describing a transport: how a room gets its frames to a peer.
+// Peers are numbered by the caller, a peer is anything >= 0
+typedef struct Transport {
+	// hands a frame to a peer, returns 0 or -1 if he is gone
+	int (*send)(struct Transport *t, int peer, char *frame, size_t len);
+
+	// the room is done with a peer
+	void (*close)(struct Transport *t, int peer);
+
+	void *ctx;	// the transport's own data
+}Transport;
+
+// a room, opaque to the caller
+typedef struct CoreRoom CoreRoom;
+
+// in-memory loopback transport, opaque to the caller
+typedef struct Loopback Loopback;
+
+/*- ---------------------------------------------------------------- -*/
+// 				Rooms
+/*- ---------------------------------------------------------------- -*/
+
+// opens a room with the inventory of a file (the server's -i), NULL if
+// the file can't be read or has duplicates
+CoreRoom *openCoreRoom(char *inventory, int slots, int quota, Transport *t);
+
+// closes a room, its players are closed through the transport
+void closeCoreRoom(CoreRoom *room);
+
+// a player's request (name, then "item\tquantity" lines). He is answered
+// like by the server without kept seats, in a 32 byte frame, "OK\n" or
+// the problem message. Returns his slot or -1
+int coreJoin(CoreRoom *room, int peer, char *request);
+
+// a message of the player in a slot: chat, "WHISPER <player> <text>",
+// "CHANNEL <channel> <text>", "JOIN <channel>" or "LEAVE <channel>".
+// Every recipient gets a CORE_FRAME_LEN frame. Returns the frames it was
+// sent as, or -1 if the slot is free
+int coreMessage(CoreRoom *room, int slot, char *raw);
+
+// the player in a slot leaves, his items stay taken like in the server
+void coreLeave(CoreRoom *room, int slot);
+
+// players in the room
+int corePlayers(CoreRoom *room);
+
+// gives the room its whole inventory back, as if it had just opened
+void coreRestock(CoreRoom *room);
+
+/*- ---------------------------------------------------------------- -*/
+// 				Loopback transport
+/*- ---------------------------------------------------------------- -*/
+
+// opens a loopback with a queue of depth frames for each of peers
+// peers. A full queue drops its oldest frame, like the server's -o drop
+Loopback *openLoopback(int peers, int depth);
+
+// frees the loopback
+void closeLoopback(Loopback *lb);
+
+// the transport rooms send through
+Transport *loopbackTransport(Loopback *lb);
+
+// takes the oldest frame queued for a peer, returns its length or 0
+size_t loopbackRead(Loopback *lb, int peer, char *frame, size_t len);
+
+// throws away the frames queued for a peer, returns how many there were
+int loopbackDrain(Loopback *lb, int peer);
+
+// frames dropped because a queue was full
+long loopbackDropped(Loopback *lb);
+
+#endif
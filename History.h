@@ -0,0 +1,316 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <time.h>		// message timestamps
+#include <signal.h>		// kill, to look the room and the writers up
+#include <sched.h>		// sched_yield, waiting for a writer
+#include <semaphore.h>	// the order lock of the writers
+
+#define HISTORY_WRITING (1ULL << 63)	// set in the number of an entry that is being written
+#define HISTORY_SPINS 1000				// times a writer lets the one before it finish
+
+// struct holding one message of the room's history. Entries take whole
+// cache lines, so the room writing one never slows down a player
+// process reading its neighbour
+typedef struct {
+	unsigned long long seq;	// number of the message (0 if empty), HISTORY_WRITING set while written
+	unsigned long long claim;	// the number's low half and the pid of the process writing it
+	long long ns;			// wall clock time it was sent, in nanoseconds
+	char sender[LINE_LEN];	// name of the player that sent it
+	char text[pSize];		// the message, as it was sent
+} __attribute__((aligned(64))) HistoryEntry;
+
+// struct holding the last messages of a room (kept in the room's
+// segment). The player processes number and store their players'
+// messages before relaying them, so the room's fan-out never touches
+// it. They hold the order lock until the message is in the room's
+// pipe, so the room relays the messages in the order of their numbers.
+// Readers take no lock: writers claim an entry by marking its number
+// and readers check the number before and after copying an entry, to
+// know nobody overwrote it in the meantime. A writer that dies half way
+// is found by its pid, its entry is then lost instead of stuck
+typedef struct {
+	// numbers handed out to the messages
+	unsigned long long next __attribute__((aligned(64)));
+
+	// newest message stored, on a line of its own
+	unsigned long long head __attribute__((aligned(64)));
+
+	int size;		// messages the history holds (0 = off)
+	pid_t owner;	// process running the room (changes if the room moves)
+	sem_t order;	// one player process at a time numbers and relays a message
+
+	HistoryEntry entries[];
+}History;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the bytes a history of the given size takes
+ *
+ * @param Takes in the number of messages
+ *
+ * @return The size in bytes
+ */
+size_t historyBytes(int size) {
+	return sizeof(History) + sizeof(HistoryEntry)*size;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Empties a history
+ *
+ * @param Takes in a history pointer and the number of messages it holds
+ *
+ */
+void initHistory(History *h, int size) {
+	int i;	// for counter
+
+	h->next = 0;
+	h->head = 0;
+	h->size = size;
+	h->owner = getpid();
+
+	if (sem_init(&(h->order), 1, 1) < 0) {
+		perror("sem_init error -> history");
+		exit(1);
+	}
+
+	for (i=0; i<size; ++i) {
+		h->entries[i].seq = 0;
+		h->entries[i].claim = 0;
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Tells the processes that follow a room (the spectator relay)
+ * whether it is still running. They are children of
+ * the process that opened it, which is gone once the room moves to
+ * another process, so that one is only looked up then
+ *
+ * @param Takes in the room's history and the pid it opened with
+ *
+ * @return 1 if the room is still running, 0 otherwise
+ */
+int roomRunning(History *h, pid_t room) {
+	return (getppid() == room) ||
+		(kill(__atomic_load_n(&(h->owner), __ATOMIC_RELAXED), 0) == 0);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the number a frame carries (0 for server notices)
+ *
+ * @param Takes in the frame
+ *
+ * @return The number
+ */
+unsigned long long frameSeq(char *frame) {
+	unsigned long long seq;	// the number
+
+	memcpy(&seq, frame + FRAME_TEXT, sizeof(seq));
+
+	return seq;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Tells whether the process writing an entry died before it was
+ * done. Its pid goes with the number it claimed, so a claim whose pid
+ * isn't stored yet is never taken for a dead one
+ *
+ * @param Takes in the entry and the number it held
+ *
+ * @return 1 if the writer is gone, 0 otherwise
+ */
+int historyWriterGone(HistoryEntry *e, unsigned long long held) {
+	unsigned long long claim = __atomic_load_n(&(e->claim), __ATOMIC_ACQUIRE);
+
+	if ( !(held & HISTORY_WRITING) || ((claim >> 32) != (held & 0xffffffffULL)) ) {
+		return 0;
+	}
+
+	return (kill((pid_t)(claim & 0xffffffffULL), 0) < 0) && (errno == ESRCH);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Player side. Numbers a message and stores it over the oldest
+ * one, before it is relayed. The number travels in the last bytes of
+ * the message's frame, so the players learn it too and can ask for
+ * what came after it. If another player's process is still writing a
+ * message a whole history older into the same entry, we let it finish
+ * first (it is left out if it takes too long), if it died we take the
+ * entry over
+ *
+ * @param Takes in a history pointer, the message's frame and the name
+ * of its sender
+ *
+ */
+void recordHistory(History *h, char *frame, char *sender) {
+	unsigned long long seq = 0;	// the message's number
+	unsigned long long old;		// number the entry holds
+	unsigned long long head;	// newest message stored
+	HistoryEntry *e;			// the message's entry
+	struct timespec now;		// when it was sent
+	int spins = 0;				// times we waited for the writer before us
+
+	if (h->size > 0) {
+		seq = __atomic_add_fetch(&(h->next), 1, __ATOMIC_RELAXED);
+	}
+
+	memcpy(frame + FRAME_TEXT, &seq, sizeof(seq));
+
+	if (seq == 0) {
+		return;
+	}
+
+	e = &(h->entries[seq % h->size]);
+
+	// claiming the entry, readers of the old message see that it is gone
+	for (;;) {
+		old = __atomic_load_n(&(e->seq), __ATOMIC_RELAXED);
+
+		if ((old & ~HISTORY_WRITING) > seq) {
+			return;	// a newer message is there, or it is being written
+		}
+
+		if ( !(old & HISTORY_WRITING) || historyWriterGone(e, old) ) {
+			if (__atomic_compare_exchange_n(&(e->seq), &old, seq | HISTORY_WRITING, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				break;
+			}
+
+			continue;
+		}
+
+		// an older message is being written, it has the entry a moment more
+		if (++spins > HISTORY_SPINS) {
+			return;
+		}
+
+		sched_yield();
+	}
+
+	__atomic_store_n(&(e->claim), (seq << 32) | (unsigned)getpid(), __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	e->ns = now.tv_sec*1000000000LL + now.tv_nsec;
+	strncpy(e->sender, sender, LINE_LEN-1);
+	e->sender[LINE_LEN-1] = '\0';
+	memcpy(e->text, frame, pSize);
+
+	// a writer that took us for dead has the entry now
+	old = seq | HISTORY_WRITING;
+	if ( !__atomic_compare_exchange_n(&(e->seq), &old, seq, 0, __ATOMIC_RELEASE,
+		__ATOMIC_RELAXED) ) {
+		return;
+	}
+
+	// moving the head forward, unless a newer message got there first
+	head = __atomic_load_n(&(h->head), __ATOMIC_RELAXED);
+
+	while ( (head < seq) && !__atomic_compare_exchange_n(&(h->head), &head, seq, 
+		0, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Copies a message out of the history
+ *
+ * @param Takes in a history pointer, the message's number and a buffer
+ * of pSize chars
+ *
+ * @return 0 on success or -1 if the message is not there
+ */
+int readHistory(History *h, unsigned long long seq, char *frame) {
+	HistoryEntry *e = &(h->entries[seq % h->size]);	// its entry
+
+	if (__atomic_load_n(&(e->seq), __ATOMIC_ACQUIRE) != seq) {
+		return -1;
+	}
+
+	memcpy(frame, e->text, pSize);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	// the room started writing over it while we were copying
+	if (__atomic_load_n(&(e->seq), __ATOMIC_RELAXED) != seq) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Copies a whole entry (message, sender and time) out of the
+ * history
+ *
+ * @param Takes in a history pointer, the message's number and the
+ * entry to copy it to
+ *
+ * @return 0 on success, 1 if the message was overwritten already (or
+ * its writer died half way) or -1 if it is not there yet (or being
+ * written)
+ */
+int readHistoryEntry(History *h, unsigned long long seq, HistoryEntry *out) {
+	HistoryEntry *e = &(h->entries[seq % h->size]);	// its entry
+	unsigned long long held;						// number it holds
+
+	held = __atomic_load_n(&(e->seq), __ATOMIC_ACQUIRE);
+
+	if (held != seq) {
+		if ( ((held & ~HISTORY_WRITING) > seq) ||
+			((held == (seq | HISTORY_WRITING)) && historyWriterGone(e, held)) ) {
+			return 1;
+		}
+
+		return -1;
+	}
+
+	memcpy(out, e, sizeof(HistoryEntry));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	// a newer message took the entry while we were copying
+	if (__atomic_load_n(&(e->seq), __ATOMIC_RELAXED) != seq) {
+		return 1;
+	}
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the number of the newest stored message
+ *
+ * @param Takes in a history pointer
+ *
+ * @return The number (0 if the room hasn't relayed anything yet)
+ */
+unsigned long long historyHead(History *h) {
+	return __atomic_load_n(&(h->head), __ATOMIC_ACQUIRE);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the number of the oldest message a catch-up after
+ * the given one can still get
+ *
+ * @param Takes in a history pointer and the last message the player has
+ *
+ * @return The number of the first message to send
+ */
+unsigned long long historyFrom(History *h, unsigned long long since) {
+	unsigned long long head = historyHead(h);	// newest message
+
+	if (head > (unsigned long long)h->size && since < head - h->size) {
+		since = head - h->size;	// older messages are gone
+	}
+
+	return since + 1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
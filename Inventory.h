@@ -21,12 +21,19 @@
 // defining port number
 #define PORT_NO 5623
 
+// Unix domain socket the server also listens on, for same-host players
+#define UNIX_PATH "/tmp/game5623.sock"
+
 // defining line length
 #define LINE_LEN 32
 
 // defining the max size in chars of an inventory
 #define pSize 1024
 
+// room for text in a chat frame, its last bytes carry the message's
+// number in the room's history
+#define FRAME_TEXT (pSize - sizeof(unsigned long long))
+
 // struct containing the inventory data
 typedef struct {
 	char **items;
@@ -340,31 +347,49 @@ int findItem(Inventory inv, char *target, int *index) {
 
 /*- ---------------------------------------------------------------- -*/
 /**
- * @brief Checks for duplicates in the given inventory
+ * @brief Orders two item names, for qsort
+ *
+ * @param Takes in pointers to the two names
+ *
+ * @return Less than, equal to or greater than zero, like strcmp
+ */
+int compareItems(const void *a, const void *b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Checks for duplicates in the given inventory. The names are
+ * sorted in a copy of the array, so equal names end up next to each other
  *
  * @param Takes in an inventory struct
  *
  * @return 1 if duplicate was found or 0 if not
  */
 int checkForDuplicates(Inventory inv) {
-	int i, j;		// for counter
-	int flag;	// flag for dublicates
+	char **sorted;	// the names, in order
+	int found = 0;	// flag for duplicates
+	int i;			// for counter
 
-	for (i=0; i<inv.count; ++i) {
-		flag = 0;	// set the flag to zero at every loop
+	if (inv.count < 2) {
+		return 0;
+	}
 
-		for (j=0; j<inv.count; ++j) {
-			if (inv.items[i] == inv.items[j]) {
-				++flag;
-			}
-		}// j
+	if ( (sorted = malloc(sizeof(char *)*inv.count)) == NULL ) {
+		perror("Allocation error");
+		exit(1);
+	}
 
-		if (flag > 1) {
-			return 1;	// found a duplicate entry
-		}
-	}// i
+	memcpy(sorted, inv.items, sizeof(char *)*inv.count);
+	qsort(sorted, inv.count, sizeof(char *), compareItems);
 
-	return 0;
+	for (i=1; (i < inv.count) && !found; ++i) {
+		found = !strcmp(sorted[i-1], sorted[i]);	// found a duplicate entry
+	}
+
+	free(sorted);
+
+	return found;
 }
 
 /*- ---------------------------------------------------------------- -*/
@@ -435,6 +460,41 @@ void printInventory(Inventory inv) {
 	printf("\n");
 }
 
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Splits a server's address into the host and the port. The
+ * address is host:port, [IPv6 address]:port or just the host (or an
+ * IPv6 address), which gets the default port
+ *
+ * @param Takes in the address, a buffer for the host and its size and
+ * a buffer of LINE_LEN chars for the port
+ *
+ */
+void splitAddress(char *addr, char *host, size_t len, char *port) {
+	char *colon = strchr(addr, ':');	// first colon
+	char *end;							// end of the host
+	size_t n;							// its length
+
+	snprintf(port, LINE_LEN, "%d", PORT_NO);
+
+	if ( (addr[0] == '[') && ((end = strchr(addr, ']')) != NULL) ) {
+		++addr;
+
+		if (end[1] == ':') {
+			snprintf(port, LINE_LEN, "%s", end + 2);
+		}
+	} else if ( colon && (colon == strrchr(addr, ':')) ) {
+		end = colon;
+		snprintf(port, LINE_LEN, "%s", colon + 1);
+	} else {
+		end = addr + strlen(addr);
+	}
+
+	n = ((size_t)(end - addr) < len) ? (size_t)(end - addr) : len - 1;
+	memcpy(host, addr, n);
+	host[n] = '\0';
+}
+
 /*- ---------------------------------------------------------------- -*/
 
 #endif
\ No newline at end of file
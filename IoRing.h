@@ -0,0 +1,586 @@
+#ifndef IORING_H
+#define IORING_H
+
+#include <linux/io_uring.h>	// io_uring structs and constants
+#include <sys/syscall.h>	// io_uring has no libc wrappers
+#include <sys/mman.h>		// mapping the rings
+#include <poll.h>			// poll events
+#include <sys/time.h>		// timeval for the accept timeout
+
+// i/o engines a room can use
+#define ENGINE_SELECT 0	// select and one syscall per operation
+#define ENGINE_URING 1	// io_uring, one syscall for a whole batch
+#define ENGINE_SPLICE 2	// select, with a zero-copy fan-out (tee and splice)
+
+// defining the ring limits
+#define RING_ENTRIES 256	// submission queue size of a room's ring
+#define RING_CHAIN 16		// max linked sends per player at a time
+#define RING_BUFFERS 64		// buffers the kernel receives relayed messages in
+#define RING_GROUP 0		// id of that buffer group
+
+// what a completion belongs to (the top byte of its user_data)
+#define RING_ACCEPT 1	// accepting a player
+#define RING_TIMER 2	// timeout linked to the accept
+#define RING_RELAY 3	// message relayed by a player's process
+#define RING_MIGRATE 4	// a sparse room is sending us a player
+#define RING_SEND 5		// message sent to a player
+
+// packing the request's kind, the player's slot and the slot's
+// generation in the user_data of a request
+#define RING_TAG(kind, slot, gen) \
+	( ((__u64)(kind) << 56) | ((__u64)(slot) << 32) | (__u32)(gen) )
+#define RING_KIND(tag) ((int)((tag) >> 56))
+#define RING_SLOT(tag) ((int)(((tag) >> 32) & 0xffffff))
+#define RING_GEN(tag) ((unsigned)(tag))
+
+// struct holding an io_uring instance and the memory it shares with
+// the kernel
+typedef struct {
+	int fd;	// ring's file descriptor
+
+	// submission queue
+	unsigned *sqHead;			// first entry the kernel hasn't consumed
+	unsigned *sqTail;			// entries we handed to the kernel
+	unsigned *sqMask;			// mask for the ring indexes
+	unsigned *sqArray;			// indexes of the handed entries
+	struct io_uring_sqe *sqes;	// the entries themselves
+	unsigned sqEntries;			// size of the queue
+	unsigned sqLocal;			// our tail, handed to the kernel on submit
+
+	// completion queue
+	unsigned *cqHead;			// first completion we haven't seen
+	unsigned *cqTail;			// completions posted by the kernel
+	unsigned *cqMask;			// mask for the ring indexes
+	struct io_uring_cqe *cqes;	// the completions themselves
+
+	// mappings shared with the kernel
+	void *sqMap;		// submission ring
+	size_t sqMapLen;
+	void *cqMap;		// completion ring (same as sqMap on most kernels)
+	size_t cqMapLen;
+	size_t sqesLen;		// length of the entries' mapping
+
+	// buffers the kernel picks from when receiving
+	struct io_uring_buf_ring *bufRing;	// ring of free buffers
+	char *bufs;							// the buffers themselves
+	unsigned bufCount;					// number of buffers
+	unsigned bufSize;					// size of each buffer
+	unsigned short bufTail;				// our tail of the free ring
+}IoRing;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Unmaps a ring and closes it. Forked processes call this to
+ * drop the copy they inherited, so only their own mappings go away and
+ * the parent's requests keep running
+ *
+ * @param Takes in a ring pointer
+ *
+ */
+void closeRing(IoRing *r) {
+	if (r->bufRing != NULL) {
+		munmap(r->bufRing, r->bufCount*sizeof(struct io_uring_buf));
+	}
+
+	if (r->sqes != NULL) {
+		munmap(r->sqes, r->sqesLen);
+	}
+
+	if ( (r->cqMap != NULL) && (r->cqMap != r->sqMap) ) {
+		munmap(r->cqMap, r->cqMapLen);
+	}
+
+	if (r->sqMap != NULL) {
+		munmap(r->sqMap, r->sqMapLen);
+	}
+
+	if (r->fd >= 0) {
+		close(r->fd);
+	}
+
+	free(r->bufs);
+	bzero(r, sizeof(*r));
+	r->fd = -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Sets up a ring and maps its queues. The ring is created
+ * through the raw syscalls, we don't depend on liburing
+ *
+ * @param Takes in a ring pointer and the submission queue size
+ *
+ * @return 0 on success or -1 if the kernel can't give us a ring
+ */
+int openRing(IoRing *r, unsigned entries) {
+	struct io_uring_params p;	// ring parameters filled by the kernel
+	char *sq;					// submission ring
+	char *cq;					// completion ring
+
+	bzero(&p, sizeof(p));
+	bzero(r, sizeof(*r));
+
+	if ( (r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0 ) {
+		r->fd = -1;
+		return -1;
+	}
+
+	r->sqMapLen = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+	r->cqMapLen = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+	r->sqesLen = p.sq_entries*sizeof(struct io_uring_sqe);
+
+	// newer kernels keep both rings in a single mapping
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cqMapLen > r->sqMapLen) {
+			r->sqMapLen = r->cqMapLen;
+		}
+
+		r->cqMapLen = r->sqMapLen;
+	}
+
+	r->sqMap = mmap(NULL, r->sqMapLen, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+
+	if (r->sqMap == MAP_FAILED) {
+		r->sqMap = NULL;
+		closeRing(r);
+		return -1;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cqMap = r->sqMap;
+	} else {
+		r->cqMap = mmap(NULL, r->cqMapLen, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+
+		if (r->cqMap == MAP_FAILED) {
+			r->cqMap = NULL;
+			closeRing(r);
+			return -1;
+		}
+	}
+
+	r->sqes = mmap(NULL, r->sqesLen, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		closeRing(r);
+		return -1;
+	}
+
+	// finding our way around the rings
+	sq = r->sqMap;
+	cq = r->cqMap;
+
+	r->sqHead = (unsigned *)(sq + p.sq_off.head);
+	r->sqTail = (unsigned *)(sq + p.sq_off.tail);
+	r->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sqArray = (unsigned *)(sq + p.sq_off.array);
+	r->sqEntries = p.sq_entries;
+	r->sqLocal = *(r->sqTail);
+
+	r->cqHead = (unsigned *)(cq + p.cq_off.head);
+	r->cqTail = (unsigned *)(cq + p.cq_off.tail);
+	r->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Gives a buffer back to the kernel so that it can receive in
+ * it again
+ *
+ * @param Takes in a ring pointer and the buffer's id
+ *
+ */
+void ringRecycle(IoRing *r, int bid) {
+	struct io_uring_buf *buf = &(r->bufRing->bufs[r->bufTail & (r->bufCount - 1)]);
+
+	buf->addr = (unsigned long)(r->bufs + bid*r->bufSize);
+	buf->len = r->bufSize;
+	buf->bid = bid;
+
+	// publishing the buffer after it is filled in
+	++r->bufTail;
+	__atomic_store_n(&(r->bufRing->tail), r->bufTail, __ATOMIC_RELEASE);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Registers a ring of buffers that receives pick from, so that
+ * a multishot receive never needs a buffer of its own
+ *
+ * @param Takes in a ring pointer, the number of buffers (a power of
+ * two) and the size of each buffer
+ *
+ * @return 0 on success or -1 if the kernel doesn't support it
+ */
+int ringProvideBuffers(IoRing *r, unsigned count, unsigned size) {
+	struct io_uring_buf_reg reg;	// registration of the buffer ring
+	unsigned i;						// for counter
+
+	// shared, so that the ring stays the kernel's after we fork
+	r->bufRing = mmap(NULL, count*sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (r->bufRing == MAP_FAILED) {
+		r->bufRing = NULL;
+		return -1;
+	}
+
+	r->bufCount = count;
+	r->bufSize = size;
+	r->bufTail = 0;
+
+	if ( (r->bufs = malloc(count*size)) == NULL ) {
+		perror("Allocation error -> ring buffers");
+		exit(1);
+	}
+
+	bzero(&reg, sizeof(reg));
+	reg.ring_addr = (unsigned long)r->bufRing;
+	reg.ring_entries = count;
+	reg.bgid = RING_GROUP;
+
+	if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		return -1;
+	}
+
+	for (i=0; i<count; ++i) {
+		ringRecycle(r, i);
+	}
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the free entries of the submission queue
+ *
+ * @param Takes in a ring pointer
+ *
+ * @return The number of free entries
+ */
+unsigned ringSpace(IoRing *r) {
+	return r->sqEntries - (r->sqLocal - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE));
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Checks whether the kernel posted completions we haven't seen
+ *
+ * @param Takes in a ring pointer
+ *
+ * @return 1 if there are completions or 0 if not
+ */
+int ringReady(IoRing *r) {
+	return __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE) != *(r->cqHead);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Hands all the prepared entries to the kernel and optionally
+ * waits for a completion, in a single syscall. Signals don't interrupt
+ * us, the call is simply repeated
+ *
+ * @param Takes in a ring pointer and whether we wait for a completion
+ *
+ * @return 0 on success or -1 on error
+ */
+int ringSubmit(IoRing *r, int wait) {
+	unsigned pending;	// entries the kernel hasn't consumed yet
+
+	__atomic_store_n(r->sqTail, r->sqLocal, __ATOMIC_RELEASE);
+
+	for (;;) {
+		pending = r->sqLocal - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE);
+
+		if ( (pending == 0) && (!wait || ringReady(r)) ) {
+			return 0;
+		}
+
+		if ( (syscall(__NR_io_uring_enter, r->fd, pending, wait ? 1 : 0,
+			wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0) < 0) && (errno != EINTR) ) {
+			return -1;
+		}
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Like ringSubmit, waiting for a completion, but a signal ends
+ * the wait, for callers that must look at what its handler flagged
+ *
+ * @param Takes in a ring pointer
+ *
+ * @return 0 on success or -1 on error (EINTR if a signal came first)
+ */
+int ringWait(IoRing *r) {
+	if (ringSubmit(r, 0) < 0) {
+		return -1;
+	}
+
+	if ( !ringReady(r) && (syscall(__NR_io_uring_enter, r->fd, 0, 1, 
+		IORING_ENTER_GETEVENTS, NULL, 0) < 0) ) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Gets a cleared submission entry. If the queue is full, what
+ * we have so far goes to the kernel first
+ *
+ * @param Takes in a ring pointer
+ *
+ * @return The entry
+ */
+struct io_uring_sqe *ringGetSqe(IoRing *r) {
+	struct io_uring_sqe *sqe;	// the entry
+	unsigned idx;				// its index
+
+	if (ringSpace(r) == 0) {
+		ringSubmit(r, 0);
+	}
+
+	idx = r->sqLocal & *(r->sqMask);
+	sqe = &(r->sqes[idx]);
+	bzero(sqe, sizeof(*sqe));
+
+	r->sqArray[idx] = idx;
+	++r->sqLocal;
+
+	return sqe;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the next completion, without consuming it
+ *
+ * @param Takes in a ring pointer
+ *
+ * @return The completion or NULL if there is none
+ */
+struct io_uring_cqe *ringPeek(IoRing *r) {
+	if (!ringReady(r)) {
+		return NULL;
+	}
+
+	return &(r->cqes[*(r->cqHead) & *(r->cqMask)]);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Consumes the completion returned by ringPeek
+ *
+ * @param Takes in a ring pointer
+ *
+ */
+void ringSeen(IoRing *r) {
+	__atomic_store_n(r->cqHead, *(r->cqHead) + 1, __ATOMIC_RELEASE);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Queues a multishot receive on a socket. Every message gets a
+ * completion of its own, in a buffer the kernel picks from the
+ * provided ones, until the request ends (no IORING_CQE_F_MORE)
+ *
+ * @param Takes in a ring pointer, the socket and the request's tag
+ *
+ */
+void ringRecvMulti(IoRing *r, int fd, __u64 tag) {
+	struct io_uring_sqe *sqe = ringGetSqe(r);
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = RING_GROUP;
+	sqe->user_data = tag;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Queues a one shot poll for incoming data on a socket
+ *
+ * @param Takes in a ring pointer, the socket and the request's tag
+ *
+ */
+void ringPollIn(IoRing *r, int fd, __u64 tag) {
+	struct io_uring_sqe *sqe = ringGetSqe(r);
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = tag;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Accepts a connection, waiting up to timeout for it. The
+ * timeout is linked to the accept, so waiting for both takes a single
+ * syscall. The ring must have nothing else in flight. A signal takes
+ * the accept back, unless a connection beat it
+ *
+ * @param Takes in a ring pointer, the listening socket and the timeout
+ * (NULL to wait forever)
+ *
+ * @return The connection's socket or -1 with errno set (ETIME if the
+ * timeout expired, EINTR if a signal came first)
+ */
+int ringAccept(IoRing *r, int listenfd, struct timeval *timeout) {
+	struct __kernel_timespec ts;	// timeout in the kernel's format
+	struct io_uring_sqe *sqe;		// requests we queue
+	struct io_uring_cqe *cqe;		// their completions
+	int pending = 1;				// completions we wait for
+	int connfd = -1;				// accepted socket
+	int err = EINTR;				// why the accept failed
+	int cancelled = 0;				// a signal came first, we took it back
+
+	sqe = ringGetSqe(r);
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listenfd;
+	sqe->user_data = RING_TAG(RING_ACCEPT, 0, 0);
+
+	if (timeout) {
+		// the accept is cancelled when the timeout expires
+		sqe->flags = IOSQE_IO_LINK;
+
+		ts.tv_sec = timeout->tv_sec;
+		ts.tv_nsec = timeout->tv_usec * 1000;
+
+		sqe = ringGetSqe(r);
+		sqe->opcode = IORING_OP_LINK_TIMEOUT;
+		sqe->addr = (unsigned long)&ts;
+		sqe->len = 1;
+		sqe->user_data = RING_TAG(RING_TIMER, 0, 0);
+
+		++pending;
+	}
+
+	while (pending > 0) {
+		if ( (cancelled ? ringSubmit(r, 1) : ringWait(r)) < 0 ) {
+			if ( (errno != EINTR) || cancelled ) {
+				return -1;
+			}
+
+			// the caller has to see the signal, and the accept can't
+			// stay behind to take a player nobody serves
+			cancelled = 1;
+
+			sqe = ringGetSqe(r);
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = RING_TAG(RING_ACCEPT, 0, 0);
+			sqe->user_data = RING_TAG(RING_TIMER, 0, 0);
+
+			++pending;
+			continue;
+		}
+
+		while ( (cqe = ringPeek(r)) != NULL ) {
+			if (RING_KIND(cqe->user_data) == RING_ACCEPT) {
+				if (cqe->res >= 0) {
+					connfd = cqe->res;
+				} else if (cqe->res == -ECANCELED) {
+					err = cancelled ? EINTR : ETIME;
+				} else {
+					err = -cqe->res;
+				}
+			}
+
+			--pending;
+			ringSeen(r);
+		}
+	}
+
+	if (connfd < 0) {
+		errno = err;
+	}
+
+	return connfd;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Checks whether the kernel supports everything the io_uring
+ * engine needs, by receiving a message with a multishot receive in a
+ * provided buffer. Older kernels (or ones with io_uring disabled) fail
+ * somewhere along the way
+ *
+ * @return 1 if the engine can be used or 0 if not
+ */
+int ringAvailable() {
+	IoRing r;					// test ring
+	int pair[2];				// test sockets
+	struct io_uring_cqe *cqe;	// the receive's completion
+	int ok = 0;					// whether everything worked
+
+	if (openRing(&r, 4) < 0) {
+		return 0;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) < 0) {
+		closeRing(&r);
+		return 0;
+	}
+
+	if ( (ringProvideBuffers(&r, 2, 16) == 0) && (write(pair[1], "?", 1) == 1) ) {
+		ringRecvMulti(&r, pair[0], RING_TAG(RING_RELAY, 0, 0));
+
+		if ( (ringSubmit(&r, 1) == 0) && ((cqe = ringPeek(&r)) != NULL) ) {
+			ok = (cqe->res == 1) && (cqe->flags & IORING_CQE_F_MORE);
+		}
+	}
+
+	close(pair[0]);
+	close(pair[1]);
+	closeRing(&r);
+
+	return ok;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the name of an i/o engine
+ *
+ * @param Takes in the engine
+ *
+ * @return The engine's name
+ */
+char *engineName(int engine) {
+	switch (engine) {
+		case ENGINE_URING: return "uring";
+		case ENGINE_SPLICE: return "splice";
+		default: return "select";
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Parses the i/o engine name given to the server
+ *
+ * @param Takes in the engine's name
+ *
+ * @return The engine or -1 if the name is unknown
+ */
+int parseEngine(char *name) {
+	if (!strcmp(name, "select")) {
+		return ENGINE_SELECT;
+	} else if (!strcmp(name, "uring")) {
+		return ENGINE_URING;
+	} else if (!strcmp(name, "splice")) {
+		return ENGINE_SPLICE;
+	}
+
+	return -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
@@ -0,0 +1,563 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdarg.h>		// variable arguments of the log calls
+#include <time.h>		// record timestamps
+#include <pthread.h>	// resetting the cached pid after a fork
+
+// verbosity levels
+#define LOG_ERROR 0		// something failed
+#define LOG_INFO 1		// rooms opening and closing, players coming and going
+#define LOG_DEBUG 2		// details of what the rooms do for their players
+
+#define LOG_RECORDS 4096	// records the ring holds (a power of two)
+#define LOG_DATA 88		// bytes of a record's arguments
+#define LOG_FLUSH_US 10000	// the writer's nap when the ring is empty
+#define LOG_STALL 100		// naps before the writer skips a record whose process died
+
+// struct holding one log record, a cache line pair of its own so that
+// processes writing neighbouring records don't slow each other down.
+// The message is not formatted by the process that logs it: the record
+// keeps the format and the raw arguments (numbers as 8 bytes, strings
+// copied) and the writer formats them. Every process is a fork of the
+// server, so the format's address is the same in all of them
+typedef struct {
+	unsigned long long seq;	// position + 1 once the record is written
+	long long ns;			// wall clock time in nanoseconds
+	const char *fmt;		// printf format of the message
+	pid_t pid;				// process that logged it
+	int level;				// its verbosity level
+	int len;				// bytes of data used
+	char data[LOG_DATA];	// the arguments
+} __attribute__((aligned(128))) LogRecord;
+
+// server wide log ring (shared memory). Any process appends records
+// without a lock or a syscall: it claims a position by moving the tail
+// forward and marks the record written through its sequence number. A
+// dedicated writer process drains the records in order to the log
+typedef struct {
+	unsigned long long tail __attribute__((aligned(64)));	// next free position
+	unsigned long long head __attribute__((aligned(64)));	// next record to write out
+	unsigned long long dropped __attribute__((aligned(64)));// records lost to a full ring
+	int level;	// records above this level are not logged
+
+	LogRecord records[LOG_RECORDS];
+}LogRing;
+
+// the ring every process logs to (inherited through fork)
+LogRing *logRing = NULL;
+
+// this process's pid, getpid() is a syscall
+pid_t logPid = 0;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Forgets the cached pid in a new child process
+ *
+ */
+void logForked() {
+	logPid = 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Creates the log ring in a shared memory segment, marked for
+ * deletion right away like the room table
+ *
+ * @param Takes in the verbosity level
+ *
+ * @return A pointer to the ring
+ */
+LogRing *openLogRing(int level) {
+	int id;			// segment id
+	LogRing *r;		// the attached ring
+	int i;			// for counter
+
+	if ((id = shmget(IPC_PRIVATE, sizeof(LogRing), IPC_CREAT | 0600)) < 0) {
+		perror("shmget error -> log ring");
+		exit(1);
+	}
+
+	if ((r = shmat(id, NULL, 0)) == (LogRing *)-1) {
+		perror("shmat error -> log ring");
+		exit(1);
+	}
+
+	shmctl(id, IPC_RMID, (struct shmid_ds *) NULL);
+
+	bzero(r, sizeof(LogRing));
+	r->level = level;
+
+	// every record is free for the first lap
+	for (i=0; i<LOG_RECORDS; ++i) {
+		r->records[i].seq = i;
+	}
+
+	pthread_atfork(NULL, NULL, logForked);
+
+	return r;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Finds the next conversion of a printf format
+ *
+ * @param Takes in the format, from where we look, and pointers for
+ * the conversion's start, its length modifier and its conversion char
+ *
+ * @return The position after the conversion or -1 if there is none
+ */
+int logNextSpec(const char *fmt, int i, int *start, int *lmod, char *conv) {
+	for (; fmt[i]; ++i) {
+		if (fmt[i] != '%') {
+			continue;
+		}
+
+		*start = i++;
+
+		if (fmt[i] == '%') {
+			continue;	// a literal percent sign
+		}
+
+		while (fmt[i] && strchr("-+ #0123456789.", fmt[i])) {
+			++i;
+		}
+
+		// counting l's, h's and z's: 1 for long/size_t, 2 for long long
+		*lmod = 0;
+
+		while (fmt[i] && strchr("hlzjt", fmt[i])) {
+			*lmod += (fmt[i] == 'l') ? 1 : ((fmt[i] == 'h') ? 0 : 1);
+			++i;
+		}
+
+		if ( (*conv = fmt[i]) == '\0' ) {
+			return -1;
+		}
+
+		return i + 1;
+	}
+
+	return -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Copies the arguments of a log call into a record's data:
+ * numbers as 8 bytes, strings with their terminating zero (cut short
+ * if they don't fit). Arguments that don't fit at all are left out
+ *
+ * @param Takes in the record's data, the format and the arguments
+ *
+ * @return The bytes used
+ */
+int logPack(char *data, const char *fmt, va_list ap) {
+	int len = 0;		// bytes used
+	int i = 0;			// position in the format
+	int start, lmod;	// current conversion
+	char conv;			// its conversion char
+	long long num;		// a number argument
+	double real;		// a floating point argument
+	char *str;			// a string argument
+	int n;				// bytes of the string
+
+	while ( (i = logNextSpec(fmt, i, &start, &lmod, &conv)) >= 0 ) {
+		if (conv == 's') {
+			str = va_arg(ap, char *);
+
+			if (str == NULL) {
+				str = "(null)";
+			}
+
+			if (len >= LOG_DATA) {
+				continue;
+			}
+
+			for (n = 0; str[n] && (len + n < LOG_DATA - 1); ++n) {
+				data[len + n] = str[n];
+			}
+
+			data[len + n] = '\0';
+			len += n + 1;
+
+			continue;
+		}
+
+		if (strchr("fgeGE", conv)) {
+			real = va_arg(ap, double);
+			memcpy(&num, &real, sizeof(num));
+		} else if (conv == 'p') {
+			num = (long long)(unsigned long)va_arg(ap, void *);
+		} else if (lmod >= 2) {
+			num = va_arg(ap, long long);
+		} else if (lmod == 1) {
+			num = (strchr("di", conv)) ? va_arg(ap, long) : (long long)va_arg(ap, unsigned long);
+		} else {
+			num = (strchr("di", conv)) ? va_arg(ap, int) : (long long)va_arg(ap, unsigned);
+		}
+
+		if (len + (int)sizeof(num) <= LOG_DATA) {
+			memcpy(data + len, &num, sizeof(num));
+			len += sizeof(num);
+		}
+	}
+
+	return len;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Writer side. Copies the text between two conversions of a
+ * format, where "%%" stands for a percent sign
+ *
+ * @param Takes in the output buffer, the chars written to it so far,
+ * its size, the text and its length
+ *
+ */
+void logCopyText(char *out, size_t *at, size_t size, const char *text, int len) {
+	int i;	// for counter
+
+	for (i=0; (i < len) && (*at < size - 1); ++i) {
+		out[(*at)++] = text[i];
+
+		if (text[i] == '%') {
+			++i;	// skipping the second one
+		}
+	}
+
+	out[*at] = '\0';
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Writer side. Formats a record's message out of its format and
+ * its arguments, one conversion at a time
+ *
+ * @param Takes in the record, a buffer and its size
+ *
+ */
+void logFormat(LogRecord *rec, char *out, size_t size) {
+	const char *fmt = rec->fmt;	// the format
+	char spec[LINE_LEN];		// one conversion, as a format of its own
+	int used = 0;				// bytes of the data read
+	int i = 0, last = 0;		// positions in the format
+	int start, lmod;			// current conversion
+	char conv;					// its conversion char
+	size_t at = 0;				// chars written
+	long long num;				// a number argument
+	double real;				// a floating point argument
+	int n;						// chars of a piece
+
+	#define LOG_PUT(...) do { \
+		n = snprintf(out + at, size - at, __VA_ARGS__); \
+		at = (n < 0) ? at : ((at + n < size) ? at + n : size - 1); \
+	} while (0)
+
+	out[0] = '\0';
+
+	while ( (i = logNextSpec(fmt, i, &start, &lmod, &conv)) >= 0 ) {
+		// the text up to the conversion
+		logCopyText(out, &at, size, fmt + last, start - last);
+		last = i;
+
+		if (i - start + 3 > (int)sizeof(spec)) {
+			continue;
+		}
+
+		// the conversion, with the length modifier of what we stored
+		n = 0;
+		while (!strchr("hlzjt", fmt[start + n]) && (start + n < i - 1)) {
+			spec[n] = fmt[start + n];
+			++n;
+		}
+
+		if (conv == 's') {
+			spec[n] = 's';
+			spec[n+1] = '\0';
+
+			if (used < rec->len) {
+				LOG_PUT(spec, rec->data + used);
+				used += strlen(rec->data + used) + 1;
+			}
+
+			continue;
+		}
+
+		if (used + (int)sizeof(num) > rec->len) {
+			continue;	// it didn't fit in the record
+		}
+
+		memcpy(&num, rec->data + used, sizeof(num));
+		used += sizeof(num);
+
+		if (strchr("fgeGE", conv)) {
+			spec[n] = conv;
+			spec[n+1] = '\0';
+			memcpy(&real, &num, sizeof(real));
+			LOG_PUT(spec, real);
+		} else if (conv == 'p') {
+			spec[n] = 'p';
+			spec[n+1] = '\0';
+			LOG_PUT(spec, (void *)(unsigned long)num);
+		} else if (conv == 'c') {
+			spec[n] = 'c';
+			spec[n+1] = '\0';
+			LOG_PUT(spec, (int)num);
+		} else {
+			spec[n] = 'l';
+			spec[n+1] = 'l';
+			spec[n+2] = conv;
+			spec[n+3] = '\0';
+			LOG_PUT(spec, num);
+		}
+	}
+
+	// the rest of the text
+	logCopyText(out, &at, size, fmt + last, strlen(fmt + last));
+
+	#undef LOG_PUT
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Logs a message. This never blocks: the arguments are copied
+ * straight into a record of the ring and the writer process formats
+ * them and does the i/o. If the ring is full the record is dropped and
+ * counted. Before the ring exists the message goes to stdout. Safe to
+ * call from signal handlers. The format has to be a string literal and
+ * may use the d i u x X o c s f g e p conversions with the h l ll z
+ * length modifiers
+ *
+ * @param Takes in the verbosity level, a printf format and its arguments
+ *
+ */
+void logMsg(int level, const char *fmt, ...) {
+	LogRing *r = logRing;		// the ring
+	LogRecord *rec;				// the record we claim
+	unsigned long long pos;		// its position
+	unsigned long long seq;		// its sequence number
+	struct timespec now;		// timestamp
+	va_list ap;					// the arguments
+
+	if (r == NULL) {
+		va_start(ap, fmt);
+		vprintf(fmt, ap);
+		va_end(ap);
+		printf("\n");
+
+		return;
+	}
+
+	if (level > r->level) {
+		return;
+	}
+
+	// claiming the next free record
+	pos = __atomic_load_n(&(r->tail), __ATOMIC_RELAXED);
+
+	for (;;) {
+		rec = &(r->records[pos & (LOG_RECORDS - 1)]);
+		seq = __atomic_load_n(&(rec->seq), __ATOMIC_ACQUIRE);
+
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&(r->tail), &pos, pos + 1, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (seq < pos) {
+			// the writer is a whole ring behind
+			__atomic_add_fetch(&(r->dropped), 1, __ATOMIC_RELAXED);
+			return;
+		} else {
+			pos = __atomic_load_n(&(r->tail), __ATOMIC_RELAXED);
+		}
+	}
+
+	if (logPid == 0) {
+		logPid = getpid();
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	rec->ns = now.tv_sec*1000000000LL + now.tv_nsec;
+	rec->fmt = fmt;
+	rec->pid = logPid;
+	rec->level = level;
+
+	va_start(ap, fmt);
+	rec->len = logPack(rec->data, fmt, ap);
+	va_end(ap);
+
+	// the writer may take it now, unless it gave up waiting for us
+	// (LOG_STALL) and passed the record on to the next lap
+	seq = pos;
+	if (!__atomic_compare_exchange_n(&(rec->seq), &seq, pos + 1, 0, __ATOMIC_RELEASE,
+		__ATOMIC_RELAXED)) {
+		__atomic_add_fetch(&(r->dropped), 1, __ATOMIC_RELAXED);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the name of a verbosity level
+ *
+ * @param Takes in the level
+ *
+ * @return The level's name
+ */
+char *logLevelName(int level) {
+	switch (level) {
+		case LOG_ERROR: return "error";
+		case LOG_DEBUG: return "debug";
+		default: return "info";
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Parses the verbosity level name given to the server
+ *
+ * @param Takes in the level's name
+ *
+ * @return The level or -1 if the name is unknown
+ */
+int parseLogLevel(char *name) {
+	if (!strcmp(name, "error")) {
+		return LOG_ERROR;
+	} else if (!strcmp(name, "info")) {
+		return LOG_INFO;
+	} else if (!strcmp(name, "debug")) {
+		return LOG_DEBUG;
+	}
+
+	return -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Writer side. Writes out the records that are ready, in order.
+ * A claimed record that never gets written (its process was killed in
+ * between) would stop the log, so after LOG_STALL calls without
+ * progress it is skipped. A process that was only slow finds out when it
+ * marks the record written, the record is then counted as dropped
+ *
+ * @param Takes in the ring, the log file and the calls without progress
+ * so far
+ *
+ * @return The number of records written out
+ */
+int drainLog(LogRing *r, FILE *out, int *stalled) {
+	unsigned long long pos;		// next record
+	unsigned long long seq;		// its sequence number
+	unsigned long long lost;	// records dropped meanwhile
+	LogRecord *rec;				// the record
+	struct tm tm;				// its time
+	time_t secs;				// its seconds
+	char stamp[LINE_LEN];		// its time as text
+	char text[pSize];			// its message
+	int n = 0;					// records written
+
+	for (;;) {
+		pos = r->head;
+		rec = &(r->records[pos & (LOG_RECORDS - 1)]);
+		seq = __atomic_load_n(&(rec->seq), __ATOMIC_ACQUIRE);
+
+		if (seq != pos + 1) {
+			if ( (seq != pos) || (__atomic_load_n(&(r->tail), __ATOMIC_RELAXED) == pos) ||
+				(++*stalled < LOG_STALL) ) {
+				break;	// nothing new, or its process is still writing it
+			}
+
+			// passing it on, unless its process got there just now
+			if (!__atomic_compare_exchange_n(&(rec->seq), &seq, pos + LOG_RECORDS, 0,
+				__ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+				continue;
+			}
+
+			fprintf(out, "(a log record was lost)\n");
+			*stalled = 0;
+			__atomic_store_n(&(r->head), pos + 1, __ATOMIC_RELAXED);
+
+			continue;
+		}
+
+		secs = rec->ns / 1000000000LL;
+		localtime_r(&secs, &tm);
+		strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+
+		logFormat(rec, text, sizeof(text));
+
+		fprintf(out, "%s.%06lld %6d %-5s %s\n", stamp, (rec->ns % 1000000000LL) / 1000,
+			rec->pid, logLevelName(rec->level), text);
+		++n;
+
+		*stalled = 0;
+
+		// the record is free for the next lap
+		__atomic_store_n(&(rec->seq), pos + LOG_RECORDS, __ATOMIC_RELEASE);
+		__atomic_store_n(&(r->head), pos + 1, __ATOMIC_RELAXED);
+	}
+
+	if ( (lost = __atomic_exchange_n(&(r->dropped), 0, __ATOMIC_RELAXED)) > 0 ) {
+		fprintf(out, "(%llu log records dropped, the log couldn't keep up)\n", lost);
+	}
+
+	if (n > 0 || lost > 0) {
+		fflush(out);
+	}
+
+	return n;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Forks the writer process, which drains the ring to the log
+ * file (stdout for "-") until the process that started it exits. It
+ * ignores SIGINT, so it writes out everything that process logged on
+ * its way out before it follows
+ *
+ * @param Takes in the ring and the log file's path
+ *
+ * @return The writer's pid
+ */
+pid_t startLogWriter(LogRing *r, char *path) {
+	pid_t parent = getpid();	// the process we log for
+	pid_t pid;					// the writer
+	FILE *out = stdout;			// the log
+	int stalled = 0;			// drains without progress
+
+	fflush(stdout);
+
+	if ( (pid = fork()) != 0 ) {
+		if (pid < 0) {
+			perror("Couldn't start the log writer");
+			exit(1);
+		}
+
+		return pid;
+	}
+
+	signal(SIGINT, SIG_IGN);
+
+	if ( strcmp(path, "-") && ((out = fopen(path, "a")) == NULL) ) {
+		perror("Couldn't open the log file");
+		exit(1);
+	}
+
+	for (;;) {
+		if (drainLog(r, out, &stalled) > 0) {
+			continue;
+		}
+
+		// one last drain after the server is gone
+		if (getppid() != parent) {
+			drainLog(r, out, &stalled);
+			exit(0);
+		}
+
+		usleep(LOG_FLUSH_US);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
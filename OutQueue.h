@@ -0,0 +1,243 @@
+#ifndef OUTQUEUE_H
+#define OUTQUEUE_H
+
+#include <sys/uio.h>	// batches of queued messages
+
+// what a room does when a player's queue is full
+#define OVERFLOW_DROP 0			// drop the oldest queued message
+#define OVERFLOW_COALESCE 1		// merge the message into the last queued one
+#define OVERFLOW_DISCONNECT 2	// kick the player
+
+#define FLUSH_BATCH 64	// queued messages sent with one syscall
+
+// struct holding the messages a slow player hasn't received yet
+typedef struct {
+	char (*frames)[pSize];	// ring of queued messages
+	int head;				// oldest queued message
+	int count;				// messages in the queue
+	int size;				// max messages in the queue
+	size_t sent;			// bytes of the oldest message already sent
+	int dropped;			// messages dropped since the player fell behind
+	int busy;				// oldest messages handed to the kernel (io_uring)
+	unsigned gen;			// changes when the queue is reset
+}OutQueue;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Allocates an empty queue for up to size messages
+ *
+ * @param Takes in a queue pointer and its size
+ *
+ */
+void initOutQueue(OutQueue *q, int size) {
+	q->head = 0;
+	q->count = 0;
+	q->size = size;
+	q->sent = 0;
+	q->dropped = 0;
+	q->busy = 0;
+	q->gen = 0;
+
+	q->frames = malloc(sizeof(*(q->frames))*size);
+
+	if (q->frames == NULL) {
+		perror("Allocation error -> out queue");
+		exit(1);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Empties a queue, used when its slot gets a new player. Sends
+ * still in flight for the old player are told apart by the generation
+ *
+ * @param Takes in a queue pointer
+ *
+ */
+void resetOutQueue(OutQueue *q) {
+	q->head = 0;
+	q->count = 0;
+	q->sent = 0;
+	q->dropped = 0;
+	q->busy = 0;
+	++q->gen;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Frees the heap allocated memory of a queue
+ *
+ * @param Takes in a queue pointer
+ *
+ */
+void freeOutQueue(OutQueue *q) {
+	free(q->frames);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Sends as much of the queue as the socket takes without
+ * blocking, up to FLUSH_BATCH messages per syscall. Messages always
+ * leave whole, so the player's framing stays intact even when a send
+ * stops half way
+ *
+ * @param Takes in a queue pointer and the player's socket
+ *
+ * @return 0 if the socket is fine or -1 if the player is gone
+ */
+int flushOutQueue(OutQueue *q, int fd) {
+	struct iovec iov[FLUSH_BATCH];	// queued messages, oldest first
+	struct msghdr msg;				// the batch
+	ssize_t n;						// bytes the socket took
+	int i;							// for counter
+
+	bzero(&msg, sizeof(msg));
+	msg.msg_iov = iov;
+
+	while (q->count > 0) {
+		msg.msg_iovlen = (q->count < FLUSH_BATCH) ? q->count : FLUSH_BATCH;
+
+		for (i=0; i<(int)msg.msg_iovlen; ++i) {
+			iov[i].iov_base = q->frames[(q->head + i) % q->size];
+			iov[i].iov_len = pSize;
+		}
+
+		iov[0].iov_base = (char *)iov[0].iov_base + q->sent;
+		iov[0].iov_len -= q->sent;
+
+		n = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				return 0;	// socket is full, we try again later
+			}
+
+			return -1;
+		}
+
+		// dropping the messages that left whole
+		n += q->sent;
+		q->head = (q->head + n / pSize) % q->size;
+		q->count -= n / pSize;
+		q->sent = n % pSize;
+
+		if (q->sent > 0) {
+			return 0;	// socket is full
+		}
+	}
+
+	q->dropped = 0;
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Queues a message for a player. If the queue is full the
+ * overflow policy decides what happens. Messages that are being sent
+ * (half sent, or handed to the kernel) are never touched
+ *
+ * @param Takes in a queue pointer, the message and the overflow policy
+ *
+ * @return 0 if the message was queued (or dropped) or -1 if the player
+ * has to be disconnected
+ */
+int pushOutQueue(OutQueue *q, char *msg, int policy) {
+	int tail;		// newest queued message
+	size_t used;	// length of the newest message
+	int locked;		// oldest messages that are being sent
+	int i;			// for counter
+
+	if (q->count == q->size) {
+		if (policy == OVERFLOW_DISCONNECT) {
+			return -1;
+		}
+
+		locked = q->busy;
+
+		if ( (locked == 0) && (q->sent > 0) ) {
+			locked = 1;
+		}
+
+		// merging the message with the newest one, if they fit
+		tail = (q->head + q->count - 1) % q->size;
+		used = strlen(q->frames[tail]);
+
+		if ( (policy == OVERFLOW_COALESCE) && (q->count > locked) &&
+			(used + 1 + strlen(msg) < FRAME_TEXT) ) {
+			q->frames[tail][used] = '\n';
+			strcpy(q->frames[tail] + used + 1, msg);
+
+			// the merged message carries the number of the newest one
+			memcpy(q->frames[tail] + FRAME_TEXT, msg + FRAME_TEXT, pSize - FRAME_TEXT);
+
+			return 0;
+		}
+
+		// dropping the oldest message that isn't being sent
+		++q->dropped;
+
+		if (q->count == locked) {
+			return 0;	// all of them are, the new one is dropped
+		}
+
+		if (locked == 0) {
+			q->head = (q->head + 1) % q->size;
+		} else {
+			// the messages being sent stay where they are, the
+			// newer ones move back to fill the gap
+			for (i=locked; i<q->count-1; ++i) {
+				memcpy(q->frames[(q->head + i) % q->size],
+					q->frames[(q->head + i + 1) % q->size], pSize);
+			}
+		}
+
+		--q->count;
+	}
+
+	tail = (q->head + q->count) % q->size;
+	memcpy(q->frames[tail], msg, pSize);
+	++q->count;
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the name of an overflow policy
+ *
+ * @param Takes in the policy
+ *
+ * @return The policy's name
+ */
+char *overflowPolicyName(int policy) {
+	switch (policy) {
+		case OVERFLOW_COALESCE: return "coalesce";
+		case OVERFLOW_DISCONNECT: return "disconnect";
+		default: return "drop";
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Parses the overflow policy name given to the server
+ *
+ * @param Takes in the policy's name
+ *
+ * @return The policy or -1 if the name is unknown
+ */
+int parseOverflowPolicy(char *name) {
+	if (!strcmp(name, "drop")) {
+		return OVERFLOW_DROP;
+	} else if (!strcmp(name, "coalesce")) {
+		return OVERFLOW_COALESCE;
+	} else if (!strcmp(name, "disconnect")) {
+		return OVERFLOW_DISCONNECT;
+	}
+
+	return -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
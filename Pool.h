@@ -0,0 +1,247 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <sched.h>		// sched_getcpu, to pick a shard
+
+#define POOL_MAX_SHARDS 16	// most counters an item is split into
+
+// struct holding part of an item's stock. Each one takes a cache line,
+// so rooms borrowing from different shards never share one
+typedef struct {
+	int stock;	// units left in this shard
+} __attribute__((aligned(64))) PoolShard;
+
+// struct holding the stock every room shares (global pool mode). Each
+// item is split into one counter per core, a room takes stock from the
+// shard of the core it runs on and only looks at the others when that
+// one is empty. Rooms borrow a batch at a time into their own
+// quantities, so joins only touch the pool when the room runs out, and
+// give back what they didn't hand out when they stop taking players.
+// Nothing is locked, and the units in the pool, in the rooms and with
+// the players always add up to the inventory
+typedef struct {
+	int items;		// items of the inventory
+	int shards;		// counters per item
+	int batch;		// units a room borrows at once
+
+	// items*shards counters, the shards of an item next to each other
+	PoolShard stock[];
+}Pool;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Creates the pool of an inventory, its stock spread evenly over
+ * the shards. The segment is marked for deletion right away, the rooms
+ * attach it through fork and it goes away with the last of them
+ *
+ * @param Takes in the inventory and the units a room borrows at once
+ *
+ * @return A pointer to the pool
+ */
+Pool *openPool(Inventory *inv, int batch) {
+	int shards = sysconf(_SC_NPROCESSORS_ONLN);	// one per core
+	int id;		// segment's id
+	Pool *p;	// the pool
+	int i, s;	// for counters
+
+	if (shards < 1) {
+		shards = 1;
+	} else if (shards > POOL_MAX_SHARDS) {
+		shards = POOL_MAX_SHARDS;
+	}
+
+	if ( (id = shmget(IPC_PRIVATE, sizeof(Pool) + sizeof(PoolShard)*inv->count*shards,
+		IPC_CREAT | 0600)) < 0 ) {
+		perror("shmget error -> pool");
+		exit(1);
+	}
+
+	if ( (p = shmat(id, NULL, 0)) == (void *)-1 ) {
+		perror("shmat error -> pool");
+		exit(1);
+	}
+
+	shmctl(id, IPC_RMID, NULL);
+
+	p->items = inv->count;
+	p->shards = shards;
+	p->batch = batch;
+
+	for (i=0; i<inv->count; ++i) {
+		for (s=0; s<shards; ++s) {
+			p->stock[i*shards + s].stock = inv->quantity[i] / shards +
+				(s < inv->quantity[i] % shards);
+		}
+	}
+
+	return p;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Takes up to the given units of an item out of the pool, from
+ * our core's shard first
+ *
+ * @param Takes in the pool, the item and the units we want
+ *
+ * @return The units we got
+ */
+int borrowStock(Pool *p, int item, int want) {
+	PoolShard *shards = &(p->stock[item*p->shards]);	// the item's counters
+	int first = sched_getcpu();	// our core's shard
+	int got = 0;				// units taken so far
+	int s, i;					// shard we look at
+	int have, take;				// units it has and we take
+
+	if (first < 0) {
+		first = getpid();
+	}
+
+	for (i=0; (i < p->shards) && (got < want); ++i) {
+		s = (first + i) % p->shards;
+		have = __atomic_load_n(&(shards[s].stock), __ATOMIC_RELAXED);
+
+		do {
+			if (have <= 0) {
+				break;
+			}
+
+			take = (have < want - got) ? have : want - got;
+		} while ( !__atomic_compare_exchange_n(&(shards[s].stock), &have, have - take,
+			0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) );
+
+		if (have > 0) {
+			got += take;
+		}
+	}
+
+	return got;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Gives units of an item back to the pool, to our core's shard
+ *
+ * @param Takes in the pool, the item and the units
+ *
+ */
+void returnStock(Pool *p, int item, int units) {
+	int s = sched_getcpu();	// our core's shard
+
+	if (s < 0) {
+		s = getpid();
+	}
+
+	__atomic_add_fetch(&(p->stock[item*p->shards + s % p->shards].stock), units,
+		__ATOMIC_RELEASE);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the units of an item left in the pool. While rooms
+ * borrow it is only a hint, the shards are read one by one
+ *
+ * @param Takes in the pool and the item
+ *
+ * @return The units
+ */
+int poolStock(Pool *p, int item) {
+	int units = 0;	// units so far
+	int s;			// for counter
+
+	for (s=0; s<p->shards; ++s) {
+		units += __atomic_load_n(&(p->stock[item*p->shards + s].stock), __ATOMIC_RELAXED);
+	}
+
+	return units;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Borrows what the room is missing for a player's
+ * request, a batch at a time, before the items are subtracted as
+ * usual. It runs without the semaphore, so the room's quantities are
+ * only a hint and the units go to lent until addLent puts them in the
+ * room. Requests that can never be served don't borrow anything
+ *
+ * @param Takes in the pool, the room's inventory, the player's
+ * inventory, the room's quantities, the max quota and the units
+ * borrowed per item of the room
+ *
+ * @return The units borrowed or -1 if the request can never be served
+ */
+int topUpRoom(Pool *p, Inventory *room, Inventory player, int *qData, int quota, int *lent) {
+	int pos = -1;	// position of the item in the room
+	int need;		// units the room is missing
+	int units = 0;	// units borrowed
+	int i;			// for counter
+
+	memset(lent, 0, sizeof(int)*room->count);
+
+	if (player.quota > quota) {
+		return -1;
+	}
+
+	for (i=0; i<player.count; ++i) {
+		if ( !findItem(*room, player.items[i], &pos) ) {
+			return -1;
+		}
+	}
+
+	for (i=0; i<player.count; ++i) {
+		findItem(*room, player.items[i], &pos);
+
+		if ( (need = player.quantity[i] - __atomic_load_n(&(qData[pos]), __ATOMIC_RELAXED)) > 0 ) {
+			lent[pos] += borrowStock(p, pos, (need > p->batch) ? need : p->batch);
+			units += lent[pos];
+		}
+	}
+
+	return units;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Adds the units topUpRoom borrowed to the room's
+ * quantities. Must be called while holding the semaphore
+ *
+ * @param Takes in the pool, the units borrowed per item and the room's
+ * quantities
+ *
+ */
+void addLent(Pool *p, int *lent, int *qData) {
+	int i;	// for counter
+
+	for (i=0; i<p->items; ++i) {
+		qData[i] += lent[i];
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Gives everything the room didn't hand out back to
+ * the pool, once it takes no more players. Must be called while holding
+ * the semaphore
+ *
+ * @param Takes in the pool and the room's quantities
+ *
+ * @return The units given back
+ */
+int returnRoomStock(Pool *p, int *qData) {
+	int units = 0;	// units given back
+	int i;			// for counter
+
+	for (i=0; i<p->items; ++i) {
+		if (qData[i] > 0) {
+			returnStock(p, i, qData[i]);
+			units += qData[i];
+			qData[i] = 0;
+		}
+	}
+
+	return units;
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#define LIMIT_DELAY 0	// a flooding player's messages wait for their turn
+#define LIMIT_DROP 1	// they are thrown away
+
+// struct holding a player's message allowance (token bucket). It fills
+// up at rate tokens per second up to burst and every message takes one,
+// so a player can send burst messages at once and rate per second after
+typedef struct {
+	float tokens;	// messages the player may send right now
+	float rate;		// tokens added per second
+	float burst;	// most tokens the bucket holds
+	int policy;		// what happens to messages over the allowance
+	double last;	// last time the bucket was filled up
+}TokenBucket;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Prepares a full bucket
+ *
+ * @param Takes in a bucket pointer, the messages per second, the burst,
+ * the policy and the current time
+ *
+ */
+void initBucket(TokenBucket *b, double rate, int burst, int policy, double now) {
+	b->rate = rate;
+	b->burst = burst;
+	b->tokens = b->burst;
+	b->policy = policy;
+	b->last = now;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Takes a token for a message, filling the bucket up for the
+ * time that went by first
+ *
+ * @param Takes in a bucket pointer and the current time
+ *
+ * @return 0 if the message may go or the seconds until it may
+ */
+double takeToken(TokenBucket *b, double now) {
+	b->tokens += (now - b->last) * b->rate;
+	b->last = now;
+
+	if (b->tokens > b->burst) {
+		b->tokens = b->burst;
+	}
+
+	if (b->tokens >= 1) {
+		b->tokens -= 1;
+		return 0;
+	}
+
+	return (1 - b->tokens) / b->rate;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the name of a rate limit policy
+ *
+ * @param Takes in the policy
+ *
+ * @return The policy's name
+ */
+char *limitPolicyName(int policy) {
+	return (policy == LIMIT_DROP) ? "drop" : "delay";
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Parses the rate limit policy name given to the server
+ *
+ * @param Takes in the policy's name
+ *
+ * @return The policy or -1 if the name is unknown
+ */
+int parseLimitPolicy(char *name) {
+	if (!strcmp(name, "delay")) {
+		return LIMIT_DELAY;
+	} else if (!strcmp(name, "drop")) {
+		return LIMIT_DROP;
+	}
+
+	return -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
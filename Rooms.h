@@ -0,0 +1,662 @@
+#ifndef ROOMS_H
+#define ROOMS_H
+
+#include <sys/random.h>	// resumption token secrets
+#include <stddef.h>		// offsetof, for the relay header
+#include <sys/prctl.h>	// the main server adopts rooms that moved
+
+// defining the room table limits
+#define MAX_ROOMS 256	// rooms that can be listed at the same time
+
+// room states as seen in the room table
+#define ROOM_FREE 0			// unused table entry
+#define ROOM_FILLING 1		// room is still accepting players
+#define ROOM_RUNNING 2		// game in progress
+#define ROOM_MIGRATING 3	// room is moving its players to another room
+#define ROOM_MOVING 4		// room is moving to a new process (sigusr1)
+
+// migrating players come with their whole slot, players that resume
+// only with the slot they want back (and pid set to this)
+#define MIGRATE_RESUME -1
+
+// struct holding one player of a room (kept in the room's segment)
+typedef struct {
+	int connfd;				// player's socket (-1 if the slot is free)
+	pid_t pid;				// process serving the player (0 while pending)
+	char name[LINE_LEN];	// player's name
+	char request[pSize];	// items reserved for the player
+	unsigned long long token;	// secret of his resumption token (0 = none)
+	int detached;			// lost his connection, the seat waits for him
+	int draining;			// the room or its process moves, his process stops after its message
+	unsigned long seen;		// last message he got before that (history)
+}PlayerSlot;
+
+// struct describing a room in the server wide room table
+typedef struct {
+	pid_t pid;		// room process
+	int state;		// one of the ROOM_* states
+	int count;		// players in the room, including incoming ones
+	int incoming;	// players that are migrating into the room
+	int catalog;	// version of the inventory the room opened with
+	pid_t origin;	// pid the room opened with, its helpers go by it
+}RoomEntry;
+
+// server wide room table (shared memory)
+typedef struct {
+	// arrival statistics used for the fill deadline
+	double lastArrival;	// time of the last connection we accepted
+	double arrivalGap;	// average seconds between two connections
+
+	// node the room directory suggests for the players we can't take
+	// ("" = none)
+	char nextNode[LINE_LEN*4];
+
+	RoomEntry rooms[MAX_ROOMS];
+}RoomTable;
+
+// room events, passed instead of the sender's socket
+#define RELAY_WAKEUP -1						// a player left, check the slots (to = ROUTE_SLOT
+											// of a player process that stopped for a merge)
+#define RELAY_HISTORY(fd) (-2 - (fd))		// the player on fd asks for the history
+#define RELAY_HISTORY_FD(sender) (-2 - (sender))
+
+// where a message goes, passed along with it
+#define ROUTE_ALL 0								// everyone but the sender
+#define ROUTE_SLOT(slot) (1 + (slot))			// a single player
+#define ROUTE_SLOT_OF(to) ((to) - 1)
+#define ROUTE_CHANNEL(ch) (-1 - (ch))			// the players on a channel
+#define ROUTE_CHANNEL_OF(to) (-1 - (to))
+
+// struct passed through the pipe between the players and their room
+typedef struct {
+	int sender;			// sender's socket (negative for room events)
+	int to;				// recipients, one of the ROUTE_* values
+	char text[pSize];	// the message
+}RelayMsg;
+
+// bytes before the text, the zero-copy fan-out only reads these
+#define RELAY_HEADER offsetof(RelayMsg, text)
+
+#define MAX_CHANNELS 16	// channels a room can have at the same time
+
+// struct describing a channel of a room (kept in the room's segment).
+// Its subscribers are a bitmap of player slots, next to the channels
+typedef struct {
+	char name[LINE_LEN];	// channel's name ("" if unused)
+	int members;			// players subscribed to it
+}Channel;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Creates the room table in a shared memory segment. The segment
+ * is marked for deletion right away, so it disappears with the last
+ * process attached to it, even if the server crashes. It has no key,
+ * other servers on the host (nodes, or the one we replaced) keep theirs
+ *
+ * @return A pointer to the table
+ */
+RoomTable *openRoomTable() {
+	int id;				// segment id
+	RoomTable *table;	// the attached table
+
+	if ((id = shmget(IPC_PRIVATE, sizeof(RoomTable), IPC_CREAT | 0600)) < 0) {
+		perror("shmget error -> room table");
+		exit(1);
+	}
+
+	if ((table = shmat(id, NULL, 0)) == (RoomTable *)-1) {
+		perror("shmat error -> room table");
+		exit(1);
+	}
+
+	// forked rooms inherit the attachment, nobody else needs it
+	shmctl(id, IPC_RMID, (struct shmid_ds *) NULL);
+
+	bzero(table, sizeof(RoomTable));
+
+	return table;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Lists a room in the table. Must be called while holding the
+ * room semaphore
+ *
+ * @param Takes in the table, the room's pid and the version of the
+ * inventory it opened with
+ *
+ * @return The room's index in the table or -1 if the table is full
+ */
+int registerRoom(RoomTable *table, pid_t pid, int catalog) {
+	RoomEntry *rooms = table->rooms;	// the table's entries
+	int i;	// for counter
+
+	for (i=0; i<MAX_ROOMS; ++i) {
+		if (rooms[i].state == ROOM_FREE) {
+			rooms[i].pid = pid;
+			rooms[i].state = ROOM_FILLING;
+			rooms[i].count = 0;
+			rooms[i].incoming = 0;
+			rooms[i].catalog = catalog;
+			rooms[i].origin = pid;
+
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the pid a room opened with, the one its transcript and
+ * spectator relay go by, even after the room moved to another process.
+ * Must be called while holding the room semaphore
+ *
+ * @param Takes in the table and the room's current pid
+ *
+ * @return The pid it opened with (the one given if it isn't listed)
+ */
+pid_t roomOrigin(RoomTable *table, pid_t pid) {
+	int i;	// for counter
+
+	for (i=0; i<MAX_ROOMS; ++i) {
+		if ( (table->rooms[i].state != ROOM_FREE) && (table->rooms[i].pid == pid) ) {
+			return table->rooms[i].origin;
+		}
+	}
+
+	return pid;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Finds the room that is filling up, the one that accepts the
+ * players. Must be called while holding the room semaphore
+ *
+ * @param Takes in the table
+ *
+ * @return Its pid or 0 if no room is filling up
+ */
+pid_t fillingRoom(RoomTable *table) {
+	int i;	// for counter
+
+	for (i=0; i<MAX_ROOMS; ++i) {
+		if (table->rooms[i].state == ROOM_FILLING) {
+			return table->rooms[i].pid;
+		}
+	}
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Counts the rooms that are still open. A room that died
+ * without clearing its entry doesn't count
+ *
+ * @param Takes in the table
+ *
+ * @return The number of rooms
+ */
+int roomsLeft(RoomTable *table) {
+	int rooms = 0;	// rooms so far
+	int i;			// for counter
+
+	for (i=0; i<MAX_ROOMS; ++i) {
+		if ( (table->rooms[i].state != ROOM_FREE) && (kill(table->rooms[i].pid, 0) == 0) ) {
+			++rooms;
+		}
+	}
+
+	return rooms;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Counts the players of the node, in all its rooms, including
+ * the ones that are moving between rooms. Must be called while holding
+ * the room semaphore
+ *
+ * @param Takes in the table
+ *
+ * @return The number of players
+ */
+int roomPlayers(RoomTable *table) {
+	int players = 0;	// players so far
+	int i;				// for counter
+
+	for (i=0; i<MAX_ROOMS; ++i) {
+		if (table->rooms[i].state != ROOM_FREE) {
+			players += table->rooms[i].count;
+		}
+	}
+
+	return players;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Looks for a running room that can take all the players of the
+ * given room and opened with the same inventory. The fullest room that
+ * still fits is preferred, so sparse rooms end up merged into few rooms.
+ * Must be called while holding the room semaphore
+ *
+ * @param Takes in the table, the index of the sparse room and the max
+ * number of players per room
+ *
+ * @return The index of the target room or -1 if no room fits
+ */
+int findMergeTarget(RoomTable *table, int me, int players) {
+	RoomEntry *rooms = table->rooms;	// the table's entries
+	int i;			// for counter
+	int best = -1;	// best target so far
+
+	for (i=0; i<MAX_ROOMS; ++i) {
+		if ( (i == me) || (rooms[i].state != ROOM_RUNNING) ) {
+			continue;
+		}
+
+		if (rooms[i].count + rooms[me].count > players) {
+			continue;	// not enough space
+		}
+
+		if (rooms[i].catalog != rooms[me].catalog) {
+			continue;	// the items are counted differently there
+		}
+
+		if ( (best < 0) || (rooms[i].count > rooms[best].count) ) {
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Records a new connection in the arrival statistics. Must be
+ * called while holding the room semaphore
+ *
+ * @param Takes in the table and the current (monotonic) time
+ *
+ */
+void noteArrival(RoomTable *table, double now) {
+	double gap = now - table->lastArrival;	// time since the last one
+
+	// exponential moving average, recent arrivals weigh more
+	if (table->lastArrival == 0) {
+		// first connection ever, nothing to compare with
+	} else if (table->arrivalGap == 0) {
+		table->arrivalGap = gap;
+	} else {
+		table->arrivalGap = 0.8*table->arrivalGap + 0.2*gap;
+	}
+
+	table->lastArrival = now;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Computes when a room that is still filling should start with
+ * the players it has. No room waits longer than maxWait after its first
+ * player arrived, and when players arrive slowly there is no point in
+ * waiting that long: if the next player is late compared to the usual
+ * gap between arrivals, the room starts right away
+ *
+ * @param Takes in the table, the time of the room's first and last
+ * arrivals and the maximum wait in seconds
+ *
+ * @return The (monotonic) time the room should start
+ */
+double fillDeadline(RoomTable *table, double first, double last, int maxWait) {
+	double deadline = first + maxWait;	// hard limit
+	double patience;					// how long we wait for the next one
+
+	if (table->arrivalGap > 0) {
+		// waiting for about two usual gaps, but at least a second
+		patience = 2*table->arrivalGap;
+
+		if (patience < 1) {
+			patience = 1;
+		}
+
+		if (last + patience < deadline) {
+			deadline = last + patience;
+		}
+	}
+
+	return deadline;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Fills in the address a room receives migrating players on.
+ * We use the abstract namespace so no file is left behind
+ *
+ * @param Takes in the room's pid and the address struct
+ *
+ * @return The length of the address
+ */
+socklen_t roomAddress(pid_t pid, struct sockaddr_un *addr) {
+	bzero(addr, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	// first byte stays zero (abstract namespace)
+	snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "room%d.%d", PORT_NO, pid);
+
+	return sizeof(sa_family_t) + 1 + strlen(addr->sun_path + 1);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Picks the secret of a resumption token. Tokens are printed
+ * with 12 hex digits, so the secret has 48 random bits
+ *
+ * @return The secret (never 0)
+ */
+unsigned long long newToken() {
+	unsigned long long token = 0;	// the secret
+
+	while (token == 0) {
+		if (getrandom(&token, sizeof(token), 0) != sizeof(token)) {
+			token = ((unsigned long long)rand() << 24) ^ rand();
+		}
+
+		token &= 0xffffffffffffULL;
+	}
+
+	return token;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Writes a resumption token. It names the room and the slot, so
+ * whichever room accepts the reconnection knows where to send it
+ *
+ * @param Takes in a buffer and its size, the room's pid, the slot and
+ * the secret
+ *
+ */
+void formatToken(char *buf, size_t len, pid_t room, int slot, unsigned long long token) {
+	snprintf(buf, len, "%d.%d.%012llx", room, slot, token);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Reads a resumption token
+ *
+ * @param Takes in the token's text and where to store the room's pid,
+ * the slot and the secret
+ *
+ * @return 0 on success or -1 if the token is malformed
+ */
+int parseToken(char *str, pid_t *room, int *slot, unsigned long long *token) {
+	if (sscanf(str, "%d.%d.%llx", room, slot, token) != 3) {
+		return -1;
+	}
+
+	return (*room > 0 && *slot >= 0 && *token != 0) ? 0 : -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Writes the response of an accepted player, with his resumption
+ * token if his seat is kept for him
+ *
+ * @param Takes in the response buffer (LINE_LEN chars), the room's pid,
+ * the slot and the secret (0 if the seat isn't kept)
+ *
+ */
+void joinResponse(char *response, pid_t room, int slot, unsigned long long token) {
+	char str[LINE_LEN-4];	// the token
+
+	if (token == 0) {
+		strcpy(response, "OK\n");
+		return;
+	}
+
+	formatToken(str, sizeof(str), room, slot, token);
+	snprintf(response, LINE_LEN, "OK %s\n", str);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the 64 bit words a subscriber bitmap takes
+ *
+ * @param Takes in the number of player slots
+ *
+ * @return The number of words
+ */
+int channelWords(int slots) {
+	return (slots + 63) / 64;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Looks a channel up by name. Must be called while holding the
+ * semaphore
+ *
+ * @param Takes in the room's channels and the name
+ *
+ * @return The channel or -1 if there is no such channel
+ */
+int findChannel(Channel *chans, char *name) {
+	int i;	// for counter
+
+	for (i=0; i<MAX_CHANNELS; ++i) {
+		if ( chans[i].name[0] && !strcmp(chans[i].name, name) ) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Tells whether a player is subscribed to a channel
+ *
+ * @param Takes in the subscriber bitmaps, the words per bitmap, the
+ * channel and the player's slot
+ *
+ * @return 1 if he is, 0 otherwise
+ */
+int onChannel(unsigned long long *bits, int words, int ch, int slot) {
+	unsigned long long word = __atomic_load_n(&(bits[ch*words + slot/64]), __ATOMIC_RELAXED);
+
+	return (word >> (slot % 64)) & 1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Subscribes a player to a channel, opening it if it doesn't
+ * exist. Must be called while holding the semaphore, the room reads the
+ * bitmaps without it, so bits change atomically
+ *
+ * @param Takes in the room's channels, the subscriber bitmaps, the words
+ * per bitmap, the channel's name and the player's slot
+ *
+ * @return The channel or -1 if the room has no channel left
+ */
+int joinChannel(Channel *chans, unsigned long long *bits, int words, char *name, int slot) {
+	int ch = findChannel(chans, name);	// the channel
+	int i;								// for counter
+
+	for (i=0; (ch < 0) && (i < MAX_CHANNELS); ++i) {
+		if (chans[i].name[0] == '\0') {
+			strncpy(chans[i].name, name, LINE_LEN-1);
+			chans[i].name[LINE_LEN-1] = '\0';
+			chans[i].members = 0;
+			ch = i;
+		}
+	}
+
+	if ( (ch >= 0) && !onChannel(bits, words, ch, slot) ) {
+		__atomic_fetch_or(&(bits[ch*words + slot/64]), 1ULL << (slot % 64), __ATOMIC_RELEASE);
+		++(chans[ch].members);
+	}
+
+	return ch;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Unsubscribes a player from a channel, closing it when nobody is
+ * left. Must be called while holding the semaphore
+ *
+ * @param Takes in the room's channels, the subscriber bitmaps, the words
+ * per bitmap, the channel and the player's slot
+ *
+ */
+void leaveChannel(Channel *chans, unsigned long long *bits, int words, int ch, int slot) {
+	if (!onChannel(bits, words, ch, slot)) {
+		return;
+	}
+
+	__atomic_fetch_and(&(bits[ch*words + slot/64]), ~(1ULL << (slot % 64)), __ATOMIC_RELEASE);
+
+	if (--(chans[ch].members) == 0) {
+		chans[ch].name[0] = '\0';
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Tells whether a message is one of the commands routeCommand
+ * handles, without the semaphore
+ *
+ * @param Takes in the raw message
+ *
+ * @return 1 if it is, 0 otherwise
+ */
+int routedCommand(char *raw) {
+	return !strncmp(raw, "WHISPER ", 8) || !strncmp(raw, "CHANNEL ", 8) ||
+		!strncmp(raw, "JOIN ", 5) || !strncmp(raw, "LEAVE ", 6);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Routes the commands that don't go to the whole room: "WHISPER
+ * <player> <text>" goes to one player, "CHANNEL <channel> <text>" to the
+ * players on a channel, and "JOIN <channel>" and "LEAVE <channel>"
+ * change the player's channels and are answered with a notice to him,
+ * as is a command we can't make sense of. Must be called while holding
+ * the semaphore
+ *
+ * @param Takes in the room's channels, the subscriber bitmaps, the words
+ * per bitmap, a function that finds a player's slot by his name and what
+ * it is passed, the player's slot, his name, the raw message, a buffer
+ * for the text (pSize chars) and where to store the route and the text
+ * the other players read (NULL for a notice)
+ *
+ * @return 1 if it was one of these commands, 0 otherwise
+ */
+int routeCommand(Channel *chans, unsigned long long *bits, int words,
+	int (*player)(char *name, void *ctx), void *ctx, int slot, char *name, char *raw,
+	char *text, int *to, char **body) {
+	char word[LINE_LEN];	// the player or channel the command names
+	int at = 0;				// where the text begins
+	int ch;					// the channel or the player
+
+	if (!routedCommand(raw)) {
+		return 0;
+	}
+
+	// notices go back to the player, they carry no number
+	*to = ROUTE_SLOT(slot);
+	*body = NULL;
+	bzero(text, pSize);
+
+	if ( (sscanf(raw, "WHISPER %31s %n", word, &at) == 1) && (at > 0) ) {
+		if ( (ch = player(word, ctx)) >= 0 ) {
+			*to = ROUTE_SLOT(ch);
+			*body = raw + at;
+			snprintf(text, FRAME_TEXT, "[%s whispers]: %s", name, raw + at);
+		} else {
+			snprintf(text, FRAME_TEXT, "No player named %s in the room", word);
+		}
+	} else if ( (sscanf(raw, "CHANNEL %31s %n", word, &at) == 1) && (at > 0) ) {
+		ch = findChannel(chans, word);
+
+		if ( (ch >= 0) && onChannel(bits, words, ch, slot) ) {
+			*to = ROUTE_CHANNEL(ch);
+			*body = raw + at;
+			snprintf(text, FRAME_TEXT, "[%s @%s]: %s", name, word, raw + at);
+		} else {
+			snprintf(text, FRAME_TEXT, "You are not on channel %s", word);
+		}
+	} else if (sscanf(raw, "JOIN %31s", word) == 1) {
+		if ( (ch = joinChannel(chans, bits, words, word, slot)) >= 0 ) {
+			snprintf(text, FRAME_TEXT, "Joined channel %s (%d players)", word, chans[ch].members);
+		} else {
+			snprintf(text, FRAME_TEXT, "The room has no channel left for %s", word);
+		}
+	} else if (sscanf(raw, "LEAVE %31s", word) == 1) {
+		if ( (ch = findChannel(chans, word)) >= 0 ) {
+			leaveChannel(chans, bits, words, ch, slot);
+		}
+
+		snprintf(text, FRAME_TEXT, "Left channel %s", word);
+	} else {
+		snprintf(text, FRAME_TEXT, "Usage: WHISPER <player> <text>, CHANNEL "
+			"<channel> <text>, JOIN <channel> or LEAVE <channel>");
+	}
+
+	return 1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Collects the slots a message goes to. Broadcasts go through
+ * every slot, channel messages only through the set bits of the
+ * channel's bitmap and whispers straight to their slot, so the cost
+ * follows the recipients and not the size of the room
+ *
+ * @param Takes in the room's socket array, the number of slots, the
+ * subscriber bitmaps, the words per bitmap, the sender's socket, the
+ * route and an array for the slots (slots entries)
+ *
+ * @return The number of recipients
+ */
+int recipients(int *sockArray, int slots, unsigned long long *bits, int words,
+	int sender, int to, int *out) {
+	unsigned long long word;	// part of a channel's bitmap
+	int n = 0;					// recipients found
+	int i, w;					// for counters
+
+	if (to == ROUTE_ALL) {
+		for (i=0; i<slots; ++i) {
+			if ( (sockArray[i] >= 0) && (sockArray[i] != sender) ) {
+				out[n++] = i;
+			}
+		}
+	} else if (to > 0) {
+		i = ROUTE_SLOT_OF(to);
+
+		if ( (i < slots) && (sockArray[i] >= 0) ) {
+			out[n++] = i;
+		}
+	} else if (ROUTE_CHANNEL_OF(to) < MAX_CHANNELS) {
+		bits += ROUTE_CHANNEL_OF(to) * words;
+
+		for (w=0; w<words; ++w) {
+			word = __atomic_load_n(&(bits[w]), __ATOMIC_ACQUIRE);
+
+			while (word) {
+				i = w*64 + __builtin_ctzll(word);
+				word &= word - 1;
+
+				if ( (i < slots) && (sockArray[i] >= 0) && (sockArray[i] != sender) ) {
+					out[n++] = i;
+				}
+			}
+		}
+	}
+
+	return n;
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
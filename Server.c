@@ -12,29 +12,86 @@
  */
 
 #include "Inventory.h"
+#include <netinet/tcp.h>	// TCP_DEFER_ACCEPT
+#include "Waitlist.h"		// players waiting for a room with enough items
+#include "OutQueue.h"		// outbound queues for slow players
+#include "IoRing.h"			// io_uring engine for the rooms
+#include "ZeroCopy.h"		// zero-copy fan-out with tee and splice
+#include "History.h"		// the last messages of each room
+#include "Log.h"			// asynchronous logging
+#include "Transcript.h"		// the rooms' chat, on disk
+#include "RateLimit.h"		// players' message allowance
+#include "Filter.h"			// banned words
+#include "Pool.h"			// stock shared by all the rooms
+#include "Availability.h"	// what the filling room has left, lock free
+#include "Trade.h"			// item trades between the players of a room
 #include "ServerBackend.h"	// server backend, which handles the game
+#include "Directory.h"		// room directory shared by the nodes
+#include "Rooms.h"			// room table and player slots
+#include "Spectators.h"		// read-only fan-out to spectators
+#include "Trace.h"			// latency stamps of traced messages
 
 
 	/*- ---- Global Variables & Defining ---- -*/ 
 #define LISTENQ 150		// size for the queue
-#define SHM_KEY 5623	// key for the shared memory segment
 #define WAIT 60			// wait time for the server until connection expires
 #define MYERRCODE -5623 // used as error code, funny because it's my student id
+#define UPGRADE_WAIT 10	// seconds a new binary has to start accepting
+#define CHAT_MOVED 2	// chat's result when the room moves the player
+#define RESERVE_TRIES 3	// times a join borrows from the pool for its items
+#define CATALOG_CHUNK 65536	// bytes of a reloaded inventory we read at a time
 
 sem_t *my_sem = NULL;		// declaring a semaphore variable
-int roomsOpened = 0; 		// room counter
 int shmid = MYERRCODE;		// id of the current room's shared memory segment
 pid_t pprocID = MYERRCODE;	// main process's id 
 pid_t rprocID = MYERRCODE;	// only game rooms should store their pid here
+
+RoomTable *roomTable = NULL;	// server wide list of rooms (shared memory)
+int roomIndex = -1;				// this room's entry in the room table
+PlayerSlot *plSlots = NULL;		// this room's players (shared memory)
+int slotCount = 0;				// number of player slots in the room
+int migSock = -1;				// this room's socket for migrating players
+OutQueue *outQueues = NULL;		// messages waiting for slow players
+IoRing *ioRing = NULL;			// this room's ring (NULL with the select engine)
+SpliceQueue *spliceQueues = NULL;	// player pipes of the zero-copy fan-out
+int devNull = -1;				// where the zero-copy fan-out throws bytes away
+char *unixPath = NULL;			// Unix domain socket the main server removes
+History *history = NULL;		// this room's last messages (shared memory)
+int transcriptSock = -1;		// this room's transcript writer (-1 = none)
+Channel *channels = NULL;		// this room's channels (shared memory)
+unsigned long long *chanBits = NULL;	// their subscribers, a bitmap each
+int chanWords = 0;				// words of a subscriber bitmap
+int *targets = NULL;			// recipients of the message being relayed
+FilterCtl *filterCtl = NULL;	// current banned word list (NULL = no filter)
+Filter *filter = NULL;			// the list this process has attached
+int filterGen = 0;				// its generation
+volatile sig_atomic_t reload = 0;	// the main server was asked to reload
+Availability *avail = NULL;		// what the filling room has left (shared memory)
+TradeOffer *offers = NULL;		// this room's trade offers (shared memory)
+int *holdings = NULL;			// the items its players hold, per slot (shared memory)
+Inventory *roomInv = NULL;		// this room's inventory
+volatile sig_atomic_t handoff = 0;		// the room was asked to move (sigusr1)
+volatile sig_atomic_t handoffCpu = -1;	// core it moves to (-1 = any)
+int moving = 0;			// the room waits for its player processes to move
+int moveCpu = -1;		// core it moves to then
+double moveStart = 0;	// when it stopped them
+volatile sig_atomic_t upgrade = 0;		// a new binary takes over (sigusr2)
+sigset_t openMask;				// signals the main server's children let in
+int mergeTarget = -1;			// room our players move to, once their processes stopped
+int mergeCount = 0;				// players we reserved space for there
+char **serverArgv = NULL;		// our command line, the new binary runs it again
 	/*- ---- Global Variables & Defining ---- -*/ 
 
 	/*- ------- Function declarations ------- -*/ 
 void catch_sig(int signo);		// signal handler for zombie processes
 void catch_int(int signo);		// terminating the server
 void catch_alarm(int signo);	// alarm handling
+void catch_hup(int signo);		// reloading the banned words
+void catch_usr1(int signo, siginfo_t *info, void *context);	// moving a room
+void catch_usr2(int signo);		// upgrading the binary
 
 // initializes the server struct (ports, etc)
-void initServer(int *listenfd, struct sockaddr_in *servaddr);	
+void initServer(ServerVars *sv);	
 
 // gets the main server going	
 void serverUp(ServerVars *sv);
@@ -42,22 +99,130 @@ void serverUp(ServerVars *sv);
 // opens a smaller server acting as the game room
 void openGameRoom(int *fd, ServerVars *sv);
 
+// waits for the next player of a room
+int acceptPlayer(ServerVars *sv, struct timeval *timeout);
+
+// closes the listening sockets in processes that don't accept
+void closeListeners(ServerVars *sv);
+
+// hands the listening sockets to a new binary and lets the rooms finish
+void upgradeServer(ServerVars *sv);
+void upgradeDone(ServerVars *sv, int started);
+int adoptListeners(ServerVars *sv);
+void stopAccepting(ServerVars *sv, int *qData, int *fd, int *plPipe);
+void closeRoom(ServerVars *sv, int *qData, char *why);
+
 // opens another server that handles his player's requests
-void servePlayer(int connfd, int *qData, ServerVars *sv, char **name,
+void servePlayer(int connfd, int slot, int *qData, ServerVars *sv, char **name,
 	int *fullFlag, int full);
 
+// connects a served player to the chat and cleans up after he leaves
+void playerSession(int connfd, int slot, int *plPipe, char *name, int *qData, 
+	ServerVars *sv, char *greeting);
+void freeSlot(ServerVars *sv, int *qData, int slot);
+
+// tells the room whether the last player it waited for took his seat
+void confirmFull(int *qData, ServerVars *sv, int *fullFlag, int full);
+
+// players that lost their connection and come back with their token
+int resumeRequest(int connfd, int slot, char *request, char **name);
+void watchRequest(int connfd, int slot, char *request);
+int availAnswer(ServerVars *sv, char *request, char **text);
+void availRequest(int connfd, int slot, ServerVars *sv, char *request);
+int quickAvail(int connfd, ServerVars *sv);
+void showAvailability(ServerVars *sv, int *qData, pid_t room, int opened);
+void resumeSlot(ServerVars *sv, int *qData, int *sockArray, int *plPipe, 
+	int connfd, PlayerSlot *pl);
+void tokenResponse(pid_t room, int slot, char *response);
+void newRoomToken(int connfd, int slot, unsigned long long secret);
+
+// sends players the messages they missed from the room's history
+void catchUp(ServerVars *sv, int *sockArray, int slot, unsigned long long since);
+void historyRequest(ServerVars *sv, int *sockArray, int sender, char *text);
+
+// keeps the player counter and the room table in sync
+void updateCount(int *qData, int plCountPos, int delta);
+
+// player slot handling on the room side
+int claimSlot(int connfd, int *sockArray);
+void attachSlot(int slot, int connfd, int *sockArray);
+void syncSlots(int *sockArray);
+
+// starts a room that reached its fill deadline or stopped accepting
+int startShortHanded(ServerVars *sv, int *qData, int *fd, int *plPipe, char *why);
+
+// moves the players of a sparse room to another room
+int compactRoom(ServerVars *sv, int *qData, int filling);
+int finishMerge(ServerVars *sv, int *qData);
+int roomWakeup(ServerVars *sv, int *qData, int *sockArray, int to);
+void receivePlayer(ServerVars *sv, int *qData, int *sockArray, int *plPipe);
+
+// moves a running room to a new process
+void handOffRoom(ServerVars *sv, int *qData, int *sockArray, int *plPipe);
+void finishHandoff(ServerVars *sv, int *qData, int *sockArray, int *plPipe);
+
+// checks whether a fresh room could serve the player
+int canWait(ServerVars *sv, Inventory plInv);
+int reserveItems(ServerVars *sv, Inventory plInv, int *qData);
+void releaseStock(ServerVars *sv, int *qData);
+
+// nodes sharing a room directory
+void reportNode(ServerVars *sv, int stale);
+int redirectPlayer(int connfd, int slot, ServerVars *sv);
+
+// main server side of the waitlist
+void enqueueWaiting(ServerVars *sv, int sock);
+void pickWaiting(ServerVars *sv);
+void pruneWaiting(ServerVars *sv);
+void notifyWaiting(ServerVars *sv);
+
+// room side of the waitlist
+void admitWaiting(ServerVars *sv, int *qData, int *sockArray, int *plPipe);
+
 // gets a single player's messages and sends it to the game room server
-int chat(int connfd, int *plPipe, char *name, int *qData, 
-	int plCountPos, int players);
+int chat(int connfd, int slot, int *plPipe, char *name, int *qData, 
+	int plCountPos, int players, char *greeting, TokenBucket *bucket);
+
+// whispers, channel messages and channel subscriptions
+int chatCommand(int connfd, int slot, char *name, char *raw, RelayMsg *relay);
+char *messageBody(char *raw);
+int findPlayer(char *name, void *ctx);
+
+// item trades between the players of a room
+int tradeCommand(int connfd, int slot, char *name, char *raw, RelayMsg *relay, int fd2);
 
 // game room handles pushing messages to all the players
-void pushMessage(int *plPipe, int *sockArray, int *qData, int plCountPos, int players);
+void pushMessage(int *plPipe, int *sockArray, int *qData, ServerVars *sv);
+
+// hands a message to a player without ever blocking the room
+void deliver(ServerVars *sv, int *sockArray, int slot, char *text);
+
+// io_uring engine of the rooms
+IoRing *openRoomRing();
+void dropRing();
+void relayRing(int *plPipe, int *sockArray, int *qData, ServerVars *sv);
+void queueSends(int *sockArray, int slot);
+void sendDone(int slot, unsigned gen, int res);
+
+// zero-copy fan-out of the rooms
+void relaySpliced(int *plPipe, int *sockArray, int *qData, ServerVars *sv);
+void deliverSpliced(ServerVars *sv, int *sockArray, int slot, int relay);
 
 // opens a memory segment for ipc
-int openSharedMem(Inventory *inv, int **data);
+int openSharedMem(Inventory *inv, int slots, int histSize, int **data, 
+	PlayerSlot **plData, History **hist, Channel **chans, unsigned long long **bits,
+	TradeOffer **offer, int **held);
 
 // closes the memory segments we opened
 void closeSharedMem(int shmid);
+
+// compiles the banned words and hands them to every process
+int loadFilter(ServerVars *sv);
+
+// reads the inventory again in a process of its own, for the rooms
+// opened after it is done
+int readCatalog(ServerVars *sv);
+int takeCatalog(ServerVars *sv);
 	/*- ------- Function declarations ------- -*/ 
 
 /*- ---------------------------------------------------------------- -*/
@@ -67,12 +232,14 @@ int main(int argc, char **argv) {
 	// compact way to access useful vars
 	ServerVars sv;
 
-	// structs for server address
-	struct sockaddr_in servaddr; 
-
 	// getting parameters to set up the server according to the user
 	initSettings(argc, argv, &(sv.s));
 
+	// a new binary is started with the same command line (sigusr2)
+	serverArgv = argv;
+	sv.upFrom = sv.upTo = sv.upStart = -1;
+	sv.dirSock = -1;
+
 	// taking data from the inventory file to a struct for easy management
 	if ( readInventory(sv.s.inventory, &(sv.inv)) ) {
 		perror("Inventory problem");
@@ -88,8 +255,61 @@ int main(int argc, char **argv) {
 	// printing the inventory to the user	
 	printInventory(sv.inv);
 
+	// rooms take a copy of the inventory when they open, a reload
+	// only changes the one of the rooms that open after it
+	sv.catalog = 1;
+	sv.catalogFd = -1;
+	sv.catalogBuf = NULL;
+
+	// in global pool mode the rooms share one stock instead
+	sv.pool = (sv.s.pool > 0) ? openPool(&(sv.inv), sv.s.pool) : NULL;
+
+	// players can ask what the filling room has left before joining
+	avail = openAvailability(sv.inv.count);
+
+	// from here on every process logs through the ring, and a
+	// process of its own does the writing
+	logRing = openLogRing(sv.s.logLevel);
+	startLogWriter(logRing, sv.s.logFile);
+
+	// compiling the banned words once, every player process shares them
+	if (strcmp(sv.s.filterFile, "off")) {
+		filterCtl = openFilterCtl(sv.s.filterPolicy);
+
+		if (loadFilter(&sv) < 0) {
+			perror("Couldn't load the banned words");
+			return -1;
+		}
+	}
+
+	// preparing the waitlist (stays empty if it is disabled)
+	initWaitlist(&(sv.wl), sv.s.waitlist);
+
+	// this node might host the room directory of all the nodes
+	if (sv.s.dirPort > 0) {
+		startDirectory(sv.s.dirPort);
+	}
+
 	// initializing sockets and server address
-	initServer(&(sv.listenfd), &servaddr);
+	initServer(&sv);
+
+	// players we can't take go to the node the directory suggests
+	if ( strcmp(sv.s.directory, "off") && ((sv.dirSock = openDirectory(sv.s.directory)) < 0) ) {
+		logMsg(LOG_ERROR, "Couldn't find the room directory %s, taking every player", 
+			sv.s.directory);
+	}
+
+	// other nodes reach us where the directory does, unless told otherwise
+	if ( (sv.dirSock >= 0) && (sv.s.nodeAddr[0] == '\0') ) {
+		nodeAddress(sv.dirSock, sv.s.port, sv.s.nodeAddr, sizeof(sv.s.nodeAddr));
+		logMsg(LOG_INFO, "| Other nodes send their players to us at %s |", sv.s.nodeAddr);
+	}
+
+	// falling back to select if the kernel can't run the io_uring engine
+	if ( (sv.s.engine == ENGINE_URING) && !ringAvailable() ) {
+		logMsg(LOG_INFO, "io_uring is not available, using select instead");
+		sv.s.engine = ENGINE_SELECT;
+	}
 
 	// start listening
 	serverUp(&sv);
@@ -99,46 +319,130 @@ int main(int argc, char **argv) {
 
 /*- ---------------------------------------------------------------- -*/
 /**
- * @brief Initializes the server address and assigns a socket and port
- * number to the server so that the client can connect through them.
+ * @brief Initializes the server addresses and assigns sockets to the
+ * server so that the clients can connect through them. The TCP socket is
+ * IPv6 and takes IPv4 clients as well (dual-stack), unless the host has
+ * no IPv6. Clients on the same host can use the Unix domain socket,
+ * which skips the TCP/IP stack. A new binary started by an upgrade
+ * takes the old server's sockets over instead.
  * We also set our signal handlers and create a semaphore for use 
  * later on
  *
- * @param Takes in the socket number and the server address struct
+ * @param Takes in the ServerVars struct with the settings
  * 
  */
-void initServer(int *listenfd, struct sockaddr_in *servaddr) {
+void initServer(ServerVars *sv) {
+	struct sockaddr_in6 addr6;	// IPv6 address (dual-stack)
+	struct sockaddr_in servaddr;// IPv4 address
+	struct sockaddr_un unaddr;	// Unix domain address
+	struct stat st;				// what sits on the Unix socket's path
+	int off = 0;				// IPV6_V6ONLY off
+	int on = 1;					// SO_REUSEADDR on
+	int defer = 1;				// seconds a connection may wait for its request
+	struct sigaction sa;		// handler that reads the signal's value
+	char semName[LINE_LEN];		// the semaphore's name
+
 	// setting our signal handlers
 	signal(SIGCHLD, catch_sig);
 	signal(SIGINT, catch_int);
 	signal(SIGALRM, catch_alarm);
+	signal(SIGHUP, catch_hup);
+	signal(SIGUSR2, catch_usr2);
 
-	// server's endpoint
-	*listenfd = socket(AF_INET, SOCK_STREAM, 0); 
+	// attempting to open the semaphore, one per node of the host
+	sprintf(semName, "sem%d", sv->s.port);
+	my_sem = sem_open(semName, O_CREAT, 0600, 1);
 
-	if (*listenfd < 0) {	// checking if socket was opened
-		perror("Couldn't open socket");
+	// checking if the semaphore opened
+	if (my_sem == SEM_FAILED) {	
+		logMsg(LOG_ERROR, "Could not open semaphore!");
+		exit(1);
+	}
+
+	// a room that is asked to move can be told the core to move to
+	bzero(&sa, sizeof(sa));
+	sa.sa_sigaction = catch_usr1;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	// the server we replace hands us its listening sockets instead
+	if (adoptListeners(sv)) {
+		return;
 	}
 
-	// initializing connection variables
-	bzero(servaddr, sizeof(*servaddr));		// zero servaddr fields
-	servaddr->sin_family = AF_INET; 		// setting the socket type to INET
-	servaddr->sin_port = htons(PORT_NO);	// assigning the port number
-	servaddr->sin_addr.s_addr = INADDR_ANY;	// contains the port number
+	// server's endpoint, IPv6 with IPv4-mapped addresses
+	sv->listenfd = socket(AF_INET6, SOCK_STREAM, 0);
+
+	bzero(&addr6, sizeof(addr6));
+	addr6.sin6_family = AF_INET6;
+	addr6.sin6_port = htons(sv->s.port);
+	addr6.sin6_addr = in6addr_any;
+
+	// players that reconnect leave connections in TIME_WAIT behind,
+	// they must not keep a restarted server from binding the port
+	if ( (sv->listenfd < 0) ||
+		setsockopt(sv->listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+		setsockopt(sv->listenfd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) ||
+		bind(sv->listenfd, (struct sockaddr*) &addr6, sizeof(addr6)) ) {
+		// no IPv6 on this host, listening on IPv4 only
+		if (sv->listenfd >= 0) {
+			close(sv->listenfd);
+		}
+
+		sv->listenfd = socket(AF_INET, SOCK_STREAM, 0); 
 
-	// creating the file for the socket and registering it
-	bind(*listenfd, (struct sockaddr*) servaddr, sizeof(*servaddr));
+		if (sv->listenfd < 0) {	// checking if socket was opened
+			perror("Couldn't open socket");
+		}
+
+		setsockopt(sv->listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+		// initializing connection variables
+		bzero(&servaddr, sizeof(servaddr));		// zero servaddr fields
+		servaddr.sin_family = AF_INET; 			// setting the socket type to INET
+		servaddr.sin_port = htons(sv->s.port);	// assigning the port number
+		servaddr.sin_addr.s_addr = INADDR_ANY;	// contains the port number
+
+		// creating the file for the socket and registering it
+		bind(sv->listenfd, (struct sockaddr*) &servaddr, sizeof(servaddr));
+	}
 
 	// creating the request queue
-	listen(*listenfd, LISTENQ); 
+	listen(sv->listenfd, LISTENQ); 
 
-	// attempting to open the semaphore
-	my_sem = sem_open("sem5623", O_CREAT, 0600, 1);
+	// a connection is only accepted with its request, so a room can
+	// answer the queries that take no seat right away (quickAvail)
+	setsockopt(sv->listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer, sizeof(defer));
 
-	// checking if the semaphore opened
-	if (my_sem == SEM_FAILED) {	
-		printf("Could not open semaphore!\n");
-		exit(1);
+	// the Unix domain endpoint
+	sv->unixfd = -1;
+
+	if ( strcmp(sv->s.unixPath, "off") &&
+		(strlen(sv->s.unixPath) < sizeof(unaddr.sun_path)) ) {
+		bzero(&unaddr, sizeof(unaddr));
+		unaddr.sun_family = AF_UNIX;
+		strcpy(unaddr.sun_path, sv->s.unixPath);
+
+		// a socket left behind by a server that didn't exit cleanly
+		if ( !stat(unaddr.sun_path, &st) && S_ISSOCK(st.st_mode) ) {
+			unlink(unaddr.sun_path);
+		}
+
+		sv->unixfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if ( (sv->unixfd < 0) ||
+			bind(sv->unixfd, (struct sockaddr*) &unaddr, sizeof(unaddr)) ||
+			listen(sv->unixfd, LISTENQ) ) {
+			perror("Couldn't open the Unix domain socket");
+
+			if (sv->unixfd >= 0) {
+				close(sv->unixfd);
+			}
+
+			sv->unixfd = -1;
+		} else {
+			unixPath = sv->s.unixPath;
+		}
 	}
 }
 
@@ -163,34 +467,252 @@ void serverUp(ServerVars *sv) {
 	int fd[2];	// pipe array
 	pipe(fd);	// declaring fd is a pipe
 
+	// read set for the rooms' pipe and the waitlist socket
+	fd_set read_set;
+
+	// the server we replace is waiting for our first room
+	int upgrading = (sv->upFrom >= 0);
+	char ready = 1;
+
+	// after we hand over we look at our rooms every second, until the
+	// last one closes (its exit might slip past select)
+	struct timespec tick;
+	struct timespec *timed;
+	int rooms;
+
+	// sighup and sigusr2 are only let in while we wait, so one that
+	// comes after we looked at their flags still ends the wait
+	sigset_t flagged;
+
+	// a sighup came while the inventory was still being read
+	int reread = 0;
+
+	// we report our load to the room directory every DIR_REPORT_MS
+	double nextReport = 0;
+	double heard = monoTime();	// its last answer
+	double now;
+	double left;	// time a new binary has left to start
+
+	// rooms hand us the players that have to wait through this socket
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv->wlSock) < 0) {
+		perror("Couldn't open the waitlist socket");
+		exit(1);
+	}
+
 	// storing this process's id
 	pprocID = getpid();
 
+	// a room that moves to a new process leaves it behind, we take it
+	// in so that it is still ours to wait for
+	prctl(PR_SET_CHILD_SUBREAPER, 1);
+
+	// every room lists itself here so that sparse rooms can find
+	// another room to merge with
+	roomTable = openRoomTable();
+
+	sigemptyset(&flagged);
+	sigaddset(&flagged, SIGHUP);
+	sigaddset(&flagged, SIGUSR2);
+	sigprocmask(SIG_BLOCK, &flagged, &openMask);
+
 	// infinite loop, here we handle requests
 	for (;;) {
 		// forking the process and creating a child
 		// if the last room is full or this room is the first
 		if (needroom) {
 			needroom = 0;		// updating the flag to zero until we need a room
-			++roomsOpened;		// about to open a new room
+
+			// picking the waiting players that the new room will take
+			waitRoomOpened(&(sv->wl));
+			pickWaiting(sv);
+
 			childpid = fork();	// well ... fork
+
+			if (childpid != 0) {
+				// Printing the parent pid
+				logMsg(LOG_INFO, "| Main Server pid: %d |", getpid());
+
+				// the room owns the players it took from now on
+				notifyWaiting(sv);
+
+				// the server we replace can stop accepting, the
+				// players it doesn't take queue up for our room
+				if (upgrading) {
+					upgrading = 0;
+					send(sv->upFrom, &ready, sizeof(ready), 0);
+				}
+			}
 		}
 
 		if (childpid == 0) {	// checking if it is the child process	
 			needroom = 0;		// only the parent server can create rooms, avoiding trouble	
+			sigprocmask(SIG_SETMASK, &openMask, NULL);
+
+			// a reload that is going on is the main server's
+			if (sv->catalogFd >= 0) {
+				close(sv->catalogFd);
+				free(sv->catalogBuf);
+				sv->catalogFd = -1;
+				sv->catalogBuf = NULL;
+			}
+
+			// and so is an upgrade
+			if (sv->upStart >= 0) {
+				close(sv->upStart);
+				sv->upStart = -1;
+			}
+
 			openGameRoom(fd, sv);
 		
 			// making sure no child survives past this point
 			exit(0);
 		} else {
-			// Printing the parent pid
-			printf("\n\n| Main Server pid: %d |\n", getpid());
+			// the inventory or the banned words changed (sighup)
+			if (reload) {
+				reload = 0;
+				reread = 1;
+
+				if ( filterCtl && (loadFilter(sv) < 0) ) {
+					logMsg(LOG_ERROR, "Couldn't reload the banned words: %s", strerror(errno));
+				}
+			}
+
+			// one reader at a time, the next one reads the file as it is then
+			if ( reread && (sv->catalogFd < 0) ) {
+				reread = 0;
+
+				if (readCatalog(sv) < 0) {
+					logMsg(LOG_ERROR, "Couldn't reload the inventory: %s", strerror(errno));
+				}
+			}
+
+			// a new binary takes over (sigusr2)
+			if (upgrade) {
+				upgrade = 0;
+
+				if ( (sv->upTo < 0) && (sv->upStart < 0) ) {
+					upgradeServer(sv);
+				}
+			}
+
+			// it didn't start in time, or it died
+			if ( (sv->upStart >= 0) && ((monoTime() >= sv->upUntil) || 
+				(kill(sv->upPid, 0) < 0)) ) {
+				upgradeDone(sv, 0);
+			}
+
+			// we handed over and our last room closed
+			if (sv->upTo >= 0) {
+				sem_wait(my_sem);
+				rooms = roomsLeft(roomTable);
+				sem_post(my_sem);
+
+				if (rooms == 0) {
+					logMsg(LOG_INFO, "| Server %d: Last room closed, the new server carries on |", 
+						getpid());
+					exit(0);
+				}
+
+				tick.tv_sec = 1;
+				tick.tv_nsec = 0;
+				timed = &tick;
+			} else {
+				timed = NULL;
+			}
+
+			FD_ZERO(&read_set);
+			FD_SET(fd[0], &read_set);
+			FD_SET(sv->wlSock[0], &read_set);
+
+			if (sv->upFrom >= 0) {
+				FD_SET(sv->upFrom, &read_set);
+			}
+
+			if (sv->catalogFd >= 0) {
+				FD_SET(sv->catalogFd, &read_set);
+			}
+
+			// the new server reports for the both of us
+			if ( (sv->dirSock >= 0) && (sv->upTo < 0) ) {
+				if ( (now = monoTime()) >= nextReport ) {
+					reportNode(sv, now - heard > DIR_EXPIRE);
+					nextReport = now + DIR_REPORT_MS / 1000.0;
+				}
+
+				tick.tv_sec = 0;
+				tick.tv_nsec = (long)((nextReport - now) * 1e9);
+				timed = &tick;
+
+				FD_SET(sv->dirSock, &read_set);
+			}
+
+			// the new binary tells us when its first room accepts,
+			// we don't wait for it past its deadline
+			if (sv->upStart >= 0) {
+				FD_SET(sv->upStart, &read_set);
+
+				left = sv->upUntil - monoTime();
+				left = (left > 0) ? left : 0;
+
+				if ( !timed || (timed->tv_sec + timed->tv_nsec / 1e9 > left) ) {
+					tick.tv_sec = (long)left;
+					tick.tv_nsec = (long)((left - tick.tv_sec) * 1e9);
+					timed = &tick;
+				}
+			}
+
+			// waiting until we need a new room or a player has to wait
+			if (pselect(FD_SETSIZE, &read_set, NULL, NULL, timed, &openMask) < 0) {
+				if (errno == EINTR) {
+					continue;	// a room closed (sigchld) or a sighup
+				}
 
-			// waiting until we need a new room
-			if (read(fd[0], &needroom, sizeof(needroom)) < 0) {
 				perror("Couldn't read from the game server");
 				exit(1);		
 			}
+
+			// a room asked for a player to be put on the waitlist
+			if (FD_ISSET(sv->wlSock[0], &read_set)) {
+				enqueueWaiting(sv, sv->wlSock[0]);
+			}
+
+			// and so did the server we replaced
+			if ( (sv->upFrom >= 0) && FD_ISSET(sv->upFrom, &read_set) ) {
+				enqueueWaiting(sv, sv->upFrom);
+			}
+
+			// the new binary is ready to take over
+			if ( (sv->upStart >= 0) && FD_ISSET(sv->upStart, &read_set) ) {
+				upgradeDone(sv, 1);
+			}
+
+			// the reloaded inventory is coming in
+			if ( (sv->catalogFd >= 0) && FD_ISSET(sv->catalogFd, &read_set) &&
+				(takeCatalog(sv) < 0) ) {
+				logMsg(LOG_ERROR, "Couldn't reload the inventory, keeping the old one");
+			}
+
+			// the directory answered our report
+			if ( (sv->dirSock >= 0) && FD_ISSET(sv->dirSock, &read_set) ) {
+				sem_wait(my_sem);
+				if (readSuggestion(sv->dirSock, roomTable->nextNode)) {
+					heard = monoTime();
+				}
+				sem_post(my_sem);
+			}
+
+			// a room is full
+			if (FD_ISSET(fd[0], &read_set)) {
+				if (read(fd[0], &needroom, sizeof(needroom)) < 0) {
+					perror("Couldn't read from the game server");
+					exit(1);		
+				}
+
+				// the new server opens the rooms now
+				if (sv->upTo >= 0) {
+					needroom = 0;
+				}
+			}
 		} // if		
 	} // for
 }
@@ -215,12 +737,6 @@ void openGameRoom(int *fd, ServerVars *sv) {
 	// connection socket
 	int connfd = -1;
 
-	// client's address length
-	socklen_t clilen;
-
-	// client's address struct
-	struct sockaddr_in cliaddr;
-
 	// room flag
 	int needroom = 0;
 	int full = 0;
@@ -231,54 +747,216 @@ void openGameRoom(int *fd, ServerVars *sv) {
 	// player's name
 	char *name;
 
+	// player's slot in the room
+	int slot = -1;
+
+	// address for the migration socket
+	struct sockaddr_un migAddr;
+	socklen_t migLen;
+
+	// fill deadline vars
+	double firstArrival = 0;	// first connection of this room
+	double lastArrival = 0;		// latest connection of this room
+	double deadline;			// time the room starts anyway
+	double now;					// current time
+	struct timeval timeout;		// time left until the deadline
+	struct timeval *timed;		// the timeout, if the room has a deadline
+
+	// rooms on the io_uring engine get a ring of their own
+	if (sv->s.engine == ENGINE_URING) {
+		ioRing = openRoomRing();
+	}
+
 	int plPipe[2];	// pipe array
-	pipe(plPipe);	// declaring plPipe is a pipe
+
+	// the ring receives all the players' messages with a single multishot
+	// request, which needs a socket (messages stay whole on both)
+	if (ioRing) {
+		socketpair(AF_UNIX, SOCK_SEQPACKET, 0, plPipe);
+	} else {
+		pipe(plPipe);	// declaring plPipe is a pipe
+	}
 
 	int fullFlag[2];	// pipe array
 	pipe(fullFlag);		// declaring fullFlag is a pipe
 
+	// pending players take a slot too, so we keep some spare ones
+	slotCount = 2*(sv->s.players);
+
 	// socket array
-	int *sockArray = malloc(sizeof(int)*(sv->s.players));
+	int *sockArray = malloc(sizeof(int)*slotCount);
+
+	// outbound queues, one per slot
+	outQueues = malloc(sizeof(OutQueue)*slotCount);
+
+	// the zero-copy fan-out keeps each player's messages in a pipe
+	if (sv->s.engine == ENGINE_SPLICE) {
+		spliceQueues = malloc(sizeof(SpliceQueue)*slotCount);
+		devNull = open("/dev/null", O_WRONLY);
+
+		if (spliceQueues == NULL || devNull < 0) {
+			perror("error -> spliceQueues");
+			exit(1);
+		}
+
+		for (slot=0; slot<slotCount; ++slot) {
+			initSpliceQueue(&(spliceQueues[slot]));
+		}
+	}
 
 	// storing this process's id
 	rprocID = getpid();
 
 	// printing the room's pid
-	printf("| Opened a game room with pid: %d |\n", rprocID);
+	logMsg(LOG_INFO, "| Opened a game room with pid: %d |", rprocID);
 
-	if (sockArray == NULL) {
+	// recipients of a message, collected before it is delivered
+	targets = malloc(sizeof(int)*slotCount);
+
+	if (sockArray == NULL || outQueues == NULL || targets == NULL) {
 		perror("error -> sockArray");
 		exit(1);
 	}
 
+	// no sockets yet
+	for (slot=0; slot<slotCount; ++slot) {
+		sockArray[slot] = -1;
+		initOutQueue(&(outQueues[slot]), sv->s.backlog);
+	}
+
 	// opening a room specific shared memory
-	shmid = openSharedMem(&(sv->inv), &qData);
+	shmid = openSharedMem(&(sv->inv), slotCount, sv->s.history, &qData, &plSlots, &history,
+		&channels, &chanBits, &offers, &holdings);
+	roomInv = &(sv->inv);
+
+	// sharing the stock, the room starts empty and borrows from the pool
+	if (sv->pool) {
+		memset(qData, 0, sizeof(int)*sv->inv.count);
+	}
+	chanWords = channelWords(slotCount);
+
+	// a process of its own copies the room's chat to disk
+	if (strcmp(sv->s.transcripts, "off")) {
+		transcriptSock = startTranscriptWriter(rprocID, sv->s.transcripts);
+	}
+
+	// and another one relays it to the room's spectators
+	if (sv->s.spectators > 0) {
+		startSpectatorRelay(history, rprocID, sv->s.spectators);
+	}
+
+	// listing the room in the room table, and its items as the ones
+	// players can get now
+	sem_wait(my_sem);
+	roomIndex = registerRoom(roomTable, rprocID, sv->catalog);
+	showAvailability(sv, qData, rprocID, 1);
+	sem_post(my_sem);
+
+	// players of sparse rooms are handed to us through this socket
+	migSock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	migLen = roomAddress(rprocID, &migAddr);
+
+	if (bind(migSock, (struct sockaddr *)&migAddr, migLen) < 0) {
+		logMsg(LOG_ERROR, "Couldn't open the migration socket: %s", strerror(errno));
+	}
+
+	// only the main server reads from the waitlist socket
+	close(sv->wlSock[0]);
+
+	// serving the waiting players the main server picked for this room
+	admitWaiting(sv, qData, sockArray, plPipe);
+
+	// the waitlist alone might have filled the room
+	if (qData[sv->inv.count] == sv->s.players) {
+		++full;
+	} else if (qData[sv->inv.count] > 0) {
+		firstArrival = lastArrival = monoTime();
+	}
+
+	for (;;) {
+		timed = NULL;
+
+		// players that went to the waitlist or to another room gave
+		// their slot back, our copy of their socket must not keep
+		// their connection open (or get the chat once we start)
+		syncSlots(sockArray);
+
+		// a new server took over the listening sockets (sigusr2)
+		if (upgrade && !full) {
+			upgrade = 0;
+			stopAccepting(sv, qData, fd, plPipe);
+			++full;
+			continue;
+		}
+
+		// the room has players and a fill deadline, so we
+		// only wait for new players until the deadline passes
+		if ( !full && (sv->s.deadline > 0) && (firstArrival > 0) ) {
+			deadline = fillDeadline(roomTable, firstArrival, lastArrival, sv->s.deadline);
+			now = monoTime();
+
+			if (deadline > now) {
+				timeout.tv_sec = (long)(deadline - now);
+				timeout.tv_usec = (long)((deadline - now - timeout.tv_sec) * 1e6);
+			} else {
+				timeout.tv_sec = 0;
+				timeout.tv_usec = 0;
+			}
 
-	for (;;) {			
-		clilen = sizeof(cliaddr);	// got address length
+			timed = &timeout;
+		}
 
 		if (!full) {
 			// get next request and remove it from queue afterwards
-			connfd = accept(sv->listenfd, (struct sockaddr *)&cliaddr, &clilen);
+			connfd = acceptPlayer(sv, timed);
 
 			// checking if connection was successful
 			if (connfd < 0) {
-				if (errno == EINTR) {
+				if (errno == ETIME) {
+					// the deadline passed
+					if (startShortHanded(sv, qData, fd, plPipe, "Fill deadline passed")) {
+						++full;
+					} else {
+						// everyone left, waiting for new players as usual
+						firstArrival = 0;
+					}
+
+					continue;
+				} else if (errno == EINTR) {
 					continue;
 				} else { // something interrupted us
-					fprintf(stderr, "Got an error while trying to connect \n");
+					logMsg(LOG_ERROR, "Got an error while trying to connect");
 					exit(1);
 				}
 			}
 
+			// keeping the arrival statistics for the fill deadline
+			lastArrival = monoTime();
+
+			if (firstArrival == 0) {
+				firstArrival = lastArrival;
+			}
+
+			sem_wait(my_sem);
+			noteArrival(roomTable, lastArrival);
+			sem_post(my_sem);
+
+			// a query of what we have left takes no seat
+			if (quickAvail(connfd, sv)) {
+				continue;
+			}
+
 			// if we need one more player, then we set the server to
 			// blocking as we want to filter the last request
 			if ( qData[sv->inv.count] == sv->s.players - 1) {
 				++full;	// server might be full with the client we accepted
 			}
 
-			// keeping the sockets
-			sockArray[(qData[sv->inv.count])] = connfd;
+			// keeping the socket in a free slot
+			if ( (slot = claimSlot(connfd, sockArray)) < 0 ) {
+				close(connfd);
+				continue;
+			}
 
 			// forking the process to serve the request
 			newpid = fork();
@@ -301,8 +979,8 @@ void openGameRoom(int *fd, ServerVars *sv) {
 
 		} else {
 			// printing a message from the server's point to
-			// inform that this room is full
-			printf("| Room %d: Full |\n", getpid());
+			// inform that this room is full (or starts anyway)
+			logMsg(LOG_INFO, "| Room %d: Full |", getpid());
 
 			// raising the room flag and writing to the parent
 			needroom = 1;
@@ -312,10 +990,38 @@ void openGameRoom(int *fd, ServerVars *sv) {
 			}
 
 			// informing the server side that the game started
-			printf("| Room %d: Game in progress ...|\n", getpid());
+			logMsg(LOG_INFO, "| Room %d: Game in progress ...|", getpid());
+
+			// the game started, players joining from now on
+			// (through migration) don't wait for the others
+			sem_wait(my_sem);
+			qData[sv->inv.count+1] = 1;
+			if (roomIndex >= 0) {
+				roomTable->rooms[roomIndex].state = ROOM_RUNNING;
+			}
+			sem_post(my_sem);
+
+			// the items nobody took go back to the other rooms
+			releaseStock(sv, qData);
 
 			// pushing messages from the child servers to the players
-			pushMessage(plPipe, sockArray, qData, sv->inv.count, sv->s.players);
+			pushMessage(plPipe, sockArray, qData, sv);
+
+			// the last players left while they were moving, the
+			// target room gets its space back
+			if (mergeTarget >= 0) {
+				finishMerge(sv, qData);
+			}
+
+			// removing the room from the room table
+			sem_wait(my_sem);
+			if (roomIndex >= 0) {
+				roomTable->rooms[roomIndex].state = ROOM_FREE;
+			}
+			sem_post(my_sem);
+
+			// and so do the ones of players that were still joining
+			releaseStock(sv, qData);
 
 			// detaching the room from the shared memory
 			shmdt(qData);
@@ -324,7 +1030,7 @@ void openGameRoom(int *fd, ServerVars *sv) {
 			closeSharedMem(shmid);
 			
 			// informing the server side that this game ended
-			printf("| Room %d: Game ended ...|\n", getpid());
+			logMsg(LOG_INFO, "| Room %d: Game ended ...|", getpid());
 
 			// breaking out of the loop
 			break;
@@ -333,8 +1039,8 @@ void openGameRoom(int *fd, ServerVars *sv) {
 		// the child process handles the request
 		if (newpid == 0) {
 
-			// closing up the listening socket
-			close(sv->listenfd);	
+			// closing up the listening sockets
+			closeListeners(sv);
 
 			// setting an alarm for this player
 			// if he doesn't stop it then we kick him
@@ -344,29 +1050,18 @@ void openGameRoom(int *fd, ServerVars *sv) {
 			// so that we can tell these processes apart
 			rprocID = MYERRCODE;
 
+			// the room keeps the migration socket and the ring for itself
+			close(migSock);
+			dropRing();
+
 			// initiate contact with the player
-			servePlayer(connfd, qData, sv, &name, fullFlag, full);
+			servePlayer(connfd, slot, qData, sv, &name, fullFlag, full);
 
 			// stopping the alarm
 			alarm(0);
 
-			// connecting the player to the chat
-			chat(connfd, plPipe, name, qData, sv->inv.count, sv->s.players);
-
-			// entering critical area
-			sem_wait(my_sem);
-
-			// lost connection to the player
-			--qData[sv->inv.count];
-
-			// leaving critical area
-			sem_post(my_sem);
-
-			// informing the server side that a player disconnected
-			printf("\t| Player > %s < left room %d |\n", name, getppid());
-
-			// exiting this process
-			exit(0);
+			// connecting the player to the chat until he leaves
+			playerSession(connfd, slot, plPipe, name, qData, sv, NULL);
 		}
 	} // for
 	
@@ -376,65 +1071,381 @@ void openGameRoom(int *fd, ServerVars *sv) {
 
 /*- ---------------------------------------------------------------- -*/
 /**
- * @brief Makes contact with the player and serves him depending on his
- * inventory. 
+ * @brief Waits for the next player of the room, on whichever listening
+ * socket he arrives. The ring's linked accept covers a single socket, so
+ * with the Unix domain socket open the ring engine accepts through
+ * select too (once per player, the chat doesn't go through here)
  *
- * @param Takes in the connection socket, the shared memory pointer,
- * the ServerVars struct containing the inventory, settings and 
- * listening socket vars the player's name, the parent pipe and 
- * the full flag
+ * @param Takes in the ServerVars struct and the time left until the
+ * fill deadline (NULL to wait for ever)
  *
+ * @return The player's socket, or -1 with errno set to ETIME when the
+ * deadline passed first
  */
-void servePlayer(int connfd, int *qData, ServerVars *sv, char **name, 
-	int *fullFlag, int full) {
-	// player vars
-	char plStr[pSize];			// player's inventory in chars
-	Inventory plInv;			// player's inventory in our struct
-	char response[LINE_LEN];	// response to the player
-	int status = 0;				// request status (valid/invalid)
+int acceptPlayer(ServerVars *sv, struct timeval *timeout) {
+	fd_set accept_set;	// set with the listening sockets
+	int maxfd;			// highest listening socket
+	int ready;			// result of select
 
-	// waiting for the player to send us his inventory
-	if (read(connfd, plStr, sizeof(plStr)) < 0) {
-		perror("Error reading the player's inventory");
-		exit(1);
+	if (ioRing && (sv->unixfd < 0)) {
+		return ringAccept(ioRing, sv->listenfd, timeout);
 	}
 
-	// parsing the string we received to our Inventory format
-	parseStrIntoInv(name, plStr, &plInv);
-
-	// locking the segment (critical section)
-	sem_wait(my_sem);
-
-	// attempting to give items to the player
-	status = subInventories(&sv->inv, plInv, qData, sv->s.quota);
+	FD_ZERO(&accept_set);
+	FD_SET(sv->listenfd, &accept_set);
+	maxfd = sv->listenfd;
 
-	// checking if the subtraction took place
-	if (status) {
+	if (sv->unixfd >= 0) {
+		FD_SET(sv->unixfd, &accept_set);
+		maxfd = (sv->unixfd > maxfd) ? sv->unixfd : maxfd;
+	}
 
-		// increasing the player counter
-		++qData[sv->inv.count];
+	if ( (ready = select(maxfd+1, &accept_set, NULL, NULL, timeout)) <= 0 ) {
+		if (ready == 0) {
+			errno = ETIME;
+		}
 
-		// unlocking the segment (out of the critical section)
-		sem_post(my_sem);
+		return -1;
+	}
 
-		// informing the server side that a player successfully connected
-		printf("| Player > %s < connected |\n", *name);
+	if ( (sv->unixfd >= 0) && FD_ISSET(sv->unixfd, &accept_set) ) {
+		return accept(sv->unixfd, NULL, NULL);
+	}
 
-		// sending the ok message
-		strcpy(response, "OK\n");	
-	} else {
+	return accept(sv->listenfd, NULL, NULL);
+}
 
-		// unlocking the segment
-		sem_post(my_sem);
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Closes the listening sockets, for the processes that serve a
+ * single player
+ *
+ * @param Takes in the ServerVars struct
+ *
+ */
+void closeListeners(ServerVars *sv) {
+	if (sv->listenfd >= 0) {
+		close(sv->listenfd);
+	}
 
-		// sending a problem message
-		strcpy(response, "Encoutered a problem");
+	if (sv->unixfd >= 0) {
+		close(sv->unixfd);
 	}
 
-	// the game server has raised this flag
-	// meaning this might be the last player
-	if (full) {
-		// if this is indeed the last player
+	sv->listenfd = sv->unixfd = -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Main server side of an upgrade (sigusr2). Starts our binary
+ * again, which by now is the new one on disk, and hands it the listening
+ * sockets through a socket pair. We keep serving while it starts, the
+ * main loop calls upgradeDone once its first room accepts, or once it
+ * had UPGRADE_WAIT seconds
+ *
+ * @param Takes in the ServerVars struct
+ *
+ */
+void upgradeServer(ServerVars *sv) {
+	int up[2];			// socket pair between the two servers
+	UpgradeMsg msg;		// what comes with the listening sockets
+	pid_t pid;			// the new server
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, up) < 0) {
+		logMsg(LOG_ERROR, "Couldn't upgrade: %s", strerror(errno));
+		return;
+	}
+
+	if ( (pid = fork()) < 0 ) {
+		logMsg(LOG_ERROR, "Couldn't upgrade: %s", strerror(errno));
+		close(up[0]);
+		close(up[1]);
+		return;
+	}
+
+	if (pid == 0) {
+		// the new binary only keeps its end of the pair (and stdio)
+		sigprocmask(SIG_SETMASK, &openMask, NULL);
+		dup2(up[1], 3);
+		close_range(4, ~0U, 0);
+
+		setenv(UPGRADE_ENV, "3", 1);
+		execvp(serverArgv[0], serverArgv);
+
+		perror("Couldn't start the new binary");
+		_exit(1);
+	}
+
+	close(up[1]);
+
+	msg.hasUnix = (sv->unixfd >= 0);
+
+	sv->upStart = up[0];
+	sv->upPid = pid;
+	sv->upUntil = monoTime() + UPGRADE_WAIT;
+
+	if ( (sendFd(up[0], sv->listenfd, &msg, sizeof(msg)) < 0) ||
+		(msg.hasUnix && (sendFd(up[0], sv->unixfd, &msg, sizeof(msg)) < 0)) ) {
+		upgradeDone(sv, 0);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Main server side of an upgrade, once the new binary said its
+ * first room accepts (or didn't in time). The room that is filling up
+ * here stops accepting and our waiting players move to the new server's
+ * waitlist. The connections nobody accepted yet stay in the sockets'
+ * queue for the new server, so none is refused. Our rooms finish as
+ * usual and we exit after the last one. If the new binary didn't start
+ * we keep serving
+ *
+ * @param Takes in the ServerVars struct and whether the new binary
+ * might have started
+ *
+ */
+void upgradeDone(ServerVars *sv, int started) {
+	char ready;			// its first room accepts
+	int moved = 0;		// waiting players we handed over
+	int slot;			// a waiting player's entry
+	pid_t room;			// our room that is filling up
+
+	if ( !started || (recv(sv->upStart, &ready, sizeof(ready), MSG_DONTWAIT) != sizeof(ready)) ) {
+		logMsg(LOG_ERROR, "The new server didn't start, we carry on");
+		kill(sv->upPid, SIGKILL);
+		close(sv->upStart);
+		sv->upStart = -1;
+		return;
+	}
+
+	// the new server accepts from now on
+	sem_wait(my_sem);
+	room = fillingRoom(roomTable);
+	sem_post(my_sem);
+
+	if (room > 0) {
+		kill(room, SIGUSR2);
+	}
+
+	closeListeners(sv);
+	unixPath = NULL;
+	sv->upTo = sv->upStart;
+	sv->upStart = -1;
+
+	while ( (slot = popWaitSlot(&(sv->wl))) >= 0 ) {
+		if (sendFd(sv->upTo, sv->wl.entries[slot].connfd, sv->wl.entries[slot].request, 
+			pSize) == 0) {
+			++moved;
+		}
+
+		close(sv->wl.entries[slot].connfd);
+		releaseWaitSlot(&(sv->wl), slot);
+	}
+
+	logMsg(LOG_INFO, "| Server %d: Handed over to server %d (%d waiting players), "
+		"finishing our rooms ... |", getpid(), sv->upPid, moved);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief New server side of an upgrade. Takes the listening sockets
+ * over from the server that started us, if it did. We count our rooms
+ * on from its
+ *
+ * @param Takes in the ServerVars struct
+ *
+ * @return 1 if we took the sockets over or 0 if we open our own
+ */
+int adoptListeners(ServerVars *sv) {
+	char *env = getenv(UPGRADE_ENV);	// the socket to the old server
+	UpgradeMsg msg;						// what came with the sockets
+
+	if (env == NULL) {
+		return 0;
+	}
+
+	sv->upFrom = atoi(env);
+	unsetenv(UPGRADE_ENV);
+
+	sv->unixfd = -1;
+
+	if ( ((sv->listenfd = recvFd(sv->upFrom, &msg, sizeof(msg))) < 0) ||
+		(msg.hasUnix && ((sv->unixfd = recvFd(sv->upFrom, &msg, sizeof(msg))) < 0)) ) {
+		perror("Couldn't take over the listening sockets");
+		exit(1);
+	}
+
+	// the socket's path is ours to remove now
+	if (sv->unixfd >= 0) {
+		unixPath = sv->s.unixPath;
+	}
+
+	logMsg(LOG_INFO, "| Took over the listening sockets, the old server finishes its rooms |");
+
+	return 1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Makes contact with the player and serves him depending on his
+ * inventory. 
+ *
+ * @param Takes in the connection socket, the player's slot, the shared
+ * memory pointer,
+ * the ServerVars struct containing the inventory, settings and 
+ * listening socket vars the player's name, the parent pipe and 
+ * the full flag
+ *
+ */
+void servePlayer(int connfd, int slot, int *qData, ServerVars *sv, char **name, 
+	int *fullFlag, int full) {
+	// player vars
+	char plStr[pSize];			// player's inventory in chars
+	Inventory plInv;			// player's inventory in our struct
+	char response[LINE_LEN];	// response to the player
+	int status = 0;				// request status (valid/invalid)
+	int waiting = 0;			// player goes to the waitlist
+
+	// waiting for the player to send us his inventory
+	if (read(connfd, plStr, sizeof(plStr)) < 0) {
+		perror("Error reading the player's inventory");
+		exit(1);
+	}
+
+	// a player that lost his connection wants his seat back instead
+	if (!strncmp(plStr, "RESUME ", 7)) {
+		plStr[pSize-1] = '\0';
+		status = resumeRequest(connfd, slot, plStr + 7, name);
+
+		// he doesn't change the player count
+		confirmFull(qData, sv, fullFlag, full);
+
+		// his room took over, or he was turned away
+		if (status <= 0) {
+			exit(0);
+		}
+
+		return;
+	}
+
+	// a spectator only watches, he takes no seat and no items
+	if (!strncmp(plStr, "WATCH", 5)) {
+		plStr[pSize-1] = '\0';
+		watchRequest(connfd, slot, plStr + 5);
+
+		// he doesn't change the player count
+		confirmFull(qData, sv, fullFlag, full);
+
+		exit(0);
+	}
+
+	// a player asking which items are left, before he joins
+	if (!strncmp(plStr, "AVAIL", 5)) {
+		availRequest(connfd, slot, sv, plStr);
+
+		// he doesn't change the player count
+		confirmFull(qData, sv, fullFlag, full);
+
+		exit(0);
+	}
+
+	// a player another node sent us stays, the rest might go to one
+	if (!strncmp(plStr, "MOVED ", 6)) {
+		memmove(plStr, plStr + 6, pSize - 6);
+		memset(plStr + pSize - 6, 0, 6);
+	} else if (redirectPlayer(connfd, slot, sv)) {
+		// he doesn't change the player count
+		confirmFull(qData, sv, fullFlag, full);
+
+		exit(0);
+	}
+
+	// parsing the string we received to our Inventory format
+	parseStrIntoInv(name, plStr, &plInv);
+
+	// attempting to give items to the player, locking the segment
+	// (critical section)
+	status = reserveItems(sv, plInv, qData);
+	showAvailability(sv, qData, getppid(), 0);
+
+	// checking if the subtraction took place
+	if (status) {
+
+		// increasing the player counter
+		updateCount(qData, sv->inv.count, 1);
+
+		// filling in the player's slot
+		plSlots[slot].pid = getpid();
+		strncpy(plSlots[slot].name, *name, LINE_LEN-1);
+		plSlots[slot].name[LINE_LEN-1] = '\0';
+		memcpy(plSlots[slot].request, plStr, pSize);
+		plSlots[slot].token = (sv->s.grace > 0) ? newToken() : 0;
+
+		// the items he got are his to trade
+		fillHoldings(holdings + slot*sv->inv.count, &(sv->inv), plInv);
+
+		// unlocking the segment (out of the critical section)
+		sem_post(my_sem);
+
+		// informing the server side that a player successfully connected
+		logMsg(LOG_INFO, "| Player > %s < connected |", *name);
+
+		// sending the ok message, with his token if seats are kept
+		tokenResponse(getppid(), slot, response);
+	} else {
+
+		// giving the slot back
+		plSlots[slot].connfd = -1;
+
+		// unlocking the segment
+		sem_post(my_sem);
+
+		// a valid request that this room can't serve anymore
+		// might wait for the next room instead
+		waiting = canWait(sv, plInv);
+
+		// sending a problem message
+		strcpy(response, "Encoutered a problem");
+	}
+
+	// letting the game server know if the room is full now
+	confirmFull(qData, sv, fullFlag, full);
+
+	// handing the player to the main server, which answers him
+	// and keeps him until a room with enough items opens
+	if (waiting) {
+		if (sendFd(sv->wlSock[1], connfd, plStr, sizeof(plStr)) == 0) {
+			exit(0);
+		}
+	}
+
+	// writing the response back to the player
+	if (write(connfd, response, sizeof(response)) < 0) {
+		perror("Couldn't respond to the player");
+		exit(1);
+	}
+
+	if (!status) {
+		// invalid request
+		exit(0);
+	}
+
+	// free data before returning
+	freeInventory(&plInv);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief The game server raises the full flag when the player we serve
+ * might be the last one of the room, and waits for us to confirm it
+ *
+ * @param Takes in the shared memory pointer, the ServerVars struct, the
+ * full flag pipe and the full flag
+ *
+ */
+void confirmFull(int *qData, ServerVars *sv, int *fullFlag, int full) {
+	if (full) {
+		// if this is indeed the last player
 		if ( qData[sv->inv.count] == sv->s.players) {
 			
 			// we send confirmation to open another room
@@ -444,161 +1455,2887 @@ void servePlayer(int connfd, int *qData, ServerVars *sv, char **name,
 			// otherwise we lower the flag
 			full = 0;
 
-			// and let the game server know
-			write(fullFlag[1], &full, sizeof(full));		
-		}
+			// and let the game server know
+			write(fullFlag[1], &full, sizeof(full));		
+		}
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Serves a player that lost his connection and came back with
+ * his resumption token, optionally followed by the number of the last
+ * message he got. The slot we were given goes back to the room. If his
+ * seat is in our room (it was still filling up, nothing was said yet)
+ * we take it over and answer him, otherwise his socket goes to his
+ * room, which answers him, sends him what he missed and connects him
+ * to its chat. Either way his items stay reserved and nothing is parsed
+ * or reserved again
+ *
+ * @param Takes in the connection socket, the slot we were given, the
+ * request (after "RESUME ") and a pointer to the player's name
+ *
+ * @return 1 if he is back in our room, 0 if his room took over or -1
+ * if the token is not valid (anymore)
+ */
+int resumeRequest(int connfd, int slot, char *request, char **name) {
+	char response[LINE_LEN];	// response to the player
+	struct sockaddr_un addr;	// his room's address
+	socklen_t len;				// address length
+	PlayerSlot pl;				// request for his room
+	pid_t room;					// his room
+	int old;					// his seat there
+	unsigned long long secret;	// the token's secret
+	unsigned long since;		// last message he got
+	int gotSince;				// he told us which one
+	int sock;					// socket towards his room
+	int ok = 0;					// the seat is his
+
+	if (parseToken(request, &room, &old, &secret) < 0) {
+		room = -1;
+	}
+
+	gotSince = (sscanf(request, "%*s %lu", &since) == 1);
+
+	sem_wait(my_sem);
+
+	if ( (room == getppid()) && (old < slotCount) && (old != slot) && 
+		plSlots[old].detached && (plSlots[old].token == secret) ) {
+		// stopping the process that keeps his seat, we hold the
+		// semaphore so it isn't holding it
+		kill(plSlots[old].pid, SIGKILL);
+
+		// moving him to the slot of his new socket
+		plSlots[slot].pid = getpid();
+		strcpy(plSlots[slot].name, plSlots[old].name);
+		memcpy(plSlots[slot].request, plSlots[old].request, pSize);
+		plSlots[slot].token = secret;
+		plSlots[slot].seen = plSlots[old].seen;
+
+		// his items come along, the trades of the old seat are off
+		memcpy(holdings + slot*roomInv->count, holdings + old*roomInv->count,
+			sizeof(int)*roomInv->count);
+		memset(holdings + old*roomInv->count, 0, sizeof(int)*roomInv->count);
+		clearOffers(offers, slotCount, old);
+
+		plSlots[old].connfd = -1;
+		plSlots[old].detached = 0;
+		plSlots[old].token = 0;
+
+		ok = 1;
+	} else {
+		// giving the slot back
+		plSlots[slot].connfd = -1;
+	}
+
+	sem_post(my_sem);
+
+	if (ok) {
+		*name = strdup(plSlots[slot].name);
+
+		logMsg(LOG_INFO, "| Player > %s < is back in room %d |", *name, getppid());
+
+		tokenResponse(getppid(), slot, response);
+		sendFrame(connfd, response, sizeof(response));
+
+		return 1;
+	}
+
+	// his seat is in another room
+	if ( (room > 0) && (room != getppid()) ) {
+		bzero(&pl, sizeof(pl));
+		pl.pid = MIGRATE_RESUME;
+		pl.connfd = old;
+		pl.token = secret;
+		pl.detached = gotSince;
+		pl.seen = gotSince ? since : 0;
+
+		sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+		len = roomAddress(room, &addr);
+
+		if ( (connect(sock, (struct sockaddr *)&addr, len) == 0) &&
+			(sendFd(sock, connfd, &pl, sizeof(pl)) == 0) ) {
+			close(sock);
+			return 0;
+		}
+
+		close(sock);
+	}
+
+	// the seat is gone (or never existed)
+	strcpy(response, "Encountered a problem");
+	send(connfd, response, sizeof(response), MSG_NOSIGNAL);
+
+	return -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Serves a spectator. The slot we were given goes back to the
+ * room and his socket goes to the spectator relay of the room he asked
+ * for (ours if he didn't name one), which answers him
+ *
+ * @param Takes in the connection socket, the slot we were given and
+ * the request (after "WATCH")
+ *
+ */
+void watchRequest(int connfd, int slot, char *request) {
+	char response[LINE_LEN];	// response to the spectator
+	struct sockaddr_un addr;	// the relay's address
+	socklen_t len;				// address length
+	pid_t room = 0;				// the room he watches
+	int sock;					// socket towards the relay
+	int dummy = 0;				// payload of the handover
+
+	// giving the slot back
+	sem_wait(my_sem);
+	plSlots[slot].connfd = -1;
+	sem_post(my_sem);
+
+	if ( (sscanf(request, "%d", &room) != 1) || (room <= 0) ) {
+		room = getppid();
+	}
+
+	// a room that moved to another process keeps its relay
+	sem_wait(my_sem);
+	room = roomOrigin(roomTable, room);
+	sem_post(my_sem);
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	len = spectatorAddress(room, &addr);
+
+	if ( (connect(sock, (struct sockaddr *)&addr, len) == 0) &&
+		(sendFd(sock, connfd, &dummy, sizeof(dummy)) == 0) ) {
+		close(sock);
+		return;
+	}
+
+	close(sock);
+
+	// the room is gone, or it has no spectators
+	strcpy(response, "Encountered a problem");
+	send(connfd, response, sizeof(response), MSG_NOSIGNAL);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Builds the answer to an availability query from the snapshot,
+ * without taking the semaphore. In global pool mode the units the room
+ * can still borrow are added
+ *
+ * @param Takes in the ServerVars struct, the query (the items the
+ * player asks about, like a join request) and a pointer the answer's
+ * frames are returned in (freed by the caller)
+ *
+ * @return The number of frames
+ */
+int availAnswer(ServerVars *sv, char *request, char **text) {
+	Availability *snap;		// the snapshot
+	int *borrow = NULL;		// units the room can borrow
+	Inventory asked;		// the items he asks about
+	char *name;				// the query's first line
+	int frames;				// frames of the answer
+	int i;					// for counter
+
+	if ( (snap = malloc(availabilitySize(avail->size))) == NULL ) {
+		perror("Allocation error");
+		exit(1);
+	}
+
+	readAvailability(avail, snap);
+
+	// the pool is the one of the room's inventory
+	if ( sv->pool && (snap->catalog == sv->catalog) ) {
+		if ( (borrow = malloc(sizeof(int)*(snap->count + 1))) == NULL ) {
+			perror("Allocation error");
+			exit(1);
+		}
+
+		for (i=0; i<snap->count; ++i) {
+			borrow[i] = poolStock(sv->pool, i);
+		}
+	}
+
+	request[pSize-1] = '\0';
+	parseStrIntoInv(&name, request, &asked);
+
+	frames = formatAvailability(snap, borrow, &asked, text);
+
+	free(name);
+	freeInventory(&asked);
+	free(borrow);
+	free(snap);
+
+	return frames;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Answers an availability query, the player's process side. The
+ * slot we were given goes back to the room
+ *
+ * @param Takes in the connection socket, the slot we were given, the
+ * ServerVars struct and the query
+ *
+ */
+void availRequest(int connfd, int slot, ServerVars *sv, char *request) {
+	char *text;		// the answer
+	int frames;		// and its frames
+
+	frames = availAnswer(sv, request, &text);
+	send(connfd, text, (size_t)frames*pSize, MSG_NOSIGNAL);
+	free(text);
+
+	// giving the slot back
+	sem_wait(my_sem);
+	plSlots[slot].connfd = -1;
+	sem_post(my_sem);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Answers an availability query that already waits
+ * on a new connection, so it costs neither a slot nor a process. A
+ * query that hasn't arrived yet, or whose answer might not be sent
+ * without waiting, is served like any other request
+ *
+ * @param Takes in the connection socket and the ServerVars struct
+ *
+ * @return 1 if it was answered (and the connection closed), 0 if not
+ */
+int quickAvail(int connfd, ServerVars *sv) {
+	char request[pSize];	// the query
+	char *text;				// the answer
+	int frames;				// and its frames
+
+	if ( (recv(connfd, request, sizeof(request), MSG_PEEK | MSG_DONTWAIT) != sizeof(request)) ||
+		strncmp(request, "AVAIL", 5) ) {
+		return 0;
+	}
+
+	frames = availAnswer(sv, request, &text);
+
+	if (frames <= AVAIL_INLINE) {
+		recv(connfd, request, sizeof(request), MSG_DONTWAIT);
+		send(connfd, text, (size_t)frames*pSize, MSG_DONTWAIT | MSG_NOSIGNAL);
+		close(connfd);
+	}
+
+	free(text);
+
+	return frames <= AVAIL_INLINE;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Gives a player that reconnected through another
+ * room his seat back, if his token is still valid, and connects him to
+ * the chat. We answer him ourselves and queue the messages he missed
+ * before any live one, so nothing overtakes them
+ *
+ * @param Takes in the ServerVars struct, the shared memory pointer, the
+ * room's socket array, the pipe to the game server, his new socket and
+ * the request with his seat, his token and (if detached is set) the
+ * last message he got
+ *
+ */
+void resumeSlot(ServerVars *sv, int *qData, int *sockArray, int *plPipe, 
+	int connfd, PlayerSlot *pl) {
+	int slot = pl->connfd;		// his seat
+	char response[LINE_LEN];	// response to the player
+	char greeting[pSize];		// message for the player
+	int ok = 0;					// the seat is his
+
+	// he might be back before we noticed he left
+	syncSlots(sockArray);
+
+	sem_wait(my_sem);
+
+	if ( (slot < slotCount) && plSlots[slot].detached && 
+		(plSlots[slot].token == pl->token) ) {
+		// stopping the process that keeps his seat
+		kill(plSlots[slot].pid, SIGKILL);
+
+		plSlots[slot].connfd = connfd;
+		plSlots[slot].pid = 0;
+		plSlots[slot].detached = 0;
+
+		ok = 1;
+	}
+
+	sem_post(my_sem);
+
+	if (!ok) {
+		strcpy(response, "Encountered a problem");
+		send(connfd, response, sizeof(response), MSG_NOSIGNAL);
+		close(connfd);
+
+		return;
+	}
+
+	// his socket is new, the answer and the greeting leave right away
+	tokenResponse(getpid(), slot, response);
+	sendFrame(connfd, response, sizeof(response));
+
+	bzero(greeting, sizeof(greeting));
+	sprintf(greeting, "Reconnected to room %d\n", getpid());
+	sendFrame(connfd, greeting, sizeof(greeting));
+
+	attachSlot(slot, connfd, sockArray);
+
+	catchUp(sv, sockArray, slot, pl->detached ? pl->seen : plSlots[slot].seen);
+
+	logMsg(LOG_INFO, "| Player > %s < is back in room %d |", plSlots[slot].name, getpid());
+
+	if (fork() == 0) {
+		// closing up the listening and migration sockets
+		closeListeners(sv);
+		close(migSock);
+		dropRing();
+
+		// this process serves the player
+		rprocID = MYERRCODE;
+		plSlots[slot].pid = getpid();
+
+		// he was greeted already
+		playerSession(connfd, slot, plPipe, plSlots[slot].name, qData, sv, "");
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Writes the response of an accepted player. With seats kept
+ * for reconnecting players it carries his resumption token
+ *
+ * @param Takes in the player's room, his slot and the response buffer
+ *
+ */
+void tokenResponse(pid_t room, int slot, char *response) {
+	joinResponse(response, room, slot, plSlots[slot].token);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Sends a player whose room process changed (merged rooms, moved
+ * rooms) his token for the room he is in now. The messages he got are
+ * counted from the room's newest one from now on, which the frame
+ * carries where chat messages carry their number
+ *
+ * @param Takes in his socket, his slot and his token's secret
+ *
+ */
+void newRoomToken(int connfd, int slot, unsigned long long secret) {
+	char token[pSize];			// the frame
+	unsigned long long seen;	// newest message of the room
+
+	bzero(token, sizeof(token));
+	strcpy(token, "TOKEN ");
+	formatToken(token + 6, LINE_LEN, getppid(), slot, secret);
+	strcat(token, "\n");
+	seen = historyHead(history);
+	memcpy(token + FRAME_TEXT, &seen, sizeof(seen));
+	sendFrame(connfd, token, sizeof(token));
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Sends a player the messages that came after the
+ * given one, as far as the history goes back and his queue has room
+ * for (the newest ones if not all of them fit). They leave as a single
+ * batch behind whatever he has queued: one sendmsg with the select
+ * engine, one chain of linked sends with the ring and one write into
+ * his pipe with the zero-copy fan-out. The messages still in the relay
+ * pipe reach him a second time, his client drops them by their number
+ *
+ * @param Takes in the ServerVars struct, the room's socket array, the
+ * player's slot and the last message he got
+ *
+ */
+void catchUp(ServerVars *sv, int *sockArray, int slot, unsigned long long since) {
+	OutQueue *q = &(outQueues[slot]);		// his queue
+	SpliceQueue *sq = NULL;					// his pipe (zero-copy fan-out)
+	unsigned long long head = historyHead(history);	// newest message
+	unsigned long long seq = historyFrom(history, since);	// oldest we send
+	char (*frames)[pSize];					// messages copied for his pipe
+	int space;								// messages his queue takes
+	int n = 0;								// messages we send
+	int behind;								// his pipe wasn't empty
+
+	if ( (history->size == 0) || (sockArray[slot] < 0) || (seq > head) ) {
+		return;
+	}
+
+	if (spliceQueues) {
+		sq = &(spliceQueues[slot]);
+
+		if ( (sq->pipe[0] < 0) && (openSpliceQueue(sq, sv->s.backlog) < 0) ) {
+			logMsg(LOG_ERROR, "Couldn't open a player's pipe: %s", strerror(errno));
+			return;
+		}
+
+		space = sq->cap - sq->frames;
+	} else {
+		space = q->size - q->count;
+	}
+
+	if (space <= 0) {
+		return;
+	}
+
+	if (head - seq + 1 > (unsigned long long)space) {
+		seq = head - space + 1;
+	}
+
+	if (!spliceQueues) {
+		// straight into his queue, messages overwritten meanwhile are skipped
+		for (; seq <= head; ++seq) {
+			if (readHistory(history, seq, q->frames[(q->head + q->count) % q->size]) == 0) {
+				++q->count;
+			}
+		}
+
+		logMsg(LOG_DEBUG, "| Room %d: Player > %s < catches up, %d messages queued |",
+			getpid(), plSlots[slot].name, q->count);
+
+		// the ring sends them when its loop comes around
+		if ( !ioRing && (flushOutQueue(q, sockArray[slot]) < 0) ) {
+			resetOutQueue(q);	// player is gone, his process will notice
+		}
+
+		return;
+	}
+
+	if ( (frames = malloc(sizeof(*frames)*(head - seq + 1))) == NULL ) {
+		logMsg(LOG_ERROR, "Allocation error -> catch-up: %s", strerror(errno));
+		return;
+	}
+
+	for (; seq <= head; ++seq) {
+		if (readHistory(history, seq, frames[n]) == 0) {
+			++n;
+		}
+	}
+
+	logMsg(LOG_DEBUG, "| Room %d: Player > %s < catches up, %d messages |",
+		getpid(), plSlots[slot].name, n);
+
+	behind = (sq->frames > 0);
+
+	if ( (n > 0) && ((writeSpliceQueue(sq, frames, n) < 0) ||
+		(!behind && (flushSpliceQueue(sq, sockArray[slot]) < 0))) ) {
+		closeSpliceQueue(sq);
+	}
+
+	free(frames);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Handles a player's HISTORY request, passed on by
+ * his process
+ *
+ * @param Takes in the ServerVars struct, the room's socket array, the
+ * room event and its text (the last message the player got)
+ *
+ */
+void historyRequest(ServerVars *sv, int *sockArray, int sender, char *text) {
+	int fd = RELAY_HISTORY_FD(sender);	// the player's socket
+	int i;								// for counter
+
+	for (i=0; i<slotCount; ++i) {
+		if (sockArray[i] == fd) {
+			text[FRAME_TEXT-1] = '\0';
+			catchUp(sv, sockArray, i, strtoull(text, NULL, 10));
+
+			return;
+		}
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Connects a served player to the chat. When the player leaves
+ * we update the player counter, free his slot and wake up the room so
+ * that it notices. Then we terminate his process
+ *
+ * @param Takes in the connection socket, the player's slot, the pipe
+ * to the game server, the player's name, the shared memory pointer,
+ * the ServerVars struct and an optional greeting that replaces the
+ * wait for the other players (empty if the room greeted him)
+ *
+ */
+void playerSession(int connfd, int slot, int *plPipe, char *name, int *qData, 
+	ServerVars *sv, char *greeting) {
+	RelayMsg wakeup;	// room event telling the room to check on us
+
+	unsigned left = sv->s.grace;	// seconds his seat still waits
+
+	TokenBucket bucket;	// how many messages he may send
+
+	initBucket(&bucket, sv->s.rate, sv->s.burst, sv->s.limit, monoTime());
+
+	// connecting the player to the chat
+	if (chat(connfd, slot, plPipe, name, qData, sv->inv.count, sv->s.players, greeting,
+		(sv->s.rate > 0) ? &bucket : NULL) == CHAT_MOVED) {
+		// the room moves him to another room and sends his socket there
+		// once it reads this, after his last message
+		wakeup.sender = RELAY_WAKEUP;
+		wakeup.to = ROUTE_SLOT(slot);
+		wakeup.text[0] = '\0';
+		write(plPipe[1], &wakeup, sizeof(wakeup));
+
+		exit(0);
+	}
+
+	// keeping his seat for a while, he might come back with his token.
+	// If he does, the room stops us
+	if (plSlots[slot].token && (left > 0)) {
+		sem_wait(my_sem);
+		plSlots[slot].detached = 1;
+
+		// a room that was moving him leaves him behind
+		plSlots[slot].draining = 0;
+		sem_post(my_sem);
+
+		// letting the room know it has to stop sending to him
+		wakeup.sender = RELAY_WAKEUP;
+		wakeup.to = ROUTE_ALL;
+		wakeup.text[0] = '\0';
+		write(plPipe[1], &wakeup, sizeof(wakeup));
+
+		logMsg(LOG_INFO, "| Player > %s < lost his connection, his seat waits %d seconds |", 
+			name, sv->s.grace);
+
+		while (left > 0) {
+			left = sleep(left);
+		}
+	}
+
+	// lost connection to the player
+	sem_wait(my_sem);
+	freeSlot(sv, qData, slot);
+	sem_post(my_sem);
+
+	// letting the room know, it might be empty or sparse now
+	wakeup.sender = RELAY_WAKEUP;
+	wakeup.to = ROUTE_ALL;
+	wakeup.text[0] = '\0';
+	write(plPipe[1], &wakeup, sizeof(wakeup));
+
+	// informing the server side that a player disconnected
+	logMsg(LOG_INFO, "| Player > %s < left room %d |", name, getppid());
+
+	// exiting this process
+	exit(0);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Gives a player's seat up: the room has one player less, and
+ * his channels, his items and his trades go with him. Must be called
+ * while holding the semaphore
+ *
+ * @param Takes in the ServerVars struct, the shared memory pointer and
+ * his slot
+ *
+ */
+void freeSlot(ServerVars *sv, int *qData, int slot) {
+	int i;	// for counter
+
+	updateCount(qData, sv->inv.count, -1);
+	plSlots[slot].connfd = -1;
+	plSlots[slot].detached = 0;
+	plSlots[slot].draining = 0;
+
+	// the next player in the slot starts on no channel
+	for (i=0; i<MAX_CHANNELS; ++i) {
+		leaveChannel(channels, chanBits, chanWords, i, slot);
+	}
+
+	memset(holdings + slot*sv->inv.count, 0, sizeof(int)*sv->inv.count);
+	clearOffers(offers, slotCount, slot);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Checks whether the player's request could be served by a room
+ * that still has all of its items. Players asking for items that do not
+ * exist or going over the quota can never be served, so they don't wait
+ *
+ * @param Takes in the ServerVars struct and the player's inventory
+ *
+ * @return 1 if the player can wait for a new room or 0 if not
+ */
+int canWait(ServerVars *sv, Inventory plInv) {
+	int qFresh[sv->inv.count + 1];	// quantities of a fresh room
+
+	if (sv->s.waitlist <= 0) {
+		return 0;	// waitlist mode is off
+	}
+
+	memcpy(qFresh, sv->inv.quantity, sizeof(int)*sv->inv.count);
+
+	return subInventories(&sv->inv, plInv, qFresh, sv->s.quota);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Gives a player his items out of the room's quantities and
+ * returns holding the semaphore. In global pool mode the room first
+ * borrows what it is missing from the pool, before taking the
+ * semaphore, so the room's other players don't wait for the pool. If
+ * they took the units in the meantime, it borrows again
+ *
+ * @param Takes in the ServerVars struct, the player's inventory and
+ * the shared memory pointer
+ *
+ * @return 1 if the items were subtracted or 0 if not
+ */
+int reserveItems(ServerVars *sv, Inventory plInv, int *qData) {
+	int *lent;		// units borrowed for him, per item
+	int tries = 0;	// times we borrowed
+	int got;		// units borrowed the last time
+	int status;		// the items were subtracted
+
+	if (sv->pool == NULL) {
+		sem_wait(my_sem);
+
+		return subInventories(&sv->inv, plInv, qData, sv->s.quota);
+	}
+
+	if ( (lent = malloc(sizeof(int)*(sv->inv.count + 1))) == NULL ) {
+		perror("Allocation error");
+		exit(1);
+	}
+
+	for (;;) {
+		got = topUpRoom(sv->pool, &sv->inv, plInv, qData, sv->s.quota, lent);
+
+		sem_wait(my_sem);
+		addLent(sv->pool, lent, qData);
+
+		status = subInventories(&sv->inv, plInv, qData, sv->s.quota);
+
+		if ( status || (got < 0) || (++tries == RESERVE_TRIES) ) {
+			break;
+		}
+
+		sem_post(my_sem);
+	}
+
+	free(lent);
+
+	return status;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Publishes what the room has left for the availability
+ * queries. Must be called while holding the semaphore
+ *
+ * @param Takes in the ServerVars struct, the shared memory pointer, the
+ * room's pid and whether the room just opened
+ *
+ */
+void showAvailability(ServerVars *sv, int *qData, pid_t room, int opened) {
+	if (avail) {
+		publishAvailability(avail, room, opened, sv->catalog, &sv->inv, qData);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. In global pool mode gives the items the room
+ * borrowed and didn't hand out back to the pool, once it takes no more
+ * players
+ *
+ * @param Takes in the ServerVars struct and the shared memory pointer
+ *
+ */
+void releaseStock(ServerVars *sv, int *qData) {
+	int units;	// units given back
+
+	if (sv->pool == NULL) {
+		return;
+	}
+
+	sem_wait(my_sem);
+	units = returnRoomStock(sv->pool, qData);
+	sem_post(my_sem);
+
+	if (units > 0) {
+		logMsg(LOG_DEBUG, "| Room %d: Gave %d items back to the pool |", getpid(), units);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Main server side. Reports to the room directory how many more
+ * players this node takes. Without an answer for a while the node it
+ * suggested is forgotten, we keep our players then
+ *
+ * @param Takes in the ServerVars struct and whether the directory's
+ * last answer is too old
+ *
+ */
+void reportNode(ServerVars *sv, int stale) {
+	int free = DIR_FREE_ANY;	// players we can take
+
+	sem_wait(my_sem);
+
+	if (sv->s.nodeLimit > 0) {
+		free = sv->s.nodeLimit - roomPlayers(roomTable);
+	}
+
+	if (stale) {
+		roomTable->nextNode[0] = '\0';
+	}
+
+	sem_post(my_sem);
+
+	reportLoad(sv->dirSock, sv->s.nodeAddr, (free > 0) ? free : 0);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Once the node has as many players as it takes (-L),
+ * the players that join are sent to the node the directory suggests: a
+ * "MOVE" response, then a frame with its address. Players a node sent
+ * us stay, so nobody goes around in circles
+ *
+ * @param Takes in the player's socket and slot and the ServerVars struct
+ *
+ * @return 1 if the player was sent on or 0 if we take him
+ */
+int redirectPlayer(int connfd, int slot, ServerVars *sv) {
+	char response[LINE_LEN];	// the redirect
+	char addr[pSize];			// and where it sends him
+	int busy = 0;				// we send him on
+
+	if (sv->s.nodeLimit <= 0) {
+		return 0;
+	}
+
+	sem_wait(my_sem);
+
+	if ( roomTable->nextNode[0] && (roomPlayers(roomTable) >= sv->s.nodeLimit) ) {
+		busy = 1;
+
+		bzero(addr, sizeof(addr));
+		strcpy(addr, roomTable->nextNode);
+
+		// giving the slot back
+		plSlots[slot].connfd = -1;
+	}
+
+	sem_post(my_sem);
+
+	if (busy) {
+		logMsg(LOG_DEBUG, "| Room %d: Node is full, a player was sent to %s |", getppid(), addr);
+		strcat(addr, "\n");
+
+		bzero(response, sizeof(response));
+		strcpy(response, "MOVE\n");
+
+		send(connfd, response, sizeof(response), MSG_NOSIGNAL);
+		send(connfd, addr, sizeof(addr), MSG_NOSIGNAL);
+	}
+
+	return busy;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Main server side. Receives a player from a room and adds him
+ * to the waitlist, answering with his position and estimated wait. If
+ * the waitlist is full the player is rejected as usual. After an
+ * upgrade the new server's rooms serve him, so he goes to its waitlist
+ *
+ * @param Takes in the ServerVars struct and the socket he comes through
+ *
+ */
+void enqueueWaiting(ServerVars *sv, int sock) {
+	char plStr[pSize];			// the player's request
+	char response[LINE_LEN];	// response to the player
+	Inventory plInv;			// the request in our struct
+	char *name = NULL;			// player's name
+	int connfd;					// player's socket
+	int slot;					// entry in the waitlist
+	int pos;					// position in the waitlist
+
+	if ( (connfd = recvFd(sock, plStr, sizeof(plStr))) < 0 ) {
+		return;
+	}
+
+	// the new server's rooms serve him now
+	if (sv->upTo >= 0) {
+		if (sendFd(sv->upTo, connfd, plStr, sizeof(plStr)) < 0) {
+			strcpy(response, "Encountered a problem");
+			send(connfd, response, sizeof(response), MSG_NOSIGNAL);
+		}
+
+		close(connfd);
+		return;
+	}
+
+	plStr[pSize-1] = '\0';
+	parseStrIntoInv(&name, plStr, &plInv);
+
+	slot = pushWaitlist(&(sv->wl), connfd, plStr, plInv.quota);
+
+	if (slot < 0) {
+		// no room left on the waitlist
+		strcpy(response, "Encountered a problem");
+		send(connfd, response, sizeof(response), MSG_NOSIGNAL);
+		close(connfd);
+	} else {
+		pos = waitPosition(&(sv->wl), slot);
+		sprintf(response, "WAIT %d %d\n", pos,
+			waitEstimate(&(sv->wl), pos, sv->s.players));
+
+		send(connfd, response, sizeof(response), MSG_NOSIGNAL);
+
+		logMsg(LOG_INFO, "| Player > %s < is waiting for a room (position %d) |", name, pos);
+	}
+
+	freeInventory(&plInv);
+	free(name);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Main server side. Pops waiting players in priority order and
+ * keeps the ones a fresh room can serve together. Players that don't
+ * fit go back to the waitlist in O(log n) each
+ *
+ * @param Takes in the ServerVars struct
+ *
+ */
+void pickWaiting(ServerVars *sv) {
+	Waitlist *wl = &(sv->wl);
+	int qFresh[sv->inv.count + 1];	// quantities of the new room
+	int skipped[wl->count + 1];		// entries that have to wait more
+	int skipCount = 0;				// number of skipped entries
+	Inventory plInv;				// a waiting player's request
+	char *name = NULL;				// his name
+	int slot;						// entry we popped
+	int i;							// for counter
+
+	wl->admitCount = 0;
+
+	memcpy(qFresh, sv->inv.quantity, sizeof(int)*sv->inv.count);
+
+	// the new room gets what the pool has left
+	if (sv->pool) {
+		for (i=0; i<sv->inv.count; ++i) {
+			qFresh[i] = poolStock(sv->pool, i);
+		}
+	}
+
+	while ( (wl->admitCount < sv->s.players) && 
+		((slot = popWaitSlot(wl)) >= 0) ) {
+		parseStrIntoInv(&name, wl->entries[slot].request, &plInv);
+
+		if (subInventories(&sv->inv, plInv, qFresh, sv->s.quota)) {
+			wl->admitted[wl->admitCount++] = slot;
+		} else {
+			skipped[skipCount++] = slot;
+		}
+
+		freeInventory(&plInv);
+		free(name);
+	}
+
+	for (i=0; i<skipCount; ++i) {
+		pushWaitSlot(wl, skipped[i]);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Main server side, called after the inventory was reloaded.
+ * Turns away the waiting players a fresh room can't serve anymore (their
+ * items are gone from the new inventory), instead of keeping them for
+ * ever
+ *
+ * @param Takes in the ServerVars struct
+ *
+ */
+void pruneWaiting(ServerVars *sv) {
+	Waitlist *wl = &(sv->wl);
+	int kept[wl->count + 1];	// entries that still wait
+	int keptCount = 0;			// number of them
+	char response[LINE_LEN];	// response to a player we turn away
+	Inventory plInv;			// a waiting player's request
+	char *name = NULL;			// his name
+	int slot;					// entry we popped
+	int i;						// for counter
+
+	while ( (slot = popWaitSlot(wl)) >= 0 ) {
+		parseStrIntoInv(&name, wl->entries[slot].request, &plInv);
+
+		if (canWait(sv, plInv)) {
+			kept[keptCount++] = slot;
+		} else {
+			logMsg(LOG_INFO, "| Player > %s < can't be served by the new inventory |", name);
+
+			strcpy(response, "Encountered a problem");
+			send(wl->entries[slot].connfd, response, sizeof(response), MSG_NOSIGNAL);
+			close(wl->entries[slot].connfd);
+			releaseWaitSlot(wl, slot);
+		}
+
+		freeInventory(&plInv);
+		free(name);
+	}
+
+	for (i=0; i<keptCount; ++i) {
+		pushWaitSlot(wl, kept[i]);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Main server side, called after a new room was forked. Closes
+ * our copy of the sockets the room took over and sends the players that
+ * are still waiting their new position
+ *
+ * @param Takes in the ServerVars struct
+ *
+ */
+void notifyWaiting(ServerVars *sv) {
+	Waitlist *wl = &(sv->wl);
+	char response[LINE_LEN];	// update for the waiting players
+	int gone[wl->count + 1];	// entries of the players that left
+	int goneCount = 0;			// number of them
+	int i, j;					// for counters
+	int pos;					// position of a waiting player
+
+	for (i=0; i<wl->admitCount; ++i) {
+		close(wl->entries[wl->admitted[i]].connfd);
+		releaseWaitSlot(wl, wl->admitted[i]);
+	}
+
+	wl->admitCount = 0;
+
+	// the heap stays as it is while we walk it, removing a node would
+	// move the others around
+	for (i=0; i<wl->count; ++i) {
+		pos = waitPosition(wl, wl->heap[i]);
+		sprintf(response, "WAIT %d %d\n", pos, waitEstimate(wl, pos, sv->s.players));
+
+		if (send(wl->entries[wl->heap[i]].connfd, response, sizeof(response), 
+			MSG_NOSIGNAL | MSG_DONTWAIT) < 0 && errno != EAGAIN) {
+			gone[goneCount++] = wl->heap[i];
+		}
+	}
+
+	// dropping the players that left while waiting
+	for (j=0; j<goneCount; ++j) {
+		for (i=0; wl->heap[i] != gone[j]; ++i);
+
+		close(wl->entries[gone[j]].connfd);
+		releaseWaitSlot(wl, removeWaitNode(wl, i));
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Reserves the items of the waiting players that the
+ * main server picked for this room and connects them to the chat. The
+ * sockets of the players that keep waiting are closed since the main
+ * server holds them
+ *
+ * @param Takes in the ServerVars struct, the shared memory pointer, the
+ * socket array and the pipe to the game server
+ *
+ */
+void admitWaiting(ServerVars *sv, int *qData, int *sockArray, int *plPipe) {
+	Waitlist *wl = &(sv->wl);
+	WaitEntry *e;				// entry we are serving
+	Inventory plInv;			// the player's request
+	char *name = NULL;			// his name
+	char response[LINE_LEN];	// response to the player
+	int status;					// reservation status
+	int slot = -1;				// player's slot
+	int i;						// for counter
+
+	// these players stay with the main server
+	for (i=0; i<wl->count; ++i) {
+		close(wl->entries[wl->heap[i]].connfd);
+	}
+
+	for (i=0; i<wl->admitCount; ++i) {
+		e = &(wl->entries[wl->admitted[i]]);
+
+		parseStrIntoInv(&name, e->request, &plInv);
+
+		// locking the segment (critical section)
+		status = reserveItems(sv, plInv, qData);
+		showAvailability(sv, qData, getpid(), 0);
+
+		if (status) {
+			updateCount(qData, sv->inv.count, 1);
+		}
+
+		// unlocking the segment
+		sem_post(my_sem);
+
+		// a new room always has a free slot for them
+		if (status) {
+			slot = claimSlot(e->connfd, sockArray);
+
+			strncpy(plSlots[slot].name, name, LINE_LEN-1);
+			plSlots[slot].name[LINE_LEN-1] = '\0';
+			memcpy(plSlots[slot].request, e->request, pSize);
+			plSlots[slot].token = (sv->s.grace > 0) ? newToken() : 0;
+
+			// nobody trades before his process runs
+			fillHoldings(holdings + slot*sv->inv.count, &(sv->inv), plInv);
+		}
+
+		freeInventory(&plInv);
+
+		if (!status) {
+			// the main server checked this already, so it shouldn't happen
+			strcpy(response, "Encountered a problem");
+			send(e->connfd, response, sizeof(response), MSG_NOSIGNAL);
+			close(e->connfd);
+			free(name);
+			continue;
+		}
+
+		if (fork() == 0) {
+			// closing up the listening sockets
+			closeListeners(sv);
+
+			// the room keeps the migration socket and the ring for itself
+			close(migSock);
+			dropRing();
+
+			// this process serves a player
+			rprocID = MYERRCODE;
+			plSlots[slot].pid = getpid();
+
+			logMsg(LOG_INFO, "| Player > %s < connected from the waitlist |", name);
+
+			// the player has been waiting for this
+			tokenResponse(getppid(), slot, response);
+			if (write(e->connfd, response, sizeof(response)) < 0) {
+				perror("Couldn't respond to the player");
+				exit(1);
+			}
+
+			playerSession(e->connfd, slot, plPipe, name, qData, sv, NULL);
+		}
+
+		free(name);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Initiates the chat. This function handles the server-player side
+ * where if the player sends a message we push it to the game server for 
+ * further distribution
+ *
+ * @param Takes in the connection socket, the player's slot, a pipe to reach
+ * the game server, the player's name to attach to his messages, the
+ * shared memory pointer, the player counter's index, the players per
+ * room, a greeting for
+ * players that join a game in progress (NULL for new players) and his
+ * message allowance (NULL if there is no limit)
+ *
+ * @return 0 if the player left, 1 if he left before the game started or
+ * CHAT_MOVED if the room moves him (the message in hand went out first)
+ */
+int chat(int connfd, int slot, int *plPipe, char *name, int *qData, 
+	int plCountPos, int players, char *greeting, TokenBucket *bucket) {
+	// this end of the pipe to send messages
+	int fd2 = plPipe[1];
+
+	// declaring a buffer for the raw message
+	char raw[pSize];
+
+	// declaring a string that will hold the final message
+	char message[pSize];
+
+	// message in the form the game server expects it
+	RelayMsg relay;
+
+	// 100ms periods we waited for the game to start
+	int waited = 0;
+
+	// bytes we read from the player
+	ssize_t n;
+
+	// bytes of the frame being read, a frame can come in pieces
+	size_t got = 0;
+
+	// seconds until the player may send again
+	double wait;
+
+	// messages of his we dropped since the last one that went through
+	int dropped = 0;
+
+	// his message carries trace stamps, and the one before did
+	int traced = 0, wasTraced = 0;
+
+	// chars of his message that fit in a frame after his name
+	int left;
+
+	// the part of his message the other players read
+	char *body;
+
+	// the player's socket, while we wait for the others
+	struct pollfd pfd;
+
+	// read fd set (the pipe is not watched for writing, it is
+	// almost always writable and select would never block)
+	fd_set read_set;
+
+	// sigusr1 from the room (it is moving the player) is only let in
+	// while we wait for him, so it never cuts a message in half
+	sigset_t usr1, waitMask;
+
+	// until everyone is connected tell the player to wait (the zeroed
+	// tail tells him it's not a chat message)
+	bzero(message, sizeof(message));
+	strcpy(message, "Waiting for more players ...\n");
+
+	// nothing left over in the relay looks like trace stamps
+	bzero(&relay, sizeof(relay));
+
+	pfd.fd = connfd;
+	pfd.events = POLLIN;
+
+	// waiting for other players, unless the game is already running
+	sem_wait(my_sem);	// entering critical area
+	while ( (qData[plCountPos] != players) && !qData[plCountPos+1] ) {
+		sem_post(my_sem);	// leaving critical area
+
+		// the room is moving the player, his last frame went out whole
+		if (__atomic_load_n(&(plSlots[slot].draining), __ATOMIC_ACQUIRE)) {
+			return CHAT_MOVED;
+		}
+
+		// reminding the player every 5 seconds
+		if ( !(waited % 50) && (sendFrame(connfd, message, sizeof(message)) < 0) ) {
+			return 1;
+		}
+
+		// the room might start early (fill deadline), so we
+		// check every 100ms instead of sleeping for 5. A player that
+		// leaves meanwhile is noticed right away, so that his seat
+		// can wait for him
+		if (poll(&pfd, 1, 100) > 0) {
+			if ( ((n = recv(connfd, raw, 1, MSG_PEEK | MSG_DONTWAIT)) == 0) ||
+				((n < 0) && (errno != EAGAIN) && (errno != EINTR)) ) {
+				close(connfd);
+				return 1;
+			}
+
+			// he is typing already, his messages wait in the socket
+			usleep(100000);
+		}
+		++waited;
+
+		sem_wait(my_sem);	// entering critical area
+	}
+	sem_post(my_sem);	// leaving critical area
+
+	// letting the player know the game is starting (an empty greeting
+	// means the room greeted him already)
+	if (greeting) {
+		strncpy(message, greeting, FRAME_TEXT-1);
+	} else {
+		strcpy(message, "START\n");
+	}
+
+	if ( message[0] && (sendFrame(connfd, message, sizeof(message)) < 0) ) {
+		return 1;
+	}
+
+	sigemptyset(&usr1);
+	sigaddset(&usr1, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &usr1, &waitMask);
+
+	while (1) {
+		// the room is moving the player, it sends his socket on
+		// once no frame of his is half read
+		if ( (got == 0) && __atomic_load_n(&(plSlots[slot].draining), __ATOMIC_ACQUIRE) ) {
+			return CHAT_MOVED;
+		}
+
+		// zeroing the read fd set
+		FD_ZERO(&read_set);
+
+		// adding the socket to the set
+		FD_SET(connfd, &read_set);	// reading list
+
+		// using select to check if the socket is ready to read
+		if(pselect(connfd+1, &read_set, NULL, NULL, NULL, &waitMask) > 0) {
+			// checking if connfd is read to read
+			if (FD_ISSET(connfd, &read_set)) {
+				// attempting to read 
+				if ( (n = read(connfd, raw + got, sizeof(raw) - got)) > 0 ) {
+					// the stamps sit at the end of the frame, so only a
+					// whole one is a message
+					if ( (got += n) < sizeof(raw) ) {
+						continue;
+					}
+
+					got = 0;
+					raw[pSize-1] = '\0';
+
+					// his client traces this one, from here on it is
+					// stamped at every stage
+					if ( (traced = isTraced(raw, sizeof(raw))) ) {
+						traceStamp(raw, TRACE_READ);
+						raw[TRACE_AT-1] = '\0';
+					}
+
+					// the player is sending faster than he may, so his
+					// message waits for its turn or is dropped before
+					// it costs the room anything
+					while ( bucket && ((wait = takeToken(bucket, monoTime())) > 0) ) {
+						if (bucket->policy == LIMIT_DROP) {
+							break;
+						}
+
+						usleep(wait*1e6 + 1);
+					}
+
+					if ( bucket && (wait > 0) ) {
+						if (!dropped++) {
+							logMsg(LOG_INFO, "| Player > %s < is flooding the room, dropping his messages |", name);
+						}
+
+						continue;
+					} else if (dropped) {
+						logMsg(LOG_INFO, "| Player > %s < had %d messages dropped |", name, dropped);
+						dropped = 0;
+					}
+
+					// the player missed messages, the room sends them
+					// to him, behind the ones he has queued
+					if (!strncmp(raw, "HISTORY", 7)) {
+						relay.sender = RELAY_HISTORY(connfd);
+						relay.to = ROUTE_ALL;
+						snprintf(relay.text, FRAME_TEXT, "%llu", strtoull(raw + 7, NULL, 10));
+						write(fd2, &relay, sizeof(relay));
+
+						continue;
+					}
+
+					// banned words are masked, or the message goes nowhere.
+					// Only what the others read is looked at, a player or
+					// an item a command names is left alone
+					if ( currentFilter(filterCtl, &filter, &filterGen) &&
+						(body = messageBody(raw)) &&
+						scanFilter(filter, body, filterCtl->policy == FILTER_MASK) &&
+						(filterCtl->policy == FILTER_REJECT) ) {
+						relay.sender = connfd;
+						relay.to = ROUTE_SLOT(slot);
+						bzero(relay.text, pSize);
+						strcpy(relay.text, "Your message was not relayed, it has banned words");
+						write(fd2, &relay, sizeof(relay));
+
+						continue;
+					}
+
+					// only some players get it
+					if (chatCommand(connfd, slot, name, raw, &relay)) {
+						write(fd2, &relay, sizeof(relay));
+
+						continue;
+					}
+
+					// trades answer the players themselves
+					if (tradeCommand(connfd, slot, name, raw, &relay, fd2)) {
+						continue;
+					}
+
+					// the sender's socket num goes along with the
+					// message, in a single write so that messages
+					// of different players never interleave
+					relay.sender = connfd;
+					relay.to = ROUTE_ALL;
+
+					// adding the players name to the raw message, which
+					// is cut where the frame (or its stamps) begins
+					left = (traced ? TRACE_AT : FRAME_TEXT) - strlen(name) - 5;
+					snprintf(relay.text, FRAME_TEXT, "[%s]: %.*s", name, left, raw);
+
+					// the stamps of the last traced message must not
+					// go to the history, or with the next message. A
+					// longer message wrote over them already
+					if ( wasTraced && (strlen(relay.text) < TRACE_AT) ) {
+						clearTrace(relay.text);
+					}
+
+					// numbering it, keeping it in the room's history and
+					// writing it before any other player's process
+					// numbers one, so the room relays them in order
+					sem_wait(&(history->order));
+					recordHistory(history, relay.text, name);
+
+					if (traced) {
+						copyTrace(relay.text, raw);
+						traceStamp(relay.text, TRACE_PIPED);
+					}
+
+					wasTraced = traced;
+
+					// writing the message
+					write(fd2, &relay, sizeof(relay));
+					sem_post(&(history->order));
+
+					transcribe(transcriptSock, frameSeq(relay.text), name, "", raw);
+				} else if ( (n < 0) && (errno == EAGAIN) ) {
+					// the room made the socket non blocking
+					continue;
+				} else {
+					// closing this socket
+					close(connfd);
+					
+					// lost connection to the player, so we exit the chat
+					break;
+				}
+			} // connfd is set 
+		} // select
+	} // while
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Finds the part of a player's message the other players read,
+ * the one banned words are looked for in: all of a message to the room,
+ * the text after the player or the channel of a whisper or a channel
+ * message, and nothing of the other commands
+ *
+ * @param Takes in the raw message
+ *
+ * @return The text or NULL if it has none
+ */
+char *messageBody(char *raw) {
+	char word[LINE_LEN];	// the player or channel
+	int at = 0;				// where the text begins
+
+	if ( !strncmp(raw, "WHISPER ", 8) || !strncmp(raw, "CHANNEL ", 8) ) {
+		if ( (sscanf(raw + 8, "%31s %n", word, &at) == 1) && (at > 0) ) {
+			return raw + 8 + at;
+		}
+
+		return NULL;
+	}
+
+	if ( !strncmp(raw, "JOIN ", 5) || !strncmp(raw, "LEAVE ", 6) || !strncmp(raw, "TRADE ", 6) ||
+		!strncmp(raw, "ACCEPT ", 7) || !strncmp(raw, "ITEMS", 5) ) {
+		return NULL;
+	}
+
+	return raw;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Turns the commands that don't go to the whole room (whispers,
+ * channel messages, JOIN and LEAVE, see routeCommand) into a message for
+ * the room. Only broadcasts are numbered and kept in the history, so
+ * these never show up in anyone else's catch-up, the transcript gets
+ * whispers and channel messages from here
+ *
+ * @param Takes in the player's socket, his slot, his name, the raw
+ * message and the message for the room to fill in
+ *
+ * @return 1 if it was one of these commands, 0 otherwise
+ */
+int chatCommand(int connfd, int slot, char *name, char *raw, RelayMsg *relay) {
+	char target[LINE_LEN+1];	// the player or channel it went to, for the transcript
+	char *body;					// what the others read (NULL for a notice)
+
+	if (!routedCommand(raw)) {
+		return 0;
+	}
+
+	sem_wait(my_sem);
+	routeCommand(channels, chanBits, chanWords, findPlayer, NULL, slot, name, raw,
+		relay->text, &(relay->to), &body);
+
+	// the transcript names channels the way the players do
+	if (body && (relay->to > 0)) {
+		snprintf(target, sizeof(target), "%s", plSlots[ROUTE_SLOT_OF(relay->to)].name);
+	} else if (body) {
+		snprintf(target, sizeof(target), "#%s", channels[ROUTE_CHANNEL_OF(relay->to)].name);
+	}
+
+	sem_post(my_sem);
+
+	relay->sender = connfd;
+
+	if (body) {
+		transcribe(transcriptSock, 0, name, target, body);
+	}
+
+	return 1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Looks for a connected player of the room by his name. Must be
+ * called while holding the semaphore
+ *
+ * @param Takes in the name (and what routeCommand passes along, unused)
+ *
+ * @return His slot or -1 if he isn't in the room
+ */
+int findPlayer(char *name, void *ctx) {
+	int i;	// for counter
+
+	(void) ctx;	// unused
+
+	for (i=0; i<slotCount; ++i) {
+		if ( (plSlots[i].connfd >= 0) && !plSlots[i].detached &&
+			!strcmp(plSlots[i].name, name) ) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Handles the trade commands: "TRADE <player> <item> <n> <item>
+ * <m>" offers another player n units of the first item for m of the
+ * second one (replacing our previous offer), "ACCEPT <player>" takes the
+ * offer he made us and "ITEMS" lists what we hold. Offers and holdings
+ * live in the room's segment and an accepted trade changes both players'
+ * holdings under the semaphore, so it happens whole or not at all and
+ * nobody gives away an item twice. The answers are notices, written to
+ * the room here since a trade tells both players
+ *
+ * @param Takes in the player's socket, his slot, his name, the raw
+ * message, a message to fill in and the pipe to the room
+ *
+ * @return 1 if it was a trade command, 0 otherwise
+ */
+int tradeCommand(int connfd, int slot, char *name, char *raw, RelayMsg *relay, int fd2) {
+	char who[LINE_LEN];		// the other player
+	char give[LINE_LEN];	// item given
+	char want[LINE_LEN];	// and item asked for
+	int giveN, wantN;		// their units
+	int g = -1, w = -1;		// their positions in the room
+	int other;				// the other player's slot
+	int *held;				// the items we hold
+	TradeOffer o;			// the offer we accept
+	int status = TRADE_NO_OFFER;	// trade result
+	int posted = 0;			// our offer is out
+	int at;					// chars written
+	int i;					// for counter
+
+	if ( strncmp(raw, "TRADE ", 6) && strncmp(raw, "ACCEPT ", 7) && strncmp(raw, "ITEMS", 5) ) {
+		return 0;
+	}
+
+	// notices go back to the player, they carry no number
+	relay->sender = connfd;
+	relay->to = ROUTE_SLOT(slot);
+	bzero(relay->text, pSize);
+
+	if (!strncmp(raw, "ITEMS", 5)) {
+		at = snprintf(relay->text, FRAME_TEXT, "Your items:");
+
+		sem_wait(my_sem);
+		held = holdings + slot*roomInv->count;
+		for (i=0; (i < roomInv->count) && (at < (int)FRAME_TEXT); ++i) {
+			if (held[i] > 0) {
+				at += snprintf(relay->text + at, FRAME_TEXT - at, " %s %d", roomInv->items[i],
+					held[i]);
+			}
+		}
+		sem_post(my_sem);
+	} else if (sscanf(raw, "TRADE %31s %31s %d %31s %d", who, give, &giveN, want, &wantN) == 5) {
+		if ( (giveN <= 0) || (wantN <= 0) || !findItem(*roomInv, give, &g) ||
+			!findItem(*roomInv, want, &w) || (g == w) ) {
+			snprintf(relay->text, FRAME_TEXT, "Not a valid trade");
+			write(fd2, relay, sizeof(*relay));
+			return 1;
+		}
+
+		sem_wait(my_sem);
+		other = findPlayer(who, NULL);
+
+		if ( (other >= 0) && (other != slot) &&
+			(holdings[slot*roomInv->count + g] >= giveN) ) {
+			offers[slot].give = g;
+			offers[slot].giveN = giveN;
+			offers[slot].want = w;
+			offers[slot].wantN = wantN;
+			offers[slot].to = other;
+			posted = 1;
+		}
+		sem_post(my_sem);
+
+		if ( (other < 0) || (other == slot) ) {
+			snprintf(relay->text, FRAME_TEXT, "No other player named %s in the room", who);
+		} else if (!posted) {
+			snprintf(relay->text, FRAME_TEXT, "You don't have %d %s", giveN, give);
+		} else {
+			snprintf(relay->text, FRAME_TEXT, "Offered %s %d %s for %d %s", who, giveN, give,
+				wantN, want);
+			write(fd2, relay, sizeof(*relay));
+
+			// and telling him
+			relay->to = ROUTE_SLOT(other);
+			bzero(relay->text, pSize);
+			snprintf(relay->text, FRAME_TEXT, "%s offers you %d %s for %d %s (ACCEPT %s)",
+				name, giveN, give, wantN, want, name);
+		}
+	} else if (sscanf(raw, "ACCEPT %31s", who) == 1) {
+		sem_wait(my_sem);
+		if ( (other = findPlayer(who, NULL)) >= 0 ) {
+			o = offers[other];
+			status = acceptOffer(offers, holdings, roomInv->count, other, slot);
+		}
+		sem_post(my_sem);
+
+		if ( (other < 0) || (status == TRADE_NO_OFFER) ) {
+			snprintf(relay->text, FRAME_TEXT, "%s offered you no trade", who);
+		} else if (status == TRADE_THEY_LACK) {
+			snprintf(relay->text, FRAME_TEXT, "%s doesn't have %d %s anymore", who, o.giveN,
+				roomInv->items[o.give]);
+		} else if (status == TRADE_WE_LACK) {
+			snprintf(relay->text, FRAME_TEXT, "You don't have %d %s", o.wantN,
+				roomInv->items[o.want]);
+		} else {
+			snprintf(relay->text, FRAME_TEXT, "Traded %d %s to %s for %d %s", o.wantN,
+				roomInv->items[o.want], who, o.giveN, roomInv->items[o.give]);
+			write(fd2, relay, sizeof(*relay));
+
+			// and telling him
+			relay->to = ROUTE_SLOT(other);
+			bzero(relay->text, pSize);
+			snprintf(relay->text, FRAME_TEXT, "%s accepted your trade: %d %s for %d %s", name,
+				o.giveN, roomInv->items[o.give], o.wantN, roomInv->items[o.want]);
+		}
+	} else {
+		snprintf(relay->text, FRAME_TEXT, "Usage: TRADE <player> <item> <n> <item> <m>, "
+			"ACCEPT <player> or ITEMS");
+	}
+
+	write(fd2, relay, sizeof(*relay));
+
+	return 1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Receives messages from the child servers and then pushes directly
+ * to the players. Sends never block: a player that can't keep up gets
+ * his messages queued and the overflow policy decides what happens when
+ * his queue fills, so one slow player never holds back the rest of the
+ * room. Room events (players leaving) are used to check whether
+ * the room became sparse enough to merge with another room, and players of
+ * other sparse rooms are received through the migration socket
+ *
+ * @param Takes in the pipe array between the game server and the child one,
+ * the array with the stored client sockets, the shared memory pointer and
+ * the ServerVars struct
+ *
+ */
+void pushMessage(int *plPipe, int *sockArray, int *qData, ServerVars *sv) {
+	RelayMsg msg;			// message that we have to push
+	fd_set read_set;		// pipe and migration socket
+	fd_set write_set;		// players with queued messages
+	int plCountPos = sv->inv.count;	// index of the player counter
+	int traced;				// the message carries trace stamps
+	int i, n;				// for counters
+
+	// rooms on the io_uring engine batch all of this in the ring
+	if (ioRing) {
+		relayRing(plPipe, sockArray, qData, sv);
+		return;
+	}
+
+	// and the zero-copy fan-out never reads the messages
+	if (spliceQueues) {
+		relaySpliced(plPipe, sockArray, qData, sv);
+		return;
+	}
+
+	// pushing until all players leave the room
+	sem_wait(my_sem);		// entering critical area
+	while (qData[plCountPos] > 0) {
+		sem_post(my_sem);	// exiting critical area
+
+		// moving to a new process, we carry on there
+		if (handoff || moving) {
+			handOffRoom(sv, qData, sockArray, plPipe);
+		}
+
+		FD_ZERO(&read_set);
+		FD_ZERO(&write_set);
+
+		FD_SET(plPipe[0], &read_set);
+		if (migSock >= 0) {
+			FD_SET(migSock, &read_set);
+		}
+
+		// only slow players are watched for writing
+		for (i=0; i<slotCount; ++i) {
+			if ( (sockArray[i] >= 0) && (outQueues[i].count > 0) ) {
+				FD_SET(sockArray[i], &write_set);
+			}
+		}
+
+		if (select(FD_SETSIZE, &read_set, &write_set, NULL, NULL) < 0) {
+			sem_wait(my_sem);
+			continue;	// interrupted by a player process exiting
+		}
+
+		// slow players that can take more messages
+		for (i=0; i<slotCount; ++i) {
+			if ( (sockArray[i] >= 0) && (outQueues[i].count > 0) &&
+				FD_ISSET(sockArray[i], &write_set) ) {
+				if (flushOutQueue(&(outQueues[i]), sockArray[i]) < 0) {
+					resetOutQueue(&(outQueues[i]));	// player is gone
+				}
+			}
+		}
+
+		// a sparse room is sending us a player
+		if ( (migSock >= 0) && FD_ISSET(migSock, &read_set) ) {
+			receivePlayer(sv, qData, sockArray, plPipe);
+		}
+
+		// attempting to get the message from the child server
+		if (!FD_ISSET(plPipe[0], &read_set)) {
+			// nothing to push
+		} else if (read(plPipe[0], &msg, sizeof(msg)) < 0) {
+			logMsg(LOG_ERROR, "Error pushing message: %s", strerror(errno));
+		} else if (msg.sender == RELAY_WAKEUP) {
+			// a player left, we might move the rest
+			if (roomWakeup(sv, qData, sockArray, msg.to)) {
+				return;
+			}
+		} else if (msg.sender < 0) {
+			// a player asks for what he missed
+			historyRequest(sv, sockArray, msg.sender, msg.text);
+		} else {				
+			// pushing the message to its recipients
+			n = recipients(sockArray, slotCount, chanBits, chanWords, msg.sender, msg.to, targets);
+
+			// a traced message gets each recipient's own stamp
+			if ( (traced = isTraced(msg.text, sizeof(msg.text))) ) {
+				traceStamp(msg.text, TRACE_ROOM);
+			}
+
+			for (i=0; i<n; ++i) {
+				if (traced) {
+					traceStamp(msg.text, TRACE_FANOUT);
+				}
+
+				deliver(sv, sockArray, targets[i], msg.text);
+			} // for
+		}
+
+		sem_wait(my_sem);	// entering critical area
+	} // while 
+	
+	// exiting critical area
+	sem_post(my_sem);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Sends a message to a player without blocking. If the player
+ * is up to date we send it directly and only queue what the socket
+ * didn't take. If he is behind, the message waits in his queue
+ *
+ * @param Takes in the ServerVars struct, the room's socket array, the
+ * player's slot and the message
+ *
+ */
+void deliver(ServerVars *sv, int *sockArray, int slot, char *text) {
+	OutQueue *q = &(outQueues[slot]);	// the player's queue
+	ssize_t n = 0;						// bytes the socket took
+
+	// up to date players get the message right away (the ring
+	// sends straight from the queue, so it only queues here)
+	if ( (q->count == 0) && !ioRing ) {
+		n = send(sockArray[slot], text, pSize, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (n == pSize) {
+			return;
+		}
+
+		if ( (n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) ) {
+			return;	// player is gone, his process will notice
+		}
+	}
+
+	if (pushOutQueue(q, text, sv->s.overflow) < 0) {
+		// too slow, closing his connection lets his process clean up
+		logMsg(LOG_INFO, "| Room %d: Player > %s < can't keep up, disconnecting |", 
+			getpid(), plSlots[slot].name);
+
+		shutdown(sockArray[slot], SHUT_RDWR);
+		resetOutQueue(q);
+
+		return;
+	}
+
+	// part of the message already left
+	if ( (q->count == 1) && (n > 0) ) {
+		q->sent = n;
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Sets up the ring of a room on the io_uring engine, with the
+ * buffers its players' messages are received in
+ *
+ * @return The ring or NULL if the room has to use select
+ */
+IoRing *openRoomRing() {
+	IoRing *r = malloc(sizeof(IoRing));	// the room's ring
+
+	if (r == NULL) {
+		perror("Allocation error -> ring");
+		exit(1);
+	}
+
+	if ( (openRing(r, RING_ENTRIES) < 0) ||
+		(ringProvideBuffers(r, RING_BUFFERS, sizeof(RelayMsg)) < 0) ) {
+		logMsg(LOG_ERROR, "Couldn't set up io_uring, using select: %s", strerror(errno));
+		closeRing(r);
+		free(r);
+
+		return NULL;
+	}
+
+	return r;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Drops the ring a player's process inherited from its room
+ *
+ */
+void dropRing() {
+	if (ioRing) {
+		closeRing(ioRing);
+		free(ioRing);
+		ioRing = NULL;
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief The io_uring version of pushMessage. A single multishot
+ * receive gets every relayed message in a provided buffer and each
+ * player's queued messages go out as a chain of linked sends, so the
+ * whole batch (receives, fan-out sends and their completions) costs one
+ * syscall per loop instead of one per operation. The rest (overflow
+ * policies, room events, migrations) works as in pushMessage
+ *
+ * @param Takes in the pipe array between the game server and the child one,
+ * the array with the stored client sockets, the shared memory pointer and
+ * the ServerVars struct
+ *
+ */
+void relayRing(int *plPipe, int *sockArray, int *qData, ServerVars *sv) {
+	struct io_uring_cqe *cqe;		// completion we handle
+	RelayMsg *msg;					// message that we have to push
+	int plCountPos = sv->inv.count;	// index of the player counter
+	int armRelay = 1;				// the relay receive has to be queued
+	int armMigrate = (migSock >= 0);// the migration poll has to be queued
+	int batch = sv->s.backlog / 2;	// relayed messages we push per loop
+	int bids[RING_BUFFERS];			// buffers holding messages to push
+	int first = 0;					// oldest of them
+	int held = 0;					// number of them
+	int i, n;						// for counters
+	int bid;						// buffer of a message
+	int count;						// recipients of a message
+	int traced;						// the message carries trace stamps
+	int res;						// completion's result
+	unsigned flags;					// completion's flags
+	__u64 tag;						// completion's user_data
+
+	// queued messages only leave when the loop comes around, so a
+	// player that keeps up must never get more than his queue holds
+	if (batch > RING_CHAIN) {
+		batch = RING_CHAIN;
+	} else if (batch < 1) {
+		batch = 1;
+	}
+
+	// pushing until all players leave the room
+	sem_wait(my_sem);		// entering critical area
+	while (qData[plCountPos] > 0) {
+		sem_post(my_sem);	// exiting critical area
+
+		// moving to a new process, we carry on there
+		if (handoff || moving) {
+			handOffRoom(sv, qData, sockArray, plPipe);
+		}
+
+		// (re)queueing the receive and the poll once they end
+		if (armRelay) {
+			ringRecvMulti(ioRing, plPipe[0], RING_TAG(RING_RELAY, 0, 0));
+			armRelay = 0;
+		}
+
+		if (armMigrate) {
+			ringPollIn(ioRing, migSock, RING_TAG(RING_MIGRATE, 0, 0));
+			armMigrate = 0;
+		}
+
+		// players with queued messages and no sends in flight
+		for (i=0; i<slotCount; ++i) {
+			if ( (sockArray[i] >= 0) && (outQueues[i].count > 0) &&
+				(outQueues[i].busy == 0) ) {
+				queueSends(sockArray, i);
+			}
+		}
+
+		// handing everything to the kernel and waiting for completions,
+		// unless messages from the last loop are still waiting
+		if (ringSubmit(ioRing, held == 0) < 0) {
+			perror("Error pushing message");
+			exit(1);
+		}
+
+		while ( (cqe = ringPeek(ioRing)) != NULL ) {
+			tag = cqe->user_data;
+			res = cqe->res;
+			flags = cqe->flags;
+			ringSeen(ioRing);
+
+			if (RING_KIND(tag) == RING_SEND) {
+				sendDone(RING_SLOT(tag), RING_GEN(tag), res);
+			} else if (RING_KIND(tag) == RING_MIGRATE) {
+				// a sparse room is sending us a player
+				if (res > 0) {
+					receivePlayer(sv, qData, sockArray, plPipe);
+				}
+
+				armMigrate = 1;
+			} else {
+				// the multishot receive ended, it gets queued again
+				if ( !(flags & IORING_CQE_F_MORE) ) {
+					armRelay = 1;
+				}
+
+				// keeping the message in its buffer until we push it
+				if ( (res > 0) && (flags & IORING_CQE_F_BUFFER) ) {
+					bids[(first + held) % RING_BUFFERS] = flags >> IORING_CQE_BUFFER_SHIFT;
+					++held;
+				}
+			}
+		}
+
+		// pushing a batch of messages, the rest waits for the next loop
+		for (n=0; (n < batch) && (held > 0); ++n) {
+			bid = bids[first];
+			first = (first + 1) % RING_BUFFERS;
+			--held;
+
+			msg = (RelayMsg *)(ioRing->bufs + bid*ioRing->bufSize);
+
+			if ( (msg->sender < 0) && (msg->sender != RELAY_WAKEUP) ) {
+				// a player asks for what he missed
+				historyRequest(sv, sockArray, msg->sender, msg->text);
+				ringRecycle(ioRing, bid);
+
+				continue;
+			} else if (msg->sender < 0) {
+				count = msg->to;
+				ringRecycle(ioRing, bid);
+
+				// a player left, we might move the rest
+				if (roomWakeup(sv, qData, sockArray, count)) {
+					return;
+				}
+
+				continue;
+			}
+
+			// queueing the message for its recipients
+			count = recipients(sockArray, slotCount, chanBits, chanWords, msg->sender, msg->to, targets);
+
+			// a traced message gets each recipient's own stamp
+			if ( (traced = isTraced(msg->text, sizeof(msg->text))) ) {
+				traceStamp(msg->text, TRACE_ROOM);
+			}
+
+			for (i=0; i<count; ++i) {
+				if (traced) {
+					traceStamp(msg->text, TRACE_FANOUT);
+				}
+
+				deliver(sv, sockArray, targets[i], msg->text);
+			}
+
+			ringRecycle(ioRing, bid);
+		}
+
+		sem_wait(my_sem);	// entering critical area
+	} // while
+
+	// exiting critical area
+	sem_post(my_sem);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Hands a player's queued messages to the ring as a chain of
+ * linked sends, so they leave in order. A send that fails or stops
+ * short breaks the chain and the rest is sent again later
+ *
+ * @param Takes in the room's socket array and the player's slot
+ *
+ */
+void queueSends(int *sockArray, int slot) {
+	OutQueue *q = &(outQueues[slot]);	// the player's queue
+	struct io_uring_sqe *sqe;			// send we queue
+	int n = q->count;					// messages in the chain
+	int i;								// for counter
+	size_t skip;						// part of the message already sent
+
+	if (n > RING_CHAIN) {
+		n = RING_CHAIN;
+	}
+
+	// a chain has to reach the kernel in one piece
+	if (ringSpace(ioRing) < (unsigned)n) {
+		ringSubmit(ioRing, 0);
+	}
+
+	for (i=0; i<n; ++i) {
+		skip = i ? 0 : q->sent;
+
+		sqe = ringGetSqe(ioRing);
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = sockArray[slot];
+		sqe->addr = (unsigned long)(q->frames[(q->head + i) % q->size] + skip);
+		sqe->len = pSize - skip;
+		sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+		sqe->user_data = RING_TAG(RING_SEND, slot, q->gen);
+
+		if (i < n-1) {
+			sqe->flags = IOSQE_IO_LINK;
+		}
+	}
+
+	q->busy = n;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Handles a finished send of a player's chain
+ *
+ * @param Takes in the player's slot, the generation of his queue when
+ * the send was queued and the send's result
+ *
+ */
+void sendDone(int slot, unsigned gen, int res) {
+	OutQueue *q = &(outQueues[slot]);	// the player's queue
+
+	if (q->gen != gen) {
+		return;	// the slot was reset since, the player is gone
+	}
+
+	--q->busy;
+
+	if (res == (int)(pSize - q->sent)) {
+		// the whole message left
+		q->head = (q->head + 1) % q->size;
+		--q->count;
+		q->sent = 0;
+		q->dropped = 0;
+	} else if (res >= 0) {
+		q->sent += res;	// stopped short, the rest goes with the next chain
+	} else if (res != -ECANCELED) {
+		resetOutQueue(q);	// player is gone, his process will notice
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief The zero-copy version of pushMessage. Only the sender's socket
+ * is read from the relay pipe. The message itself is duplicated with
+ * tee into every other player's pipe, spliced from there to his socket
+ * and finally thrown away from the relay pipe, so its bytes never reach
+ * the room. A player's pipe is his outbound queue: whatever his socket
+ * doesn't take waits there until poll reports it writable
+ *
+ * @param Takes in the pipe array between the game server and the child one,
+ * the array with the stored client sockets, the shared memory pointer and
+ * the ServerVars struct
+ *
+ */
+void relaySpliced(int *plPipe, int *sockArray, int *qData, ServerVars *sv) {
+	RelayMsg head;			// sender and route of the message at the pipe's head
+	int sender;				// its sender
+	char text[pSize];		// text of a room event, when it has one
+	int n;					// recipients of the message
+	struct pollfd *pfds;	// pipe, migration socket and slow players
+	int plCountPos = sv->inv.count;	// index of the player counter
+	int i;					// for counter
+
+	// splice has no MSG_NOSIGNAL, a player that left must not kill the room
+	signal(SIGPIPE, SIG_IGN);
+
+	// the players' pipes take two descriptors each, so in big rooms the
+	// sockets can go past FD_SETSIZE and we poll instead of select
+	if ( (pfds = malloc(sizeof(struct pollfd)*(slotCount+2))) == NULL ) {
+		perror("Allocation error -> pfds");
+		exit(1);
+	}
+
+	// pushing until all players leave the room
+	sem_wait(my_sem);		// entering critical area
+	while (qData[plCountPos] > 0) {
+		sem_post(my_sem);	// exiting critical area
+
+		// moving to a new process, we carry on there
+		if (handoff || moving) {
+			handOffRoom(sv, qData, sockArray, plPipe);
+		}
+
+		pfds[0].fd = plPipe[0];
+		pfds[0].events = POLLIN;
+		pfds[1].fd = migSock;
+		pfds[1].events = POLLIN;
+
+		// only slow players are watched for writing
+		for (i=0; i<slotCount; ++i) {
+			pfds[i+2].fd = -1;
+			pfds[i+2].events = POLLOUT;
+
+			if ( (sockArray[i] >= 0) && (spliceQueues[i].frames > 0) ) {
+				pfds[i+2].fd = sockArray[i];
+			}
+		}
+
+		if (poll(pfds, slotCount+2, -1) < 0) {
+			sem_wait(my_sem);
+			continue;	// interrupted by a player process exiting
+		}
+
+		// slow players that can take more messages
+		for (i=0; i<slotCount; ++i) {
+			if ( (pfds[i+2].fd >= 0) && pfds[i+2].revents ) {
+				if (flushSpliceQueue(&(spliceQueues[i]), sockArray[i]) < 0) {
+					closeSpliceQueue(&(spliceQueues[i]));	// player is gone
+				}
+			}
+		}
+
+		// a sparse room is sending us a player
+		if ( (migSock >= 0) && (pfds[1].revents & POLLIN) ) {
+			receivePlayer(sv, qData, sockArray, plPipe);
+		}
+
+		// the message itself stays in the pipe
+		if (!(pfds[0].revents & POLLIN)) {
+			// nothing to push
+		} else if (read(plPipe[0], &head, RELAY_HEADER) != RELAY_HEADER) {
+			logMsg(LOG_ERROR, "Error pushing message: %s", strerror(errno));
+		} else if ( (sender = head.sender) == RELAY_WAKEUP ) {
+			spliceDiscard(plPipe[0], devNull, pSize);
+
+			// a player left, we might move the rest
+			if (roomWakeup(sv, qData, sockArray, head.to)) {
+				free(pfds);
+				return;
+			}
+		} else if (sender < 0) {
+			// a player asks for what he missed
+			read(plPipe[0], text, pSize);
+			historyRequest(sv, sockArray, sender, text);
+		} else {
+			// duplicating the message for its recipients
+			n = recipients(sockArray, slotCount, chanBits, chanWords, sender, head.to, targets);
+
+			for (i=0; i<n; ++i) {
+				deliverSpliced(sv, sockArray, targets[i], plPipe[0]);
+			}
+
+			// everyone has a copy, the message leaves the relay pipe
+			spliceDiscard(plPipe[0], devNull, pSize);
+		}
+
+		sem_wait(my_sem);	// entering critical area
+	} // while
+
+	// exiting critical area
+	sem_post(my_sem);
+
+	free(pfds);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Queues the message at the head of the relay pipe for a player
+ * and, if he is up to date, sends what his socket takes right away. The
+ * player's pipe is opened the first time he gets a message
+ *
+ * @param Takes in the ServerVars struct, the room's socket array, the
+ * player's slot and the relay pipe's read end
+ *
+ */
+void deliverSpliced(ServerVars *sv, int *sockArray, int slot, int relay) {
+	SpliceQueue *q = &(spliceQueues[slot]);	// the player's queue
+	int behind;								// his socket was full last time
+
+	if ( (q->pipe[0] < 0) && (openSpliceQueue(q, sv->s.backlog) < 0) ) {
+		logMsg(LOG_ERROR, "Couldn't open a player's pipe: %s", strerror(errno));
+		return;
+	}
+
+	behind = (q->frames > 0);
+
+	if (teeSpliceQueue(q, relay, devNull, sv->s.overflow) < 0) {
+		// too slow, closing his connection lets his process clean up
+		logMsg(LOG_INFO, "| Room %d: Player > %s < can't keep up, disconnecting |", 
+			getpid(), plSlots[slot].name);
+
+		shutdown(sockArray[slot], SHUT_RDWR);
+		closeSpliceQueue(q);
+
+		return;
+	}
+
+	// players that are behind wait until poll reports them writable
+	if ( !behind && (flushSpliceQueue(q, sockArray[slot]) < 0) ) {
+		closeSpliceQueue(q);	// player is gone, his process will notice
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Changes the player counter of the room and mirrors it to the
+ * room table. Must be called while holding the semaphore
+ *
+ * @param Takes in the shared memory pointer, the player counter's index
+ * and the change
+ *
+ */
+void updateCount(int *qData, int plCountPos, int delta) {
+	qData[plCountPos] += delta;
+
+	if (roomIndex >= 0) {
+		roomTable->rooms[roomIndex].count += delta;
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Gives a free player slot to a new socket. The slot
+ * stays pending until the player process fills it in or gives it back
+ *
+ * @param Takes in the socket and the room's socket array
+ *
+ * @return The slot index or -1 if all slots are taken
+ */
+int claimSlot(int connfd, int *sockArray) {
+	int i;			// for counter
+	int slot = -1;	// slot we found
+
+	sem_wait(my_sem);
+
+	for (i=0; i<slotCount; ++i) {
+		if (plSlots[i].connfd < 0) {
+			slot = i;
+
+			plSlots[i].connfd = connfd;
+			plSlots[i].pid = 0;
+			plSlots[i].name[0] = '\0';
+			plSlots[i].request[0] = '\0';
+			plSlots[i].token = 0;
+			plSlots[i].detached = 0;
+			plSlots[i].draining = 0;
+			plSlots[i].seen = 0;
+
+			break;
+		}
+	}
+
+	sem_post(my_sem);
+
+	if (slot >= 0) {
+		attachSlot(slot, connfd, sockArray);
+	}
+
+	return slot;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Points a slot to a new socket, with an empty queue
+ *
+ * @param Takes in the slot, the socket and the room's socket array
+ *
+ */
+void attachSlot(int slot, int connfd, int *sockArray) {
+	// the previous owner is gone, closing our copy of his socket
+	if ( (sockArray[slot] >= 0) && (sockArray[slot] != connfd) ) {
+		close(sockArray[slot]);
+	}
+
+	sockArray[slot] = connfd;
+	resetOutQueue(&(outQueues[slot]));
+
+	if (spliceQueues) {
+		closeSpliceQueue(&(spliceQueues[slot]));
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Closes our copy of the sockets of players that left
+ * or lost their connection, so that their connection really closes. The
+ * ones that lost it get the messages relayed from now on when they come
+ * back
+ *
+ * @param Takes in the room's socket array
+ *
+ */
+void syncSlots(int *sockArray) {
+	int i;	// for counter
+
+	for (i=0; i<slotCount; ++i) {
+		if ( (sockArray[i] >= 0) && 
+			((plSlots[i].connfd != sockArray[i]) || plSlots[i].detached) ) {
+			if (plSlots[i].detached) {
+				plSlots[i].seen = historyHead(history);
+			}
+
+			close(sockArray[i]);
+			sockArray[i] = -1;
+			resetOutQueue(&(outQueues[i]));
+
+			if (spliceQueues) {
+				closeSpliceQueue(&(spliceQueues[i]));
+			}
+		}
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Called when a room that is still filling up reaches
+ * its fill deadline or stops accepting. If a running room has space for
+ * our players they move there and this room closes, otherwise the room
+ * starts with the players it has
+ *
+ * @param Takes in the ServerVars struct, the shared memory pointer, the
+ * pipe to the main server, the pipe from the player processes and why
+ * the room starts, for the log
+ *
+ * @return 1 if the room should start or 0 if it has to keep waiting
+ */
+int startShortHanded(ServerVars *sv, int *qData, int *fd, int *plPipe, char *why) {
+	int needroom = 1;	// flag for the main server
+	int players;		// players in the room
+	int merged;			// the players moved to another room
+	RelayMsg msg;		// wakeup of a player process
+
+	merged = compactRoom(sv, qData, 1);
+
+	// another room takes our players once their processes stopped
+	// between two frames, each one tells us with a wakeup
+	while (!merged && (mergeTarget >= 0)) {
+		if (read(plPipe[0], &msg, sizeof(msg)) != sizeof(msg)) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			logMsg(LOG_ERROR, "Couldn't read from the player processes: %s", strerror(errno));
+			exit(1);
+		}
+
+		if ( (msg.sender == RELAY_WAKEUP) && (msg.to != ROUTE_ALL) ) {
+			sem_wait(my_sem);
+			plSlots[ROUTE_SLOT_OF(msg.to)].draining = 0;
+			sem_post(my_sem);
+		}
+
+		merged = compactRoom(sv, qData, 1);
+	}
+
+	if (merged) {
+		// the main server opens the next room as if we were full
+		if (write(fd[1], &needroom, sizeof(needroom)) < 0) {
+			logMsg(LOG_ERROR, "Couldn't write to the main server: %s", strerror(errno));
+		}
+
+		closeRoom(sv, qData, "Players moved, room closed");
+	}
+
+	sem_wait(my_sem);
+	players = qData[sv->inv.count];
+	sem_post(my_sem);
+
+	if (players > 0) {
+		logMsg(LOG_INFO, "| Room %d: %s, starting with %d players |", getpid(), why, players);
+	}
+
+	return players > 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. A new server took over the listening sockets, so
+ * the room that is filling up stops accepting. The players still
+ * sending us their inventory get until their alarm goes off, then the
+ * room starts with the players it has, or moves them to a running room.
+ * Without players it closes
+ *
+ * @param Takes in the ServerVars struct, the shared memory pointer, the
+ * pipe to the main server and the pipe from the player processes
+ *
+ */
+void stopAccepting(ServerVars *sv, int *qData, int *fd, int *plPipe) {
+	double until = monoTime() + WAIT + 1;	// the last alarm went off
+	int pending;	// players that are still being served
+	int i;			// for counter
+
+	closeListeners(sv);
+
+	logMsg(LOG_INFO, "| Room %d: The new server accepts the players from now on |", getpid());
+
+	do {
+		pending = 0;
+
+		sem_wait(my_sem);
+		for (i=0; i<slotCount; ++i) {
+			if ( (plSlots[i].connfd >= 0) && (plSlots[i].pid == 0) ) {
+				++pending;
+			}
+		}
+		sem_post(my_sem);
+
+		if (pending) {
+			usleep(10000);
+		}
+	} while ( pending && (monoTime() < until) );
+
+	if (!startShortHanded(sv, qData, fd, plPipe, "Stopped accepting")) {
+		closeRoom(sv, qData, "No players, room closed");
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Closes a room that never started, releasing its
+ * table entry, its stock and its shared memory
+ *
+ * @param Takes in the ServerVars struct, the shared memory pointer and
+ * the reason, for the log
+ *
+ */
+void closeRoom(ServerVars *sv, int *qData, char *why) {
+	sem_wait(my_sem);
+	roomTable->rooms[roomIndex].state = ROOM_FREE;
+	sem_post(my_sem);
+
+	releaseStock(sv, qData);
+
+	shmdt(qData);
+	closeSharedMem(shmid);
+
+	logMsg(LOG_INFO, "| Room %d: %s ...|", getpid(), why);
+
+	exit(0);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. If the room has only a few players left we look for a
+ * running room that can take all of them. The players' processes are
+ * asked to stop once they relayed the message they hold, and finishMerge
+ * sends their sockets, names and reserved items to the other room when
+ * they did, so nobody loses his connection or a message. The caller
+ * closes the room afterwards, releasing its process and shared memory. A
+ * room that is still filling up uses this too when its fill deadline
+ * passes, its players' processes stop between two of their waiting
+ * frames
+ *
+ * @param Takes in the ServerVars struct, the shared memory pointer and
+ * whether this is a filling room that reached its deadline
+ *
+ * @return 1 if the players moved to another room or 0 if not (yet)
+ */
+int compactRoom(ServerVars *sv, int *qData, int filling) {
+	RoomEntry *me;				// our entry in the table
+	int target = -1;			// room we are moving to
+	int pending = 0;			// players that are still being served
+	int i;						// for counter
+
+	if ( (!filling && (sv->s.compact <= 0)) || (roomIndex < 0) ) {
+		return 0;	// compaction is off
+	}
+
+	// we are moving already, waiting for the player processes
+	if (mergeTarget >= 0) {
+		return finishMerge(sv, qData);
+	}
+
+	// moving to a new process, the room stays as it is until it did
+	if (moving) {
+		return 0;
+	}
+
+	me = &(roomTable->rooms[roomIndex]);
+
+	sem_wait(my_sem);
+
+	// players still sending us their inventory can't be moved yet
+	for (i=0; i<slotCount; ++i) {
+		if ( (plSlots[i].connfd >= 0) && (plSlots[i].pid == 0) ) {
+			++pending;
+		}
+	}
+
+	// rooms that are receiving players stay where they are
+	if (filling) {
+		if ( (me->state == ROOM_FILLING) && (pending == 0) && 
+			(qData[sv->inv.count] > 0) ) {
+			target = findMergeTarget(roomTable, roomIndex, sv->s.players);
+		}
+	} else if ( (me->state == ROOM_RUNNING) && (me->incoming == 0) && 
+		(qData[sv->inv.count] > 0) && (qData[sv->inv.count] <= sv->s.compact) ) {
+		target = findMergeTarget(roomTable, roomIndex, sv->s.players);
+	}
+
+	if (target >= 0) {
+		// reserving the space in the other room
+		me->state = ROOM_MIGRATING;
+		roomTable->rooms[target].count += me->count;
+		roomTable->rooms[target].incoming += me->count;
+
+		mergeTarget = target;
+		mergeCount = me->count;
+
+		// the player processes must stop using the sockets. The ones
+		// chatting finish the message they read first and the ones
+		// waiting for the game finish the frame they are sending. The
+		// ones keeping a seat only sleep, so they can go at once (we
+		// still hold the semaphore, so none of them is holding it)
+		for (i=0; i<slotCount; ++i) {
+			if ( (plSlots[i].connfd < 0) || (plSlots[i].pid <= 0) ) {
+				continue;
+			}
+
+			if (plSlots[i].detached) {
+				kill(plSlots[i].pid, SIGKILL);
+			} else {
+				plSlots[i].draining = 1;
+				kill(plSlots[i].pid, SIGUSR1);
+			}
+		}
+	}
+
+	sem_post(my_sem);
+
+	if (target < 0) {
+		return 0;
+	}
+
+	logMsg(LOG_INFO, "| Room %d: Merging into room %d |", getpid(), roomTable->rooms[target].pid);
+
+	return finishMerge(sv, qData);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Sends our players to the room we merge into, once
+ * all of their processes stopped. Each one stops with a wakeup behind
+ * its last message, so by the time the last wakeup is read every
+ * message of theirs went out to this room's players. Until then the
+ * room keeps relaying
+ *
+ * @param Takes in the ServerVars struct and the shared memory pointer
+ *
+ * @return 1 if the players moved or 0 if some processes still run
+ */
+int finishMerge(ServerVars *sv, int *qData) {
+	RoomEntry *me = &(roomTable->rooms[roomIndex]);	// our entry in the table
+	RoomEntry *to = &(roomTable->rooms[mergeTarget]);	// the target's
+	int sock;					// socket towards the target room
+	struct sockaddr_un addr;	// target room's address
+	socklen_t len;				// address length
+	int moved = 0;				// players we moved
+	int i;						// for counter
+
+	sem_wait(my_sem);
+	for (i=0; i<slotCount; ++i) {
+		if ( (plSlots[i].connfd >= 0) && plSlots[i].draining ) {
+			sem_post(my_sem);
+			return 0;
+		}
+	}
+	sem_post(my_sem);
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	len = roomAddress(to->pid, &addr);
+
+	if (connect(sock, (struct sockaddr *)&addr, len) < 0) {
+		logMsg(LOG_ERROR, "Couldn't reach the target room: %s", strerror(errno));
+	}
+
+	for (i=0; i<slotCount; ++i) {
+		// players that lost their connection lose their seat too
+		if ( (plSlots[i].connfd < 0) || (plSlots[i].pid <= 0) || plSlots[i].detached ) {
+			continue;
+		}
+
+		// his items are the ones he holds now, trades included
+		holdingsRequest(plSlots[i].name, &(sv->inv), holdings + i*sv->inv.count,
+			plSlots[i].request);
+
+		if (sendFd(sock, plSlots[i].connfd, &(plSlots[i]), sizeof(PlayerSlot)) == 0) {
+			++moved;
+		}
+	}
+
+	close(sock);
+
+	// players that didn't make it are not coming
+	sem_wait(my_sem);
+	to->count -= mergeCount - moved;
+	to->incoming -= mergeCount - moved;
+	qData[sv->inv.count] = 0;
+	me->count = 0;
+	sem_post(my_sem);
+
+	mergeTarget = -1;
+
+	return 1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Handles a wakeup of a player process: a player left
+ * or lost his connection, or his process stopped for a merge
+ *
+ * @param Takes in the ServerVars struct, the shared memory pointer, the
+ * room's socket array and the wakeup's route (the slot of a stopped
+ * process, ROUTE_ALL otherwise)
+ *
+ * @return 1 if the players moved to another room or 0 if not
+ */
+int roomWakeup(ServerVars *sv, int *qData, int *sockArray, int to) {
+	// its last message is out, the player can move
+	if (to != ROUTE_ALL) {
+		sem_wait(my_sem);
+		plSlots[ROUTE_SLOT_OF(to)].draining = 0;
+
+		// our new process serves him when we move
+		if (moving) {
+			plSlots[ROUTE_SLOT_OF(to)].pid = 0;
+		}
+		sem_post(my_sem);
+	}
+
+	// a player left, dropping our copy of his socket
+	syncSlots(sockArray);
+
+	// moving the rest of the players if we are too few
+	return compactRoom(sv, qData, 0);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Room side. Receives a player from a sparse room and connects
+ * him to our chat. His items were reserved in his old room, so they
+ * come along with him and don't touch our quantities
+ *
+ * @param Takes in the ServerVars struct, the shared memory pointer, the
+ * room's socket array and the pipe to the game server
+ *
+ */
+void receivePlayer(ServerVars *sv, int *qData, int *sockArray, int *plPipe) {
+	PlayerSlot pl;		// the player's slot in his old room
+	int connfd;			// his socket
+	int slot;			// his slot in our room
+	char greeting[LINE_LEN*2];	// message for the player
+	Inventory plInv;			// the items he holds
+	char *name = NULL;			// his name, as the request has it
+
+	if ( (connfd = recvFd(migSock, &pl, sizeof(pl))) < 0 ) {
+		return;
+	}
+
+	// one of our players reconnected and another room accepted him
+	if (pl.pid == MIGRATE_RESUME) {
+		resumeSlot(sv, qData, sockArray, plPipe, connfd, &pl);
+		return;
 	}
 
-	// writing the response back to the player
-	if (write(connfd, response, sizeof(response)) < 0) {
-		perror("Couldn't respond to the player");
-		exit(1);
+	if ( (slot = claimSlot(connfd, sockArray)) < 0 ) {
+		close(connfd);
+		return;
 	}
 
-	if (!status) {
-		// invalid request
-		exit(0);
+	// he keeps the items he held in his old room
+	parseStrIntoInv(&name, pl.request, &plInv);
+
+	sem_wait(my_sem);
+
+	strcpy(plSlots[slot].name, pl.name);
+	memcpy(plSlots[slot].request, pl.request, pSize);
+	plSlots[slot].token = pl.token;
+	fillHoldings(holdings + slot*sv->inv.count, &(sv->inv), plInv);
+
+	// the table counted him already, when the space was reserved
+	++qData[sv->inv.count];
+	if (roomIndex >= 0) {
+		--roomTable->rooms[roomIndex].incoming;
 	}
 
-	// free data before returning
+	sem_post(my_sem);
+
 	freeInventory(&plInv);
+	free(name);
+
+	logMsg(LOG_INFO, "| Player > %s < moved to room %d |", pl.name, getpid());
+
+	if (fork() == 0) {
+		// closing up the listening and migration sockets
+		closeListeners(sv);
+		close(migSock);
+		dropRing();
+
+		// this process serves a player
+		rprocID = MYERRCODE;
+		plSlots[slot].pid = getpid();
+
+		sprintf(greeting, "Room merged, now playing in room %d\n", getppid());
+
+		// his token has to name this room now
+		if (pl.token) {
+			newRoomToken(connfd, slot, pl.token);
+		}
+
+		playerSession(connfd, slot, plPipe, plSlots[slot].name, qData, sv, greeting);
+	}
 }
 
 /*- ---------------------------------------------------------------- -*/
 /**
- * @brief Initiates the chat. This function handles the server-player side
- * where if the player sends a message we push it to the game server for 
- * further distribution
+ * @brief Moves a running room to a new process, which can run on
+ * another core, without disconnecting anyone. The room's inventory,
+ * players, channels, trades and history (with its numbers) are all in
+ * its segment, which the new process keeps attached, and it inherits the
+ * players' sockets, the pipe and the messages queued for slow players.
+ * The player processes are children of the old process, so they are
+ * asked to stop once they relayed the message they hold, like for a
+ * merge, and finishHandoff moves the room when they did. The room keeps
+ * relaying meanwhile. Seats kept for players that lost their connection
+ * are given up, and a room that still has players joining moves once
+ * they are in. A room that merges into another one is closing anyway,
+ * and one on the io_uring engine can't move at all: the ring's requests
+ * die with the process that queued them
  *
- * @param Takes in the connection socket, a pipe to reach the game server
- * and the player's name to attach to his messages
+ * @param Takes in the ServerVars struct, the shared memory pointer, the
+ * room's socket array and the pipe to the room
  *
  */
-int chat(int connfd, int *plPipe, char *name, int *qData, 
-	int plCountPos, int players) {
-	// this end of the pipe to send messages
-	int fd2 = plPipe[1];
+void handOffRoom(ServerVars *sv, int *qData, int *sockArray, int *plPipe) {
+	RoomEntry *me;				// our entry in the table
+	int busy = 0;				// players still joining
+	int i;						// for counter
 
-	// declaring a buffer for the raw message
-	char raw[pSize];
+	// asked again while we are moving, the first request counts
+	handoff = 0;
 
-	// declaring a string that will hold the final message
-	char message[pSize];
+	if (moving) {
+		finishHandoff(sv, qData, sockArray, plPipe);
+		return;
+	}
 
-	// read/write fd sets
-	fd_set read_set;
-	fd_set write_set;
+	if (ioRing) {
+		logMsg(LOG_ERROR, "Room %d: rooms on the io_uring engine can't move, staying", getpid());
+		return;
+	}
 
-	// until everyone is connected tell the player to wait
-	strcpy(message, "Waiting for more players ...\n");
+	if (roomIndex < 0) {
+		return;
+	}
 
-	// waiting for other players
-	sem_wait(my_sem);	// entering critical area
-	while (qData[plCountPos] != players) {
-		sem_post(my_sem);	// leaving critical area
-		if (write(connfd, message, sizeof(message)) <= 0) {
-			return 1;
-		}
+	me = &(roomTable->rooms[roomIndex]);
 
-		// sleep for 5
-		sleep(5);
-	}
-	sem_post(my_sem);	// leaving critical area
+	sem_wait(my_sem);
 
-	// letting the player know the game is starting
-	strcpy(message, "START\n");
-	if (write(connfd, message, sizeof(message)) <= 0) {
-		return 1;
+	if ( (mergeTarget >= 0) || (me->state == ROOM_MIGRATING) ) {
+		sem_post(my_sem);
+		logMsg(LOG_ERROR, "Room %d: merging into another room, not moving", getpid());
+		return;
 	}
 
-	while (1) {
-		// zeroing the read and write fs sets
-		FD_ZERO(&read_set);
-		FD_ZERO(&write_set);
+	for (i=0; i<slotCount; ++i) {
+		if ( (plSlots[i].connfd >= 0) && (plSlots[i].pid == 0) ) {
+			++busy;
+		}
+	}
 
-		// adding sockets to the sets
-		FD_SET(connfd, &read_set);	// reading list
-		FD_SET(fd2, &write_set);	// writing list
+	// their processes or their rooms would lose track of them
+	if ( busy || (me->incoming > 0) || (me->state != ROOM_RUNNING) ) {
+		sem_post(my_sem);
+		handoff = 1;
+		return;
+	}
 
-		// using select to check if the socket in our list are ready to read/write
-		if(select(connfd+1, &read_set, &write_set, NULL, NULL) > 0) {
-			// checking if connfd is read to read
-			if (FD_ISSET(connfd, &read_set)) {
-				// attempting to read 
-				if (read(connfd, raw, sizeof(raw)) > 0) {
-					// checking if the pipe is good to read
-					// writing the sender's socket num
-					if (FD_ISSET(fd2, &write_set)) {
-						write(fd2, &connfd, sizeof(connfd));
-					}
+	// no merges into or out of the room until it moved
+	me->state = ROOM_MOVING;
+	moving = 1;
+	moveCpu = handoffCpu;
+	moveStart = monoTime();
+
+	// the ones chatting finish the message they read first, the ones
+	// keeping a seat lose it (we hold the semaphore, so none of them is
+	// holding it)
+	for (i=0; i<slotCount; ++i) {
+		if ( (plSlots[i].connfd < 0) || (plSlots[i].pid <= 0) ) {
+			continue;
+		}
 
-					// checking if the pipe is good to read
-					// writing the message
-					if (FD_ISSET(fd2, &write_set)) {
-						// adding the players name to the raw message
-						sprintf(message, "[%s]: %s", name, raw);
+		if (plSlots[i].detached) {
+			kill(plSlots[i].pid, SIGKILL);
+			freeSlot(sv, qData, i);
+		} else {
+			plSlots[i].draining = 1;
+			kill(plSlots[i].pid, SIGUSR1);
+		}
+	}
 
-						// writing the message
-						write(fd2, message, sizeof(message));
-					} 
-				} else {
-					// closing this socket
-					close(connfd);
-					
-					// lost connection to the player, so we exit the chat
-					break;
-				}
-			} // connfd is set 
-		} // select
-	} // while
+	sem_post(my_sem);
 
-	return 0;
+	finishHandoff(sv, qData, sockArray, plPipe);
 }
 
 /*- ---------------------------------------------------------------- -*/
 /**
- * @brief Receives messages from the child servers and then pushes directly
- * to the players 
+ * @brief Room side. Forks the room's new process once the player
+ * processes stopped (each one with a wakeup behind its last message, so
+ * all of their messages went out). The old process hands the room over
+ * and exits, the new one binds the migration socket under its pid and
+ * forks new player processes, which send their players a token for the
+ * room's new pid, and carries on where the old one was
  *
- * @param Takes in the pipe array between the game server and the child one,
- * the array with the stored client sockets, the shared memory pointer and
- * an index to the player counter for the shared memory pointer
+ * @param Takes in the ServerVars struct, the shared memory pointer, the
+ * room's socket array and the pipe to the room
  *
  */
-void pushMessage(int *plPipe, int *sockArray, int *qData, int plCountPos, int players) {
-	char message[pSize];	// message that we have to push	
-	int senderSocket = -1;	// used to identify the sender's socket to avoid duplicate message
-	int i;					// for counter
+void finishHandoff(ServerVars *sv, int *qData, int *sockArray, int *plPipe) {
+	RoomEntry *me = &(roomTable->rooms[roomIndex]);	// our entry in the table
+	struct sockaddr_un addr;	// our new migration address
+	socklen_t len;				// its length
+	cpu_set_t cpus;				// cores the new process may run on
+	char greeting[LINE_LEN*2];	// message for the players
+	int moved = 0;				// players we took along
+	pid_t old = getpid();		// the process we leave
+	pid_t pid;					// the one we move to
+	int i;						// for counter
 
-	// pushing until all players leave the room
-	sem_wait(my_sem);		// entering critical area
-	while (qData[plCountPos] > 0) {
-		sem_post(my_sem);	// exiting critical area
+	sem_wait(my_sem);
 
-		// attempting to read the sender's socket
-		read(plPipe[0], &senderSocket, sizeof(senderSocket));
+	for (i=0; i<slotCount; ++i) {
+		if ( (plSlots[i].connfd >= 0) && plSlots[i].draining ) {
+			sem_post(my_sem);
+			return;
+		}
+	}
 
-		// attempting to get the message from the child server
-		if (read(plPipe[0], message, sizeof(message)) < 0) {
-			perror("Error pushing message");
-		} else {				
-			// iterating through the open sockets to push the message
-			for (i=0; i<players; ++i) {
-				// this was the sender so we don't push the message
-				if (sockArray[i] == senderSocket) {
-					continue;
-				}
+	if ( (pid = fork()) < 0 ) {
+		// the players get new processes here instead
+		pid = 0;
+		logMsg(LOG_ERROR, "Room %d: couldn't move: %s", old, strerror(errno));
+	} else if (pid > 0) {
+		// the room goes by the new process from now on
+		me->pid = pid;
+		__atomic_store_n(&(history->owner), pid, __ATOMIC_RELAXED);
+
+		sem_post(my_sem);
+
+		exit(0);
+	} else {
+		// waiting for the old process to let the room go
+		sem_wait(my_sem);
+	}
+
+	rprocID = getpid();
+	me->state = ROOM_RUNNING;
+	moving = 0;
 
-				// attempting to write the message to the clients
-				if (write(sockArray[i], message, sizeof(message)) <= 0) {							
-					continue;
-				}
-			} // for
-		}
-	} // while 
-	
-	// exiting critical area
 	sem_post(my_sem);
+
+	if (rprocID != old) {
+		// a core of its own, or any (a room that was pinned is let go)
+		CPU_ZERO(&cpus);
+		for (i=0; i<CPU_SETSIZE; ++i) {
+			if ( (moveCpu < 0) || (i == moveCpu) ) {
+				CPU_SET(i, &cpus);
+			}
+		}
+
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+			logMsg(LOG_ERROR, "Room %d: couldn't move to core %d: %s", rprocID, moveCpu, 
+				strerror(errno));
+		}
+
+		// the migration socket goes by our pid
+		close(migSock);
+		migSock = socket(AF_UNIX, SOCK_DGRAM, 0);
+		len = roomAddress(rprocID, &addr);
+
+		if (bind(migSock, (struct sockaddr *)&addr, len) < 0) {
+			logMsg(LOG_ERROR, "Couldn't open the migration socket: %s", strerror(errno));
+		}
+	}
+
+	// dropping the seats that were given up
+	syncSlots(sockArray);
+
+	sprintf(greeting, "Room moved, now playing in room %d\n", rprocID);
+
+	for (i=0; i<slotCount; ++i) {
+		// the players whose process stopped, the others kept theirs
+		if ( (plSlots[i].connfd < 0) || (sockArray[i] < 0) || (plSlots[i].pid != 0) ||
+			plSlots[i].detached ) {
+			continue;
+		}
+
+		++moved;
+
+		if (fork() == 0) {
+			// closing up the listening and migration sockets
+			closeListeners(sv);
+			close(migSock);
+
+			// this process serves the player
+			rprocID = MYERRCODE;
+			plSlots[i].pid = getpid();
+
+			if (plSlots[i].token) {
+				newRoomToken(sockArray[i], i, plSlots[i].token);
+			}
+
+			playerSession(sockArray[i], i, plPipe, plSlots[i].name, qData, sv, greeting);
+		}
+	}
+
+	logMsg(LOG_INFO, "| Room %d: Moved to process %d with %d players in %.2f ms |", old,
+		rprocID, moved, (monoTime() - moveStart)*1e3);
 }
 
 /*- ---------------------------------------------------------------- -*/
@@ -608,22 +4345,34 @@ void pushMessage(int *plPipe, int *sockArray, int *qData, int plCountPos, int pl
  * can achieve a dynamic shared memory allocator so that each room
  * gets its own segment to write on
  *
- * @param Takes in the number of rooms opened, the inventory struct 
- * and a pointer to the beginning of the segment
+ * @param Takes in the inventory struct, the number of player slots,
+ * the messages the history keeps, a pointer to the beginning of the
+ * segment, a pointer to the player slots that follow the quantities,
+ * one to the room's channels and one to their subscriber bitmaps that
+ * follow the slots, one to the players' trade offers and one to their
+ * holdings and one to the room's history that comes last
  *
  */
-int openSharedMem(Inventory *inv, int **data) {
+int openSharedMem(Inventory *inv, int slots, int histSize, int **data, 
+	PlayerSlot **plData, History **hist, Channel **chans, unsigned long long **bits,
+	TradeOffer **offer, int **held) {
 	int shmid;
-	key_t key;
-	size_t shmsize = sizeof(int)*(inv->count+1);
+	// the slots, the channels, the bitmaps, the trades and the history start on
+	// a cache line of their own
+	size_t slotsAt = (sizeof(int)*(inv->count+2) + 63) & ~(size_t)63;
+	size_t chansAt = (slotsAt + sizeof(PlayerSlot)*slots + 63) & ~(size_t)63;
+	size_t bitsAt = (chansAt + sizeof(Channel)*MAX_CHANNELS + 63) & ~(size_t)63;
+	size_t bitsSize = sizeof(unsigned long long)*channelWords(slots)*MAX_CHANNELS;
+	size_t offersAt = (bitsAt + bitsSize + 63) & ~(size_t)63;
+	size_t heldAt = (offersAt + sizeof(TradeOffer)*slots + 63) & ~(size_t)63;
+	size_t histAt = (heldAt + sizeof(int)*inv->count*slots + 63) & ~(size_t)63;
+	size_t shmsize = histAt + historyBytes(histSize);
 	int *start;
 	int i;
 
-	// naming our shared memory
-	key = SHM_KEY + roomsOpened;
-
-	// creating the memory segment
-	if ((shmid = shmget(key, shmsize, IPC_CREAT | 0666)) < 0) {
+	// creating the memory segment, without a key so that other servers
+	// on the host (nodes, or the one we replaced) never share it
+	if ((shmid = shmget(IPC_PRIVATE, shmsize, IPC_CREAT | 0600)) < 0) {
 		perror("shmget error");
 		exit(1);
 	}
@@ -645,13 +4394,241 @@ int openSharedMem(Inventory *inv, int **data) {
 		++start;
 	}
 
-	// last int in the shared memory stands for the player counter
+	// next int in the shared memory stands for the player counter
+	*start = 0;
+	++start;
+
+	// and the last one tells whether the game has started
 	*start = 0;
+	++start;
+
+	// player slots follow, all of them free
+	*plData = (PlayerSlot *)((char *)*data + slotsAt);
+	for (i=0; i<slots; ++i) {
+		(*plData)[i].connfd = -1;
+		(*plData)[i].pid = 0;
+		(*plData)[i].token = 0;
+		(*plData)[i].detached = 0;
+	}
+
+	// no channels yet
+	*chans = (Channel *)((char *)*data + chansAt);
+	*bits = (unsigned long long *)((char *)*data + bitsAt);
+	for (i=0; i<MAX_CHANNELS; ++i) {
+		(*chans)[i].name[0] = '\0';
+		(*chans)[i].members = 0;
+	}
+	memset(*bits, 0, bitsSize);
+
+	// no trades offered and nobody holds anything yet
+	*offer = (TradeOffer *)((char *)*data + offersAt);
+	*held = (int *)((char *)*data + heldAt);
+	for (i=0; i<slots; ++i) {
+		(*offer)[i].to = -1;
+	}
+	memset(*held, 0, sizeof(int)*inv->count*slots);
+
+	// and the room's history, empty
+	*hist = (History *)((char *)*data + histAt);
+	initHistory(*hist, histSize);
 
 	// returning the id so that we can remove the shared memory later on
 	return shmid;
 }
 
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Compiles the banned words and makes them the current ones. The
+ * player processes pick them up with their next message
+ *
+ * @param Takes in the ServerVars struct
+ *
+ * @return 0 on success or -1 if the list couldn't be compiled
+ */
+int loadFilter(ServerVars *sv) {
+	Filter *f;	// the new automaton
+	int id;		// its segment
+
+	if ( (f = compileFilter(sv->s.filterFile, &id)) == NULL ) {
+		return -1;
+	}
+
+	publishFilter(filterCtl, f, id, &filter);
+	filterGen = filterCtl->gen;
+
+	logMsg(LOG_INFO, "| Loaded %d banned words (%d states) |", f->words, f->states);
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Starts a process that reads the inventory file again and checks
+ * it, so that the main server goes on serving the rooms meanwhile, how
+ * large the file is doesn't matter. The process sends the inventory back
+ * through a pipe, its count and then every item's quantity and
+ * name, or closes it without a word if the file is not a valid inventory.
+ * takeCatalog reads it
+ *
+ * @param Takes in the ServerVars struct
+ *
+ * @return 0 on success or -1 if the process couldn't be started
+ */
+int readCatalog(ServerVars *sv) {
+	Inventory inv;	// the new inventory
+	int fd[2];		// the pipe it comes through
+	FILE *out;		// the reader's end
+	pid_t pid;		// the reader
+	int i;			// for counter
+
+	if (pipe(fd) < 0) {
+		return -1;
+	}
+
+	fflush(stdout);
+
+	if ( (pid = fork()) < 0 ) {
+		close(fd[0]);
+		close(fd[1]);
+		return -1;
+	}
+
+	if (pid > 0) {
+		close(fd[1]);
+		fcntl(fd[0], F_SETFL, O_NONBLOCK);
+
+		sv->catalogFd = fd[0];
+		sv->catalogLen = 0;
+
+		return 0;
+	}
+
+	// the reader
+	signal(SIGINT, SIG_IGN);
+	sigprocmask(SIG_SETMASK, &openMask, NULL);
+	closeListeners(sv);
+	close(fd[0]);
+
+	if ( readInventory(sv->s.inventory, &inv) || (inv.count == 0) || checkForDuplicates(inv) ) {
+		exit(0);
+	}
+
+	if ( (out = fdopen(fd[1], "w")) == NULL ) {
+		exit(1);
+	}
+
+	fwrite(&(inv.count), sizeof(int), 1, out);
+
+	for (i=0; i<inv.count; ++i) {
+		fwrite(&(inv.quantity[i]), sizeof(int), 1, out);
+		fwrite(inv.items[i], strlen(inv.items[i])+1, 1, out);
+	}
+
+	fclose(out);
+	exit(0);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Reads what readCatalog's process sent, and once it is done makes
+ * the new inventory the one new rooms start with. Every room took its own
+ * copy of the inventory when it was forked and keeps it until it closes,
+ * so we only swap ours and free the old one, nobody else uses it. Rooms
+ * only merge with rooms of the same inventory (the room table knows which
+ * one they have). A file that couldn't be read leaves everything as it was
+ *
+ * @param Takes in the ServerVars struct
+ *
+ * @return 0 while it comes in or on success, -1 if the file was not a
+ * valid inventory
+ */
+int takeCatalog(ServerVars *sv) {
+	Inventory inv;		// the new inventory
+	int count;			// its items
+	int quantity;		// an item's quantity
+	size_t at;			// where the next item starts
+	char *name;			// and its name
+	ssize_t got;		// bytes read
+	int i;				// for counter
+
+	if ( (sv->catalogBuf = realloc(sv->catalogBuf, sv->catalogLen + CATALOG_CHUNK)) == NULL ) {
+		perror("Allocation error");
+		exit(1);
+	}
+
+	got = read(sv->catalogFd, sv->catalogBuf + sv->catalogLen, CATALOG_CHUNK);
+
+	if ( (got < 0) && ((errno == EAGAIN) || (errno == EINTR)) ) {
+		return 0;
+	}
+
+	if (got > 0) {
+		sv->catalogLen += got;
+		return 0;
+	}
+
+	// the reader is done
+	close(sv->catalogFd);
+	sv->catalogFd = -1;
+
+	if (sv->catalogLen < sizeof(count)) {
+		return -1;
+	}
+
+	memcpy(&count, sv->catalogBuf, sizeof(count));
+	at = sizeof(count);
+
+	initInventory(&inv);
+
+	for (i=0; i<count; ++i) {
+		name = sv->catalogBuf + at + sizeof(quantity);
+
+		if ( (at + sizeof(quantity) >= sv->catalogLen) ||
+			(memchr(name, '\0', sv->catalogLen - at - sizeof(quantity)) == NULL) ) {
+			freeInventory(&inv);
+			count = -1;
+			break;
+		}
+
+		memcpy(&quantity, sv->catalogBuf + at, sizeof(quantity));
+		newInventoryRecord(&inv, name, quantity);
+
+		at += sizeof(quantity) + strlen(name) + 1;
+	}
+
+	free(sv->catalogBuf);
+	sv->catalogBuf = NULL;
+
+	if (count <= 0) {
+		return -1;
+	}
+
+	freeInventory(&(sv->inv));
+	sv->inv = inv;
+	++(sv->catalog);
+
+	// the room filling up keeps the snapshot it has, the ones that open
+	// from now on get one with room for every item
+	if (inv.count > avail->size) {
+		shmdt(avail);
+		avail = openAvailability(inv.count);
+	}
+
+	// the rooms of the old inventory keep its pool until they close
+	if (sv->pool) {
+		shmdt(sv->pool);
+		sv->pool = openPool(&(sv->inv), sv->s.pool);
+	}
+
+	logMsg(LOG_INFO, "| Loaded inventory %d: %d items, %d in total |", sv->catalog, 
+		inv.count, inv.quota);
+
+	// waiting players whose items are gone don't wait anymore
+	pruneWaiting(sv);
+
+	return 0;
+}
+
 /*- ---------------------------------------------------------------- -*/
 /**
  * @brief Releases the shared memory segment we reserved
@@ -717,15 +4694,66 @@ void catch_int(int signo) {
 	}
 
 
+	// the main server removes its Unix domain socket
+	if ( unixPath && (pprocID == getpid()) ) {
+		unlink(unixPath);
+	}
+
 	if (pprocID == getppid()) {
 		// goodbye message
-		printf("\n\n\t\t Server terminated with SIGINT ... GoodBye ! \n\n");	
+		logMsg(LOG_INFO, "Server terminated with SIGINT ... GoodBye !");
 	}
 
 	// exiting
 	exit(0);
 }
 
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Handles the sighup signal, the main server reloads the
+ * inventory and the banned words once it is out of the handler
+ *
+ * @param Takes in the signal int code
+ *
+ */
+void catch_hup(int signo) {
+	(void) signo;	// unused
+
+	reload = 1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Signal handler for SIGUSR1. A running room moves to a new
+ * process with its next event. Sent with a value (sigqueue) it is the
+ * core the room moves to
+ *
+ * @param Takes in the signal's number, its info and context
+ *
+ */
+void catch_usr1(int signo, siginfo_t *info, void *context) {
+	(void) signo;	// unused
+	(void) context;	// unused
+
+	handoffCpu = (info->si_code == SI_QUEUE) ? info->si_value.sival_int : -1;
+	handoff = 1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Handles the sigusr2 signal. The main server hands its
+ * listening sockets to a new binary, the room that is filling up stops
+ * accepting. Both happen once they are out of the handler
+ *
+ * @param Takes in the signal int code
+ *
+ */
+void catch_usr2(int signo) {
+	(void) signo;	// unused
+
+	upgrade = 1;
+}
+
 /*- ---------------------------------------------------------------- -*/
 /**
  * @brief Handles the sigalarm signal
@@ -740,7 +4768,7 @@ void catch_alarm(int signo) {
 	signal(SIGALRM, SIG_IGN);
 
 	// inforiming the server user that this connection timed out
-	printf("| A player in room %d timed out and was kicked ... |\n", getpid());
+	logMsg(LOG_INFO, "| A player in room %d timed out and was kicked ... |", getpid());
 
 	// exiting ...
 	exit(1);
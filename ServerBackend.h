@@ -1,12 +1,38 @@
 #ifndef SERVERBACKEND_H
 #define SERVERBACKEND_H
 
+#include <limits.h>		// INT_MAX, the largest count an option takes
+
 // Structs
 	// struct that holds settings
 typedef struct {
 	int players;
 	int quota;
 	char inventory[LINE_LEN];
+	int waitlist;	// max players waiting for a room (0 = off)
+	int compact;	// rooms with this many players or less merge (0 = off)
+	int deadline;	// max seconds a room waits to fill up (0 = off)
+	int backlog;	// messages queued for a slow player
+	int overflow;	// what happens when a player's queue is full
+	int engine;		// i/o engine of the rooms
+	char unixPath[LINE_LEN*4];	// Unix domain listener ("off" = none)
+	int grace;		// seconds a player's seat waits for him (0 = off)
+	int history;	// messages a room keeps for catching up (0 = off)
+	int logLevel;	// verbosity of the log
+	char logFile[LINE_LEN*4];	// where the log goes ("-" = stdout)
+	char transcripts[LINE_LEN*4];	// directory of the room transcripts ("off" = none)
+	double rate;	// messages per second a player may send (0 = no limit)
+	int burst;		// messages he may send at once
+	int limit;		// what happens to the messages over his allowance
+	char filterFile[LINE_LEN*4];	// banned words, one per line ("off" = none)
+	int filterPolicy;	// what happens to messages with banned words
+	int spectators;	// spectators a room takes (0 = off)
+	int pool;		// units a room borrows from the global pool (0 = off)
+	int port;		// TCP port the players connect to
+	char directory[LINE_LEN*4];	// room directory the node reports to ("off" = none)
+	int dirPort;	// port of the directory this node hosts (0 = none)
+	char nodeAddr[LINE_LEN*4];	// address other nodes send our players to ("" = ours towards the directory)
+	int nodeLimit;	// players the node takes before sending them on (0 = no limit)
 }Settings;
 
 	// struct that groups useful vars
@@ -17,10 +43,53 @@ typedef struct {
 	// server's inventory
 	Inventory inv;
 
-	// listening socket
+	// listening sockets, TCP (IPv6 dual-stack or IPv4) and Unix domain
 	int listenfd; 
+	int unixfd;
+
+	// players waiting for a room with enough items
+	Waitlist wl;
+
+	// socket the rooms use to hand waiting players to the main server
+	int wlSock[2];
+
+	// version of the inventory, bumped when it is reloaded (sighup)
+	int catalog;
+
+	// a reload's new inventory, as its reader process sends it to us
+	// (-1 = no reload going on)
+	int catalogFd;
+	char *catalogBuf;
+	size_t catalogLen;
+
+	// stock all the rooms share (NULL unless in global pool mode)
+	Pool *pool;
+
+	// socket to the room directory (-1 = none)
+	int dirSock;
+
+	// binary upgrades: the server we took the listening sockets from
+	// and the one we handed them to (-1 = none)
+	int upFrom;
+	int upTo;
+
+	// the new binary while it starts (-1 = none), its pid and the time
+	// it has to start until
+	int upStart;
+	pid_t upPid;
+	double upUntil;
 } ServerVars;
 
+// environment variable telling a new binary which socket the running
+// server hands its listening sockets through
+#define UPGRADE_ENV "SERVER_UPGRADE_FD"
+
+// message that comes with the TCP listening socket during an upgrade,
+// the Unix domain one follows in a message of its own
+typedef struct {
+	int hasUnix;	// the Unix domain socket follows
+}UpgradeMsg;
+
 typedef struct {
 	int connfd;
 
@@ -31,6 +100,29 @@ typedef struct {
 } ChatData;
 
 
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Reads the value of an option that counts something (players,
+ * seconds), so that a typo isn't taken as "off"
+ *
+ * @param Takes in the value
+ *
+ * @return The count or -1 if it isn't a number >= 0
+ */
+int parseCount(char *str) {
+	char *end;	// where the number ends
+	long n;		// the number
+
+	errno = 0;
+	n = strtol(str, &end, 10);
+
+	if ( (end == str) || (*end != '\0') || (errno != 0) || (n < 0) || (n > INT_MAX) ) {
+		return -1;
+	}
+
+	return (int)n;
+}
+
 /*- ---------------------------------------------------------------- -*/
 /**
  * @brief Initializes the the settings struct according
@@ -48,8 +140,34 @@ typedef struct {
 	int gotQ = 0;
 	int gotI = 0;
 
-	// managing invalid parameter input
-	if (argc != 7) {
+	// optional settings
+	s->waitlist = 0;
+	s->compact = 0;
+	s->deadline = 0;
+	s->backlog = 64;
+	s->overflow = OVERFLOW_DROP;
+	s->engine = ENGINE_SELECT;
+	strcpy(s->unixPath, UNIX_PATH);
+	s->grace = 0;
+	s->history = 64;
+	s->logLevel = LOG_INFO;
+	strcpy(s->logFile, "-");
+	strcpy(s->transcripts, "off");
+	s->rate = 0;
+	s->burst = 0;
+	s->limit = LIMIT_DELAY;
+	strcpy(s->filterFile, "off");
+	s->filterPolicy = FILTER_MASK;
+	s->spectators = 0;
+	s->pool = 0;
+	s->port = PORT_NO;
+	strcpy(s->directory, "off");
+	s->dirPort = 0;
+	s->nodeAddr[0] = '\0';
+	s->nodeLimit = 0;
+
+	// managing invalid parameter input (flags always come in pairs)
+	if (argc < 7 || !(argc % 2)) {
 		printf("Invalid parameters. Exiting ... \n");
 		exit(1);		
 	}
@@ -65,24 +183,177 @@ typedef struct {
 		} else if ( !strcmp(argv[i], "-i") && gotI == 0 ) {
 			strcpy(s->inventory, argv[i+1]);
 			gotI = 1;
+		} else if ( !strcmp(argv[i], "-w") && parseCount(argv[i+1]) >= 0 ) {
+			s->waitlist = parseCount(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-c") && parseCount(argv[i+1]) >= 0 ) {
+			s->compact = parseCount(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-d") && parseCount(argv[i+1]) >= 0 ) {
+			s->deadline = parseCount(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-b") && atoi(argv[i+1]) > 0 ) {
+			s->backlog = atoi(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-o") && parseOverflowPolicy(argv[i+1]) >= 0 ) {
+			s->overflow = parseOverflowPolicy(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-e") && parseEngine(argv[i+1]) >= 0 ) {
+			s->engine = parseEngine(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-u") && strlen(argv[i+1]) < sizeof(s->unixPath) ) {
+			strcpy(s->unixPath, argv[i+1]);
+		} else if ( !strcmp(argv[i], "-r") && parseCount(argv[i+1]) >= 0 ) {
+			s->grace = parseCount(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-h") && atoi(argv[i+1]) >= 0 ) {
+			s->history = atoi(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-l") && parseLogLevel(argv[i+1]) >= 0 ) {
+			s->logLevel = parseLogLevel(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-f") && strlen(argv[i+1]) < sizeof(s->logFile) ) {
+			strcpy(s->logFile, argv[i+1]);
+		} else if ( !strcmp(argv[i], "-t") && strlen(argv[i+1]) < sizeof(s->transcripts) ) {
+			strcpy(s->transcripts, argv[i+1]);
+		} else if ( !strcmp(argv[i], "-m") && atof(argv[i+1]) >= 0 ) {
+			s->rate = atof(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-k") && atoi(argv[i+1]) >= 0 ) {
+			s->burst = atoi(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-x") && parseLimitPolicy(argv[i+1]) >= 0 ) {
+			s->limit = parseLimitPolicy(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-z") && strlen(argv[i+1]) < sizeof(s->filterFile) ) {
+			strcpy(s->filterFile, argv[i+1]);
+		} else if ( !strcmp(argv[i], "-y") && parseFilterPolicy(argv[i+1]) >= 0 ) {
+			s->filterPolicy = parseFilterPolicy(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-v") && atoi(argv[i+1]) >= 0 ) {
+			s->spectators = atoi(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-g") && atoi(argv[i+1]) >= 0 ) {
+			s->pool = atoi(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-P") && atoi(argv[i+1]) > 0 && atoi(argv[i+1]) < 65536 ) {
+			s->port = atoi(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-n") && strlen(argv[i+1]) < sizeof(s->directory) ) {
+			strcpy(s->directory, argv[i+1]);
+		} else if ( !strcmp(argv[i], "-N") && atoi(argv[i+1]) > 0 && atoi(argv[i+1]) < 65536 ) {
+			s->dirPort = atoi(argv[i+1]);
+		} else if ( !strcmp(argv[i], "-a") && strlen(argv[i+1]) < sizeof(s->nodeAddr) ) {
+			strcpy(s->nodeAddr, argv[i+1]);
+		} else if ( !strcmp(argv[i], "-L") && atoi(argv[i+1]) >= 0 ) {
+			s->nodeLimit = atoi(argv[i+1]);
 		} else {
-			break;
+			// an unknown option or a value it doesn't take, the rest
+			// of the command line must not be ignored silently
+			printf("Invalid parameter %s %s. Exiting ... \n", argv[i], argv[i+1]);
+			exit(1);
 		}
 	} // for
 
+	// the spectator relays follow the rooms' histories
+	if ( (s->spectators > 0) && (s->history == 0) ) {
+		printf("Spectators need the rooms to keep messages (-h), they are off \n");
+		s->spectators = 0;
+	}
+
+	// nodes on one host each need a Unix domain socket of their own
+	if ( (s->port != PORT_NO) && !strcmp(s->unixPath, UNIX_PATH) ) {
+		snprintf(s->unixPath, sizeof(s->unixPath), "/tmp/game%d.sock", s->port);
+	}
+
+	// the node hosting the directory reports to it too
+	if ( (s->dirPort > 0) && !strcmp(s->directory, "off") ) {
+		snprintf(s->directory, sizeof(s->directory), "localhost:%d", s->dirPort);
+	}
+
+	// a player may send a second's worth of messages at once
+	if (s->burst == 0) {
+		s->burst = (s->rate > 1) ? (int)s->rate : 1;
+	}
+
 	// checking if we got everything we need
 	if (gotP && gotQ && gotI) {
 		// printing the settings that were read
 		printf("\n\t Settings for this game: \n\n");
 		printf("\t Players: %d \n", s->players);
 		printf("\t Inventory per player: %d \n", s->quota);
-		printf("\t Using %s as inventory file\n\n", s->inventory);
+		printf("\t Using %s as inventory file\n", s->inventory);
+		printf("\t Waitlist size: %d \n", s->waitlist);
+		printf("\t Merge rooms with up to %d players \n", s->compact);
+		printf("\t Room fill deadline: %d seconds \n", s->deadline);
+		printf("\t Queued messages per player: %d (on overflow: %s) \n", 
+			s->backlog, overflowPolicyName(s->overflow));
+		printf("\t I/O engine: %s \n", engineName(s->engine));
+		printf("\t Unix domain socket: %s \n", s->unixPath);
+		printf("\t Seats kept for reconnecting players: %d seconds \n", s->grace);
+		printf("\t Messages kept per room: %d \n", s->history);
+		printf("\t Log: %s (%s) \n", strcmp(s->logFile, "-") ? s->logFile : "stdout",
+			logLevelName(s->logLevel));
+		printf("\t Transcripts: %s \n", s->transcripts);
+
+		if (s->rate > 0) {
+			printf("\t Messages per player: %g per second, %d at once (over it: %s) \n",
+				s->rate, s->burst, limitPolicyName(s->limit));
+		} else {
+			printf("\t Messages per player: no limit \n");
+		}
+
+		printf("\t Banned words: %s (%s) \n", s->filterFile, filterPolicyName(s->filterPolicy));
+		printf("\t Spectators per room: %d \n", s->spectators);
+
+		if (s->pool > 0) {
+			printf("\t Items: shared by all rooms, borrowed %d at a time \n", s->pool);
+		} else {
+			printf("\t Items: a full inventory per room \n");
+		}
+
+		printf("\t Port: %d \n", s->port);
+
+		if (strcmp(s->directory, "off")) {
+			printf("\t Room directory: %s%s, as %s (takes %d players before sending them on) \n\n",
+				s->directory, (s->dirPort > 0) ? " (hosted here)" : "", 
+				s->nodeAddr[0] ? s->nodeAddr : "our address towards it", s->nodeLimit);
+		} else {
+			printf("\t Room directory: off \n\n");
+		}
 	} else {
 		printf("Invalid or missing parameters. Exiting ... \n");
 		exit(1);
 	}
 }
 /*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the time of the monotonic clock in seconds
+ *
+ * @return The current time
+ */
+double monoTime() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Writes a whole message to a player. The room's zero-copy
+ * fan-out makes player sockets non blocking, so instead of failing
+ * when the socket is full we wait until it takes the rest
+ *
+ * @param Takes in the player's socket, the message and its length
+ *
+ * @return 0 on success or -1 if the player is gone
+ */
+int sendFrame(int fd, char *frame, size_t len) {
+	struct pollfd pfd;	// waiting for the socket to drain
+	size_t done = 0;	// bytes written
+	ssize_t n;			// bytes of the last write
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+
+	while (done < len) {
+		if ( (n = send(fd, frame + done, len - done, MSG_NOSIGNAL)) > 0 ) {
+			done += n;
+		} else if ( (n < 0) && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+			poll(&pfd, 1, -1);
+		} else if ( !((n < 0) && (errno == EINTR)) ) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+/*- ---------------------------------------------------------------- -*/
 /**
  * @brief Checking the validity of the inventory that the client sent 
  *
@@ -112,5 +383,91 @@ int checkInv(Inventory *srv, Inventory cli, int max_quota) {
 	return -1;
 }
 /*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Passes an open file descriptor to another process through a
+ * Unix domain socket, along with a small payload
+ *
+ * @param Takes in the Unix socket, the descriptor to pass and the
+ * payload with its length
+ *
+ * @return Returns 0 on success or -1 on failure
+ */
+int sendFd(int sock, int fd, void *buf, size_t len) {
+	struct msghdr msg;		// message header
+	struct iovec iov;		// payload
+	struct cmsghdr *cmsg;	// control message carrying the descriptor
+
+	// control buffer, aligned the way cmsghdr expects
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} ctrl;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	bzero(&msg, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buf;
+	msg.msg_controllen = sizeof(ctrl.buf);
+
+	// attaching the descriptor
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	if (sendmsg(sock, &msg, 0) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Receives a file descriptor sent with sendFd
+ *
+ * @param Takes in the Unix socket and a buffer for the payload
+ * along with its length
+ *
+ * @return Returns the new descriptor or -1 on failure
+ */
+int recvFd(int sock, void *buf, size_t len) {
+	struct msghdr msg;		// message header
+	struct iovec iov;		// payload
+	struct cmsghdr *cmsg;	// control message carrying the descriptor
+	int fd = -1;			// descriptor we received
+
+	// control buffer, aligned the way cmsghdr expects
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} ctrl;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	bzero(&msg, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buf;
+	msg.msg_controllen = sizeof(ctrl.buf);
+
+	if (recvmsg(sock, &msg, 0) <= 0) {
+		return -1;
+	}
+
+	// pulling the descriptor out of the control message
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if ( cmsg && cmsg->cmsg_level == SOL_SOCKET && 
+		cmsg->cmsg_type == SCM_RIGHTS ) {
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	return fd;
+}
+/*- ---------------------------------------------------------------- -*/
 
 #endif
\ No newline at end of file
@@ -0,0 +1,414 @@
+#ifndef SPECTATORS_H
+#define SPECTATORS_H
+
+#include <sys/epoll.h>		// spectators' sockets
+#include <sys/resource.h>	// descriptors for thousands of them
+
+#define SPECTATOR_BATCH 16		// most messages a spectator gets per send
+#define SPECTATOR_REPLAY 10		// recent messages a new spectator gets
+#define SPECTATOR_EVENTS 256	// socket events handled per wait
+#define SPECTATOR_POLL_MS 2		// wait between looks at an idle history
+#define SPECTATOR_BUSY_US 100	// and at the history of a room that chats
+#define SPECTATOR_BUSY 50		// looks without a message until it is idle
+
+// struct holding what a spectator got so far. All of them share the
+// relay's copy of the messages, so this is all a spectator costs
+typedef struct {
+	int fd;						// his socket (-1 = free)
+	unsigned long long next;	// next message he gets
+	int sent;					// bytes of it he already got
+	int blocked;				// his socket is full, epoll tells us when not
+}Spectator;
+
+// struct holding a room's spectator relay. It follows the room's
+// history and copies every message once into a cache of frames, which
+// goes out to the spectators with non blocking batched sends. Neither
+// the room nor the players' processes know about the spectators, so
+// however many there are the players don't wait for them
+typedef struct {
+	History *h;					// the room's history
+	int room;					// the room's pid
+	int max;					// most spectators
+	int count;					// spectators now
+	int sock;					// rooms hand spectators to us through it
+	int ep;						// epoll instance
+	unsigned long long last;	// newest message in the cache
+	unsigned long long *seqs;	// message each cache entry holds (0 = lost)
+	char *frames;				// the cache, as many frames as the history
+	Spectator *viewers;			// the spectators
+	int *spare;					// free spectator entries
+	int spares;					// number of them
+}SpectatorRelay;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Fills in the address of a room's spectator relay. Like the
+ * rooms' sockets it lives in the abstract namespace
+ *
+ * @param Takes in the room's pid and the address to fill in
+ *
+ * @return The length of the address
+ */
+socklen_t spectatorAddress(pid_t pid, struct sockaddr_un *addr) {
+	bzero(addr, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	// first byte stays zero (abstract namespace)
+	snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "spectators%d.%d", PORT_NO, pid);
+
+	return sizeof(sa_family_t) + 1 + strlen(addr->sun_path + 1);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Copies the messages the room relayed since we last looked
+ * into the cache. If the room got a whole history ahead of us the
+ * oldest ones are gone and left out
+ *
+ * @param Takes in the relay
+ *
+ * @return The number of new messages
+ */
+int cacheMessages(SpectatorRelay *r) {
+	unsigned long long head = historyHead(r->h);	// newest message
+	unsigned long long seq;							// message we copy
+	HistoryEntry e;									// its entry
+	int size = r->h->size;							// entries of the cache
+	int got = 0;									// new messages
+	int status;										// result of the copy
+
+	if (head > r->last + size) {
+		r->last = head - size;
+	}
+
+	for (seq = r->last + 1; seq <= head; ++seq) {
+		// a player's process is still writing it, it goes out next time
+		if ( (status = readHistoryEntry(r->h, seq, &e)) < 0 ) {
+			break;
+		}
+
+		if (status == 0) {
+			memcpy(r->frames + (seq % size)*pSize, e.text, pSize);
+			r->seqs[seq % size] = seq;
+		} else {
+			r->seqs[seq % size] = 0;
+		}
+
+		r->last = seq;
+		++got;
+	}
+
+	return got;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Lets a spectator go
+ *
+ * @param Takes in the relay and the spectator's entry
+ *
+ */
+void dropSpectator(SpectatorRelay *r, int i) {
+	close(r->viewers[i].fd);
+	r->viewers[i].fd = -1;
+	r->spare[r->spares++] = i;
+	--(r->count);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Sends a spectator the messages he doesn't have yet, as many as
+ * his socket takes, up to SPECTATOR_BATCH frames per send. A spectator
+ * that falls a whole cache behind skips to its oldest message, unless
+ * he is in the middle of a frame, which is gone. Then he is let go, the
+ * way a player that can't keep up is
+ *
+ * @param Takes in the relay and the spectator's entry
+ *
+ */
+void feedSpectator(SpectatorRelay *r, int i) {
+	Spectator *v = &(r->viewers[i]);		// the spectator
+	int size = r->h->size;					// entries of the cache
+	struct iovec iov[SPECTATOR_BATCH];		// frames of a send
+	unsigned long long seqs[SPECTATOR_BATCH];	// and their messages
+	struct msghdr msg;						// the send
+	struct epoll_event ev;					// his socket's events
+	unsigned long long seq;					// message we add
+	ssize_t n;								// bytes sent
+	int k, rem;								// for counters
+
+	while (v->next <= r->last) {
+		if (r->last - v->next >= (unsigned long long)size) {
+			if (v->sent > 0) {
+				logMsg(LOG_DEBUG, "| Room %d: A spectator can't keep up, disconnecting |", r->room);
+				dropSpectator(r, i);
+				return;
+			}
+
+			v->next = r->last - size + 1;
+		}
+
+		// the frames he is owed, the first one maybe in part
+		for (k = 0, seq = v->next; (k < SPECTATOR_BATCH) && (seq <= r->last); ++seq) {
+			if (r->seqs[seq % size] != seq) {
+				continue;	// lost before we could copy it
+			}
+
+			iov[k].iov_base = r->frames + (seq % size)*pSize;
+			iov[k].iov_len = pSize;
+			seqs[k++] = seq;
+		}
+
+		if (k == 0) {
+			v->next = seq;
+			break;
+		}
+
+		if (seqs[0] != v->next) {
+			v->sent = 0;	// the message he stopped in was lost, he never started it
+		}
+
+		iov[0].iov_base = (char *)iov[0].iov_base + v->sent;
+		iov[0].iov_len -= v->sent;
+
+		bzero(&msg, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = k;
+
+		if ( (n = sendmsg(v->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0 ) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+
+			if (errno != EINTR) {
+				dropSpectator(r, i);
+				return;
+			}
+
+			continue;
+		}
+
+		// moving past what left
+		v->next = seqs[0];
+
+		for (k=0; (n > 0) && (k < (int)msg.msg_iovlen); ++k) {
+			rem = iov[k].iov_len;
+
+			if (n < rem) {
+				v->sent += n;
+				n = 0;
+				break;
+			}
+
+			n -= rem;
+			v->next = seqs[k] + 1;
+			v->sent = 0;
+		}
+
+		// his socket is full
+		if (k < (int)msg.msg_iovlen) {
+			break;
+		}
+	}
+
+	// waiting for his socket to drain, if he is behind
+	if ( (v->next <= r->last) != v->blocked ) {
+		v->blocked = !v->blocked;
+		ev.events = EPOLLIN | (v->blocked ? EPOLLOUT : 0);
+		ev.data.u32 = i;
+		epoll_ctl(r->ep, EPOLL_CTL_MOD, v->fd, &ev);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Handles what epoll reports about a spectator's socket.
+ * Spectators have nothing to say, whatever they send is thrown away and
+ * the end of their stream means they left
+ *
+ * @param Takes in the relay, the spectator's entry and the events
+ *
+ */
+void watchEvent(SpectatorRelay *r, int i, unsigned events) {
+	char buf[pSize];	// what he sent
+	ssize_t n = 1;		// bytes of it
+
+	if (events & EPOLLIN) {
+		n = recv(r->viewers[i].fd, buf, sizeof(buf), MSG_DONTWAIT);
+	}
+
+	if ( (events & (EPOLLHUP | EPOLLERR)) || (n == 0) ||
+		((n < 0) && (errno != EAGAIN) && (errno != EINTR)) ) {
+		dropSpectator(r, i);
+	} else if (events & EPOLLOUT) {
+		feedSpectator(r, i);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Takes the spectators the room's processes handed over since we
+ * last looked, answers them and sends them the last few messages
+ *
+ * @param Takes in the relay
+ *
+ */
+void admitSpectators(SpectatorRelay *r) {
+	char response[LINE_LEN];	// answer to the spectator
+	struct epoll_event ev;		// his socket's events
+	int dummy;					// payload of the handover
+	int fd;						// his socket
+	int i;						// his entry
+
+	while ( (fd = recvFd(r->sock, &dummy, sizeof(dummy))) >= 0 ) {
+		bzero(response, sizeof(response));
+
+		if (r->spares == 0) {
+			strcpy(response, "Too many spectators");
+			send(fd, response, sizeof(response), MSG_NOSIGNAL | MSG_DONTWAIT);
+			close(fd);
+			continue;
+		}
+
+		snprintf(response, sizeof(response), "OK watching room %d", r->room);
+
+		if (send(fd, response, sizeof(response), MSG_NOSIGNAL | MSG_DONTWAIT) != sizeof(response)) {
+			close(fd);
+			continue;
+		}
+
+		i = r->spare[--(r->spares)];
+		r->viewers[i].fd = fd;
+		r->viewers[i].next = (r->last > SPECTATOR_REPLAY) ? r->last - SPECTATOR_REPLAY + 1 : 1;
+		r->viewers[i].sent = 0;
+		r->viewers[i].blocked = 0;
+		++(r->count);
+
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+
+		if (epoll_ctl(r->ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			dropSpectator(r, i);
+			continue;
+		}
+
+		logMsg(LOG_DEBUG, "| Room %d: %d spectators |", r->room, r->count);
+
+		feedSpectator(r, i);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Starts a process that relays a room's chat to its spectators.
+ * It follows the history, looking more often while the room chats, and
+ * leaves with the room
+ *
+ * @param Takes in the room's history, the room's pid and the most
+ * spectators it takes
+ *
+ * @return The relay's pid (or -1 if it couldn't start)
+ */
+pid_t startSpectatorRelay(History *h, int room, int max) {
+	SpectatorRelay r;							// the relay
+	struct sockaddr_un addr;					// where spectators come from
+	socklen_t len;								// its length
+	struct epoll_event ev;						// the handover socket's events
+	struct epoll_event events[SPECTATOR_EVENTS];// events of a wait
+	struct rlimit lim;							// descriptors we may open
+	int idle = SPECTATOR_BUSY;					// looks since the last message
+	int n, i;									// for counters
+	pid_t pid;									// the relay
+
+	if ( (pid = fork()) != 0 ) {
+		if (pid < 0) {
+			logMsg(LOG_ERROR, "Room %d: couldn't start the spectator relay: %s",
+				room, strerror(errno));
+		}
+
+		return pid;
+	}
+
+	signal(SIGINT, SIG_IGN);
+	signal(SIGCHLD, SIG_DFL);
+
+	// one descriptor per spectator
+	if ( (getrlimit(RLIMIT_NOFILE, &lim) == 0) && (lim.rlim_cur < (rlim_t)max + 64) ) {
+		lim.rlim_cur = (lim.rlim_max < (rlim_t)max + 64) ? lim.rlim_max : (rlim_t)max + 64;
+		setrlimit(RLIMIT_NOFILE, &lim);
+	}
+
+	r.h = h;
+	r.room = room;
+	r.max = max;
+	r.count = 0;
+	r.last = historyHead(h);
+	r.seqs = calloc(h->size, sizeof(unsigned long long));
+	r.frames = malloc((size_t)h->size*pSize);
+	r.viewers = malloc(sizeof(Spectator)*max);
+	r.spare = malloc(sizeof(int)*max);
+	r.spares = max;
+
+	if ( !r.seqs || !r.frames || !r.viewers || !r.spare ) {
+		exit(1);
+	}
+
+	for (i=0; i<max; ++i) {
+		r.viewers[i].fd = -1;
+		r.spare[i] = max - 1 - i;
+	}
+
+	r.sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	len = spectatorAddress(room, &addr);
+
+	if ( (r.sock < 0) || (bind(r.sock, (struct sockaddr *)&addr, len) < 0) ||
+		((r.ep = epoll_create1(0)) < 0) ) {
+		logMsg(LOG_ERROR, "Room %d: couldn't open the spectator socket: %s", room, strerror(errno));
+		exit(1);
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.u32 = max;
+	epoll_ctl(r.ep, EPOLL_CTL_ADD, r.sock, &ev);
+
+	for (;;) {
+		// while the room chats we look more often, so that the
+		// history doesn't wrap around before we copy it
+		n = epoll_wait(r.ep, events, SPECTATOR_EVENTS,
+			(idle < SPECTATOR_BUSY) ? 0 : SPECTATOR_POLL_MS);
+
+		for (i=0; i<n; ++i) {
+			if (events[i].data.u32 == (unsigned)max) {
+				admitSpectators(&r);
+			} else if (r.viewers[events[i].data.u32].fd >= 0) {
+				watchEvent(&r, events[i].data.u32, events[i].events);
+			}
+		}
+
+		// new messages go to everyone who isn't behind already
+		if (cacheMessages(&r) > 0) {
+			idle = 0;
+
+			for (i=0; i<max; ++i) {
+				if ( (r.viewers[i].fd >= 0) && !r.viewers[i].blocked ) {
+					feedSpectator(&r, i);
+				}
+			}
+		} else {
+			++idle;
+		}
+
+		// the room is gone, so are its spectators
+		if (!roomRunning(r.h, room)) {
+			exit(0);
+		}
+
+		if (idle < SPECTATOR_BUSY) {
+			usleep(SPECTATOR_BUSY_US);
+		}
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <time.h>		// monotonic stamps
+#include <stddef.h>		// offsetof, for the stamps
+
+#define TRACE_MAGIC 0x54524331u	// marks a traced message ("TRC1")
+
+// stages a traced message is stamped at, in the order it goes through them
+#define TRACE_TYPED 0	// the sender pressed enter (playerWrite)
+#define TRACE_SENT 1	// and his client wrote it to the socket
+#define TRACE_READ 2	// his server process read it (chat)
+#define TRACE_PIPED 3	// and wrote it to the room's pipe
+#define TRACE_ROOM 4	// the room took it from the pipe (pushMessage)
+#define TRACE_FANOUT 5	// and handed it to the recipient's socket or queue
+#define TRACE_RECV 6	// the recipient's client read it (playerRead)
+#define TRACE_SHOWN 7	// and printed it
+#define TRACE_STAMPS 8
+
+#define TRACE_BUCKETS 26	// histogram buckets, a power of two of microseconds each
+
+// stamps of a traced message. They ride at the end of the frame's text,
+// where every frame has room to spare, so tracing adds no bytes to what
+// goes through the sockets and the pipes. A message is traced when its
+// sender's client turns tracing on, everyone on the way only checks the
+// magic, which an untraced message doesn't carry
+typedef struct {
+	unsigned magic;				// TRACE_MAGIC if the message is traced
+	unsigned pad;				// keeps the stamps aligned
+	long long ns[TRACE_STAMPS];	// monotonic time of each stage (0 = not stamped)
+}TraceStamps;
+
+// where the stamps start in a frame, a traced message's text ends before
+#define TRACE_AT (FRAME_TEXT - sizeof(TraceStamps))
+
+// struct holding the latency histograms of the traced messages a client
+// got, one per stage, each from the stamp before it
+typedef struct {
+	unsigned long long count[TRACE_STAMPS][TRACE_BUCKETS];	// messages per bucket
+	unsigned long long total[TRACE_STAMPS];		// messages per stage
+	unsigned long long skewed;	// stages that ended before they began (clocks of two hosts)
+}TraceHist;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the time of the monotonic clock in nanoseconds, the
+ * clock all the processes of a host share
+ *
+ * @return The current time
+ */
+long long traceNow() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec*1000000000LL + now.tv_nsec;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Checks whether a frame carries trace stamps
+ *
+ * @param Takes in the frame and the bytes of it we have
+ *
+ * @return 1 if it is traced, 0 otherwise
+ */
+int isTraced(char *frame, size_t len) {
+	unsigned magic;	// the frame's mark
+
+	if (len < TRACE_AT + sizeof(TraceStamps)) {
+		return 0;
+	}
+
+	memcpy(&magic, frame + TRACE_AT, sizeof(magic));
+
+	return magic == TRACE_MAGIC;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Marks a frame as traced, with the time its sender typed it as
+ * its first stamp. Its text has to end before TRACE_AT
+ *
+ * @param Takes in the frame and the time it was typed
+ *
+ */
+void startTrace(char *frame, long long typed) {
+	TraceStamps t;	// the stamps
+
+	bzero(&t, sizeof(t));
+	t.magic = TRACE_MAGIC;
+	t.ns[TRACE_TYPED] = typed;
+
+	memcpy(frame + TRACE_AT, &t, sizeof(t));
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Removes the mark of a traced frame, so that a buffer used
+ * again doesn't pass an old message's stamps on
+ *
+ * @param Takes in the frame
+ *
+ */
+void clearTrace(char *frame) {
+	memset(frame + TRACE_AT, 0, sizeof(unsigned));
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Stamps a traced frame with the current time
+ *
+ * @param Takes in the frame and the stage (one of the TRACE_* values)
+ *
+ */
+void traceStamp(char *frame, int stage) {
+	long long now = traceNow();	// the stamp
+
+	memcpy(frame + TRACE_AT + offsetof(TraceStamps, ns) + stage*sizeof(now), &now, sizeof(now));
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Moves the stamps of a traced frame to another frame, whose
+ * text was cut before TRACE_AT
+ *
+ * @param Takes in the frame that gets them and the one that has them
+ *
+ */
+void copyTrace(char *to, char *from) {
+	memcpy(to + TRACE_AT, from + TRACE_AT, sizeof(TraceStamps));
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Adds the stages of a traced frame to the histograms. Stages
+ * nobody stamped (the zero-copy fan-out never reads the messages) are
+ * left out, the next stage that was stamped counts from the last stamp
+ *
+ * @param Takes in the histograms and the frame
+ *
+ */
+void traceRecord(TraceHist *h, char *frame) {
+	TraceStamps t;		// the frame's stamps
+	long long us;		// length of a stage in microseconds
+	int last = -1;		// stage stamped last
+	int b, i;			// bucket and for counter
+
+	memcpy(&t, frame + TRACE_AT, sizeof(t));
+
+	for (i=0; i<TRACE_STAMPS; ++i) {
+		if (!t.ns[i]) {
+			continue;
+		}
+
+		if ( (last < 0) || (t.ns[i] < t.ns[last]) ) {
+			h->skewed += (last >= 0);
+			last = i;
+			continue;
+		}
+
+		us = (t.ns[i] - t.ns[last]) / 1000;
+		last = i;
+		for (b=0; (us > 0) && (b < TRACE_BUCKETS-1); ++b, us >>= 1);
+
+		++h->count[i][b];
+		++h->total[i];
+	}
+
+	// the whole trip goes in the first row
+	if ( t.ns[TRACE_TYPED] && (t.ns[TRACE_SHOWN] >= t.ns[TRACE_TYPED]) ) {
+		us = (t.ns[TRACE_SHOWN] - t.ns[TRACE_TYPED]) / 1000;
+		for (b=0; (us > 0) && (b < TRACE_BUCKETS-1); ++b, us >>= 1);
+
+		++h->count[0][b];
+		++h->total[0];
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the upper bound of the bucket a percentile falls in
+ *
+ * @param Takes in the histograms, the stage and the percentile
+ *
+ * @return The bound in microseconds (0 if the stage has no messages)
+ */
+long long tracePercentile(TraceHist *h, int stage, double pct) {
+	unsigned long long seen = 0;	// messages in the buckets so far
+	int b;							// for counter
+
+	if (!h->total[stage]) {
+		return 0;
+	}
+
+	for (b=0; b<TRACE_BUCKETS; ++b) {
+		seen += h->count[stage][b];
+
+		if (seen >= pct/100 * h->total[stage]) {
+			break;
+		}
+	}
+
+	return 1LL << ((b < TRACE_BUCKETS) ? b : TRACE_BUCKETS-1);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Prints the histograms, a column per stage and a row per bucket
+ * (messages that took less than its bound), then the medians and the
+ * 99th percentiles. The stages between the client and the server only
+ * mean something when both run on the same host
+ *
+ * @param Takes in the histograms
+ *
+ */
+void printTraceHist(TraceHist *h) {
+	char *names[TRACE_STAMPS] = {"total", "write", "->server", "chat", "plPipe",
+		"fan-out", "->player", "read"};
+	unsigned long long any;	// messages in a bucket, over the stages
+	int first = -1, last = -1;	// buckets that have messages
+	int b, i;					// for counters
+
+	if (!h->total[0] && !h->total[TRACE_RECV]) {
+		printf("No traced messages yet, turn tracing on with /trace on\n");
+		return;
+	}
+
+	for (b=0; b<TRACE_BUCKETS; ++b) {
+		for (any=0, i=0; i<TRACE_STAMPS; ++i) {
+			any += h->count[i][b];
+		}
+
+		if (any) {
+			first = (first < 0) ? b : first;
+			last = b;
+		}
+	}
+
+	printf("%10s", "<us");
+	for (i=1; i<=TRACE_STAMPS; ++i) {
+		printf("%10s", names[i % TRACE_STAMPS]);
+	}
+	printf("\n");
+
+	for (b=first; b<=last; ++b) {
+		printf("%10lld", 1LL << b);
+
+		for (i=1; i<=TRACE_STAMPS; ++i) {
+			printf("%10llu", h->count[i % TRACE_STAMPS][b]);
+		}
+		printf("\n");
+	}
+
+	printf("%10s", "p50 <us");
+	for (i=1; i<=TRACE_STAMPS; ++i) {
+		printf("%10lld", tracePercentile(h, i % TRACE_STAMPS, 50));
+	}
+	printf("\n%10s", "p99 <us");
+	for (i=1; i<=TRACE_STAMPS; ++i) {
+		printf("%10lld", tracePercentile(h, i % TRACE_STAMPS, 99));
+	}
+	printf("\n");
+
+	if (h->skewed) {
+		printf("%llu stages ended before they began, the server runs on another host\n",
+			h->skewed);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef TRADE_H
+#define TRADE_H
+
+#define TRADE_OK 0			// the items changed hands
+#define TRADE_NO_OFFER -1	// nobody offered us that trade
+#define TRADE_THEY_LACK -2	// the player who offered it doesn't have his items anymore
+#define TRADE_WE_LACK -3	// we don't have what he asks for
+
+// struct holding the trade a player offers (kept in the room's segment,
+// one per slot, next to the players' holdings). A player has at most
+// one offer out, a new one replaces it
+typedef struct {
+	int to;		// slot the offer is for (-1 = none)
+	int give;	// item he gives
+	int giveN;	// units of it
+	int want;	// item he wants in return
+	int wantN;	// units of it
+}TradeOffer;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Gives a player who joins his holdings, the items he reserved
+ *
+ * @param Takes in his holdings (one counter per item of the room), the
+ * room's inventory and the player's inventory
+ *
+ */
+void fillHoldings(int *held, Inventory *room, Inventory player) {
+	int pos = -1;	// position of an item in the room
+	int i;			// for counter
+
+	memset(held, 0, sizeof(int)*room->count);
+
+	for (i=0; i<player.count; ++i) {
+		if (findItem(*room, player.items[i], &pos)) {
+			held[pos] += player.quantity[i];
+		}
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Writes a player's holdings as a request (the way the client
+ * sends his inventory), so they go along with him when he moves to
+ * another room
+ *
+ * @param Takes in his name, the room's inventory, his holdings and a
+ * buffer of pSize chars
+ *
+ */
+void holdingsRequest(char *name, Inventory *room, int *held, char *request) {
+	int at;	// chars written
+	int i;	// for counter
+
+	bzero(request, pSize);
+	at = snprintf(request, pSize, "%s\n", name);
+
+	for (i=0; (i < room->count) && (at < pSize); ++i) {
+		if (held[i] > 0) {
+			at += snprintf(request + at, pSize - at, "%s\t%d\n", room->items[i], held[i]);
+		}
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Withdraws a player's offer and the offers made to him, when
+ * he leaves. Must be called while holding the semaphore
+ *
+ * @param Takes in the room's offers, its number of slots and his slot
+ *
+ */
+void clearOffers(TradeOffer *offers, int slots, int slot) {
+	int i;	// for counter
+
+	for (i=0; i<slots; ++i) {
+		if ( (i == slot) || (offers[i].to == slot) ) {
+			offers[i].to = -1;
+		}
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Accepts the offer another player made us. Both holdings are
+ * checked and changed in one go while the caller holds the semaphore,
+ * so two trades of the same players never see each other half done and
+ * an item is never given twice: the second trade finds it gone. The
+ * offer is used up either way, unless it wasn't for us
+ *
+ * @param Takes in the room's offers and holdings, its number of items,
+ * the slot of the player who offered and ours
+ *
+ * @return One of the TRADE_* values
+ */
+int acceptOffer(TradeOffer *offers, int *holdings, int items, int from, int me) {
+	TradeOffer *o = &(offers[from]);	// the offer
+	int *theirs = holdings + from*items;	// what he has
+	int *mine = holdings + me*items;		// and what we have
+
+	if (o->to != me) {
+		return TRADE_NO_OFFER;
+	}
+
+	o->to = -1;
+
+	if (theirs[o->give] < o->giveN) {
+		return TRADE_THEY_LACK;
+	}
+
+	if (mine[o->want] < o->wantN) {
+		return TRADE_WE_LACK;
+	}
+
+	theirs[o->give] -= o->giveN;
+	mine[o->give] += o->giveN;
+	mine[o->want] -= o->wantN;
+	theirs[o->want] += o->wantN;
+
+	return TRADE_OK;
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
@@ -0,0 +1,133 @@
+/**
+ * @file Transcript.c
+ *
+ * @brief Dumps the chat transcripts the rooms write (server option -t)
+ *
+ * Reads the given segments (files roomPID.N.trs) and prints their
+ * messages, one per line. With a start time the segment's index is used
+ * to skip straight to the first batch that can hold it
+ *
+ */
+
+#include "Inventory.h"
+#include <limits.h>		// LLONG_MAX
+#include "History.h"		// the rooms' last messages
+#include "Log.h"			// asynchronous logging
+#include "Transcript.h"		// the rooms' chat, on disk
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Prints the messages of a segment between two times
+ *
+ * @param Takes in the segment's path and the times in nanoseconds
+ *
+ * @return 0 on success or -1 if it isn't a transcript
+ */
+int dumpSegment(char *path, long long from, long long until) {
+	FILE *seg;				// the segment
+	TranscriptHeader hd;	// its header
+	TranscriptRecord rec;	// a record
+	char sender[LINE_LEN];	// its sender
+	char to[LINE_LEN*2];	// its recipient
+	char text[pSize];		// its text
+	char when[LINE_LEN];	// its time
+	time_t secs;			// its time in seconds
+	struct tm tm;			// its time broken down
+
+	if ( (seg = fopen(path, "r")) == NULL ) {
+		perror(path);
+		return -1;
+	}
+
+	if ( (fread(&hd, sizeof(hd), 1, seg) != 1) || memcmp(hd.magic, TRANSCRIPT_MAGIC, 4) ) {
+		fprintf(stderr, "%s: not a transcript\n", path);
+		fclose(seg);
+		return -1;
+	}
+
+	fseek(seg, seekTranscript(path, from), SEEK_SET);
+
+	while (readTranscript(seg, &rec, sender, to, text) == 0) {
+		if (rec.ns < from) {
+			continue;
+		}
+
+		if (rec.ns > until) {
+			break;
+		}
+
+		secs = rec.ns / 1000000000LL;
+		localtime_r(&secs, &tm);
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+
+		if (rec.toLen) {
+			printf("%s.%06lld room %d [%s -> %s]: %s\n", when, (rec.ns % 1000000000LL) / 1000,
+				rec.room, sender, to, text);
+		} else {
+			printf("%s.%06lld room %d #%llu [%s]: %s\n", when, (rec.ns % 1000000000LL) / 1000,
+				rec.room, rec.seq, sender, text);
+		}
+	}
+
+	fclose(seg);
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Turns a time given on the command line (seconds since the
+ * epoch, fractions allowed) to nanoseconds. The seconds and the
+ * fraction are read apart, a double doesn't hold today's times to the
+ * nanosecond
+ *
+ * @param Takes in the argument
+ *
+ * @return The time in nanoseconds
+ */
+long long parseTime(char *arg) {
+	int sign = (*arg == '-') ? -1 : 1;			// times before the epoch
+	long long secs = strtoll(arg, &arg, 10);	// whole seconds
+	long long ns = 0;							// and the fraction
+	long long unit = 100000000LL;				// worth of its next digit
+
+	if (*arg == '.') {
+		for (++arg; (*arg >= '0') && (*arg <= '9'); ++arg, unit /= 10) {
+			ns += (*arg - '0') * unit;
+		}
+	}
+
+	return secs*1000000000LL + sign*ns;
+}
+
+/*- ---------------------------------------------------------------- -*/
+int main(int argc, char **argv) {
+	long long from = 0;			// first time to print
+	long long until = LLONG_MAX;	// last time to print
+	int status = 0;				// exit status
+	int i;						// for counter
+
+	for (i=1; (i < argc - 1) && (argv[i][0] == '-'); i+=2) {
+		if (!strcmp(argv[i], "-s")) {
+			from = parseTime(argv[i+1]);
+		} else if (!strcmp(argv[i], "-u")) {
+			until = parseTime(argv[i+1]);
+		} else {
+			break;
+		}
+	}
+
+	if (i >= argc) {
+		printf("Usage: ./transcript [-s <since>] [-u <until>] <segment> ... \n");
+		printf("\t (times in seconds since the epoch) \n");
+		return 1;
+	}
+
+	for (; i<argc; ++i) {
+		if (dumpSegment(argv[i], from, until) < 0) {
+			status = 1;
+		}
+	}
+
+	return status;
+}
@@ -0,0 +1,391 @@
+#ifndef TRANSCRIPT_H
+#define TRANSCRIPT_H
+
+#include <signal.h>		// the writer ignores SIGINT
+#include <poll.h>		// the writer waits for records
+
+#define TRANSCRIPT_MAGIC "GTR1"			// first bytes of every segment
+#define TRANSCRIPT_SEGMENT (8<<20)		// bytes after which a new segment starts
+#define TRANSCRIPT_BUFFER (64<<10)		// bytes the writer gathers per write
+#define TRANSCRIPT_FLUSH_MS 200			// longest a record waits in the buffer
+
+// header of a transcript segment
+typedef struct {
+	char magic[4];	// TRANSCRIPT_MAGIC
+	int room;		// pid of the room
+	int segment;	// number of the segment
+} __attribute__((packed)) TranscriptHeader;
+
+// one record of a transcript, followed by the sender's name, the
+// recipient and the message's text (none of them zero terminated)
+typedef struct {
+	long long ns;				// when it was sent, in nanoseconds
+	unsigned long long seq;		// its number in the room (0 if it isn't numbered)
+	int room;					// pid of the room
+	unsigned short senderLen;	// bytes of the sender's name
+	unsigned short toLen;		// bytes of the recipient (none for the whole room,
+								// a player's name or "#" and a channel's name)
+	unsigned short textLen;		// bytes of the text
+} __attribute__((packed)) TranscriptRecord;
+
+// largest record a player process sends the writer
+#define TRANSCRIPT_RECORD (sizeof(TranscriptRecord) + 3*LINE_LEN + pSize)
+
+// one entry of a segment's index (file .idx next to it): where the
+// first record of each batch the writer wrote begins
+typedef struct {
+	long long ns;	// time of that record
+	long long at;	// its offset in the segment
+} TranscriptIndex;
+
+// state of a room's transcript writer
+typedef struct {
+	char dir[LINE_LEN*4];	// directory of the transcripts
+	int room;				// pid of the room
+	int segment;			// number of the open segment
+	int fd;					// the open segment
+	int idx;				// its index
+	long long size;			// bytes in the segment
+	char buf[TRANSCRIPT_BUFFER];	// records not written yet
+	int used;				// bytes of buf in use
+	long long firstNs;		// time of the first record in buf
+	long long since;		// when it came (monotonic milliseconds)
+}Transcript;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Builds the path of a transcript segment or of its index
+ *
+ * @param Takes in the buffer for the path (LINE_LEN*8 chars), the
+ * directory, the room, the segment and the extension ("trs" or "idx")
+ *
+ */
+void transcriptPath(char *path, char *dir, int room, int segment, char *ext) {
+	snprintf(path, LINE_LEN*8, "%s/room%d.%d.%s", dir, room, segment, ext);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Opens the first segment of the room that isn't full (a room
+ * whose pid was used before carries on after the old segments)
+ *
+ * @param Takes in the transcript
+ *
+ * @return 0 on success or -1 on error
+ */
+int openSegment(Transcript *t) {
+	char path[LINE_LEN*8];	// segment's path
+	struct stat st;			// its size
+	TranscriptHeader hd;	// header of a new segment
+
+	for (;; ++(t->segment)) {
+		transcriptPath(path, t->dir, t->room, t->segment, "trs");
+
+		if ( (stat(path, &st) < 0) || (st.st_size < TRANSCRIPT_SEGMENT) ) {
+			break;
+		}
+	}
+
+	if ( (t->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0 ) {
+		return -1;
+	}
+
+	transcriptPath(path, t->dir, t->room, t->segment, "idx");
+
+	if ( (t->idx = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0 ) {
+		close(t->fd);
+		return -1;
+	}
+
+	t->size = lseek(t->fd, 0, SEEK_END);
+
+	if (t->size == 0) {
+		memcpy(hd.magic, TRANSCRIPT_MAGIC, 4);
+		hd.room = t->room;
+		hd.segment = t->segment;
+
+		if (write(t->fd, &hd, sizeof(hd)) != sizeof(hd)) {
+			return -1;
+		}
+
+		t->size = sizeof(hd);
+	}
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Writes the gathered records to the segment with a single
+ * append, indexes the batch and moves to the next segment when this
+ * one is full
+ *
+ * @param Takes in the transcript
+ *
+ */
+void flushTranscript(Transcript *t) {
+	TranscriptIndex ix;	// index entry of the batch
+
+	if (t->used == 0) {
+		return;
+	}
+
+	ix.ns = t->firstNs;
+	ix.at = t->size;
+
+	if (write(t->fd, t->buf, t->used) != t->used) {
+		logMsg(LOG_ERROR, "Room %d: couldn't write the transcript: %s", t->room, strerror(errno));
+	} else if (write(t->idx, &ix, sizeof(ix)) != sizeof(ix)) {
+		logMsg(LOG_ERROR, "Room %d: couldn't index the transcript: %s", t->room, strerror(errno));
+	}
+
+	t->size += t->used;
+	t->used = 0;
+
+	if (t->size >= TRANSCRIPT_SEGMENT) {
+		close(t->fd);
+		close(t->idx);
+		++(t->segment);
+
+		if (openSegment(t) < 0) {
+			logMsg(LOG_ERROR, "Room %d: couldn't open a transcript segment: %s",
+				t->room, strerror(errno));
+			exit(1);
+		}
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Player side. Sends a message to the room's transcript writer,
+ * as a record ready for the segment. The socket blocks when the writer
+ * falls behind, so a burst slows the players down instead of losing
+ * their messages
+ *
+ * @param Takes in the writer's socket (-1 if transcripts are off), the
+ * message's number, the sender's name, the recipient ("" for the whole
+ * room) and the text
+ *
+ */
+void transcribe(int sock, unsigned long long seq, char *sender, char *to, char *text) {
+	char buf[TRANSCRIPT_RECORD];	// the record
+	TranscriptRecord rec;			// its header
+	struct timespec now;			// when it was sent
+	size_t at = sizeof(rec);		// bytes of the record
+
+	if (sock < 0) {
+		return;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	rec.ns = now.tv_sec*1000000000LL + now.tv_nsec;
+	rec.seq = seq;
+	rec.room = 0;	// the writer knows the room
+	rec.senderLen = strnlen(sender, LINE_LEN-1);
+	rec.toLen = strnlen(to, LINE_LEN*2-1);
+	rec.textLen = strnlen(text, pSize-1);
+
+	// the line break the client sent along
+	while ( (rec.textLen > 0) && (text[rec.textLen-1] == '\n' || text[rec.textLen-1] == '\r') ) {
+		--rec.textLen;
+	}
+
+	memcpy(buf, &rec, sizeof(rec));
+	memcpy(buf + at, sender, rec.senderLen);
+	at += rec.senderLen;
+	memcpy(buf + at, to, rec.toLen);
+	at += rec.toLen;
+	memcpy(buf + at, text, rec.textLen);
+	at += rec.textLen;
+
+	while ( (send(sock, buf, at, MSG_NOSIGNAL) < 0) && (errno == EINTR) );
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Forks the room's transcript writer. The player processes send
+ * it every message they relay (whispers and channel messages included)
+ * through a socket pair, and it appends them in large batches to the
+ * room's segments, so neither the fan-out nor the player processes do
+ * any file i/o. It ignores SIGINT and writes out what is left once the
+ * room and all of its player processes closed the socket
+ *
+ * @param Takes in the room's pid and the directory of the transcripts
+ *
+ * @return The socket the room's player processes send to, or -1 if the
+ * writer couldn't start
+ */
+int startTranscriptWriter(int room, char *dir) {
+	Transcript *t;					// the transcript
+	TranscriptRecord rec;			// header of a record we got
+	struct pollfd pfd;				// the players' records
+	struct timespec now;			// how long the buffer waited
+	int sv[2];						// the socket pair
+	int wait;						// milliseconds until the buffer goes out
+	ssize_t n;						// bytes of a record
+	pid_t pid;						// the writer
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+		logMsg(LOG_ERROR, "Room %d: couldn't start the transcript writer: %s",
+			room, strerror(errno));
+		return -1;
+	}
+
+	if ( (pid = fork()) != 0 ) {
+		close(sv[0]);
+
+		if (pid < 0) {
+			logMsg(LOG_ERROR, "Room %d: couldn't start the transcript writer: %s",
+				room, strerror(errno));
+			close(sv[1]);
+			return -1;
+		}
+
+		return sv[1];
+	}
+
+	signal(SIGINT, SIG_IGN);
+	signal(SIGCHLD, SIG_DFL);
+
+	close(sv[1]);
+
+	if ( (t = malloc(sizeof(Transcript))) == NULL ) {
+		exit(1);
+	}
+
+	strcpy(t->dir, dir);
+	t->room = room;
+	t->segment = 0;
+	t->used = 0;
+
+	if (openSegment(t) < 0) {
+		logMsg(LOG_ERROR, "Room %d: couldn't open a transcript segment: %s", room, strerror(errno));
+		exit(1);
+	}
+
+	pfd.fd = sv[0];
+	pfd.events = POLLIN;
+
+	for (;;) {
+		wait = -1;
+
+		if (t->used > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			wait = TRANSCRIPT_FLUSH_MS - (int)(now.tv_sec*1000LL + now.tv_nsec/1000000 - t->since);
+			wait = (wait < 0) ? 0 : wait;
+		}
+
+		if ( (poll(&pfd, 1, wait) == 0) && (t->used > 0) ) {
+			flushTranscript(t);
+			continue;
+		}
+
+		// taking all the records that came, a batch per write
+		for (;;) {
+			if (t->used + TRANSCRIPT_RECORD > TRANSCRIPT_BUFFER) {
+				flushTranscript(t);
+			}
+
+			n = recv(sv[0], t->buf + t->used, TRANSCRIPT_RECORD, MSG_DONTWAIT);
+
+			if (n == 0) {
+				// the room and its players are gone, writing out the rest
+				flushTranscript(t);
+				exit(0);
+			}
+
+			if (n < (ssize_t)sizeof(rec)) {
+				break;	// nothing more for now
+			}
+
+			memcpy(&rec, t->buf + t->used, sizeof(rec));
+			rec.room = t->room;
+			memcpy(t->buf + t->used, &rec, sizeof(rec));
+
+			if (t->used == 0) {
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				t->firstNs = rec.ns;
+				t->since = now.tv_sec*1000LL + now.tv_nsec/1000000;
+			}
+
+			t->used += n;
+		}
+
+		if (t->used >= TRANSCRIPT_BUFFER/2) {
+			flushTranscript(t);
+		}
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Reader side. Finds where the records from the given time on
+ * begin in a segment, through its index
+ *
+ * @param Takes in the segment's path and the time in nanoseconds
+ *
+ * @return The offset to start reading from
+ */
+long long seekTranscript(char *path, long long ns) {
+	char idxPath[LINE_LEN*8];	// the index's path
+	TranscriptIndex ix;			// an index entry
+	long long at = sizeof(TranscriptHeader);	// where to start
+	size_t len = strlen(path);	// length of the path
+	FILE *idx;					// the index
+
+	if ( (len < 4) || (len >= sizeof(idxPath)) || strcmp(path + len - 4, ".trs") ) {
+		return at;
+	}
+
+	strcpy(idxPath, path);
+	strcpy(idxPath + len - 4, ".idx");
+
+	if ( (idx = fopen(idxPath, "r")) == NULL ) {
+		return at;
+	}
+
+	// batches are written in order, the last one starting before
+	// the given time is where we begin
+	while ( (fread(&ix, sizeof(ix), 1, idx) == 1) && (ix.ns <= ns) ) {
+		at = ix.at;
+	}
+
+	fclose(idx);
+
+	return at;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Reader side. Reads the next record of a segment
+ *
+ * @param Takes in the segment, the record and buffers for the sender's name (LINE_LEN chars), the recipient
+ * (LINE_LEN*2 chars) and the text (pSize chars)
+ *
+ * @return 0 on success or -1 at the end of the segment
+ */
+int readTranscript(FILE *seg, TranscriptRecord *rec, char *sender, char *to, char *text) {
+	if (fread(rec, sizeof(TranscriptRecord), 1, seg) != 1) {
+		return -1;
+	}
+
+	if ( (rec->senderLen >= LINE_LEN) || (rec->toLen >= LINE_LEN*2) || (rec->textLen >= pSize) ) {
+		return -1;	// not a record, the segment is damaged
+	}
+
+	if ( (fread(sender, 1, rec->senderLen, seg) != rec->senderLen) ||
+		(fread(to, 1, rec->toLen, seg) != rec->toLen) ||
+		(fread(text, 1, rec->textLen, seg) != rec->textLen) ) {
+		return -1;
+	}
+
+	sender[rec->senderLen] = '\0';
+	to[rec->toLen] = '\0';
+	text[rec->textLen] = '\0';
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef WAITLIST_H
+#define WAITLIST_H
+
+#include <time.h>		// monotonic clock for the arrival times
+
+// struct holding a player that waits for a room with enough items
+typedef struct {
+	int connfd;					// player's socket (owned by the main server)
+	int quota;					// total items requested, breaks arrival ties
+	struct timespec arrival;	// time the player joined the waitlist
+	char request[pSize];		// the request exactly as the player sent it
+}WaitEntry;
+
+// bounded priority queue of waiting players
+typedef struct {
+	WaitEntry *entries;	// storage for the entries
+	int *heap;			// min-heap of indexes to the entries array
+	int *freeSlots;		// stack of unused indexes
+	int count;			// entries currently in the heap
+	int freeCount;		// indexes left on the free stack
+	int size;			// maximum number of waiting players
+
+	// players picked for the next room
+	int *admitted;		// indexes to the entries array
+	int admitCount;		// number of picked players
+
+	// used for the wait time estimation
+	double interval;			// average seconds between two rooms
+	struct timespec lastRoom;	// time the last room was opened
+}Waitlist;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Allocates a waitlist that can hold up to size players. A size
+ * of zero is valid and leaves the waitlist disabled
+ *
+ * @param Takes in a waitlist pointer and its maximum size
+ *
+ */
+void initWaitlist(Waitlist *wl, int size) {
+	int i;	// for counter
+
+	wl->count = 0;
+	wl->size = size;
+	wl->freeCount = size;
+	wl->interval = 0;
+	wl->admitCount = 0;
+	clock_gettime(CLOCK_MONOTONIC, &(wl->lastRoom));
+
+	wl->entries = NULL;
+	wl->heap = NULL;
+	wl->freeSlots = NULL;
+	wl->admitted = NULL;
+
+	if (size <= 0) {
+		wl->size = 0;
+		wl->freeCount = 0;
+		return;	// waitlist mode is off
+	}
+
+	wl->entries = malloc(sizeof(WaitEntry)*size);
+	wl->heap = malloc(sizeof(int)*size);
+	wl->freeSlots = malloc(sizeof(int)*size);
+	wl->admitted = malloc(sizeof(int)*size);
+
+	if (wl->entries == NULL || wl->heap == NULL || wl->freeSlots == NULL ||
+		wl->admitted == NULL) {
+		perror("Allocation error -> waitlist");
+		exit(1);
+	}
+
+	// every slot starts on the free stack
+	for (i=0; i<size; ++i) {
+		wl->freeSlots[i] = size - i - 1;
+		wl->entries[i].connfd = -1;
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Frees the heap allocated memory of a waitlist
+ *
+ * @param Takes in a waitlist pointer
+ *
+ */
+void freeWaitlist(Waitlist *wl) {
+	free(wl->entries);
+	free(wl->heap);
+	free(wl->freeSlots);
+	free(wl->admitted);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Orders two entries. Players that arrived first go first and
+ * on equal arrival times the smaller request is preferred
+ *
+ * @param Takes in a waitlist pointer and two entry indexes
+ *
+ * @return 1 if entry a goes before entry b or 0 if not
+ */
+int waitBefore(Waitlist *wl, int a, int b) {
+	WaitEntry *ea = &(wl->entries[a]);
+	WaitEntry *eb = &(wl->entries[b]);
+
+	if (ea->arrival.tv_sec != eb->arrival.tv_sec) {
+		return ea->arrival.tv_sec < eb->arrival.tv_sec;
+	}
+
+	if (ea->arrival.tv_nsec != eb->arrival.tv_nsec) {
+		return ea->arrival.tv_nsec < eb->arrival.tv_nsec;
+	}
+
+	return ea->quota < eb->quota;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Places an entry at a heap node, moving it up or down until
+ * the heap order holds again. Runs in O(log n)
+ *
+ * @param Takes in a waitlist pointer, the node and the entry index
+ *
+ */
+void siftWaitSlot(Waitlist *wl, int i, int slot) {
+	int parent;	// parent node
+	int child;	// child node we compare against
+
+	// moving the entry up until its parent goes before it
+	while (i > 0) {
+		parent = (i - 1) / 2;
+
+		if (!waitBefore(wl, slot, wl->heap[parent])) {
+			break;
+		}
+
+		wl->heap[i] = wl->heap[parent];
+		i = parent;
+	}
+
+	// moving the entry down until both children go after it
+	while ( (child = 2*i + 1) < wl->count ) {
+		if ( (child + 1 < wl->count) &&
+			waitBefore(wl, wl->heap[child+1], wl->heap[child]) ) {
+			++child;
+		}
+
+		if (!waitBefore(wl, wl->heap[child], slot)) {
+			break;
+		}
+
+		wl->heap[i] = wl->heap[child];
+		i = child;
+	}
+
+	wl->heap[i] = slot;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Inserts an already filled entry to the heap
+ *
+ * @param Takes in a waitlist pointer and the entry index
+ *
+ */
+void pushWaitSlot(Waitlist *wl, int slot) {
+	++wl->count;
+	siftWaitSlot(wl, wl->count - 1, slot);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Removes the entry at a heap node, filling the gap with the
+ * last entry. The removed entry stays reserved until it is released
+ * or pushed again
+ *
+ * @param Takes in a waitlist pointer and the heap node
+ *
+ * @return The index of the removed entry
+ */
+int removeWaitNode(Waitlist *wl, int i) {
+	int slot = wl->heap[i];			// entry we are removing
+	int last = wl->heap[--wl->count];	// entry that fills the gap
+
+	if (i < wl->count) {
+		siftWaitSlot(wl, i, last);
+	}
+
+	return slot;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Removes the first entry from the heap
+ *
+ * @param Takes in a waitlist pointer
+ *
+ * @return The index of the entry or -1 if the waitlist is empty
+ */
+int popWaitSlot(Waitlist *wl) {
+	if (wl->count == 0) {
+		return -1;
+	}
+
+	return removeWaitNode(wl, 0);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns an entry to the free stack
+ *
+ * @param Takes in a waitlist pointer and the entry index
+ *
+ */
+void releaseWaitSlot(Waitlist *wl, int slot) {
+	wl->entries[slot].connfd = -1;
+	wl->freeSlots[wl->freeCount++] = slot;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Adds a player to the waitlist
+ *
+ * @param Takes in a waitlist pointer, the player's socket, his request
+ * and the total number of items he asked for
+ *
+ * @return The entry index or -1 if the waitlist is full
+ */
+int pushWaitlist(Waitlist *wl, int connfd, char *request, int quota) {
+	int slot;	// free entry we are filling
+
+	if (wl->freeCount == 0) {
+		return -1;	// no room left (or waitlist disabled)
+	}
+
+	slot = wl->freeSlots[--wl->freeCount];
+
+	// filling in the entry
+	wl->entries[slot].connfd = connfd;
+	wl->entries[slot].quota = quota;
+	clock_gettime(CLOCK_MONOTONIC, &(wl->entries[slot].arrival));
+	strncpy(wl->entries[slot].request, request, pSize-1);
+	wl->entries[slot].request[pSize-1] = '\0';
+
+	pushWaitSlot(wl, slot);
+
+	return slot;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Counts the players that are ahead of an entry. This is only
+ * a hint for the player so a linear scan is good enough
+ *
+ * @param Takes in a waitlist pointer and the entry index
+ *
+ * @return The position of the entry (starting from 1)
+ */
+int waitPosition(Waitlist *wl, int slot) {
+	int i;			// for counter
+	int pos = 1;	// position of the entry
+
+	for (i=0; i<wl->count; ++i) {
+		if ( wl->heap[i] != slot && waitBefore(wl, wl->heap[i], slot) ) {
+			++pos;
+		}
+	}
+
+	return pos;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Estimates how many seconds a player will wait, based on how
+ * often rooms have been opening so far
+ *
+ * @param Takes in a waitlist pointer, the player's position and the
+ * number of players per room
+ *
+ * @return The estimated wait in seconds
+ */
+int waitEstimate(Waitlist *wl, int pos, int players) {
+	int rooms = (pos + players - 1) / players;	// rooms until our turn
+
+	return (int)(rooms * wl->interval + 0.5);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Updates the average time between two rooms. Called every
+ * time the server opens a room
+ *
+ * @param Takes in a waitlist pointer
+ *
+ */
+void waitRoomOpened(Waitlist *wl) {
+	struct timespec now;	// current time
+	double elapsed;			// seconds since the last room
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	elapsed = (now.tv_sec - wl->lastRoom.tv_sec) +
+		(now.tv_nsec - wl->lastRoom.tv_nsec) / 1e9;
+
+	// exponential moving average, recent rooms weigh more
+	if (wl->interval == 0) {
+		wl->interval = elapsed;
+	} else {
+		wl->interval = 0.75*wl->interval + 0.25*elapsed;
+	}
+
+	wl->lastRoom = now;
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <fcntl.h>	// splice, tee and the pipe size
+
+// struct holding the messages a player hasn't received yet, in the
+// zero-copy fan-out. The messages sit in a pipe of his own as references
+// to the relay pipe's pages, so their bytes never reach the room
+typedef struct {
+	int pipe[2];	// the player's pipe (-1 while the slot is free)
+	int frames;		// messages in the pipe
+	int cap;		// max messages in the pipe
+	size_t sent;	// bytes of the oldest message already sent
+	int dropped;	// messages dropped since the player fell behind
+	int nonblock;	// the player's socket was made non blocking
+}SpliceQueue;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Marks a queue as unused
+ *
+ * @param Takes in a queue pointer
+ *
+ */
+void initSpliceQueue(SpliceQueue *q) {
+	q->pipe[0] = q->pipe[1] = -1;
+	q->frames = 0;
+	q->cap = 0;
+	q->sent = 0;
+	q->dropped = 0;
+	q->nonblock = 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Closes a queue, dropping the messages it still holds
+ *
+ * @param Takes in a queue pointer
+ *
+ */
+void closeSpliceQueue(SpliceQueue *q) {
+	if (q->pipe[0] >= 0) {
+		close(q->pipe[0]);
+		close(q->pipe[1]);
+	}
+
+	initSpliceQueue(q);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Opens the pipe of a queue. A message takes up to two of the
+ * pipe's pages, so we ask for a pipe that fits backlog messages. The
+ * kernel might give us less (pipe-user-pages-soft), then the queue is
+ * shorter
+ *
+ * @param Takes in a queue pointer and the messages it should hold
+ *
+ * @return 0 on success or -1 if the pipe couldn't be opened
+ */
+int openSpliceQueue(SpliceQueue *q, int backlog) {
+	long page = sysconf(_SC_PAGESIZE);	// size of a pipe buffer
+	int size;							// size we got
+
+	closeSpliceQueue(q);
+
+	if (pipe2(q->pipe, O_NONBLOCK) < 0) {
+		q->pipe[0] = q->pipe[1] = -1;
+		return -1;
+	}
+
+	fcntl(q->pipe[1], F_SETPIPE_SZ, 2*backlog*page);
+
+	if ( (size = fcntl(q->pipe[1], F_GETPIPE_SZ)) < 0 ) {
+		size = 16*page;	// the default size
+	}
+
+	q->cap = size / page / 2;
+
+	if (q->cap > backlog) {
+		q->cap = backlog;
+	} else if (q->cap < 1) {
+		q->cap = 1;
+	}
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Throws away bytes at the head of a pipe, without reading them
+ *
+ * @param Takes in the pipe's read end, /dev/null and the bytes
+ *
+ * @return 0 on success or -1 on error
+ */
+int spliceDiscard(int fd, int devNull, size_t len) {
+	ssize_t n;	// bytes thrown away
+
+	while (len > 0) {
+		if ( (n = splice(fd, NULL, devNull, NULL, len, SPLICE_F_MOVE)) <= 0 ) {
+			if ( (n < 0) && (errno == EINTR) ) {
+				continue;
+			}
+
+			return -1;
+		}
+
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Sends as much of the queue as the socket takes without
+ * blocking. The socket is made non blocking the first time, splice has
+ * no flag for it. Whatever the socket doesn't take stays in the pipe,
+ * a message cut in half included
+ *
+ * @param Takes in a queue pointer and the player's socket
+ *
+ * @return 0 if the socket is fine or -1 if the player is gone
+ */
+int flushSpliceQueue(SpliceQueue *q, int fd) {
+	ssize_t n;	// bytes the socket took
+
+	if (!q->nonblock) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		q->nonblock = 1;
+	}
+
+	while (q->frames > 0) {
+		n = splice(q->pipe[0], NULL, fd, NULL, q->frames*pSize - q->sent,
+			SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+		if (n <= 0) {
+			if ( (n < 0) && (errno == EAGAIN || errno == EINTR) ) {
+				return 0;	// socket is full, we try again later
+			}
+
+			return -1;
+		}
+
+		q->sent += n;
+		q->frames -= q->sent / pSize;
+		q->sent %= pSize;
+	}
+
+	q->dropped = 0;
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Queues the message at the head of the relay pipe for a
+ * player, by duplicating it with tee. The relay pipe is left as it was.
+ * If the queue is full the overflow policy decides what happens.
+ * Merging messages would mean copying them, so coalesce drops like drop
+ *
+ * @param Takes in a queue pointer, the relay pipe's read end,
+ * /dev/null and the overflow policy
+ *
+ * @return 0 if the message was queued (or dropped) or -1 if the player
+ * has to be disconnected
+ */
+int teeSpliceQueue(SpliceQueue *q, int relay, int devNull, int policy) {
+	ssize_t n;	// bytes duplicated
+
+	if (q->frames == q->cap) {
+		if (policy == OVERFLOW_DISCONNECT) {
+			return -1;
+		}
+
+		// dropping the oldest message, unless it is half sent
+		++q->dropped;
+
+		if (q->sent > 0) {
+			return 0;	// the new one is dropped instead
+		}
+
+		if (spliceDiscard(q->pipe[0], devNull, pSize) < 0) {
+			return -1;
+		}
+
+		--q->frames;
+	}
+
+	do {
+		n = tee(relay, q->pipe[1], pSize, SPLICE_F_NONBLOCK);
+	} while ( (n < 0) && (errno == EINTR) );
+
+	// a message cut in half would break the player's framing
+	if (n != pSize) {
+		return -1;
+	}
+
+	++q->frames;
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Queues messages the room holds in memory for a player, with
+ * a single write that copies them into his pipe. The caller makes sure
+ * they fit: a message takes at most two pages in the queue, copied ones
+ * share pages, so up to cap - frames of them always do
+ *
+ * @param Takes in a queue pointer, the messages and their number
+ *
+ * @return 0 on success or -1 if the pipe didn't take them whole
+ */
+int writeSpliceQueue(SpliceQueue *q, char (*frames)[pSize], int n) {
+	ssize_t len = (ssize_t)n*pSize;	// bytes to queue
+	ssize_t w;						// bytes the pipe took
+
+	do {
+		w = write(q->pipe[1], frames, len);
+	} while ( (w < 0) && (errno == EINTR) );
+
+	// a message cut in half would break the player's framing
+	if (w != len) {
+		return -1;
+	}
+
+	q->frames += n;
+
+	return 0;
+}
+
+/*- ---------------------------------------------------------------- -*/
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ * @file core_bench.c
+ *
+ * @brief Drives a room of the core library (GameCore.h) through the
+ * loopback transport, in this process alone: players join with a
+ * couple of items, chat, whisper and use a channel, then leave, round
+ * after round. Nothing goes through the kernel, so the numbers are the
+ * cost per join and per message of the library's room, which parses and
+ * routes like the server but doesn't relay through its pipes and player
+ * processes. For every room size we print the joins, messages and
+ * frames delivered per second
+ *
+ * Build and run from the repository root:
+ *	make bench-core && ./core_bench
+ *
+ */
+
+#include "GameCore.h"
+#include <stdio.h>		// printing the results
+#include <stdlib.h>		// exit, mkstemp
+#include <string.h>		// building the requests
+#include <unistd.h>		// writing the catalog
+#include <time.h>		// timing
+
+#define JOINS 1000000		// joins per room size
+#define MESSAGES 1000000	// messages per room size
+#define DEPTH 64			// frames queued per player, like -b
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the time of the monotonic clock in seconds
+ *
+ * @return The current time
+ */
+double now() {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Runs a room of the given size
+ *
+ * @param Takes in the inventory file and the number of players
+ *
+ */
+void run(char *catalog, int players) {
+	Loopback *lb = openLoopback(players, DEPTH);	// the players' side
+	CoreRoom *room;				// the room
+	char request[CORE_FRAME_LEN];	// a player's request
+	char frame[CORE_FRAME_LEN];	// and the frames he reads
+	int slots[players];			// the players' slots
+	long joins = 0;				// joins served
+	long messages = 0;			// messages relayed
+	long frames = 0;			// frames the players got
+	double tJoin = 0, tChat = 0;	// time spent on each
+	double t;					// start of a round
+	int i, p;					// for counters
+
+	if ( (room = openCoreRoom(catalog, players, 1000, loopbackTransport(lb))) == NULL ) {
+		perror("Couldn't open the room");
+		exit(1);
+	}
+
+	while ( (joins < JOINS) || (messages < MESSAGES) ) {
+		coreRestock(room);
+
+		t = now();
+		for (p=0; p<players; ++p) {
+			snprintf(request, sizeof(request), "player%d\ngold\t1\nrock\t1\n\n", p);
+			slots[p] = coreJoin(room, p, request);
+
+			if ( (slots[p] < 0) || !loopbackRead(lb, p, frame, sizeof(frame)) ) {
+				printf("Player %d was turned away\n", p);
+				exit(1);
+			}
+		}
+		tJoin += now() - t;
+		joins += players;
+
+		// a few players are on a channel, one of them whispers
+		coreMessage(room, slots[0], "JOIN bench");
+		coreMessage(room, slots[players-1], "JOIN bench");
+
+		t = now();
+		for (i=0; (i < MESSAGES/100) && (messages < MESSAGES); ++i, ++messages) {
+			p = i % players;
+
+			if (i % 10 == 1) {
+				coreMessage(room, slots[p], "WHISPER player0 psst");
+			} else if (i % 10 == 2) {
+				coreMessage(room, slots[0], "CHANNEL bench hello channel");
+			} else {
+				coreMessage(room, slots[p], "hello room");
+			}
+
+			// the players read what they got now and then
+			if (i % DEPTH == DEPTH-1) {
+				for (p=0; p<players; ++p) {
+					frames += loopbackDrain(lb, p);
+				}
+			}
+		}
+		tChat += now() - t;
+
+		for (p=0; p<players; ++p) {
+			frames += loopbackDrain(lb, p);
+			coreLeave(room, slots[p]);
+		}
+	}
+
+	printf("%8d  %12.0f  %12.0f  %12.0f  %8ld\n", players, joins / tJoin, messages / tChat,
+		frames / tChat, loopbackDropped(lb));
+
+	closeCoreRoom(room);
+	closeLoopback(lb);
+}
+
+/*- ---------------------------------------------------------------- -*/
+int main() {
+	char catalog[] = "/tmp/core_benchXXXXXX";	// the room's inventory
+	char items[] = "gold\t1000000\nrock\t1000000\narmor\t1000000\n";
+	int sizes[] = {2, 8, 64, 256};		// players per room
+	int fd;		// the inventory file
+	int i;		// for counter
+
+	if ( ((fd = mkstemp(catalog)) < 0) || (write(fd, items, strlen(items)) < 0) ) {
+		perror("Couldn't write the inventory");
+		exit(1);
+	}
+
+	close(fd);
+
+	printf("%8s  %12s  %12s  %12s  %8s\n", "players", "joins/s", "messages/s", "frames/s",
+		"dropped");
+
+	for (i=0; i<(int)(sizeof(sizes)/sizeof(sizes[0])); ++i) {
+		run(catalog, sizes[i]);
+	}
+
+	unlink(catalog);
+
+	return 0;
+}
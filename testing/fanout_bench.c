@@ -0,0 +1,323 @@
+/**
+ * @file fanout_bench.c
+ *
+ * @brief Compares the two fan-out paths of a room: the copying one
+ * (the message is read from the relay pipe and sent to every player)
+ * and the zero-copy one (tee and splice, only the sender and the route
+ * are read).
+ *
+ * A writer thread plays the player processes and fills the relay pipe,
+ * the main thread fans the messages out to N loopback TCP connections
+ * and a child process drains them. For every room size we print the
+ * bytes that went through the fan-out thread's buffers and its CPU time
+ * per message (RUSAGE_THREAD, so the writer and the readers don't count)
+ *
+ * Build and run from the repository root:
+ *	make bench-fanout && ./fanout_bench
+ *
+ */
+
+#include "Inventory.h"
+#include "OutQueue.h"
+#include "ZeroCopy.h"
+#include "Rooms.h"
+#include <poll.h>			// waiting for the sockets
+#include <pthread.h>		// the writer thread
+#include <sys/resource.h>	// cpu time of the fan-out thread
+#include <arpa/inet.h>		// loopback address
+
+#define BACKLOG 64				// messages queued per player
+#define DELIVERIES 200000		// messages sent per room size and path
+
+// struct describing one run
+typedef struct {
+	int relay[2];	// the relay pipe
+	int messages;	// messages the writer relays
+	int sender;		// socket of the player that sends them
+}Writer;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Writer thread, relays messages the way the player processes do
+ *
+ * @param Takes in the run's Writer struct
+ *
+ */
+void *writeMessages(void *arg) {
+	Writer *w = arg;	// the run
+	RelayMsg msg;		// message we relay
+	int i;				// for counter
+
+	bzero(&msg, sizeof(msg));
+	msg.sender = w->sender;
+
+	for (i=0; i<w->messages; ++i) {
+		snprintf(msg.text, sizeof(msg.text), "[bench]: message %d\n", i);
+		write(w->relay[1], &msg, sizeof(msg));
+	}
+
+	return NULL;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Opens n loopback connections. The server ends are returned,
+ * the client ends go to a child process that reads until they close
+ *
+ * @param Takes in the number of connections and an array for them
+ *
+ * @return The pid of the reading process
+ */
+pid_t connectPlayers(int n, int *socks) {
+	struct sockaddr_in addr;			// listener's address
+	socklen_t len = sizeof(addr);		// its length
+	int *peers = malloc(sizeof(int)*n);	// client ends
+	struct pollfd *pfds;				// client ends for poll
+	char buf[65536];					// drained bytes
+	int listenfd;						// listener
+	int open = n;						// client ends still open
+	int i;								// for counter
+	pid_t pid;							// reading process
+
+	listenfd = socket(AF_INET, SOCK_STREAM, 0);
+
+	bzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	bind(listenfd, (struct sockaddr *)&addr, sizeof(addr));
+	listen(listenfd, n);
+	getsockname(listenfd, (struct sockaddr *)&addr, &len);
+
+	for (i=0; i<n; ++i) {
+		peers[i] = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (connect(peers[i], (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			perror("connect");
+			exit(1);
+		}
+
+		socks[i] = accept(listenfd, NULL, NULL);
+	}
+
+	close(listenfd);
+
+	if ( (pid = fork()) != 0 ) {
+		for (i=0; i<n; ++i) {
+			close(peers[i]);
+		}
+
+		free(peers);
+
+		return pid;
+	}
+
+	// the reading process
+	pfds = malloc(sizeof(struct pollfd)*n);
+
+	for (i=0; i<n; ++i) {
+		close(socks[i]);
+		pfds[i].fd = peers[i];
+		pfds[i].events = POLLIN;
+	}
+
+	while (open > 0) {
+		poll(pfds, n, -1);
+
+		for (i=0; i<n; ++i) {
+			if ( (pfds[i].fd >= 0) && pfds[i].revents &&
+				(read(pfds[i].fd, buf, sizeof(buf)) <= 0) ) {
+				close(pfds[i].fd);
+				pfds[i].fd = -1;
+				--open;
+			}
+		}
+	}
+
+	_exit(0);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the cpu time of the calling thread in microseconds
+ *
+ * @return The cpu time
+ */
+double threadTime() {
+	struct rusage ru;
+
+	getrusage(RUSAGE_THREAD, &ru);
+
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)*1e6 +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Runs one room size on one path and prints the results
+ *
+ * @param Takes in the number of players and whether the zero-copy
+ * path is used
+ *
+ */
+void runBench(int n, int zeroCopy) {
+	int *socks = malloc(sizeof(int)*n);				// players
+	OutQueue *queues = malloc(sizeof(OutQueue)*n);	// copying path queues
+	SpliceQueue *pipes = malloc(sizeof(SpliceQueue)*n);// zero-copy path queues
+	struct pollfd *pfds = malloc(sizeof(struct pollfd)*(n+1));
+	double bytes = 0;	// bytes that went through our buffers
+	double start;		// cpu time at the start
+	int devNull = open("/dev/null", O_WRONLY);
+	int relayed = 0;	// messages taken from the relay pipe
+	int pending;		// players with queued messages
+	int dropped = 0;	// messages dropped for slow readers
+	int before;			// queued messages before a flush
+	RelayMsg head;		// sender and route of a message
+	RelayMsg msg;		// message of the copying path
+	ssize_t sent;		// bytes a socket took
+	pthread_t writer;	// the writer thread
+	Writer w;			// its run
+	pid_t reader;		// the reading process
+	int i;				// for counter
+
+	reader = connectPlayers(n, socks);
+
+	for (i=0; i<n; ++i) {
+		initOutQueue(&(queues[i]), BACKLOG);
+		initSpliceQueue(&(pipes[i]));
+
+		if (zeroCopy) {
+			openSpliceQueue(&(pipes[i]), BACKLOG);
+		}
+	}
+
+	pipe(w.relay);
+	w.messages = DELIVERIES / n;
+	w.sender = socks[0];
+
+	start = threadTime();
+	pthread_create(&writer, NULL, writeMessages, &w);
+
+	do {
+		pending = 0;
+
+		pfds[n].fd = (relayed < w.messages) ? w.relay[0] : -1;
+		pfds[n].events = POLLIN;
+
+		for (i=0; i<n; ++i) {
+			pfds[i].fd = -1;
+			pfds[i].events = POLLOUT;
+
+			if ( (zeroCopy && pipes[i].frames > 0) || (!zeroCopy && queues[i].count > 0) ) {
+				pfds[i].fd = socks[i];
+				++pending;
+			}
+		}
+
+		if ( (pfds[n].fd < 0) && (pending == 0) ) {
+			break;	// everything was relayed and sent
+		}
+
+		poll(pfds, n+1, -1);
+
+		// players that can take more messages
+		for (i=0; i<n; ++i) {
+			if ( (pfds[i].fd < 0) || !pfds[i].revents ) {
+				continue;
+			} else if (zeroCopy) {
+				flushSpliceQueue(&(pipes[i]), socks[i]);
+			} else {
+				before = queues[i].count;
+				flushOutQueue(&(queues[i]), socks[i]);
+				bytes += (before - queues[i].count)*pSize;
+			}
+		}
+
+		if ( (pfds[n].fd < 0) || !(pfds[n].revents & POLLIN) ) {
+			continue;
+		}
+
+		++relayed;
+
+		if (zeroCopy) {
+			read(w.relay[0], &head, RELAY_HEADER);
+			bytes += RELAY_HEADER;
+
+			// the same as deliverSpliced() in the server
+			for (i=1; i<n; ++i) {
+				before = pipes[i].frames;
+				dropped += (before == pipes[i].cap);
+				teeSpliceQueue(&(pipes[i]), w.relay[0], devNull, OVERFLOW_DROP);
+
+				if (before == 0) {
+					flushSpliceQueue(&(pipes[i]), socks[i]);
+				}
+			}
+
+			spliceDiscard(w.relay[0], devNull, pSize);
+		} else {
+			read(w.relay[0], &msg, sizeof(msg));
+			bytes += sizeof(msg);
+
+			// the same as deliver() in the server
+			for (i=1; i<n; ++i) {
+				sent = 0;
+
+				if (queues[i].count == 0) {
+					sent = send(socks[i], msg.text, pSize, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+					if (sent == pSize) {
+						bytes += pSize;
+						continue;
+					}
+				}
+
+				dropped += (queues[i].count == queues[i].size);
+				pushOutQueue(&(queues[i]), msg.text, OVERFLOW_DROP);
+
+				if ( (queues[i].count == 1) && (sent > 0) ) {
+					queues[i].sent = sent;
+				}
+			}
+		}
+	} while (1);
+
+	printf("%8d  %-7s  %8d  %14.0f  %11.2f  %8d\n", n, zeroCopy ? "splice" : "copy",
+		relayed, bytes / relayed, (threadTime() - start) / relayed, dropped);
+
+	pthread_join(writer, NULL);
+
+	// cleaning up, the reader exits once every connection closes
+	for (i=0; i<n; ++i) {
+		close(socks[i]);
+		freeOutQueue(&(queues[i]));
+		closeSpliceQueue(&(pipes[i]));
+	}
+
+	waitpid(reader, NULL, 0);
+
+	close(w.relay[0]);
+	close(w.relay[1]);
+	close(devNull);
+
+	free(socks);
+	free(queues);
+	free(pipes);
+	free(pfds);
+}
+
+/*- ---------------------------------------------------------------- -*/
+int main() {
+	int sizes[] = {5, 50, 500};	// room sizes we compare
+	int i;						// for counter
+
+	printf("%8s  %-7s  %8s  %14s  %11s  %8s\n", "players", "path", "messages",
+		"user bytes/msg", "cpu us/msg", "dropped");
+
+	for (i=0; i<3; ++i) {
+		runBench(sizes[i], 0);
+		runBench(sizes[i], 1);
+	}
+
+	return 0;
+}
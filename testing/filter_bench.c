@@ -0,0 +1,174 @@
+/**
+ * @file filter_bench.c
+ *
+ * @brief Measures the banned words filter: a list of random words is
+ * compiled into the automaton the server uses (Filter.h) and chat sized
+ * messages are scanned with it, counting and masking. The same messages
+ * go through a strcasestr per word for comparison, the way a filter
+ * without the automaton would do it. For every list size we print the
+ * compile time, the automaton's size and the throughput in MB/s
+ *
+ * Build and run from the repository root:
+ *	make bench-filter && ./filter_bench
+ *
+ */
+
+#include "Inventory.h"
+#include "Filter.h"
+#include <time.h>			// timing
+
+#define MESSAGES 65536		// messages scanned by the automaton
+#define NAIVE_MESSAGES 64	// and with a strcasestr per word
+#define MSG_LEN 200			// chars of a message
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the time of the monotonic clock in seconds
+ *
+ * @return The current time
+ */
+double now() {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Fills a buffer with random lower case letters
+ *
+ * @param Takes in the buffer and the number of letters
+ *
+ */
+void randomWord(char *word, int len) {
+	int i;	// for counter
+
+	for (i=0; i<len; ++i) {
+		word[i] = 'a' + rand() % 26;
+	}
+
+	word[len] = '\0';
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Runs the benchmark for a list of random words
+ *
+ * @param Takes in the number of words and the messages to scan
+ *
+ */
+void runBench(int count, char *msgs) {
+	char path[] = "/tmp/filter_benchXXXXXX";	// the word list
+	char **words = malloc(sizeof(char *)*count);	// its words
+	char text[MSG_LEN+1];	// a message being masked
+	FILE *fp;				// the list
+	Filter *f;				// the automaton
+	int shmid;				// its segment
+	int fd;					// the list's descriptor
+	int found = 0;			// words found
+	int i, j;				// for counters
+	double t;				// start of a measurement
+	double build, scan, mask, naive;	// the measurements
+
+	if ( (words == NULL) || ((fd = mkstemp(path)) < 0) || ((fp = fdopen(fd, "w")) == NULL) ) {
+		perror("Couldn't write the word list");
+		exit(1);
+	}
+
+	// words of 5 to 10 letters, like most banned words
+	for (i=0; i<count; ++i) {
+		words[i] = malloc(11);
+		randomWord(words[i], 5 + rand() % 6);
+		fprintf(fp, "%s\n", words[i]);
+	}
+
+	fclose(fp);
+
+	t = now();
+	if ( (f = compileFilter(path, &shmid)) == NULL ) {
+		perror("Couldn't compile the word list");
+		exit(1);
+	}
+	build = now() - t;
+
+	unlink(path);
+
+	// counting only
+	t = now();
+	for (i=0; i<MESSAGES; ++i) {
+		found += scanFilter(f, msgs + i*(MSG_LEN+1), 0);
+	}
+	scan = now() - t;
+
+	// masking, on a copy of each message
+	t = now();
+	for (i=0; i<MESSAGES; ++i) {
+		memcpy(text, msgs + i*(MSG_LEN+1), MSG_LEN+1);
+		scanFilter(f, text, 1);
+	}
+	mask = now() - t;
+
+	// one strcasestr per word
+	t = now();
+	for (i=0; i<NAIVE_MESSAGES; ++i) {
+		for (j=0; j<count; ++j) {
+			found += (strcasestr(msgs + i*(MSG_LEN+1), words[j]) != NULL);
+		}
+	}
+	naive = now() - t;
+
+	printf("%8d  %8d  %10.1f  %10.1f  %10.1f  %10.1f  %10.2f  %8d\n", count, f->states,
+		((double)f->states*f->classes*sizeof(int)) / (1<<20), build*1e3,
+		MESSAGES*(double)MSG_LEN / scan / 1e6, MESSAGES*(double)MSG_LEN / mask / 1e6,
+		NAIVE_MESSAGES*(double)MSG_LEN / naive / 1e6, found);
+
+	shmdt(f);
+
+	for (i=0; i<count; ++i) {
+		free(words[i]);
+	}
+	free(words);
+}
+
+/*- ---------------------------------------------------------------- -*/
+int main() {
+	int sizes[] = {100, 1000, 10000};	// word list sizes we compare
+	char *msgs = malloc((size_t)MESSAGES*(MSG_LEN+1));	// the messages
+	int i, j, len;						// for counters
+
+	if (msgs == NULL) {
+		perror("Allocation error -> msgs");
+		exit(1);
+	}
+
+	srand(5623);
+
+	// words of random letters, like chat but with more hits
+	for (i=0; i<MESSAGES; ++i) {
+		for (j=0; j<MSG_LEN; j+=len+1) {
+			len = 2 + rand() % 7;
+
+			if (j + len > MSG_LEN) {
+				len = MSG_LEN - j;
+			}
+
+			randomWord(msgs + i*(MSG_LEN+1) + j, len);
+			msgs[i*(MSG_LEN+1) + j + len] = ' ';
+		}
+
+		msgs[i*(MSG_LEN+1) + MSG_LEN] = '\0';
+	}
+
+	printf("%8s  %8s  %10s  %10s  %10s  %10s  %10s  %8s\n", "words", "states", "table MB",
+		"build ms", "scan MB/s", "mask MB/s", "naive MB/s", "found");
+
+	for (i=0; i<3; ++i) {
+		runBench(sizes[i], msgs);
+	}
+
+	free(msgs);
+
+	return 0;
+}
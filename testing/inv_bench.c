@@ -0,0 +1,352 @@
+/**
+ * @file inv_bench.c
+ *
+ * @brief Microbenchmarks of the inventory functions every join goes
+ * through (Inventory.h): readInventory, parseStrIntoInv, parseInvIntoStr,
+ * findItem, subInventories and checkForDuplicates, with catalogs of 10
+ * to 1M items. Each one runs ROUNDS times until it has taken a tenth of
+ * a second, and we report the nanoseconds per call of the fastest round.
+ *
+ * Some of them grow with the square of the catalog, a size they would
+ * spend more than BUDGET seconds per call on is skipped and marked so.
+ * We guess that from how much slower they got from the size before
+ * last to the size before (ten times at least).
+ *
+ * The results go to the standard output as JSON, one record per line.
+ * Given the JSON of an earlier run (-c), every record also carries the
+ * baseline and the change, and the ones slower than the baseline by
+ * more than the threshold (-t, in percent) are flagged as regressions,
+ * on the standard error too, and we exit with 1
+ *
+ * Build and run from the repository root:
+ *	make bench
+ *	make bench BASELINE=<earlier bench.json>
+ *	make bench-baseline		(this host's numbers become the baseline)
+ *
+ */
+
+#include "Inventory.h"
+#include <time.h>		// timing
+
+#define MIN_TIME 0.1		// seconds a round takes at least
+#define ROUNDS 3			// rounds of each measurement
+#define BUDGET 2.0			// seconds a single call may take
+#define MAX_SIZE 1000000	// largest catalog
+#define LOOKUPS 1024		// items we look up, cycled through
+#define PICKS 4				// items of a player's request
+#define MAX_RECORDS 64		// records of a baseline
+
+// struct holding a record of the baseline
+typedef struct {
+	char bench[LINE_LEN];	// the function
+	int items;				// the catalog's size
+	double ns;				// nanoseconds per call
+}Record;
+
+// struct holding what the benchmarks of a size work on
+typedef struct {
+	int items;				// the catalog's size
+	Inventory inv;			// the catalog
+	int *qData;				// the room's quantities
+	char path[LINE_LEN];	// the catalog as a file
+	char *str;				// and as a request
+	char **lookups;			// items we look up
+	Inventory player;		// a player's request
+}Fixture;
+
+Record baseline[MAX_RECORDS];	// the earlier run (-c)
+int baseCount = 0;				// its records
+double threshold = 20;			// slowdown that counts as a regression, in percent
+int regressions = 0;			// regressions found
+int records = 0;				// records printed
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the time of the monotonic clock in seconds
+ *
+ * @return The current time
+ */
+double now() {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Reads the records of an earlier run, exits if it has none
+ *
+ * @param Takes in the file
+ *
+ */
+void readBaseline(char *file) {
+	char line[pSize];	// a record
+	FILE *fp;			// the file
+	Record *r;			// the record we fill in
+
+	if ( (fp = fopen(file, "r")) == NULL ) {
+		perror("Couldn't read the baseline");
+		exit(1);
+	}
+
+	while ( (baseCount < MAX_RECORDS) && fgets(line, sizeof(line), fp) ) {
+		r = &(baseline[baseCount]);
+
+		if (sscanf(line, " {\"bench\": \"%31[^\"]\", \"items\": %d, \"ops\": %*d, \"ns_per_op\": %lf",
+			r->bench, &(r->items), &(r->ns)) == 3) {
+			++baseCount;
+		}
+	}
+
+	fclose(fp);
+
+	// comparing with nothing would pass every run
+	if (baseCount == 0) {
+		fprintf(stderr, "The baseline %s has no records\n", file);
+		exit(1);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Prints a record, compared to the baseline if we have one
+ *
+ * @param Takes in the function, the catalog's size, the calls made and
+ * the seconds they took (ops 0 if the size was skipped)
+ *
+ */
+void report(char *bench, int items, long ops, double secs) {
+	double ns = secs*1e9 / (ops ? ops : 1);	// nanoseconds per call
+	double change;							// against the baseline, in percent
+	int i;									// for counter
+
+	printf("%s  {\"bench\": \"%s\", \"items\": %d, ", records++ ? ",\n" : "[\n", bench, items);
+
+	if (!ops) {
+		printf("\"skipped\": \"over %.0fs per call\"}", BUDGET);
+		return;
+	}
+
+	printf("\"ops\": %ld, \"ns_per_op\": %.1f", ops, ns);
+
+	for (i=0; i<baseCount; ++i) {
+		if ( !strcmp(baseline[i].bench, bench) && (baseline[i].items == items) ) {
+			change = (ns / baseline[i].ns - 1) * 100;
+
+			printf(", \"baseline_ns\": %.1f, \"change_pct\": %.1f, \"regression\": %s",
+				baseline[i].ns, change, (change > threshold) ? "true" : "false");
+
+			if (change > threshold) {
+				fprintf(stderr, "REGRESSION %s with %d items: %.1f ns, was %.1f (+%.1f%%)\n",
+					bench, items, ns, baseline[i].ns, change);
+				++regressions;
+			}
+		}
+	}
+
+	printf("}");
+	fflush(stdout);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Builds the catalog of a size, as an inventory, a file and a
+ * request, and the items a player asks for
+ *
+ * @param Takes in the fixture and the catalog's size
+ *
+ */
+void buildFixture(Fixture *f, int items) {
+	char item[LINE_LEN];	// an item
+	FILE *fp;				// the catalog's file
+	size_t at = 0;			// chars of the request
+	int fd;					// the file's descriptor
+	int i;					// for counter
+
+	f->items = items;
+	initInventory(&(f->inv));
+	initInventory(&(f->player));
+
+	strcpy(f->path, "/tmp/inv_benchXXXXXX");
+	f->str = malloc((size_t)items*LINE_LEN + LINE_LEN);
+	f->lookups = malloc(sizeof(char *)*LOOKUPS);
+
+	if ( !f->str || !f->lookups || ((fd = mkstemp(f->path)) < 0) ||
+		((fp = fdopen(fd, "w")) == NULL) ) {
+		perror("Couldn't build the catalog");
+		exit(1);
+	}
+
+	at = sprintf(f->str, "bench\n");
+
+	for (i=0; i<items; ++i) {
+		sprintf(item, "item%d", i);
+		newInventoryRecord(&(f->inv), item, 1000000000);
+		fprintf(fp, "%s\t%d\n", item, 1000000000);
+		at += sprintf(f->str + at, "%s\t%d\n", item, 1);
+	}
+
+	fclose(fp);
+
+	f->qData = malloc(sizeof(int)*items);
+	memcpy(f->qData, f->inv.quantity, sizeof(int)*items);
+
+	// the same random items for every function
+	for (i=0; i<LOOKUPS; ++i) {
+		f->lookups[i] = f->inv.items[rand() % items];
+	}
+
+	for (i=0; (i < PICKS) && (i < items); ++i) {
+		newInventoryRecord(&(f->player), f->inv.items[(long)i*items/PICKS], 1);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Frees what buildFixture made
+ *
+ * @param Takes in the fixture
+ *
+ */
+void freeFixture(Fixture *f) {
+	unlink(f->path);
+	freeInventory(&(f->inv));
+	freeInventory(&(f->player));
+	free(f->qData);
+	free(f->str);
+	free(f->lookups);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Makes one call of a function
+ *
+ * @param Takes in the function's number, the fixture, a buffer for
+ * parseInvIntoStr and the call's number
+ *
+ */
+void call(int bench, Fixture *f, char *buf, long n) {
+	Inventory inv;	// what a call reads
+	char *name;		// the request's name
+	int pos;		// an item's position
+
+	switch (bench) {
+		case 0:
+			readInventory(f->path, &inv);
+			freeInventory(&inv);
+			break;
+		case 1:
+			parseStrIntoInv(&name, f->str, &inv);
+			free(name);
+			freeInventory(&inv);
+			break;
+		case 2:
+			parseInvIntoStr("bench", f->inv, buf);
+			break;
+		case 3:
+			findItem(f->inv, f->lookups[n % LOOKUPS], &pos);
+			break;
+		case 4:
+			// the quantities are large enough to never run out
+			subInventories(&(f->inv), f->player, f->qData, 1000);
+			break;
+		case 5:
+			checkForDuplicates(f->inv);
+			break;
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+int main(int argc, char **argv) {
+	char *names[] = {"readInventory", "parseStrIntoInv", "parseInvIntoStr", "findItem",
+		"subInventories", "checkForDuplicates"};
+	double last[6] = {0};		// seconds per call at the size before
+	double prev[6] = {0};		// and at the one before it
+	double growth;				// how much slower the next size is, guessed
+	int benches = sizeof(names)/sizeof(names[0]);
+	int maxSize = MAX_SIZE;		// largest catalog we run
+	Fixture f;					// the catalog of a size
+	char *buf;					// parseInvIntoStr's output
+	double t, secs;				// timing of a round
+	long ops = 1, n;			// calls of the fastest round and of this one
+	double best = 0;			// seconds of the fastest round
+	int r;						// for counter
+	int batch;					// calls between two clock reads
+	int items, b;				// for counters
+	int opt;					// option being parsed
+
+	while ( (opt = getopt(argc, argv, "c:t:m:")) != -1 ) {
+		switch (opt) {
+			case 'c':
+				readBaseline(optarg);
+				break;
+			case 't':
+				threshold = atof(optarg);
+				break;
+			case 'm':
+				maxSize = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-c baseline.json] [-t percent] [-m items]\n", argv[0]);
+				exit(1);
+		}
+	}
+
+	srand(5623);
+
+	for (items=10; items<=maxSize; items*=10) {
+		buildFixture(&f, items);
+
+		if ( (buf = malloc((size_t)items*LINE_LEN + LINE_LEN)) == NULL ) {
+			perror("Couldn't build the catalog");
+			exit(1);
+		}
+
+		fprintf(stderr, "%d items ...\n", items);
+
+		for (b=0; b<benches; ++b) {
+			growth = (prev[b] > 0) ? last[b] / prev[b] : 10;
+			growth = (growth < 10) ? 10 : growth;
+
+			if (last[b]*growth > BUDGET) {
+				report(names[b], items, 0, 0);
+				continue;
+			}
+
+			// the clock is read every call only when calls are slow
+			batch = (last[b]*growth > 1e-5) ? 1 : 64;
+			// the fastest round counts, the others had the noise
+			for (r=0; r<ROUNDS; ++r) {
+				n = 0;
+				t = now();
+
+				do {
+					call(b, &f, buf, n++);
+				} while ( (n % batch) || ((secs = now() - t) < MIN_TIME) );
+
+				if ( (r == 0) || (secs/n < best/ops) ) {
+					best = secs;
+					ops = n;
+				}
+			}
+
+			prev[b] = last[b];
+			last[b] = best / ops;
+
+			report(names[b], items, ops, best);
+		}
+
+		free(buf);
+		freeFixture(&f);
+	}
+
+	printf("\n]\n");
+
+	if (baseCount) {
+		fprintf(stderr, "%d regressions over %.0f%%\n", regressions, threshold);
+	}
+
+	return regressions ? 1 : 0;
+}
@@ -70,6 +70,52 @@ function test3 {
 	echo "* The server window will remain open for 30 seconds, so that you can check the results"
 }
 
+function test4 {
+	# Test 4
+	clear && echo "Test 4 - Lasts about 20 seconds - Waitlist"
+	echo "		Player 2 asks for the items player 1 took and waits for the next room"
+	sleep 5;
+
+	# starting the server with a waitlist
+	(xterm -e timeout --signal=SIGINT 20s ../server "-p" "2" "-q" "100" "-i" "server1.dat" "-w" "8") &
+
+	sleep 1;
+	(xterm -e timeout --signal=SIGINT 15s ../client "-n" "1" "-i" "client4.dat" "$(hostname)") &
+	sleep 1;
+	(xterm -e timeout --signal=SIGINT 15s ../client "-n" "2" "-i" "client4.dat" "$(hostname)") &
+	sleep 1;
+	(xterm -e timeout --signal=SIGINT 15s ../client "-n" "3" "-i" "client3.dat" "$(hostname)") &
+	sleep 1;
+	(xterm -e timeout --signal=SIGINT 15s ../client "-n" "4" "-i" "client3.dat" "$(hostname)") &
+
+	clear && echo "* Player 2 should get a waitlist position and join the second room along with player 4"
+	sleep 15;
+}
+
+function test5 {
+	# Test 5
+	clear && echo "Test 5 - Lasts about 25 seconds - Slow player"
+	echo "		Player 1 floods the chat, player 2 stops reading and player 3 watches"
+	sleep 5;
+
+	# starting the server with small queues
+	(xterm -e timeout --signal=SIGINT 25s ../server "-p" "3" "-q" "100" "-i" "server1.dat" "-b" "16" "-o" "$1") &
+
+	sleep 1;
+	# flooding the chat
+	(yes "spam" | timeout --signal=SIGINT 20s ../client "-n" "1" "-i" "client3.dat" "$(hostname)" > /dev/null) &
+
+	# nobody reads this client's output, so it stops reading its socket
+	(timeout --signal=SIGINT 20s ../client "-n" "2" "-i" "client3.dat" "$(hostname)" | sleep 20) &
+
+	# this one should keep receiving messages
+	(xterm -e timeout --signal=SIGINT 20s ../client "-n" "3" "-i" "client3.dat" "$(hostname)") &
+
+	clear && echo "* Player 3 should keep getting the spam while player 2 is stuck"
+	echo "* Check the server window for players that couldn't keep up"
+	sleep 20;
+}
+
 # checking if the user wants a specific test
 if [ $# -eq 0 ]
 then
@@ -92,6 +138,9 @@ then
 	test1
 	test2
 	test3
+	test4
+	test5 "drop"
+	test5 "disconnect"
 
 elif [ $1 == 1 ] 
 then
@@ -105,6 +154,14 @@ elif [ $1 == 3 ]
 then
 	# running test 3
 	test3
+elif [ $1 == 4 ] 
+then
+	# running test 4
+	test4
+elif [ $1 == 5 ] 
+then
+	# running test 5 (with the given overflow policy)
+	test5 "${2:-drop}"
 fi
 
 
@@ -0,0 +1,235 @@
+/**
+ * @file trade_bench.c
+ *
+ * @brief Stress test of the item trades (Trade.h). A room's offers and
+ * holdings are put in shared memory the way the server does and a few
+ * processes, each playing a group of players, offer random trades to
+ * random players and accept the ones made to theirs as fast as they
+ * can, under one semaphore like the player processes. Another process
+ * keeps checking that every item still adds up to what was handed out
+ * and that nobody holds less than nothing. We print the trades per
+ * second and exit with 1 if the check ever failed
+ *
+ * Build and run from the repository root:
+ *	make bench-trade && ./trade_bench
+ *
+ */
+
+#include "Inventory.h"
+#include "Trade.h"
+#include <time.h>			// timing
+#include <semaphore.h>		// the room's semaphore
+#include <sys/wait.h>		// waiting for the traders
+
+#define SLOTS 64		// players of the room
+#define ITEMS 16		// items of the inventory
+#define START 100		// units of each item a player starts with
+#define TRADERS 4		// processes playing the players
+#define SECONDS 3		// length of the run
+
+// struct holding the room, in shared memory
+typedef struct {
+	sem_t lock;					// the room's semaphore
+	int stop;					// the run is over
+	int bad;					// the check failed
+	long trades;				// trades that went through
+	long refused;				// accepts that found the items gone
+	long checks;				// checks made
+	TradeOffer offers[SLOTS];	// the players' offers
+	int holdings[SLOTS*ITEMS];	// and their items
+}Room;
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Returns the time of the monotonic clock in seconds
+ *
+ * @return The current time
+ */
+double now() {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Plays the players of a trader: each turn one of them offers a
+ * random trade to a random player and every offer made to them is
+ * accepted
+ *
+ * @param Takes in the room and the trader's number
+ *
+ */
+void trade(Room *r, int me) {
+	long trades = 0, refused = 0;	// our counts
+	int from, to;					// players of a turn
+	int i;							// for counter
+
+	srand(5623 + me);
+
+	while (!__atomic_load_n(&(r->stop), __ATOMIC_RELAXED)) {
+		// one of our players offers something he might not have
+		from = me + TRADERS*(rand() % (SLOTS/TRADERS));
+		do {
+			to = rand() % SLOTS;
+		} while (to == from);
+
+		sem_wait(&(r->lock));
+		r->offers[from].give = rand() % ITEMS;
+		r->offers[from].giveN = 1 + rand() % 20;
+		r->offers[from].want = (r->offers[from].give + 1 + rand() % (ITEMS-1)) % ITEMS;
+		r->offers[from].wantN = 1 + rand() % 20;
+		r->offers[from].to = to;
+		sem_post(&(r->lock));
+
+		// and our players take what they were offered
+		for (to=me; to<SLOTS; to+=TRADERS) {
+			for (i=0; i<SLOTS; ++i) {
+				if (__atomic_load_n(&(r->offers[i].to), __ATOMIC_RELAXED) != to) {
+					continue;
+				}
+
+				sem_wait(&(r->lock));
+				switch (acceptOffer(r->offers, r->holdings, ITEMS, i, to)) {
+					case TRADE_OK:
+						++trades;
+						break;
+					case TRADE_THEY_LACK:
+					case TRADE_WE_LACK:
+						++refused;
+						break;
+				}
+				sem_post(&(r->lock));
+			}
+		}
+	}
+
+	__atomic_add_fetch(&(r->trades), trades, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(r->refused), refused, __ATOMIC_RELAXED);
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Checks that every item adds up and nobody holds less than
+ * nothing. Must be called while holding the semaphore
+ *
+ * @param Takes in the room
+ *
+ * @return 1 if the room is fine, 0 otherwise
+ */
+int audit(Room *r) {
+	int sum;	// units of an item
+	int i, s;	// for counters
+
+	for (i=0; i<ITEMS; ++i) {
+		sum = 0;
+
+		for (s=0; s<SLOTS; ++s) {
+			if (r->holdings[s*ITEMS + i] < 0) {
+				return 0;
+			}
+
+			sum += r->holdings[s*ITEMS + i];
+		}
+
+		if (sum != START*SLOTS) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*- ---------------------------------------------------------------- -*/
+/**
+ * @brief Keeps checking the room while the traders run
+ *
+ * @param Takes in the room
+ *
+ */
+void check(Room *r) {
+	while (!__atomic_load_n(&(r->stop), __ATOMIC_RELAXED)) {
+		sem_wait(&(r->lock));
+
+		if (!audit(r)) {
+			r->bad = 1;
+		}
+
+		++r->checks;
+		sem_post(&(r->lock));
+
+		usleep(1000);
+	}
+}
+
+/*- ---------------------------------------------------------------- -*/
+int main() {
+	int id;		// the room's segment
+	Room *r;	// the room
+	int i;		// for counter
+	double t;	// start of the run
+
+	if ( ((id = shmget(IPC_PRIVATE, sizeof(Room), IPC_CREAT | 0600)) < 0) ||
+		((r = shmat(id, NULL, 0)) == (void *)-1) ) {
+		perror("Couldn't open the room");
+		exit(1);
+	}
+
+	shmctl(id, IPC_RMID, NULL);
+	bzero(r, sizeof(Room));
+
+	if (sem_init(&(r->lock), 1, 1) < 0) {
+		perror("Couldn't open the semaphore");
+		exit(1);
+	}
+
+	for (i=0; i<SLOTS; ++i) {
+		r->offers[i].to = -1;
+	}
+
+	for (i=0; i<SLOTS*ITEMS; ++i) {
+		r->holdings[i] = START;
+	}
+
+	t = now();
+
+	for (i=0; i<=TRADERS; ++i) {
+		if (fork() == 0) {
+			if (i < TRADERS) {
+				trade(r, i);
+			} else {
+				check(r);
+			}
+
+			exit(0);
+		}
+	}
+
+	sleep(SECONDS);
+	__atomic_store_n(&(r->stop), 1, __ATOMIC_RELAXED);
+
+	while (wait(NULL) > 0);
+
+	t = now() - t;
+
+	// one last check, with everyone gone
+	if (!audit(r)) {
+		r->bad = 1;
+	}
+
+	printf("%8s  %8s  %10s  %10s  %8s  %8s\n", "players", "traders", "trades", "trades/s",
+		"refused", "checks");
+	printf("%8d  %8d  %10ld  %10.0f  %8ld  %8ld\n", SLOTS, TRADERS, r->trades, r->trades / t,
+		r->refused, r->checks);
+
+	if (r->bad) {
+		printf("Items were lost or given twice\n");
+		return 1;
+	}
+
+	printf("Every item adds up\n");
+
+	return 0;
+}